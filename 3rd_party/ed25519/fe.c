@@ -1,6 +1,8 @@
 #include "fixedint.h"
 #include "fe.h"
 
+#ifndef ED25519_FE51
+
 
 /*
     helper functions
@@ -361,6 +363,8 @@ void fe_frombytes(fe h, const unsigned char *s) {
 
 
 
+#endif
+
 void fe_invert(fe out, const fe z) {
     fe t0;
     fe t1;
@@ -447,6 +451,8 @@ void fe_invert(fe out, const fe z) {
     fe_mul(out, t1, t0);
 }
 
+#ifndef ED25519_FE51
+
 
 
 /*
@@ -878,6 +884,8 @@ void fe_neg(fe h, const fe f) {
 }
 
 
+#endif
+
 void fe_pow22523(fe out, const fe z) {
     fe t0;
     fe t1;
@@ -963,6 +971,8 @@ void fe_pow22523(fe out, const fe z) {
     return;
 }
 
+#ifndef ED25519_FE51
+
 
 /*
 h = f * f
@@ -1489,3 +1499,4 @@ void fe_tobytes(unsigned char *s, const fe h) {
     s[30] = (unsigned char) (h9 >> 10);
     s[31] = (unsigned char) (h9 >> 18);
 }
+#endif
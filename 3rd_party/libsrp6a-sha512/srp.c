@@ -103,6 +103,7 @@ SRP_new(SRP_METHOD * meth)
   srp->bctx = BigIntegerCtxNew();
   srp->modulus = NULL;
   srp->accel = NULL;
+  srp->group = NULL;
   srp->generator = NULL;
   srp->salt = NULL;
   srp->verifier = NULL;
@@ -132,7 +133,7 @@ SRP_free(SRP * srp)
     cstr_clear_free(srp->username);
   if(srp->modulus)
     BigIntegerFree(srp->modulus);
-  if(srp->accel)
+  if(srp->accel && (srp->group == NULL || srp->accel != srp->group->accel))
     BigIntegerModAccelFree(srp->accel);
   if(srp->generator)
     BigIntegerFree(srp->generator);
@@ -158,6 +159,64 @@ SRP_free(SRP * srp)
   return SRP_SUCCESS;
 }
 
+_TYPE( SRP_GROUP * )
+SRP_group_new(const unsigned char * modulus, int modlen,
+	      const unsigned char * generator, int genlen, int expbits)
+{
+  SRP_GROUP * group;
+  BigIntegerCtx bctx;
+
+  if(modulus == NULL || generator == NULL)
+    return NULL;
+
+  group = (SRP_GROUP *) malloc(sizeof(SRP_GROUP));
+  if(group == NULL)
+    return NULL;
+
+  bctx = BigIntegerCtxNew();
+  group->modulus = BigIntegerFromBytes(modulus, modlen);
+  group->generator = BigIntegerFromBytes(generator, genlen);
+  group->accel = BigIntegerModAccelNew(group->modulus, bctx);
+  group->gtable = BigIntegerFixedBaseNew(group->generator, group->modulus,
+					 expbits, bctx, group->accel);
+  BigIntegerCtxFree(bctx);
+  return group;
+}
+
+_TYPE( SRP_RESULT )
+SRP_group_free(SRP_GROUP * group)
+{
+  if(group == NULL)
+    return SRP_SUCCESS;
+  if(group->gtable)
+    BigIntegerFixedBaseFree(group->gtable);
+  if(group->accel)
+    BigIntegerModAccelFree(group->accel);
+  BigIntegerFree(group->generator);
+  BigIntegerFree(group->modulus);
+  free(group);
+  return SRP_SUCCESS;
+}
+
+_TYPE( SRP_RESULT )
+SRP_set_group(SRP * srp, SRP_GROUP * group)
+{
+  if(srp->modulus)
+    return SRP_ERROR;	/* must come before SRP_set_params */
+  srp->group = group;
+  return SRP_SUCCESS;
+}
+
+_TYPE( SRP_RESULT )
+SRP_generator_exp(SRP * srp, BigInteger result, BigInteger expt)
+{
+  if(srp->group && srp->group->gtable &&
+     BigIntegerOK(BigIntegerFixedBaseModExp(result, expt, srp->group->gtable, srp->bctx)))
+    return SRP_SUCCESS;
+  BigIntegerModExp(result, srp->generator, expt, srp->modulus, srp->bctx, srp->accel);
+  return SRP_SUCCESS;
+}
+
 _TYPE( SRP_RESULT )
 SRP_set_client_param_verify_cb(SRP * srp, SRP_CLIENT_PARAM_VERIFY_CB cb)
 {
@@ -191,9 +250,16 @@ SRP_set_params(SRP * srp, const unsigned char * modulus, int modlen,
 
   /* Set fields in SRP context */
   srp->modulus = BigIntegerFromBytes(modulus, modlen);
-  if(srp->flags & SRP_FLAG_MOD_ACCEL)
-    srp->accel = BigIntegerModAccelNew(srp->modulus, srp->bctx);
   srp->generator = BigIntegerFromBytes(generator, genlen);
+  if(srp->group && (BigIntegerCmp(srp->modulus, srp->group->modulus) != 0 ||
+		    BigIntegerCmp(srp->generator, srp->group->generator) != 0))
+    srp->group = NULL;
+  if(srp->flags & SRP_FLAG_MOD_ACCEL) {
+    if(srp->group && srp->group->accel)
+      srp->accel = srp->group->accel;
+    else
+      srp->accel = BigIntegerModAccelNew(srp->modulus, srp->bctx);
+  }
   if(srp->salt == NULL)
     srp->salt = cstr_new();
   cstr_setn(srp->salt, (const char*)salt, saltlen);
@@ -64,6 +64,18 @@ _TYPE( int ) SRP_get_secret_bits P((int modsize));
 
 typedef struct srp_st SRP;
 
+/*
+ * Precomputed state for a fixed (modulus, generator) pair that may be
+ * shared by any number of SRP contexts, including from several threads
+ * at once, since it is never modified after SRP_group_new() returns.
+ */
+typedef struct srp_group_st {
+  BigInteger modulus;
+  BigInteger generator;
+  BigIntegerModAccel accel;	/* shared modexp acceleration */
+  BigIntegerFixedBase gtable;	/* precomputed powers of the generator */
+} SRP_GROUP;
+
 #if 0
 /* Server Lookup API */
 typedef struct srp_server_lu_st SRP_SERVER_LOOKUP;
@@ -197,6 +209,7 @@ struct srp_st {
 
   BigIntegerCtx bctx;	     /* to cache temporaries if available */
   BigIntegerModAccel accel;  /* to accelerate modexp if available */
+  SRP_GROUP * group;	     /* shared group parameters, if any */
 
   SRP_CLIENT_PARAM_VERIFY_CB param_cb;	/* to verify params */
   //SRP_SERVER_LOOKUP * slu;   /* to look up users */
@@ -240,6 +253,29 @@ _TYPE( SRP_RESULT )
      SRP_set_client_param_verify_cb P((SRP * srp,
 				       SRP_CLIENT_PARAM_VERIFY_CB cb));
 
+/*
+ * SRP_group_new() precomputes a table of powers of the generator for
+ * exponents of up to expbits bits (plus the modular acceleration state)
+ * so that contexts using these parameters avoid most of the cost of
+ * g^x and g^a.  Attach the group with SRP_set_group before calling
+ * SRP_set_params; the group must outlive every context using it.
+ * Parameters passed to SRP_set_params that do not match the group are
+ * still accepted and simply do not use the precomputation.
+ */
+_TYPE( SRP_GROUP * )
+     SRP_group_new P((const unsigned char * modulus, int modlen,
+		      const unsigned char * generator, int genlen,
+		      int expbits));
+_TYPE( SRP_RESULT ) SRP_group_free P((SRP_GROUP * group));
+_TYPE( SRP_RESULT ) SRP_set_group P((SRP * srp, SRP_GROUP * group));
+
+/*
+ * result = generator^expt mod modulus, using the group precomputation
+ * when it applies to this context.
+ */
+_TYPE( SRP_RESULT )
+     SRP_generator_exp P((SRP * srp, BigInteger result, BigInteger expt));
+
 /*
  * Both client and server must call both SRP_set_username and
  * SRP_set_params, in that order, before calling anything else.
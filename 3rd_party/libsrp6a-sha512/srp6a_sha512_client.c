@@ -129,7 +129,7 @@ srp6_sha512_client_auth(SRP * srp, const unsigned char * a, int alen)
 
   /* verifier = g^x mod N */
   srp->verifier = BigIntegerFromInt(0);
-  BigIntegerModExp(srp->verifier, srp->generator, srp->password, srp->modulus, srp->bctx, srp->accel);
+  SRP_generator_exp(srp, srp->verifier, srp->password);
 
   return SRP_SUCCESS;
 }
@@ -180,7 +180,7 @@ srp6_sha512_client_genpub(SRP * srp, cstr ** result)
   BigIntegerAddInt(srp->secret, srp->secret, BigIntegerBitLen(srp->modulus));
   /* A = g^a mod n */
   srp->pubkey = BigIntegerFromInt(0);
-  BigIntegerModExp(srp->pubkey, srp->generator, srp->secret, srp->modulus, srp->bctx, srp->accel);
+  SRP_generator_exp(srp, srp->pubkey, srp->secret);
   BigIntegerToCstr(srp->pubkey, astr);
 
   /* hash: (H(N) xor H(g)) | H(U) | s | A */
@@ -42,6 +42,7 @@ extern "C" {
 typedef void * BigInteger;
 typedef void * BigIntegerCtx;
 typedef void * BigIntegerModAccel;
+typedef void * BigIntegerFixedBase;
 #endif
 
 /*
@@ -112,6 +113,23 @@ _TYPE( BigIntegerModAccel ) BigIntegerModAccelNew P((BigInteger m,
 						     BigIntegerCtx ctx));
 _TYPE( BigIntegerResult ) BigIntegerModAccelFree P((BigIntegerModAccel accel));
 
+/*
+ * Precomputation for g^e mod m with a fixed g and m, for exponents of
+ * up to maxbits bits.  The modulus and the accel context (may be NULL)
+ * are referenced, not copied, and must outlive the returned object.
+ * BigIntegerFixedBaseModExp() returns BIG_INTEGER_ERROR if e is too large.
+ */
+_TYPE( BigIntegerFixedBase ) BigIntegerFixedBaseNew P((BigInteger g,
+						       BigInteger m,
+						       int maxbits,
+						       BigIntegerCtx ctx,
+						       BigIntegerModAccel accel));
+_TYPE( BigIntegerResult ) BigIntegerFixedBaseModExp P((BigInteger result,
+						       BigInteger expt,
+						       BigIntegerFixedBase fb,
+						       BigIntegerCtx ctx));
+_TYPE( BigIntegerResult ) BigIntegerFixedBaseFree P((BigIntegerFixedBase fb));
+
 _TYPE( BigIntegerResult ) BigIntegerInitialize();
 _TYPE( BigIntegerResult ) BigIntegerFinalize();
 
@@ -92,6 +92,7 @@ typedef void * BigIntegerModAccel;
 #else
 # error "no math library specified"
 #endif
+typedef struct BigIntegerFixedBase_st * BigIntegerFixedBase;
 #define MATH_PRIV
 
 #include "t_defines.h"
@@ -908,6 +909,168 @@ BigIntegerModAccelFree(BigIntegerModAccel accel)
   return BIG_INTEGER_SUCCESS;
 }
 
+/*
+ * Fixed-base exponentiation for a base and modulus that never change.
+ * The table holds g^(2^(w*i)) so that g^e can be computed with Yao's
+ * method in about bits(e)/w + 2^w modular multiplications instead of one
+ * squaring per exponent bit.  With OpenSSL the table is kept in Montgomery
+ * form and shares the Montgomery context passed in.
+ */
+#define FIXED_BASE_WINDOW 5
+
+struct BigIntegerFixedBase_st {
+  int windows;
+  BigInteger modulus;
+  BigIntegerModAccel accel;
+  BigInteger one;
+  BigInteger * table;
+};
+
+static void
+fixed_base_mul(BigInteger r, BigInteger a, BigInteger b, BigIntegerFixedBase fb, BigIntegerCtx c)
+{
+#ifdef OPENSSL
+  if(fb->accel) {
+    BN_mod_mul_montgomery(r, a, b, fb->accel, c);
+    return;
+  }
+#endif
+  BigIntegerModMul(r, a, b, fb->modulus, c);
+}
+
+BigIntegerFixedBase
+BigIntegerFixedBaseNew(BigInteger g, BigInteger m, int maxbits, BigIntegerCtx c, BigIntegerModAccel a)
+{
+  BigIntegerFixedBase fb;
+  BigIntegerCtx ctx = NULL;
+  int i, j;
+
+  if(maxbits <= 0)
+    return NULL;
+#ifdef OPENSSL
+  if(default_modexp)
+    return NULL;
+#endif
+  fb = (BigIntegerFixedBase) malloc(sizeof(struct BigIntegerFixedBase_st));
+  if(fb == NULL)
+    return NULL;
+  fb->windows = (maxbits + FIXED_BASE_WINDOW - 1) / FIXED_BASE_WINDOW;
+  fb->modulus = m;
+  fb->accel = a;
+  fb->table = (BigInteger *) calloc(fb->windows, sizeof(BigInteger));
+  if(fb->table == NULL) {
+    free(fb);
+    return NULL;
+  }
+#ifdef OPENSSL
+  if(c == NULL)
+    c = ctx = BN_CTX_new();
+#endif
+
+  fb->one = BigIntegerFromInt(1);
+  fb->table[0] = BigIntegerFromInt(0);
+#ifdef OPENSSL
+  if(fb->accel) {
+    BN_to_montgomery(fb->one, fb->one, fb->accel, c);
+    BN_to_montgomery(fb->table[0], g, fb->accel, c);
+  }
+  else
+#endif
+  BigIntegerMod(fb->table[0], g, m, c);
+
+  for(i = 1; i < fb->windows; ++i) {
+    fb->table[i] = BigIntegerFromInt(0);
+    fixed_base_mul(fb->table[i], fb->table[i-1], fb->table[i-1], fb, c);
+    for(j = 1; j < FIXED_BASE_WINDOW; ++j)
+      fixed_base_mul(fb->table[i], fb->table[i], fb->table[i], fb, c);
+  }
+
+  if(ctx)
+    BigIntegerCtxFree(ctx);
+  return fb;
+}
+
+BigIntegerResult
+BigIntegerFixedBaseModExp(BigInteger r, BigInteger e, BigIntegerFixedBase fb, BigIntegerCtx c)
+{
+  BigIntegerCtx ctx = NULL;
+  BigInteger A, B;
+  unsigned char * ebytes;
+  unsigned char * digits;
+  int elen, i, j, d;
+
+  if(fb == NULL || BigIntegerBitLen(e) > fb->windows * FIXED_BASE_WINDOW)
+    return BIG_INTEGER_ERROR;
+
+  elen = BigIntegerByteLen(e);
+  ebytes = (unsigned char *) malloc(elen + 1);
+  digits = (unsigned char *) calloc(fb->windows, 1);
+  if(ebytes == NULL || digits == NULL) {
+    free(ebytes);
+    free(digits);
+    return BIG_INTEGER_ERROR;
+  }
+  elen = BigIntegerToBytes(e, ebytes, elen + 1);
+
+  /* split e into w-bit digits, least significant first */
+  for(i = 0; i < elen * 8; ++i) {
+    if(ebytes[elen - 1 - i / 8] & (1 << (i % 8)))
+      digits[i / FIXED_BASE_WINDOW] |= 1 << (i % FIXED_BASE_WINDOW);
+  }
+  memset(ebytes, 0, elen);
+  free(ebytes);
+
+#ifdef OPENSSL
+  if(c == NULL)
+    c = ctx = BN_CTX_new();
+#endif
+
+  /* A = prod over d of (prod of table[i] with digit i >= d) */
+  A = BigIntegerFromInt(0);
+  B = BigIntegerFromInt(0);
+  BigIntegerAdd(A, fb->one, A);
+  BigIntegerAdd(B, fb->one, B);
+  for(d = (1 << FIXED_BASE_WINDOW) - 1; d > 0; --d) {
+    for(j = 0; j < fb->windows; ++j) {
+      if(digits[j] == d)
+        fixed_base_mul(B, B, fb->table[j], fb, c);
+    }
+    fixed_base_mul(A, A, B, fb, c);
+  }
+  memset(digits, 0, fb->windows);
+  free(digits);
+
+#ifdef OPENSSL
+  if(fb->accel)
+    BN_from_montgomery(r, A, fb->accel, c);
+  else
+#endif
+  BigIntegerMod(r, A, fb->modulus, c);
+
+  BigIntegerClearFree(A);
+  BigIntegerClearFree(B);
+  if(ctx)
+    BigIntegerCtxFree(ctx);
+  return BIG_INTEGER_SUCCESS;
+}
+
+BigIntegerResult
+BigIntegerFixedBaseFree(BigIntegerFixedBase fb)
+{
+  int i;
+
+  if(fb == NULL)
+    return BIG_INTEGER_SUCCESS;
+  for(i = 0; i < fb->windows; ++i) {
+    if(fb->table[i])
+      BigIntegerFree(fb->table[i]);
+  }
+  free(fb->table);
+  BigIntegerFree(fb->one);
+  free(fb);
+  return BIG_INTEGER_SUCCESS;
+}
+
 BigIntegerResult
 BigIntegerInitialize()
 {
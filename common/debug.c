@@ -28,12 +28,16 @@
 #define __USE_GNU 1
 #include <stdio.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <time.h>
 #ifndef _WIN32
 #include <sys/time.h>
 #endif
 
+#include <string.h>
+#include <libimobiledevice-glue/thread.h>
+
 #include "src/idevice.h"
 #include "debug.h"
 #include "libimobiledevice/libimobiledevice.h"
@@ -42,16 +46,500 @@
 #include "asprintf.h"
 #endif
 
-static int debug_level;
+int debug_subsystem_levels[DEBUG_SUBSYSTEM_COUNT];
+
+static const char *debug_subsystem_names[DEBUG_SUBSYSTEM_COUNT] = {
+	"default",
+	"connection",
+	"plist",
+	"lockdown",
+	"afc",
+	"debugserver"
+};
 
 void internal_set_debug_level(int level)
 {
-	debug_level = level;
+	int i;
+	for (i = 0; i < DEBUG_SUBSYSTEM_COUNT; i++) {
+		debug_subsystem_levels[i] = level;
+	}
+}
+
+int internal_set_debug_subsystem_level(const char *subsystem, int level)
+{
+	int i;
+	if (!subsystem)
+		return -1;
+	for (i = 0; i < DEBUG_SUBSYSTEM_COUNT; i++) {
+		if (!strcmp(debug_subsystem_names[i], subsystem)) {
+			debug_subsystem_levels[i] = level;
+			return 0;
+		}
+	}
+	return -1;
 }
 
 #define MAX_PRINT_LEN (16*1024)
 
+/* number of message, string argument or buffer bytes kept per ring buffer event */
+#define DEBUG_EVENT_DATA_SIZE 128
+
+/* messages with more conversions are formatted right away */
+#define DEBUG_EVENT_MAX_ARGS 8
+
+enum debug_event_kind {
+	DEBUG_EVENT_TEXT = 0,
+	DEBUG_EVENT_BUFFER,
+	DEBUG_EVENT_FORMAT
+};
+
+enum debug_arg_length {
+	DEBUG_ARG_INT = 0,
+	DEBUG_ARG_LONG,
+	DEBUG_ARG_LLONG,
+	DEBUG_ARG_SIZE,
+	DEBUG_ARG_INTMAX,
+	DEBUG_ARG_PTRDIFF,
+	DEBUG_ARG_LDOUBLE
+};
+
+/* one conversion of a format string */
+struct debug_spec {
+	const char *flags;
+	int flags_len;
+	int width;		/* -1 none, -2 taken from the arguments */
+	int precision;		/* -1 none, -2 taken from the arguments */
+	int length;		/* enum debug_arg_length */
+	char conv;
+};
+
+/* the raw value of one conversion, stars already resolved */
+struct debug_event_arg {
+	int width;
+	int precision;
+	union {
+		long long i;
+		double d;
+		const void *p;
+		struct {
+			uint16_t offset;
+			uint16_t length;
+		} str;
+	} v;
+};
+
+struct debug_event {
+	uint64_t timestamp;
+	const char *func;
+	const char *file;
+	int line;
+	int subsystem;
+	int kind;
+	uint32_t length;
+	const char *format;
+	int argc;
+	struct debug_event_arg args[DEBUG_EVENT_MAX_ARGS];
+	char data[DEBUG_EVENT_DATA_SIZE];
+};
+
+static struct debug_event *debug_ring = NULL;
+static unsigned int debug_ring_size = 0;
+static uint64_t debug_ring_next = 0;
+static mutex_t debug_ring_mutex;
+static thread_once_t debug_ring_once = THREAD_ONCE_INIT;
+
+static void debug_ring_init(void)
+{
+	mutex_init(&debug_ring_mutex);
+}
+
+void internal_set_debug_ring_size(unsigned int events)
+{
+	thread_once(&debug_ring_once, debug_ring_init);
+	mutex_lock(&debug_ring_mutex);
+	free(debug_ring);
+	debug_ring = NULL;
+	debug_ring_size = 0;
+	debug_ring_next = 0;
+	if (events > 0) {
+		debug_ring = (struct debug_event*)calloc(events, sizeof(struct debug_event));
+		if (debug_ring) {
+			debug_ring_size = events;
+		}
+	}
+	mutex_unlock(&debug_ring_mutex);
+}
+
+void internal_debug_init(void)
+{
+	const char *env = getenv("LIBIMOBILEDEVICE_DEBUG");
+	if (env && *env) {
+		/* either a single level for everything or a list like "afc=1,plist=1" */
+		char *spec = strdup(env);
+		char *item = spec;
+		while (item && *item) {
+			char *next = strchr(item, ',');
+			if (next) {
+				*next++ = '\0';
+			}
+			char *eq = strchr(item, '=');
+			if (eq) {
+				*eq = '\0';
+				internal_set_debug_subsystem_level(item, atoi(eq + 1));
+			} else {
+				internal_set_debug_level(atoi(item));
+			}
+			item = next;
+		}
+		free(spec);
+	}
+	env = getenv("LIBIMOBILEDEVICE_DEBUG_RING");
+	if (env && *env) {
+		internal_set_debug_ring_size((unsigned int)strtoul(env, NULL, 10));
+	}
+}
+
 #ifndef STRIP_DEBUG_CODE
+static uint64_t debug_timestamp(void)
+{
+#ifdef _WIN32
+	FILETIME ft;
+	GetSystemTimeAsFileTime(&ft);
+	return ((((uint64_t)ft.dwHighDateTime << 32) | ft.dwLowDateTime) - 116444736000000000ULL) / 10;
+#elif defined(HAVE_GETTIMEOFDAY)
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+#else
+	return (uint64_t)time(NULL) * 1000000;
+#endif
+}
+
+/**
+ * Records an event in the ring buffer, if one is enabled. No formatting
+ * or output happens here; the events are only rendered when dumped.
+ *
+ * @return 1 if the event was recorded, 0 if the ring buffer is disabled.
+ */
+static int debug_ring_add(int subsystem, const char *func, const char *file, int line, int kind, const char *data, uint32_t length)
+{
+	if (!debug_ring)
+		return 0;
+
+	uint64_t timestamp = debug_timestamp();
+	uint32_t copy_len = (length > DEBUG_EVENT_DATA_SIZE) ? DEBUG_EVENT_DATA_SIZE : length;
+
+	mutex_lock(&debug_ring_mutex);
+	if (!debug_ring) {
+		mutex_unlock(&debug_ring_mutex);
+		return 0;
+	}
+	struct debug_event *ev = &debug_ring[debug_ring_next % debug_ring_size];
+	debug_ring_next++;
+	ev->timestamp = timestamp;
+	ev->func = func;
+	ev->file = file;
+	ev->line = line;
+	ev->subsystem = subsystem;
+	ev->kind = kind;
+	ev->length = length;
+	ev->format = NULL;
+	ev->argc = 0;
+	memcpy(ev->data, data, copy_len);
+	if (kind == DEBUG_EVENT_TEXT) {
+		ev->data[(copy_len < DEBUG_EVENT_DATA_SIZE) ? copy_len : DEBUG_EVENT_DATA_SIZE-1] = '\0';
+	}
+	mutex_unlock(&debug_ring_mutex);
+
+	return 1;
+}
+
+/**
+ * Parses the conversion following a '%' in a format string.
+ *
+ * @return Pointer behind the conversion, or NULL if it is not supported.
+ */
+static const char *debug_parse_spec(const char *p, struct debug_spec *spec)
+{
+	spec->flags = p;
+	while (*p && strchr("-+ #0'", *p)) {
+		p++;
+	}
+	spec->flags_len = (int)(p - spec->flags);
+	spec->width = -1;
+	if (*p == '*') {
+		spec->width = -2;
+		p++;
+	} else if (*p >= '0' && *p <= '9') {
+		spec->width = 0;
+		while (*p >= '0' && *p <= '9') {
+			spec->width = spec->width * 10 + (*p++ - '0');
+		}
+	}
+	spec->precision = -1;
+	if (*p == '.') {
+		p++;
+		if (*p == '*') {
+			spec->precision = -2;
+			p++;
+		} else {
+			spec->precision = 0;
+			while (*p >= '0' && *p <= '9') {
+				spec->precision = spec->precision * 10 + (*p++ - '0');
+			}
+		}
+	}
+	spec->length = DEBUG_ARG_INT;
+	switch (*p) {
+	case 'h':
+		p += (p[1] == 'h') ? 2 : 1;
+		break;
+	case 'l':
+		if (p[1] == 'l') {
+			spec->length = DEBUG_ARG_LLONG;
+			p += 2;
+		} else {
+			spec->length = DEBUG_ARG_LONG;
+			p++;
+		}
+		break;
+	case 'q':
+		spec->length = DEBUG_ARG_LLONG;
+		p++;
+		break;
+	case 'z':
+		spec->length = DEBUG_ARG_SIZE;
+		p++;
+		break;
+	case 'j':
+		spec->length = DEBUG_ARG_INTMAX;
+		p++;
+		break;
+	case 't':
+		spec->length = DEBUG_ARG_PTRDIFF;
+		p++;
+		break;
+	case 'L':
+		spec->length = DEBUG_ARG_LDOUBLE;
+		p++;
+		break;
+	default:
+		break;
+	}
+	spec->conv = *p;
+	if (!spec->conv || !strchr("diouxXcsp%eEfFgGaA", spec->conv)) {
+		return NULL;
+	}
+	return p + 1;
+}
+
+/**
+ * Records a message in the ring buffer without formatting it: the format
+ * string pointer is kept together with the raw argument values, string
+ * arguments are copied. The message is only rendered when dumped.
+ *
+ * @return 1 if the event was recorded, 0 if the ring buffer is disabled or
+ *     the format uses conversions that can't be deferred.
+ */
+static int debug_ring_add_format(int subsystem, const char *func, const char *file, int line, const char *format, va_list args)
+{
+	struct debug_event_arg argv[DEBUG_EVENT_MAX_ARGS];
+	char data[DEBUG_EVENT_DATA_SIZE];
+	uint32_t data_len = 0;
+	int argc = 0;
+	const char *p = format;
+	struct debug_spec spec;
+
+	if (!debug_ring)
+		return 0;
+
+	while ((p = strchr(p, '%'))) {
+		p = debug_parse_spec(p + 1, &spec);
+		if (!p) {
+			return 0;
+		}
+		if (spec.conv == '%') {
+			continue;
+		}
+		if (argc >= DEBUG_EVENT_MAX_ARGS) {
+			return 0;
+		}
+		struct debug_event_arg *arg = &argv[argc++];
+		arg->width = (spec.width == -2) ? va_arg(args, int) : spec.width;
+		arg->precision = (spec.precision == -2) ? va_arg(args, int) : spec.precision;
+		switch (spec.conv) {
+		case 's': {
+			const char *str = va_arg(args, const char*);
+			size_t len;
+			if (!str) {
+				str = "(null)";
+			}
+			if (arg->precision >= 0) {
+				const char *end = memchr(str, '\0', (size_t)arg->precision);
+				len = (end) ? (size_t)(end - str) : (size_t)arg->precision;
+			} else {
+				len = strlen(str);
+			}
+			if (len > DEBUG_EVENT_DATA_SIZE - data_len) {
+				len = DEBUG_EVENT_DATA_SIZE - data_len;
+			}
+			memcpy(data + data_len, str, len);
+			arg->v.str.offset = (uint16_t)data_len;
+			arg->v.str.length = (uint16_t)len;
+			data_len += (uint32_t)len;
+			break;
+		}
+		case 'p':
+			arg->v.p = va_arg(args, const void*);
+			break;
+		case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+			arg->v.d = (spec.length == DEBUG_ARG_LDOUBLE) ? (double)va_arg(args, long double) : va_arg(args, double);
+			break;
+		default:
+			switch (spec.length) {
+			case DEBUG_ARG_LONG:
+				arg->v.i = va_arg(args, long);
+				break;
+			case DEBUG_ARG_LLONG:
+				arg->v.i = va_arg(args, long long);
+				break;
+			case DEBUG_ARG_SIZE:
+				arg->v.i = (long long)va_arg(args, size_t);
+				break;
+			case DEBUG_ARG_INTMAX:
+				arg->v.i = (long long)va_arg(args, intmax_t);
+				break;
+			case DEBUG_ARG_PTRDIFF:
+				arg->v.i = (long long)va_arg(args, ptrdiff_t);
+				break;
+			default:
+				arg->v.i = va_arg(args, int);
+				break;
+			}
+			break;
+		}
+	}
+
+	uint64_t timestamp = debug_timestamp();
+
+	mutex_lock(&debug_ring_mutex);
+	if (!debug_ring) {
+		mutex_unlock(&debug_ring_mutex);
+		return 0;
+	}
+	struct debug_event *ev = &debug_ring[debug_ring_next % debug_ring_size];
+	debug_ring_next++;
+	ev->timestamp = timestamp;
+	ev->func = func;
+	ev->file = file;
+	ev->line = line;
+	ev->subsystem = subsystem;
+	ev->kind = DEBUG_EVENT_FORMAT;
+	ev->length = data_len;
+	ev->format = format;
+	ev->argc = argc;
+	memcpy(ev->args, argv, argc * sizeof(struct debug_event_arg));
+	memcpy(ev->data, data, data_len);
+	mutex_unlock(&debug_ring_mutex);
+
+	return 1;
+}
+
+/* renders a deferred message into buffer, truncating as needed */
+static void debug_event_format(const struct debug_event *ev, char *buffer, size_t size)
+{
+	const char *p = ev->format;
+	size_t used = 0;
+	int argi = 0;
+	struct debug_spec spec;
+
+	buffer[0] = '\0';
+	while (*p && used + 1 < size) {
+		const char *pct = strchr(p, '%');
+		size_t lit = (pct) ? (size_t)(pct - p) : strlen(p);
+		if (lit > size - used - 1) {
+			lit = size - used - 1;
+		}
+		memcpy(buffer + used, p, lit);
+		used += lit;
+		buffer[used] = '\0';
+		if (!pct) {
+			break;
+		}
+		p = debug_parse_spec(pct + 1, &spec);
+		if (!p) {
+			break;
+		}
+		if (spec.conv == '%') {
+			if (used + 1 < size) {
+				buffer[used++] = '%';
+				buffer[used] = '\0';
+			}
+			continue;
+		}
+		if (argi >= ev->argc) {
+			break;
+		}
+		const struct debug_event_arg *arg = &ev->args[argi++];
+
+		/* rebuild the conversion with the resolved width and precision */
+		char fmt[48];
+		int n = snprintf(fmt, sizeof(fmt), "%%%.*s", (spec.flags_len < 8) ? spec.flags_len : 8, spec.flags);
+		if (arg->width >= 0) {
+			n += snprintf(fmt + n, sizeof(fmt) - n, "%d", arg->width);
+		}
+		if (spec.conv == 's') {
+			n += snprintf(fmt + n, sizeof(fmt) - n, ".%us", (unsigned int)arg->v.str.length);
+		} else {
+			if (arg->precision >= 0) {
+				n += snprintf(fmt + n, sizeof(fmt) - n, ".%d", arg->precision);
+			}
+			if (!strchr("eEfFgGaAp", spec.conv)) {
+				static const char *length_mods[] = { "", "l", "ll", "z", "j", "t", "" };
+				n += snprintf(fmt + n, sizeof(fmt) - n, "%s", length_mods[spec.length]);
+			}
+			snprintf(fmt + n, sizeof(fmt) - n, "%c", spec.conv);
+		}
+
+		char *out = buffer + used;
+		size_t avail = size - used;
+		switch (spec.conv) {
+		case 's':
+			snprintf(out, avail, fmt, ev->data + arg->v.str.offset);
+			break;
+		case 'p':
+			snprintf(out, avail, fmt, arg->v.p);
+			break;
+		case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+			snprintf(out, avail, fmt, arg->v.d);
+			break;
+		default:
+			switch (spec.length) {
+			case DEBUG_ARG_LONG:
+				snprintf(out, avail, fmt, (long)arg->v.i);
+				break;
+			case DEBUG_ARG_LLONG:
+				snprintf(out, avail, fmt, arg->v.i);
+				break;
+			case DEBUG_ARG_SIZE:
+				snprintf(out, avail, fmt, (size_t)arg->v.i);
+				break;
+			case DEBUG_ARG_INTMAX:
+				snprintf(out, avail, fmt, (intmax_t)arg->v.i);
+				break;
+			case DEBUG_ARG_PTRDIFF:
+				snprintf(out, avail, fmt, (ptrdiff_t)arg->v.i);
+				break;
+			default:
+				snprintf(out, avail, fmt, (int)arg->v.i);
+				break;
+			}
+			break;
+		}
+		used += strlen(out);
+	}
+}
+
 static void debug_print_line(const char *func, const char *file, int line, const char *buffer)
 {
 	char str_time[24];
@@ -80,67 +568,143 @@ static void debug_print_line(const char *func, const char *file, int line, const
 #endif
 	fprintf(stderr, "%s %s:%d %s(): %s\n", str_time, file, line, func, buffer);
 }
+
+static void debug_print_buffer(const char *data, const int length)
+{
+	int i;
+	int j;
+	unsigned char c;
+
+	for (i = 0; i < length; i += 16) {
+		fprintf(stderr, "%04x: ", i);
+		for (j = 0; j < 16; j++) {
+			if (i + j >= length) {
+				fprintf(stderr, "   ");
+				continue;
+			}
+			fprintf(stderr, "%02x ", *(data + i + j) & 0xff);
+		}
+		fprintf(stderr, "  | ");
+		for (j = 0; j < 16; j++) {
+			if (i + j >= length)
+				break;
+			c = *(data + i + j);
+			if ((c < 32) || (c > 127)) {
+				fprintf(stderr, ".");
+				continue;
+			}
+			fprintf(stderr, "%c", c);
+		}
+		fprintf(stderr, "\n");
+	}
+	fprintf(stderr, "\n");
+}
+#endif
+
+void internal_dump_debug_ring(void)
+{
+#ifndef STRIP_DEBUG_CODE
+	uint64_t i, first;
+
+	thread_once(&debug_ring_once, debug_ring_init);
+	mutex_lock(&debug_ring_mutex);
+	if (!debug_ring) {
+		mutex_unlock(&debug_ring_mutex);
+		return;
+	}
+	first = (debug_ring_next > debug_ring_size) ? debug_ring_next - debug_ring_size : 0;
+	fprintf(stderr, "---- last %u of %llu debug events ----\n", (unsigned int)(debug_ring_next - first), (unsigned long long)debug_ring_next);
+	for (i = first; i < debug_ring_next; i++) {
+		struct debug_event *ev = &debug_ring[i % debug_ring_size];
+		char str_time[24];
+		time_t secs = (time_t)(ev->timestamp / 1000000);
+		struct tm *tp;
+#ifdef HAVE_LOCALTIME_R
+		struct tm tp_;
+		tp = localtime_r(&secs, &tp_);
+#else
+		tp = localtime(&secs);
 #endif
+		strftime(str_time, 9, "%H:%M:%S", tp);
+		snprintf(str_time+8, 16, ".%06d", (int)(ev->timestamp % 1000000));
+		if (ev->kind == DEBUG_EVENT_BUFFER) {
+			uint32_t shown = (ev->length > DEBUG_EVENT_DATA_SIZE) ? DEBUG_EVENT_DATA_SIZE : ev->length;
+			fprintf(stderr, "%s [%s] buffer of %u bytes (%u shown)\n", str_time, debug_subsystem_names[ev->subsystem], ev->length, shown);
+			debug_print_buffer(ev->data, shown);
+		} else if (ev->kind == DEBUG_EVENT_FORMAT) {
+			char message[1024];
+			debug_event_format(ev, message, sizeof(message));
+			fprintf(stderr, "%s [%s] %s:%d %s(): %s\n", str_time, debug_subsystem_names[ev->subsystem], ev->file, ev->line, ev->func, message);
+		} else {
+			fprintf(stderr, "%s [%s] %s:%d %s(): %s%s\n", str_time, debug_subsystem_names[ev->subsystem], ev->file, ev->line, ev->func, ev->data, (ev->length >= DEBUG_EVENT_DATA_SIZE) ? "..." : "");
+		}
+	}
+	fprintf(stderr, "---- end of debug events ----\n");
+	mutex_unlock(&debug_ring_mutex);
+#endif
+}
 
-void debug_info_real(const char *func, const char *file, int line, const char *format, ...)
+void debug_info_real(int subsystem, const char *func, const char *file, int line, const char *format, ...)
 {
 #ifndef STRIP_DEBUG_CODE
 	va_list args;
-	char *buffer = NULL;
+	char stackbuf[256];
+	char *buffer = stackbuf;
+	int len;
 
-	if (!debug_level)
+	if (subsystem < 0 || subsystem >= DEBUG_SUBSYSTEM_COUNT || debug_subsystem_levels[subsystem] <= 0)
 		return;
 
-	/* run the real fprintf */
+	if (debug_ring) {
+		/* keep the raw arguments, formatting happens when dumping */
+		va_start(args, format);
+		len = debug_ring_add_format(subsystem, func, file, line, format, args);
+		va_end(args);
+		if (len)
+			return;
+	}
+
+	/* most messages fit on the stack, avoid the allocation */
 	va_start(args, format);
-	if(vasprintf(&buffer, format, args)<0){}
+	len = vsnprintf(stackbuf, sizeof(stackbuf), format, args);
 	va_end(args);
 
+	if (len >= 0 && debug_ring_add(subsystem, func, file, line, DEBUG_EVENT_TEXT, stackbuf, (uint32_t)len))
+		return;
+
+	if (len < 0 || len >= (int)sizeof(stackbuf)) {
+		buffer = NULL;
+		va_start(args, format);
+		if(vasprintf(&buffer, format, args)<0){}
+		va_end(args);
+		if (!buffer)
+			return;
+	}
+
 	debug_print_line(func, file, line, buffer);
 
-	free(buffer);
+	if (buffer != stackbuf)
+		free(buffer);
 #endif
 }
 
-void debug_buffer(const char *data, const int length)
+void debug_buffer_real(int subsystem, const char *data, const int length)
 {
 #ifndef STRIP_DEBUG_CODE
-	int i;
-	int j;
-	unsigned char c;
+	if (subsystem < 0 || subsystem >= DEBUG_SUBSYSTEM_COUNT || debug_subsystem_levels[subsystem] <= 0)
+		return;
 
-	if (debug_level) {
-		for (i = 0; i < length; i += 16) {
-			fprintf(stderr, "%04x: ", i);
-			for (j = 0; j < 16; j++) {
-				if (i + j >= length) {
-					fprintf(stderr, "   ");
-					continue;
-				}
-				fprintf(stderr, "%02x ", *(data + i + j) & 0xff);
-			}
-			fprintf(stderr, "  | ");
-			for (j = 0; j < 16; j++) {
-				if (i + j >= length)
-					break;
-				c = *(data + i + j);
-				if ((c < 32) || (c > 127)) {
-					fprintf(stderr, ".");
-					continue;
-				}
-				fprintf(stderr, "%c", c);
-			}
-			fprintf(stderr, "\n");
-		}
-		fprintf(stderr, "\n");
-	}
+	if (length > 0 && debug_ring_add(subsystem, NULL, NULL, 0, DEBUG_EVENT_BUFFER, data, (uint32_t)length))
+		return;
+
+	debug_print_buffer(data, length);
 #endif
 }
 
 void debug_buffer_to_file(const char *file, const char *data, const int length)
 {
 #ifndef STRIP_DEBUG_CODE
-	if (debug_level) {
+	if (debug_subsystem_levels[DEBUG_SUBSYSTEM_DEFAULT]) {
 		FILE *f = fopen(file, "wb");
 		fwrite(data, 1, length, f);
 		fflush(f);
@@ -149,12 +713,25 @@ void debug_buffer_to_file(const char *file, const char *data, const int length)
 #endif
 }
 
-void debug_plist_real(const char *func, const char *file, int line, plist_t plist)
+void debug_plist_real(int subsystem, const char *func, const char *file, int line, plist_t plist)
 {
 #ifndef STRIP_DEBUG_CODE
 	if (!plist)
 		return;
 
+	if (debug_ring) {
+		/* converting every plist to XML is what the ring buffer avoids */
+		plist_type type = plist_get_node_type(plist);
+		uint32_t items = 0;
+		if (type == PLIST_DICT) {
+			items = plist_dict_get_size(plist);
+		} else if (type == PLIST_ARRAY) {
+			items = plist_array_get_size(plist);
+		}
+		debug_info_real(subsystem, func, file, line, "plist of type %d with %u items", (int)type, items);
+		return;
+	}
+
 	char *buffer = NULL;
 	uint32_t length = 0;
 	plist_to_xml(plist, &buffer, &length);
@@ -164,11 +741,10 @@ void debug_plist_real(const char *func, const char *file, int line, plist_t plis
 		buffer[length-1] = '\0';
 
 	if (length <= MAX_PRINT_LEN)
-		debug_info_real(func, file, line, "printing %i bytes plist:\n%s", length, buffer);
+		debug_info_real(subsystem, func, file, line, "printing %i bytes plist:\n%s", length, buffer);
 	else
-		debug_info_real(func, file, line, "supress printing %i bytes plist...\n", length);
+		debug_info_real(subsystem, func, file, line, "supress printing %i bytes plist...\n", length);
 
 	free(buffer);
 #endif
 }
-
@@ -25,29 +25,62 @@
 
 #include <plist/plist.h>
 
+/* Subsystems with separate debug levels. A source file selects its
+ * subsystem by defining DEBUG_SUBSYSTEM before including any header. */
+enum debug_subsystem {
+	DEBUG_SUBSYSTEM_DEFAULT = 0,
+	DEBUG_SUBSYSTEM_CONNECTION,
+	DEBUG_SUBSYSTEM_PLIST,
+	DEBUG_SUBSYSTEM_LOCKDOWN,
+	DEBUG_SUBSYSTEM_AFC,
+	DEBUG_SUBSYSTEM_DEBUGSERVER,
+	DEBUG_SUBSYSTEM_COUNT
+};
+
+#ifndef DEBUG_SUBSYSTEM
+#define DEBUG_SUBSYSTEM DEBUG_SUBSYSTEM_DEFAULT
+#endif
+
+extern int debug_subsystem_levels[DEBUG_SUBSYSTEM_COUNT];
+
+/* checked at the call site so that arguments are not evaluated when off */
+#define debug_enabled() (debug_subsystem_levels[DEBUG_SUBSYSTEM] > 0)
+
 #if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 199901L && !defined(STRIP_DEBUG_CODE)
-#define debug_info(...) debug_info_real (__func__, __FILE__, __LINE__, __VA_ARGS__)
-#define debug_plist(a) debug_plist_real (__func__, __FILE__, __LINE__, a)
+#define debug_info(...) do { if (debug_enabled()) debug_info_real (DEBUG_SUBSYSTEM, __func__, __FILE__, __LINE__, __VA_ARGS__); } while (0)
+#define debug_plist(a) do { if (debug_enabled()) debug_plist_real (DEBUG_SUBSYSTEM, __func__, __FILE__, __LINE__, a); } while (0)
 #elif defined(__GNUC__) && __GNUC__ >= 3 && !defined(STRIP_DEBUG_CODE)
-#define debug_info(...) debug_info_real (__FUNCTION__, __FILE__, __LINE__, __VA_ARGS__)
-#define debug_plist(a) debug_plist_real (__FUNCTION__, __FILE__, __LINE__, a)
+#define debug_info(...) do { if (debug_enabled()) debug_info_real (DEBUG_SUBSYSTEM, __FUNCTION__, __FILE__, __LINE__, __VA_ARGS__); } while (0)
+#define debug_plist(a) do { if (debug_enabled()) debug_plist_real (DEBUG_SUBSYSTEM, __FUNCTION__, __FILE__, __LINE__, a); } while (0)
 #else
 #define debug_info(...)
 #define debug_plist(a)
 #endif
 
-void debug_info_real(const char *func,
+#ifndef STRIP_DEBUG_CODE
+#define debug_buffer(data, length) do { if (debug_enabled()) debug_buffer_real (DEBUG_SUBSYSTEM, data, length); } while (0)
+#else
+#define debug_buffer(data, length) do { } while (0)
+#endif
+
+void debug_info_real(int subsystem,
+											const char *func,
 											const char *file,
 											int	line,
 											const char *format, ...);
 
-void debug_buffer(const char *data, const int length);
+void debug_buffer_real(int subsystem, const char *data, const int length);
 void debug_buffer_to_file(const char *file, const char *data, const int length);
-void debug_plist_real(const char *func,
+void debug_plist_real(int subsystem,
+											const char *func,
 											const char *file,
 											int	line,
 											plist_t plist);
 
 void internal_set_debug_level(int level);
+int internal_set_debug_subsystem_level(const char *subsystem, int level);
+void internal_set_debug_ring_size(unsigned int events);
+void internal_dump_debug_ring(void);
+void internal_debug_init(void);
 
 #endif
@@ -24,6 +24,7 @@
 #ifdef HAVE_CONFIG_H
 #include <config.h>
 #endif
+#define DEBUG_SUBSYSTEM DEBUG_SUBSYSTEM_LOCKDOWN
 
 #include <stdio.h>
 #include <stdint.h>
@@ -35,15 +36,21 @@
 #include <sys/types.h>
 #endif
 #include <dirent.h>
+#include <sys/time.h>
 #ifndef _WIN32
 #include <pwd.h>
 #include <unistd.h>
 #include <libgen.h>
 #include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <io.h>
+#include <process.h>
 #endif
 #include <usbmuxd.h>
 #if defined(HAVE_OPENSSL)
 #include <openssl/bn.h>
+#include <openssl/crypto.h>
 #include <openssl/pem.h>
 #include <openssl/rsa.h>
 #include <openssl/x509.h>
@@ -65,6 +72,7 @@
 #include <mbedtls/ctr_drbg.h>
 #include <mbedtls/asn1write.h>
 #include <mbedtls/oid.h>
+#include <mbedtls/platform_util.h>
 #else
 #error No supported TLS/SSL library enabled
 #endif
@@ -79,6 +87,7 @@
 
 #include <libimobiledevice/libimobiledevice.h>
 #include <libimobiledevice-glue/utils.h>
+#include <libimobiledevice-glue/thread.h>
 
 #include "userpref.h"
 #include "debug.h"
@@ -103,6 +112,7 @@ const ASN1_ARRAY_TYPE pkcs1_asn1_tab[] = {
 #endif
 
 #define USERPREF_CONFIG_EXTENSION ".plist"
+#define USERPREF_CACHE_EXTENSION ".cache"
 
 #ifdef _WIN32
 #define USERPREF_CONFIG_DIR "Apple"DIR_SEP_S"Lockdown"
@@ -363,6 +373,138 @@ userpref_error_t userpref_delete_pair_record(const char *udid)
 	return res == 0 ? USERPREF_E_SUCCESS: USERPREF_E_UNKNOWN_ERROR;
 }
 
+static char *userpref_get_device_cache_path(const char *udid, const char *name)
+{
+	return string_concat(userpref_get_config_dir(), DIR_SEP_S, udid, ".", name, USERPREF_CACHE_EXTENSION, NULL);
+}
+
+/**
+ * Read a cache file stored for a device next to its pair record.
+ *
+ * @param udid The device UDID as given by the device
+ * @param name Name of the cache, e.g. "apps"
+ * @param cache Pointer that will be set to the cached plist
+ *
+ * @return USERPREF_E_SUCCESS on success,
+ *     USERPREF_E_NOENT if no cache exists for the device,
+ *     or USERPREF_E_INVALID_ARG if udid, name or cache is NULL.
+ */
+userpref_error_t userpref_read_device_cache(const char *udid, const char *name, plist_t *cache)
+{
+	if (!udid || !name || !cache)
+		return USERPREF_E_INVALID_ARG;
+
+	*cache = NULL;
+	char *path = userpref_get_device_cache_path(udid, name);
+	if (!path)
+		return USERPREF_E_UNKNOWN_ERROR;
+
+	plist_read_from_file(path, cache, NULL);
+	free(path);
+
+	return (*cache) ? USERPREF_E_SUCCESS : USERPREF_E_NOENT;
+}
+
+/**
+ * Save a cache file for a device next to its pair record. The file is
+ * written to a temporary name first and then renamed into place.
+ *
+ * @param udid The device UDID as given by the device
+ * @param name Name of the cache, e.g. "apps"
+ * @param cache The plist to store
+ *
+ * @return USERPREF_E_SUCCESS on success,
+ *     USERPREF_E_WRITE_ERROR if the file could not be written,
+ *     or USERPREF_E_INVALID_ARG if udid, name or cache is NULL.
+ */
+userpref_error_t userpref_save_device_cache(const char *udid, const char *name, plist_t cache)
+{
+	if (!udid || !name || !cache)
+		return USERPREF_E_INVALID_ARG;
+
+	char *path = userpref_get_device_cache_path(udid, name);
+	if (!path)
+		return USERPREF_E_UNKNOWN_ERROR;
+
+	char *bin = NULL;
+	uint32_t bin_len = 0;
+	plist_to_bin(cache, &bin, &bin_len);
+	if (!bin) {
+		free(path);
+		return USERPREF_E_UNKNOWN_ERROR;
+	}
+
+	/* a unique temporary file, other processes may save the same cache */
+	int fd = -1;
+#ifdef _WIN32
+	char *tmppath = NULL;
+	int attempt;
+	for (attempt = 0; attempt < 16 && fd < 0; attempt++) {
+		char suffix[32];
+		snprintf(suffix, sizeof(suffix), ".%lu.%u.tmp", (unsigned long)_getpid(), (unsigned int)(GetTickCount() + attempt));
+		free(tmppath);
+		tmppath = string_concat(path, suffix, NULL);
+		if (tmppath) {
+			fd = _open(tmppath, _O_WRONLY | _O_CREAT | _O_EXCL | _O_BINARY, _S_IREAD | _S_IWRITE);
+		}
+	}
+#else
+	char *tmppath = string_concat(path, ".XXXXXX", NULL);
+	if (tmppath) {
+		fd = mkstemp(tmppath);
+	}
+#endif
+	if (fd < 0) {
+		debug_info("Failed to create temporary file for %s: %s", path, strerror(errno));
+		free(tmppath);
+		free(bin);
+		free(path);
+		return USERPREF_E_WRITE_ERROR;
+	}
+
+	userpref_error_t res = USERPREF_E_SUCCESS;
+	uint32_t written = 0;
+	while (written < bin_len) {
+#ifdef _WIN32
+		int r = _write(fd, bin + written, bin_len - written);
+#else
+		ssize_t r = write(fd, bin + written, bin_len - written);
+#endif
+		if (r <= 0) {
+			if (r < 0 && errno == EINTR)
+				continue;
+			break;
+		}
+		written += (uint32_t)r;
+	}
+#ifdef _WIN32
+	if (_close(fd) != 0 || written != bin_len) {
+#else
+	if (close(fd) != 0 || written != bin_len) {
+#endif
+		debug_info("Failed to write device cache to %s", tmppath);
+		remove(tmppath);
+		res = USERPREF_E_WRITE_ERROR;
+	} else {
+#ifndef _WIN32
+		/* mkstemp creates the file accessible to the owner only */
+		chmod(tmppath, 0644);
+#else
+		remove(path);
+#endif
+		if (rename(tmppath, path) != 0) {
+			debug_info("Failed to rename %s to %s: %s", tmppath, path, strerror(errno));
+			remove(tmppath);
+			res = USERPREF_E_WRITE_ERROR;
+		}
+	}
+	free(tmppath);
+	free(bin);
+	free(path);
+
+	return res;
+}
+
 #if defined(HAVE_OPENSSL)
 static int X509_add_ext_helper(X509 *cert, int nid, char *value)
 {
@@ -411,6 +553,316 @@ static int _mbedtls_x509write_crt_set_basic_constraints_critical(mbedtls_x509wri
 }
 #endif
 
+#if defined(HAVE_OPENSSL)
+static EVP_PKEY* rsa_key_generate(void)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	return EVP_RSA_gen(2048);
+#else
+	BIGNUM *e = BN_new();
+	RSA* keypair = RSA_new();
+
+	BN_set_word(e, 65537);
+
+	RSA_generate_key_ex(keypair, 2048, e, NULL);
+
+	BN_free(e);
+
+	EVP_PKEY* pkey = EVP_PKEY_new();
+	EVP_PKEY_assign_RSA(pkey, keypair);
+
+	return pkey;
+#endif
+}
+#elif defined(HAVE_MBEDTLS)
+static int rsa_key_generate(mbedtls_pk_context *pkey, mbedtls_ctr_drbg_context *ctr_drbg)
+{
+	int ret = mbedtls_pk_setup(pkey, mbedtls_pk_info_from_type(MBEDTLS_PK_RSA));
+	if (ret != 0) {
+		debug_info("mbedtls_pk_setup returned -0x%04x", -ret);
+		return ret;
+	}
+
+	ret = mbedtls_rsa_gen_key(mbedtls_pk_rsa(*pkey), mbedtls_ctr_drbg_random, ctr_drbg, 2048, 65537);
+	if (ret != 0) {
+		debug_info("mbedtls_rsa_gen_key returned -0x%04x", -ret);
+	}
+	return ret;
+}
+#endif
+
+/*
+ * Pool of pre-generated RSA private keys in PEM format. Generating the
+ * 2048 bit root and host keys dominates the time it takes to create a
+ * pair record, so a background thread can keep a number of them ready.
+ */
+static struct {
+	mutex_t mutex;
+	cond_t cond;
+	key_data_t *keys;
+	unsigned int size;
+	unsigned int count;
+	int running;
+	THREAD_T thread;
+} key_pool;
+static thread_once_t key_pool_once = THREAD_ONCE_INIT;
+
+static void key_pool_init(void)
+{
+	mutex_init(&key_pool.mutex);
+	cond_init(&key_pool.cond);
+}
+
+/* wipes and frees a PEM encoded private key */
+static void key_pool_free_pem(key_data_t *pem)
+{
+	if (!pem->data) {
+		return;
+	}
+#if defined(HAVE_OPENSSL)
+	OPENSSL_cleanse(pem->data, pem->size);
+#elif defined(HAVE_GNUTLS)
+	gnutls_memset(pem->data, 0, pem->size);
+#elif defined(HAVE_MBEDTLS)
+	mbedtls_platform_zeroize(pem->data, pem->size);
+#endif
+	free(pem->data);
+	pem->data = NULL;
+	pem->size = 0;
+}
+
+static int key_pool_generate(key_data_t *pem)
+{
+	pem->data = NULL;
+	pem->size = 0;
+#if defined(HAVE_OPENSSL)
+	EVP_PKEY *pkey = rsa_key_generate();
+	if (!pkey) {
+		return -1;
+	}
+	BIO *membp = BIO_new(BIO_s_mem());
+	if (PEM_write_bio_PrivateKey(membp, pkey, NULL, NULL, 0, 0, NULL) > 0) {
+		char *bdata = NULL;
+		long size = BIO_get_mem_data(membp, &bdata);
+		pem->data = (unsigned char*)malloc(size);
+		if (pem->data) {
+			memcpy(pem->data, bdata, size);
+			pem->size = size;
+		}
+		OPENSSL_cleanse(bdata, size);
+	}
+	BIO_free(membp);
+	EVP_PKEY_free(pkey);
+#elif defined(HAVE_GNUTLS)
+	gnutls_x509_privkey_t privkey;
+	gnutls_x509_privkey_init(&privkey);
+	gcry_control(GCRYCTL_ENABLE_QUICK_RANDOM);
+	if (gnutls_x509_privkey_generate(privkey, GNUTLS_PK_RSA, 2048, 0) == GNUTLS_E_SUCCESS) {
+		size_t export_size = 0;
+		gnutls_x509_privkey_export(privkey, GNUTLS_X509_FMT_PEM, NULL, &export_size);
+		pem->data = (unsigned char*)malloc(export_size);
+		if (pem->data && gnutls_x509_privkey_export(privkey, GNUTLS_X509_FMT_PEM, pem->data, &export_size) == GNUTLS_E_SUCCESS) {
+			pem->size = export_size;
+		} else {
+			if (pem->data) {
+				gnutls_memset(pem->data, 0, export_size);
+			}
+			free(pem->data);
+			pem->data = NULL;
+		}
+	}
+	gnutls_x509_privkey_deinit(privkey);
+#elif defined(HAVE_MBEDTLS)
+	mbedtls_entropy_context entropy;
+	mbedtls_ctr_drbg_context ctr_drbg;
+	mbedtls_pk_context pkey;
+	mbedtls_entropy_init(&entropy);
+	mbedtls_ctr_drbg_init(&ctr_drbg);
+	mbedtls_pk_init(&pkey);
+	if (mbedtls_ctr_drbg_seed(&ctr_drbg, mbedtls_entropy_func, &entropy, (const unsigned char *)"limd", 4) == 0
+	    && rsa_key_generate(&pkey, &ctr_drbg) == 0) {
+		unsigned char outbuf[16384];
+		if (mbedtls_pk_write_key_pem(&pkey, outbuf, sizeof(outbuf)) == 0) {
+			/* mbedtls_pk_parse_key() wants the terminating 0 included */
+			size_t size = strlen((const char*)outbuf) + 1;
+			pem->data = (unsigned char*)malloc(size);
+			if (pem->data) {
+				memcpy(pem->data, outbuf, size);
+				pem->size = size;
+			}
+		}
+		mbedtls_platform_zeroize(outbuf, sizeof(outbuf));
+	}
+	mbedtls_pk_free(&pkey);
+	mbedtls_ctr_drbg_free(&ctr_drbg);
+	mbedtls_entropy_free(&entropy);
+#endif
+	return (pem->data) ? 0 : -1;
+}
+
+static void* key_pool_worker(void *arg)
+{
+	mutex_lock(&key_pool.mutex);
+	while (key_pool.running) {
+		if (key_pool.count >= key_pool.size) {
+			cond_wait(&key_pool.cond, &key_pool.mutex);
+			continue;
+		}
+		mutex_unlock(&key_pool.mutex);
+
+		key_data_t pem = { NULL, 0 };
+		int res = key_pool_generate(&pem);
+
+		mutex_lock(&key_pool.mutex);
+		if (res < 0) {
+			debug_info("Failed to generate key for the pool, stopping");
+			break;
+		}
+		if (key_pool.running && key_pool.count < key_pool.size) {
+			key_pool.keys[key_pool.count++] = pem;
+		} else {
+			key_pool_free_pem(&pem);
+		}
+	}
+	mutex_unlock(&key_pool.mutex);
+	return NULL;
+}
+
+/**
+ * Takes a pre-generated private key from the pool.
+ *
+ * @param pem Receives the PEM encoded key, to be freed by the caller.
+ *
+ * @return 0 on success, or -1 if the pool is empty or not running.
+ */
+static int key_pool_take(key_data_t *pem)
+{
+	int res = -1;
+	thread_once(&key_pool_once, key_pool_init);
+	mutex_lock(&key_pool.mutex);
+	if (key_pool.count > 0) {
+		*pem = key_pool.keys[--key_pool.count];
+		res = 0;
+		/* wake up the worker to refill the pool */
+		cond_signal(&key_pool.cond);
+	}
+	mutex_unlock(&key_pool.mutex);
+	return res;
+}
+
+/**
+ * Returns the number of pre-generated keys currently in the pool. Every
+ * pair record takes two of them.
+ */
+unsigned int userpref_key_pool_get_count(void)
+{
+	thread_once(&key_pool_once, key_pool_init);
+	mutex_lock(&key_pool.mutex);
+	unsigned int count = key_pool.count;
+	mutex_unlock(&key_pool.mutex);
+	return count;
+}
+
+userpref_error_t userpref_key_pool_start(unsigned int num_keypairs)
+{
+	if (num_keypairs == 0)
+		return USERPREF_E_INVALID_ARG;
+
+	thread_once(&key_pool_once, key_pool_init);
+	mutex_lock(&key_pool.mutex);
+	if (key_pool.running) {
+		mutex_unlock(&key_pool.mutex);
+		return USERPREF_E_SUCCESS;
+	}
+	key_pool.keys = (key_data_t*)calloc(num_keypairs * 2, sizeof(key_data_t));
+	if (!key_pool.keys) {
+		mutex_unlock(&key_pool.mutex);
+		return USERPREF_E_UNKNOWN_ERROR;
+	}
+	/* every pair record needs a root and a host key */
+	key_pool.size = num_keypairs * 2;
+	key_pool.count = 0;
+	key_pool.running = 1;
+	if (thread_new(&key_pool.thread, key_pool_worker, NULL) != 0) {
+		debug_info("Failed to create key pool thread");
+		free(key_pool.keys);
+		key_pool.keys = NULL;
+		key_pool.size = 0;
+		key_pool.running = 0;
+		mutex_unlock(&key_pool.mutex);
+		return USERPREF_E_UNKNOWN_ERROR;
+	}
+	mutex_unlock(&key_pool.mutex);
+	return USERPREF_E_SUCCESS;
+}
+
+void userpref_key_pool_stop(void)
+{
+	thread_once(&key_pool_once, key_pool_init);
+	mutex_lock(&key_pool.mutex);
+	if (!key_pool.running) {
+		mutex_unlock(&key_pool.mutex);
+		return;
+	}
+	key_pool.running = 0;
+	cond_broadcast(&key_pool.cond);
+	mutex_unlock(&key_pool.mutex);
+
+	/* a key generation in progress is finished before the thread exits */
+	thread_join(key_pool.thread);
+	thread_free(key_pool.thread);
+
+	mutex_lock(&key_pool.mutex);
+	while (key_pool.count > 0) {
+		key_pool_free_pem(&key_pool.keys[--key_pool.count]);
+	}
+	free(key_pool.keys);
+	key_pool.keys = NULL;
+	key_pool.size = 0;
+	mutex_unlock(&key_pool.mutex);
+}
+
+#if defined(HAVE_OPENSSL)
+static EVP_PKEY* rsa_key_from_pool(void)
+{
+	key_data_t pem = { NULL, 0 };
+	if (key_pool_take(&pem) < 0) {
+		return NULL;
+	}
+	BIO *membp = BIO_new_mem_buf(pem.data, pem.size);
+	EVP_PKEY *pkey = PEM_read_bio_PrivateKey(membp, NULL, NULL, NULL);
+	BIO_free(membp);
+	key_pool_free_pem(&pem);
+	return pkey;
+}
+#elif defined(HAVE_GNUTLS)
+static int rsa_key_from_pool(gnutls_x509_privkey_t privkey)
+{
+	key_data_t pem = { NULL, 0 };
+	if (key_pool_take(&pem) < 0) {
+		return -1;
+	}
+	int res = gnutls_x509_privkey_import(privkey, &pem, GNUTLS_X509_FMT_PEM);
+	key_pool_free_pem(&pem);
+	return (res == GNUTLS_E_SUCCESS) ? 0 : -1;
+}
+#elif defined(HAVE_MBEDTLS)
+static int rsa_key_from_pool(mbedtls_pk_context *pkey, mbedtls_ctr_drbg_context *ctr_drbg)
+{
+	key_data_t pem = { NULL, 0 };
+	if (key_pool_take(&pem) < 0) {
+		return -1;
+	}
+#if MBEDTLS_VERSION_NUMBER >= 0x03000000
+	int res = mbedtls_pk_parse_key(pkey, pem.data, pem.size, NULL, 0, mbedtls_ctr_drbg_random, ctr_drbg);
+#else
+	int res = mbedtls_pk_parse_key(pkey, pem.data, pem.size, NULL, 0);
+#endif
+	key_pool_free_pem(&pem);
+	return (res == 0) ? 0 : -1;
+}
+#endif
+
 /**
  * Private function to generate required private keys and certificates.
  *
@@ -435,28 +887,23 @@ userpref_error_t pair_record_generate_keys_and_certs(plist_t pair_record, key_da
 
 	debug_info("Generating keys and certificates...");
 
-#if defined(HAVE_OPENSSL)
-#if OPENSSL_VERSION_NUMBER >= 0x30000000L
-	EVP_PKEY* root_pkey = EVP_RSA_gen(2048);
-	EVP_PKEY* host_pkey = EVP_RSA_gen(2048);
-#else
-	BIGNUM *e = BN_new();
-	RSA* root_keypair = RSA_new();
-	RSA* host_keypair = RSA_new();
-
-	BN_set_word(e, 65537);
-
-	RSA_generate_key_ex(root_keypair, 2048, e, NULL);
-	RSA_generate_key_ex(host_keypair, 2048, e, NULL);
+	int pooled_keys = 0;
+	struct timeval start;
+	gettimeofday(&start, NULL);
 
-	BN_free(e);
-
-	EVP_PKEY* root_pkey = EVP_PKEY_new();
-	EVP_PKEY_assign_RSA(root_pkey, root_keypair);
-
-	EVP_PKEY* host_pkey = EVP_PKEY_new();
-	EVP_PKEY_assign_RSA(host_pkey, host_keypair);
-#endif
+#if defined(HAVE_OPENSSL)
+	EVP_PKEY* root_pkey = rsa_key_from_pool();
+	if (root_pkey) {
+		pooled_keys++;
+	} else {
+		root_pkey = rsa_key_generate();
+	}
+	EVP_PKEY* host_pkey = rsa_key_from_pool();
+	if (host_pkey) {
+		pooled_keys++;
+	} else {
+		host_pkey = rsa_key_generate();
+	}
 
 	/* generate root certificate */
 	X509* root_cert = X509_new();
@@ -652,8 +1099,16 @@ userpref_error_t pair_record_generate_keys_and_certs(plist_t pair_record, key_da
 	gnutls_x509_crt_init(&host_cert);
 
 	/* generate root key */
-	gnutls_x509_privkey_generate(root_privkey, GNUTLS_PK_RSA, 2048, 0);
-	gnutls_x509_privkey_generate(host_privkey, GNUTLS_PK_RSA, 2048, 0);
+	if (rsa_key_from_pool(root_privkey) == 0) {
+		pooled_keys++;
+	} else {
+		gnutls_x509_privkey_generate(root_privkey, GNUTLS_PK_RSA, 2048, 0);
+	}
+	if (rsa_key_from_pool(host_privkey) == 0) {
+		pooled_keys++;
+	} else {
+		gnutls_x509_privkey_generate(host_privkey, GNUTLS_PK_RSA, 2048, 0);
+	}
 
 	/* generate certificates */
 	gnutls_x509_crt_set_key(root_cert, root_privkey);
@@ -838,16 +1293,13 @@ userpref_error_t pair_record_generate_keys_and_certs(plist_t pair_record, key_da
 	mbedtls_ctr_drbg_seed(&ctr_drbg, mbedtls_entropy_func, &entropy, (const unsigned char *)"limd", 4);
 
 	/* ----- root key & cert ----- */
-	ret = mbedtls_pk_setup(&root_pkey, mbedtls_pk_info_from_type(MBEDTLS_PK_RSA));
-	if (ret != 0) {
-		debug_info("mbedtls_pk_setup returned -0x%04x", -ret);
-		goto cleanup;
-	}
-
-	ret = mbedtls_rsa_gen_key(mbedtls_pk_rsa(root_pkey), mbedtls_ctr_drbg_random, &ctr_drbg, 2048, 65537);
-	if (ret != 0) {
-		debug_info("mbedtls_rsa_gen_key returned -0x%04x", -ret);
-		goto cleanup;
+	if (rsa_key_from_pool(&root_pkey, &ctr_drbg) == 0) {
+		pooled_keys++;
+	} else {
+		ret = rsa_key_generate(&root_pkey, &ctr_drbg);
+		if (ret != 0) {
+			goto cleanup;
+		}
 	}
 
 	mbedtls_x509write_cert cert;
@@ -895,16 +1347,13 @@ userpref_error_t pair_record_generate_keys_and_certs(plist_t pair_record, key_da
 
 
 	/* ----- host key & cert ----- */
-	ret = mbedtls_pk_setup(&host_pkey, mbedtls_pk_info_from_type(MBEDTLS_PK_RSA));
-	if (ret != 0) {
-		debug_info("mbedtls_pk_setup returned -0x%04x", -ret);
-		goto cleanup;
-	}
-
-	ret = mbedtls_rsa_gen_key(mbedtls_pk_rsa(host_pkey), mbedtls_ctr_drbg_random, &ctr_drbg, 2048, 65537);
-	if (ret != 0) {
-		debug_info("mbedtls_rsa_gen_key returned -0x%04x", -ret);
-		goto cleanup;
+	if (rsa_key_from_pool(&host_pkey, &ctr_drbg) == 0) {
+		pooled_keys++;
+	} else {
+		ret = rsa_key_generate(&host_pkey, &ctr_drbg);
+		if (ret != 0) {
+			goto cleanup;
+		}
 	}
 
 	mbedtls_x509write_crt_init(&cert);
@@ -1028,6 +1477,10 @@ cleanup:
 		ret = USERPREF_E_SUCCESS;
 	}
 
+	struct timeval end;
+	gettimeofday(&end, NULL);
+	debug_info("Generated keys and certificates in %ld ms (%d of 2 keys from pool)", (long)((end.tv_sec - start.tv_sec) * 1000 + (end.tv_usec - start.tv_usec) / 1000), pooled_keys);
+
 	free(dev_cert_pem.data);
 	free(root_key_pem.data);
 	free(root_cert_pem.data);
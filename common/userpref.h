@@ -67,7 +67,12 @@ int userpref_read_system_buid(char **system_buid);
 userpref_error_t userpref_read_pair_record(const char *udid, plist_t *pair_record);
 userpref_error_t userpref_save_pair_record(const char *udid, uint32_t device_id, plist_t pair_record);
 userpref_error_t userpref_delete_pair_record(const char *udid);
+userpref_error_t userpref_read_device_cache(const char *udid, const char *name, plist_t *cache);
+userpref_error_t userpref_save_device_cache(const char *udid, const char *name, plist_t cache);
 
+userpref_error_t userpref_key_pool_start(unsigned int num_keypairs);
+void userpref_key_pool_stop(void);
+unsigned int userpref_key_pool_get_count(void);
 userpref_error_t pair_record_generate_keys_and_certs(plist_t pair_record, key_data_t public_key, unsigned int device_version);
 #if  defined(HAVE_OPENSSL) || defined(HAVE_MBEDTLS)
 userpref_error_t pair_record_import_key_with_name(plist_t pair_record, const char* name, key_data_t* key);
@@ -1,4 +1,4 @@
-cdef extern from "libimobiledevice/afc.h":
+cdef extern from "libimobiledevice/afc.h" nogil:
     cdef struct afc_client_private:
         pass
     ctypedef afc_client_private *afc_client_t
@@ -68,6 +68,8 @@ cdef extern from "libimobiledevice/afc.h":
     afc_error_t afc_file_tell(afc_client_t client, uint64_t handle, uint64_t *position)
     afc_error_t afc_file_truncate(afc_client_t client, uint64_t handle, uint64_t newsize)
 
+from cpython.bytes cimport PyBytes_AS_STRING
+
 LOCK_SH = AFC_LOCK_SH
 LOCK_EX = AFC_LOCK_EX
 LOCK_UN = AFC_LOCK_UN
@@ -124,45 +126,93 @@ cdef class AfcFile(Base):
         self.close()
 
     cpdef close(self):
-        self.handle_error(afc_file_close(self._client._c_client, self._c_handle))
+        cdef:
+            afc_client_t c_client = self._client._c_client
+            afc_error_t err
+        with nogil:
+            err = afc_file_close(c_client, self._c_handle)
+        self.handle_error(err)
 
     cpdef lock(self, int operation):
-        self.handle_error(afc_file_lock(self._client._c_client, self._c_handle, <afc_lock_op_t>operation))
+        cdef:
+            afc_client_t c_client = self._client._c_client
+            afc_error_t err
+        with nogil:
+            err = afc_file_lock(c_client, self._c_handle, <afc_lock_op_t>operation)
+        self.handle_error(err)
 
     cpdef seek(self, int64_t offset, int whence):
-        self.handle_error(afc_file_seek(self._client._c_client, self._c_handle, offset, whence))
+        cdef:
+            afc_client_t c_client = self._client._c_client
+            afc_error_t err
+        with nogil:
+            err = afc_file_seek(c_client, self._c_handle, offset, whence)
+        self.handle_error(err)
 
     cpdef uint64_t tell(self):
-        cdef uint64_t position
-        self.handle_error(afc_file_tell(self._client._c_client, self._c_handle, &position))
+        cdef:
+            afc_client_t c_client = self._client._c_client
+            afc_error_t err
+            uint64_t position
+        with nogil:
+            err = afc_file_tell(c_client, self._c_handle, &position)
+        self.handle_error(err)
         return position
 
     cpdef truncate(self, uint64_t newsize):
-        self.handle_error(afc_file_truncate(self._client._c_client, self._c_handle, newsize))
+        cdef:
+            afc_client_t c_client = self._client._c_client
+            afc_error_t err
+        with nogil:
+            err = afc_file_truncate(c_client, self._c_handle, newsize)
+        self.handle_error(err)
 
     cpdef bytes read(self, uint32_t size):
         cdef:
-            uint32_t bytes_read
-            char* c_data = <char *>malloc(size)
-            bytes result
-        try:
-            self.handle_error(afc_file_read(self._client._c_client, self._c_handle, c_data, size, &bytes_read))
-            result = c_data[:bytes_read]
-            return result
-        except BaseError, e:
-            raise
-        finally:
-            free(c_data)
+            afc_client_t c_client = self._client._c_client
+            afc_error_t err
+            uint32_t bytes_read = 0
+            PyObject* c_result = bytes_buffer_new(size)
+            char* c_data = PyBytes_AS_STRING(<object>c_result)
+        # read directly into the buffer of the returned bytes object
+        with nogil:
+            err = afc_file_read(c_client, self._c_handle, c_data, size, &bytes_read)
+        if err != AFC_E_SUCCESS:
+            bytes_buffer_free(c_result)
+            self.handle_error(err)
+        return bytes_buffer_finish(c_result, bytes_read)
 
-    cpdef uint32_t write(self, bytes data):
+    cpdef uint32_t readinto(self, unsigned char[::1] buffer):
+        """Read up to len(buffer) bytes into a writable buffer object, like
+        bytearray, memoryview, array or mmap, without an intermediate copy.
+        Returns the number of bytes read."""
         cdef:
-            uint32_t bytes_written
-            char* c_data = data
-        try:
-            self.handle_error(afc_file_write(self._client._c_client, self._c_handle, c_data, len(data), &bytes_written))
-        except BaseError, e:
-            raise
-
+            afc_client_t c_client = self._client._c_client
+            afc_error_t err
+            uint32_t bytes_read = 0
+            uint32_t size = <uint32_t>buffer.shape[0]
+            char* c_data
+        if size == 0:
+            return 0
+        c_data = <char*>&buffer[0]
+        with nogil:
+            err = afc_file_read(c_client, self._c_handle, c_data, size, &bytes_read)
+        self.handle_error(err)
+        return bytes_read
+
+    cpdef uint32_t write(self, const unsigned char[::1] data):
+        cdef:
+            afc_client_t c_client = self._client._c_client
+            afc_error_t err
+            uint32_t bytes_written = 0
+            uint32_t size = <uint32_t>data.shape[0]
+            char* c_data
+        if size == 0:
+            return 0
+        c_data = <char*>&data[0]
+        with nogil:
+            err = afc_file_write(c_client, self._c_handle, c_data, size, &bytes_written)
+        self.handle_error(err)
         return bytes_written
 
     cdef inline BaseError _error(self, int16_t ret):
@@ -192,7 +242,8 @@ cdef class AfcClient(BaseService):
             bytes info
             int i = 0
             list result = []
-        err = afc_get_device_info(self._c_client, &infos)
+        with nogil:
+            err = afc_get_device_info(self._c_client, &infos)
         try:
             self.handle_error(err)
         except BaseError, e:
@@ -211,11 +262,13 @@ cdef class AfcClient(BaseService):
     cpdef list read_directory(self, bytes directory):
         cdef:
             afc_error_t err
+            char* c_directory = directory
             char** dir_list = NULL
             bytes f
             int i = 0
             list result = []
-        err = afc_read_directory(self._c_client, directory, &dir_list)
+        with nogil:
+            err = afc_read_directory(self._c_client, c_directory, &dir_list)
         try:
             self.handle_error(err)
         except BaseError, e:
@@ -231,9 +284,11 @@ cdef class AfcClient(BaseService):
 
         return result
 
-    cpdef AfcFile open(self, bytes filename, bytes mode=b'r'):
+    cdef AfcFile _open(self, bytes filename, bytes mode):
         cdef:
+            afc_error_t err
             afc_file_mode_t c_mode
+            char* c_filename = filename
             uint64_t handle
             AfcFile f
         if mode == b'r':
@@ -251,7 +306,9 @@ cdef class AfcClient(BaseService):
         else:
             raise ValueError("mode string must be 'r', 'r+', 'w', 'w+', 'a', or 'a+'")
 
-        self.handle_error(afc_file_open(self._c_client, filename, c_mode, &handle))
+        with nogil:
+            err = afc_file_open(self._c_client, c_filename, c_mode, &handle)
+        self.handle_error(err)
         f = AfcFile.__new__(AfcFile)
         f._c_handle = handle
         f._client = self
@@ -259,14 +316,21 @@ cdef class AfcClient(BaseService):
 
         return f
 
+    cpdef AfcFile open(self, bytes filename, bytes mode=b'r'):
+        return self._open(filename, mode)
+
     cpdef list get_file_info(self, bytes path):
         cdef:
+            afc_error_t err
+            char* c_path = path
             list result = []
             char** c_result = NULL
             int i = 0
             bytes info
+        with nogil:
+            err = afc_get_file_info(self._c_client, c_path, &c_result)
         try:
-            self.handle_error(afc_get_file_info(self._c_client, path, &c_result))
+            self.handle_error(err)
         except BaseError, e:
             raise
         finally:
@@ -281,57 +345,68 @@ cdef class AfcClient(BaseService):
         return result
 
     cpdef remove_path(self, bytes path):
-        self.handle_error(afc_remove_path(self._c_client, path))
+        cdef:
+            afc_error_t err
+            char* c_path = path
+        with nogil:
+            err = afc_remove_path(self._c_client, c_path)
+        self.handle_error(err)
 
     cpdef remove_path_and_contents(self, bytes path):
-        self.handle_error(afc_remove_path_and_contents(self._c_client, path))
+        cdef:
+            afc_error_t err
+            char* c_path = path
+        with nogil:
+            err = afc_remove_path_and_contents(self._c_client, c_path)
+        self.handle_error(err)
 
     cpdef rename_path(self, bytes f, bytes t):
-        self.handle_error(afc_rename_path(self._c_client, f, t))
+        cdef:
+            afc_error_t err
+            char* c_from = f
+            char* c_to = t
+        with nogil:
+            err = afc_rename_path(self._c_client, c_from, c_to)
+        self.handle_error(err)
 
     cpdef make_directory(self, bytes d):
-        self.handle_error(afc_make_directory(self._c_client, d))
+        cdef:
+            afc_error_t err
+            char* c_dir = d
+        with nogil:
+            err = afc_make_directory(self._c_client, c_dir)
+        self.handle_error(err)
 
     cpdef truncate(self, bytes path, uint64_t newsize):
-        self.handle_error(afc_truncate(self._c_client, path, newsize))
+        cdef:
+            afc_error_t err
+            char* c_path = path
+        with nogil:
+            err = afc_truncate(self._c_client, c_path, newsize)
+        self.handle_error(err)
+
+    cdef _make_link(self, afc_link_type_t linktype, bytes source, bytes link_name):
+        cdef:
+            afc_error_t err
+            char* c_source = source
+            char* c_link_name = link_name
+        with nogil:
+            err = afc_make_link(self._c_client, linktype, c_source, c_link_name)
+        self.handle_error(err)
 
     cpdef link(self, bytes source, bytes link_name):
-        self.handle_error(afc_make_link(self._c_client, AFC_HARDLINK, source, link_name))
+        self._make_link(AFC_HARDLINK, source, link_name)
 
     cpdef symlink(self, bytes source, bytes link_name):
-        self.handle_error(afc_make_link(self._c_client, AFC_SYMLINK, source, link_name))
+        self._make_link(AFC_SYMLINK, source, link_name)
 
     cpdef set_file_time(self, bytes path, uint64_t mtime):
-        self.handle_error(afc_set_file_time(self._c_client, path, mtime))
+        cdef:
+            afc_error_t err
+            char* c_path = path
+        with nogil:
+            err = afc_set_file_time(self._c_client, c_path, mtime)
+        self.handle_error(err)
 
 cdef class Afc2Client(AfcClient):
     __service_name__ = "com.apple.afc2"
-
-    cpdef AfcFile open(self, bytes filename, bytes mode=b'r'):
-        cdef:
-            afc_file_mode_t c_mode
-            uint64_t handle
-            AfcFile f
-        if mode == b'r':
-            c_mode = AFC_FOPEN_RDONLY
-        elif mode == b'r+':
-            c_mode = AFC_FOPEN_RW
-        elif mode == b'w':
-            c_mode = AFC_FOPEN_WRONLY
-        elif mode == b'w+':
-            c_mode = AFC_FOPEN_WR
-        elif mode == b'a':
-            c_mode = AFC_FOPEN_APPEND
-        elif mode == b'a+':
-            c_mode = AFC_FOPEN_RDAPPEND
-        else:
-            raise ValueError("mode string must be 'r', 'r+', 'w', 'w+', 'a', or 'a+'")
-
-        self.handle_error(afc_file_open(self._c_client, filename, c_mode, &handle))
-        f = AfcFile.__new__(AfcFile)
-        f._c_handle = handle
-        f._client = <AfcClient>self
-        f._filename = filename
-
-        return f
-
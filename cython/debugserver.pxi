@@ -131,33 +131,29 @@ cdef class DebugServerClient(BaseService):
 
     cpdef bytes receive(self, uint32_t size):
         cdef:
-            uint32_t bytes_received
-            char* c_data = <char *>malloc(size)
-            bytes result
-
-        try:
-            self.handle_error(debugserver_client_receive(self._c_client, c_data, size, &bytes_received))
-            result = c_data[:bytes_received]
-            return result
-        except BaseError, e:
-            raise
-        finally:
-            free(c_data)
+            uint32_t bytes_received = 0
+            PyObject* c_result = bytes_buffer_new(size)
+            char* c_data = PyBytes_AS_STRING(<object>c_result)
+            debugserver_error_t err
+
+        err = debugserver_client_receive(self._c_client, c_data, size, &bytes_received)
+        if err != DEBUGSERVER_E_SUCCESS:
+            bytes_buffer_free(c_result)
+            self.handle_error(err)
+        return bytes_buffer_finish(c_result, bytes_received)
 
     cpdef bytes receive_with_timeout(self, uint32_t size, unsigned int timeout):
         cdef:
-            uint32_t bytes_received
-            char* c_data = <char *>malloc(size)
-            bytes result
-
-        try:
-            self.handle_error(debugserver_client_receive_with_timeout(self._c_client, c_data, size, &bytes_received, timeout))
-            result = c_data[:bytes_received]
-            return result
-        except BaseError, e:
-            raise
-        finally:
-            free(c_data)
+            uint32_t bytes_received = 0
+            PyObject* c_result = bytes_buffer_new(size)
+            char* c_data = PyBytes_AS_STRING(<object>c_result)
+            debugserver_error_t err
+
+        err = debugserver_client_receive_with_timeout(self._c_client, c_data, size, &bytes_received, timeout)
+        if err != DEBUGSERVER_E_SUCCESS:
+            bytes_buffer_free(c_result)
+            self.handle_error(err)
+        return bytes_buffer_finish(c_result, bytes_received)
 
     cpdef bytes receive_response(self):
         cdef:
@@ -57,9 +57,9 @@ cdef extern from "libimobiledevice/libimobiledevice.h":
     idevice_error_t idevice_get_handle(idevice_t device, uint32_t *handle)
     idevice_error_t idevice_connect(idevice_t device, uint16_t port, idevice_connection_t *connection)
     idevice_error_t idevice_disconnect(idevice_connection_t connection)
-    idevice_error_t idevice_connection_send(idevice_connection_t connection, char *data, uint32_t len, uint32_t *sent_bytes)
-    idevice_error_t idevice_connection_receive_timeout(idevice_connection_t connection, char *data, uint32_t len, uint32_t *recv_bytes, unsigned int timeout)
-    idevice_error_t idevice_connection_receive(idevice_connection_t connection, char *data, uint32_t len, uint32_t *recv_bytes)
+    idevice_error_t idevice_connection_send(idevice_connection_t connection, char *data, uint32_t len, uint32_t *sent_bytes) nogil
+    idevice_error_t idevice_connection_receive_timeout(idevice_connection_t connection, char *data, uint32_t len, uint32_t *recv_bytes, unsigned int timeout) nogil
+    idevice_error_t idevice_connection_receive(idevice_connection_t connection, char *data, uint32_t len, uint32_t *recv_bytes) nogil
 
 cdef class iDeviceError(BaseError):
     def __init__(self, *args, **kwargs):
@@ -135,33 +135,32 @@ cdef class iDeviceConnection(Base):
 
     cpdef bytes receive_timeout(self, uint32_t max_len, unsigned int timeout):
         cdef:
-            uint32_t bytes_received
-            char* c_data = <char *>malloc(max_len)
-            bytes result
-
-        try:
-            self.handle_error(idevice_connection_receive_timeout(self._c_connection, c_data, max_len, &bytes_received, timeout))
-            result = c_data[:bytes_received]
-            return result
-        except BaseError, e:
-            raise
-        finally:
-            free(c_data)
+            idevice_error_t err
+            uint32_t bytes_received = 0
+            PyObject* c_result = bytes_buffer_new(max_len)
+            char* c_data = PyBytes_AS_STRING(<object>c_result)
+
+        with nogil:
+            err = idevice_connection_receive_timeout(self._c_connection, c_data, max_len, &bytes_received, timeout)
+        if err != IDEVICE_E_SUCCESS:
+            bytes_buffer_free(c_result)
+            self.handle_error(err)
+        return bytes_buffer_finish(c_result, bytes_received)
 
     cpdef bytes receive(self, max_len):
         cdef:
-            uint32_t bytes_received
-            char* c_data = <char *>malloc(max_len)
-            bytes result
-
-        try:
-            self.handle_error(idevice_connection_receive(self._c_connection, c_data, max_len, &bytes_received))
-            result = c_data[:bytes_received]
-            return result
-        except BaseError, e:
-            raise
-        finally:
-            free(c_data)
+            idevice_error_t err
+            uint32_t c_max_len = max_len
+            uint32_t bytes_received = 0
+            PyObject* c_result = bytes_buffer_new(c_max_len)
+            char* c_data = PyBytes_AS_STRING(<object>c_result)
+
+        with nogil:
+            err = idevice_connection_receive(self._c_connection, c_data, c_max_len, &bytes_received)
+        if err != IDEVICE_E_SUCCESS:
+            bytes_buffer_free(c_result)
+            self.handle_error(err)
+        return bytes_buffer_finish(c_result, bytes_received)
 
     cpdef disconnect(self):
         cdef idevice_error_t err
@@ -172,6 +171,29 @@ cdef class iDeviceConnection(Base):
         return iDeviceError(ret)
 
 from libc.stdlib cimport *
+from cpython.bytes cimport PyBytes_AS_STRING, PyBytes_GET_SIZE, _PyBytes_Resize
+from cpython.object cimport PyObject
+from cpython.ref cimport Py_DECREF
+
+cdef extern from "Python.h":
+    PyObject* _bytes_buffer_alloc "PyBytes_FromStringAndSize"(char *v, Py_ssize_t len) except NULL
+
+cdef inline PyObject* bytes_buffer_new(Py_ssize_t size) except NULL:
+    # a bytes object owned through a raw pointer, so that it can be shrunk
+    # in place with _PyBytes_Resize() after a short read
+    return _bytes_buffer_alloc(NULL, size)
+
+cdef inline void bytes_buffer_free(PyObject* buf):
+    Py_DECREF(<object>buf)
+
+cdef bytes bytes_buffer_finish(PyObject* buf, Py_ssize_t size):
+    cdef bytes result
+    if size < PyBytes_GET_SIZE(<object>buf):
+        _PyBytes_Resize(&buf, size)
+    result = <bytes>buf
+    # take over the reference of buf
+    Py_DECREF(result)
+    return result
 
 cdef class iDevice(Base):
     def __cinit__(self, object udid=None, *args, **kwargs):
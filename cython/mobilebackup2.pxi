@@ -1,4 +1,4 @@
-cdef extern from "libimobiledevice/mobilebackup2.h":
+cdef extern from "libimobiledevice/mobilebackup2.h" nogil:
     cdef struct mobilebackup2_client_private:
         pass
     ctypedef mobilebackup2_client_private *mobilebackup2_client_t
@@ -59,14 +59,21 @@ cdef class MobileBackup2Client(PropertyListService):
         return MobileBackup2Error(ret)
 
     cpdef send_message(self, bytes message, plist.Node options):
-        self.handle_error(mobilebackup2_send_message(self._c_client, message, options._c_node))
+        cdef:
+            char* c_message = message
+            plist.plist_t c_options = options._c_node if options is not None else NULL
+            mobilebackup2_error_t err
+        with nogil:
+            err = mobilebackup2_send_message(self._c_client, c_message, c_options)
+        self.handle_error(err)
 
     cpdef tuple receive_message(self):
         cdef:
             char* dlmessage = NULL
             plist.plist_t c_node = NULL
             mobilebackup2_error_t err
-        err = mobilebackup2_receive_message(self._c_client, &c_node, &dlmessage)
+        with nogil:
+            err = mobilebackup2_receive_message(self._c_client, &c_node, &dlmessage)
         try:
             self.handle_error(err)
             return (plist.plist_t_to_node(c_node), <bytes>dlmessage)
@@ -77,47 +84,70 @@ cdef class MobileBackup2Client(PropertyListService):
                 free(dlmessage)
             raise
 
-    cpdef int send_raw(self, bytes data, int length):
+    cpdef int send_raw(self, const unsigned char[::1] data, int length):
         cdef:
-            uint32_t bytes_recvd = 0
+            uint32_t bytes_sent = 0
+            char* c_data
             mobilebackup2_error_t err
-        err = mobilebackup2_send_raw(self._c_client, data, length, &bytes_recvd)
-        try:
-            self.handle_error(err)
-            return <bint>bytes_recvd
-        except BaseError, e:
-            raise
-
-    cpdef int receive_raw(self, bytearray data, int length):
+        if length < 0 or length > data.shape[0]:
+            raise ValueError("length exceeds the size of data")
+        if length == 0:
+            return 0
+        c_data = <char*>&data[0]
+        with nogil:
+            err = mobilebackup2_send_raw(self._c_client, c_data, length, &bytes_sent)
+        self.handle_error(err)
+        return bytes_sent
+
+    cpdef int receive_raw(self, unsigned char[::1] data, int length):
+        """Receive up to length bytes directly into a writable buffer object,
+        like bytearray, memoryview or mmap. Returns the number of bytes received."""
         cdef:
             uint32_t bytes_recvd = 0
+            char* c_data
             mobilebackup2_error_t err
-        err = mobilebackup2_receive_raw(self._c_client, data, length, &bytes_recvd)
+        if length < 0 or length > data.shape[0]:
+            raise ValueError("length exceeds the size of data")
+        if length == 0:
+            return 0
+        c_data = <char*>&data[0]
+        with nogil:
+            err = mobilebackup2_receive_raw(self._c_client, c_data, length, &bytes_recvd)
 
         # Throwing an exception when we test if theres more data to read is excessive
         if err == -1 and bytes_recvd == 0:
             return 0
 
-        try:
-            self.handle_error(err)
-            return <bint>bytes_recvd
-        except BaseError, e:
-            raise
+        self.handle_error(err)
+        return bytes_recvd
 
     cpdef float version_exchange(self, double[::1] local_versions):
         cdef:
-            double[::1] temp = None
             double remote_version = 0.0
+            double* c_local_versions = &local_versions[0]
+            char count = <char>len(local_versions)
             mobilebackup2_error_t err
-        err = mobilebackup2_version_exchange(self._c_client, &local_versions[0], len(local_versions), &remote_version)
-        try:
-            self.handle_error(err)
-            return <float>remote_version
-        except BaseError, e:
-            raise
+        with nogil:
+            err = mobilebackup2_version_exchange(self._c_client, c_local_versions, count, &remote_version)
+        self.handle_error(err)
+        return <float>remote_version
 
     cpdef send_request(self, bytes request, bytes target_identifier, bytes source_identifier, plist.Node options):
-        self.handle_error(mobilebackup2_send_request(self._c_client, request, target_identifier, source_identifier, options._c_node))
+        cdef:
+            char* c_request = request
+            char* c_target_identifier = target_identifier
+            char* c_source_identifier = source_identifier
+            plist.plist_t c_options = options._c_node if options is not None else NULL
+            mobilebackup2_error_t err
+        with nogil:
+            err = mobilebackup2_send_request(self._c_client, c_request, c_target_identifier, c_source_identifier, c_options)
+        self.handle_error(err)
 
     cpdef send_status_response(self, int status_code, bytes status1, plist.Node status2):
-        self.handle_error(mobilebackup2_send_status_response(self._c_client, status_code, status1, status2._c_node))
+        cdef:
+            char* c_status1 = status1
+            plist.plist_t c_status2 = status2._c_node if status2 is not None else NULL
+            mobilebackup2_error_t err
+        with nogil:
+            err = mobilebackup2_send_status_response(self._c_client, status_code, c_status1, c_status2)
+        self.handle_error(err)
@@ -1,4 +1,4 @@
-cdef extern from "libimobiledevice/screenshotr.h":
+cdef extern from "libimobiledevice/screenshotr.h" nogil:
     cdef struct screenshotr_client_private:
         pass
     ctypedef screenshotr_client_private *screenshotr_client_t
@@ -51,16 +51,16 @@ cdef class ScreenshotrClient(DeviceLinkService):
             bytes result
             screenshotr_error_t err
 
-        err = screenshotr_take_screenshot(self._c_client, &c_data, &data_size)
+        with nogil:
+            err = screenshotr_take_screenshot(self._c_client, &c_data, &data_size)
         try:
             self.handle_error(err)
 
             result = c_data[:data_size]
             return result
-        except Exception, e:
+        finally:
             if c_data != NULL:
                 free(c_data)
-            raise
 
     cdef inline BaseError _error(self, int16_t ret):
         return ScreenshotrError(ret)
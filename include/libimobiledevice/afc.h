@@ -90,6 +90,44 @@ typedef enum {
 	AFC_LOCK_UN = 8 | 4  /**< unlock */
 } afc_lock_op_t;
 
+/** Values returned by the afc_walk() callbacks to steer the walk */
+typedef enum {
+	AFC_WALK_CONTINUE = 0, /**< continue walking, descend into directories */
+	AFC_WALK_SKIP     = 1, /**< skip this entry and everything below it */
+	AFC_WALK_STOP     = 2  /**< stop walking */
+} afc_walk_action_t;
+
+/**
+ * Predicate for afc_walk(), invoked for every directory entry before any
+ * request is sent for it.
+ *
+ * @param path The fully-qualified path of the entry.
+ * @param name The name of the entry within its directory.
+ * @param user_data The user data passed to afc_walk().
+ *
+ * @return AFC_WALK_CONTINUE to stat and report the entry, AFC_WALK_SKIP to
+ *         leave it out entirely, or AFC_WALK_STOP to end the walk.
+ */
+typedef afc_walk_action_t (*afc_walk_filter_cb_t)(const char *path, const char *name, void *user_data);
+
+/**
+ * Callback for afc_walk(), invoked for every entry with its file information.
+ *
+ * @param path The fully-qualified path of the entry.
+ * @param file_information The file attributes as returned by
+ *        afc_get_file_info_plist(), or NULL if error is set. It is freed after
+ *        the callback returns.
+ * @param error AFC_E_SUCCESS, or the error that occurred while getting the
+ *        file information or, for a directory reported a second time, while
+ *        reading its contents.
+ * @param user_data The user data passed to afc_walk().
+ *
+ * @return AFC_WALK_CONTINUE to keep walking (and descend if the entry is a
+ *         directory), AFC_WALK_SKIP to not descend into it, or AFC_WALK_STOP
+ *         to end the walk.
+ */
+typedef afc_walk_action_t (*afc_walk_cb_t)(const char *path, plist_t file_information, afc_error_t error, void *user_data);
+
 typedef struct afc_client_private afc_client_private; /**< \private */
 typedef afc_client_private *afc_client_t; /**< The client handle. */
 
@@ -98,6 +136,11 @@ typedef afc_client_private *afc_client_t; /**< The client handle. */
 /**
  * Makes a connection to the AFC service on the device.
  *
+ * The returned client may be used from multiple threads at the same time.
+ * Requests from different threads are sent back-to-back and their replies
+ * are delivered to the thread that issued them, so operations on different
+ * file handles proceed concurrently over the same connection.
+ *
  * @param device The device to connect to.
  * @param service The service descriptor returned by lockdownd_start_service.
  * @param client Pointer that will be set to a newly allocated afc_client_t
@@ -197,6 +240,29 @@ LIBIMOBILEDEVICE_API afc_error_t afc_get_file_info(afc_client_t client, const ch
  */
 LIBIMOBILEDEVICE_API afc_error_t afc_get_file_info_plist(afc_client_t client, const char *path, plist_t *file_information);
 
+/**
+ * Walks the directory tree below the given path depth-first and reports
+ * every entry together with its file information.
+ *
+ * The file information for all entries of a directory is requested
+ * back-to-back instead of waiting for each reply, which saves a round trip
+ * per entry compared to calling afc_get_file_info_plist() in a loop.
+ * The entry at path itself is reported first, each directory's entries are
+ * reported before the walk descends into its subdirectories.
+ *
+ * @param client The client to use.
+ * @param path The fully-qualified path to start at.
+ * @param filter Optional predicate to prune entries by name before their
+ *        information is requested, or NULL.
+ * @param callback The callback to invoke for each entry.
+ * @param user_data User data passed to filter and callback.
+ *
+ * @return AFC_E_SUCCESS when the walk completed or was stopped by a
+ *         callback, or an AFC_E_* error value if the connection failed or
+ *         the starting path could not be accessed.
+ */
+LIBIMOBILEDEVICE_API afc_error_t afc_walk(afc_client_t client, const char *path, afc_walk_filter_cb_t filter, afc_walk_cb_t callback, void *user_data);
+
 /**
  * Opens a file on the device.
  *
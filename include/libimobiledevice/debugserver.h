@@ -154,6 +154,32 @@ LIBIMOBILEDEVICE_API debugserver_error_t debugserver_client_receive(debugserver_
  */
 LIBIMOBILEDEVICE_API debugserver_error_t debugserver_client_send_command(debugserver_client_t client, debugserver_command_t command, char** response, size_t* response_size);
 
+/**
+ * Sends several commands to the debugserver service without waiting for
+ * each response before sending the next one, and receives the responses
+ * in the order the commands were sent.
+ *
+ * Commands are only pipelined when ACK mode is disabled (QStartNoAckMode),
+ * otherwise they are sent one after another like with
+ * debugserver_client_send_command. Every command must produce exactly one
+ * response, so commands that resume the inferior (like 'c' or 's') must
+ * not be part of a batch.
+ *
+ * @param client The debugserver client
+ * @param commands Array of commands to process and send
+ * @param count Number of commands in the array
+ * @param responses Array of count pointers receiving the responses in
+ *    command order (can be NULL to ignore). Entries for commands that did
+ *    not get a response are set to NULL.
+ * @param response_sizes Array of count sizes receiving the response sizes
+ *    (can be NULL to ignore)
+ *
+ * @return DEBUGSERVER_E_SUCCESS if all responses were received,
+ *  DEBUGSERVER_E_INVALID_ARG when client or commands is NULL or count is 0,
+ *  or another DEBUGSERVER_E_* error code otherwise.
+ */
+LIBIMOBILEDEVICE_API debugserver_error_t debugserver_client_send_commands(debugserver_client_t client, debugserver_command_t* commands, unsigned int count, char** responses, size_t* response_sizes);
+
 /**
  * Receives and parses response of debugserver service.
  *
@@ -265,6 +291,19 @@ LIBIMOBILEDEVICE_API void debugserver_encode_string(const char* buffer, char** e
  */
 LIBIMOBILEDEVICE_API void debugserver_decode_string(const char *encoded_buffer, size_t encoded_length, char** buffer);
 
+/**
+ * Decodes the payload of a binary response, like the one of the x packet,
+ * by resolving escaped bytes and run-length encoding.  Binary responses
+ * are half the size of hex encoded ones and need no hex decoding.
+ *
+ * @param encoded_buffer The payload of the response
+ * @param encoded_length Length of the payload
+ * @param buffer Decoded data to be freed by the caller, with a terminating
+ *    NUL byte that is not included in length
+ * @param length Receives the length of the decoded data
+ */
+LIBIMOBILEDEVICE_API void debugserver_decode_binary(const char *encoded_buffer, size_t encoded_length, char** buffer, size_t* length);
+
 #ifdef __cplusplus
 }
 #endif
@@ -32,6 +32,7 @@ extern "C" {
 
 #include <libimobiledevice/libimobiledevice.h>
 #include <libimobiledevice/lockdown.h>
+#include <libimobiledevice/notification_proxy.h>
 
 /** Service identifier passed to lockdownd_start_service() to start the installation proxy service */
 #define INSTPROXY_SERVICE_NAME "com.apple.mobile.installation_proxy"
@@ -111,6 +112,12 @@ typedef enum {
 typedef struct instproxy_client_private instproxy_client_private; /**< \private */
 typedef instproxy_client_private *instproxy_client_t; /**< The client handle. */
 
+typedef struct instproxy_browse_iterator_private instproxy_browse_iterator_private; /**< \private */
+typedef instproxy_browse_iterator_private *instproxy_browse_iterator_t; /**< Iterator over the pages of a browse command. */
+
+typedef struct instproxy_app_cache_private instproxy_app_cache_private; /**< \private */
+typedef instproxy_app_cache_private *instproxy_app_cache_t; /**< Cached application inventory of a device. */
+
 /** Reports the status response of the given command */
 typedef void (*instproxy_status_cb_t) (plist_t command, plist_t status, void *user_data);
 
@@ -192,6 +199,111 @@ LIBIMOBILEDEVICE_API instproxy_error_t instproxy_browse(instproxy_client_t clien
  */
 LIBIMOBILEDEVICE_API instproxy_error_t instproxy_browse_with_callback(instproxy_client_t client, plist_t client_options, instproxy_status_cb_t status_cb, void *user_data);
 
+/**
+ * Start listing installed applications page by page.
+ *
+ * Unlike instproxy_browse() the result is not accumulated; each page is
+ * handed out by instproxy_browse_iterator_next() as soon as it is received,
+ * so only one page is held in memory at a time.
+ * No other command may be sent with the client until the iterator has been
+ * freed with instproxy_browse_iterator_free().
+ *
+ * @param client The connected installation_proxy client
+ * @param client_options The client options to use, as PLIST_DICT, or NULL.
+ *        See instproxy_browse() for valid client options.
+ * @param iterator Pointer that will be set to a newly allocated iterator
+ *        upon successful return.
+ *
+ * @return INSTPROXY_E_SUCCESS on success or an INSTPROXY_E_* error value if
+ *         an error occurred.
+ */
+LIBIMOBILEDEVICE_API instproxy_error_t instproxy_browse_iterator_new(instproxy_client_t client, plist_t client_options, instproxy_browse_iterator_t *iterator);
+
+/**
+ * Receive the next page of installed applications.
+ *
+ * @param iterator The iterator created with instproxy_browse_iterator_new().
+ * @param apps Pointer that will be set to a plist holding an array of
+ *        PLIST_DICT with the applications of the next page, or to NULL when
+ *        the listing is complete. Free with plist_free().
+ *
+ * @return INSTPROXY_E_SUCCESS on success or an INSTPROXY_E_* error value if
+ *         an error occurred.
+ */
+LIBIMOBILEDEVICE_API instproxy_error_t instproxy_browse_iterator_next(instproxy_browse_iterator_t iterator, plist_t *apps);
+
+/**
+ * Free a browse iterator. Pages that have not been received yet are
+ * received and discarded so that the client can be used again.
+ *
+ * @param iterator The iterator to free.
+ *
+ * @return INSTPROXY_E_SUCCESS on success
+ *         or INSTPROXY_E_INVALID_ARG if iterator is NULL.
+ */
+LIBIMOBILEDEVICE_API instproxy_error_t instproxy_browse_iterator_free(instproxy_browse_iterator_t iterator);
+
+/**
+ * Create a host-side cache of the applications installed on the device.
+ *
+ * The cache is loaded from the host (stored next to the device's pair
+ * record) and validated against a lightweight Browse that only returns
+ * bundle identifiers, versions and paths. Only applications that were added
+ * or changed since the cache was stored are looked up in full.
+ *
+ * @param client The connected installation_proxy client. It must stay
+ *        connected while the cache is in use.
+ * @param cache Pointer that will be set to a newly allocated cache upon
+ *        successful return.
+ *
+ * @return INSTPROXY_E_SUCCESS on success or an INSTPROXY_E_* error value if
+ *         an error occurred.
+ */
+LIBIMOBILEDEVICE_API instproxy_error_t instproxy_app_cache_new(instproxy_client_t client, instproxy_app_cache_t *cache);
+
+/**
+ * Keep the cache up to date by observing application install and uninstall
+ * notifications. After a notification the cache is revalidated on the next
+ * lookup. Without this, the cache is only validated when it is created.
+ *
+ * @param cache The application cache.
+ * @param np A connected notification_proxy client. Its notification
+ *        callback is replaced; it must stay connected until the cache has
+ *        been freed.
+ *
+ * @return INSTPROXY_E_SUCCESS on success or an INSTPROXY_E_* error value if
+ *         an error occurred.
+ */
+LIBIMOBILEDEVICE_API instproxy_error_t instproxy_app_cache_watch(instproxy_app_cache_t cache, np_client_t np);
+
+/**
+ * Lookup information about specific applications from the cache.
+ *
+ * @param cache The application cache.
+ * @param appids An array of bundle identifiers that MUST have a terminating
+ *        NULL entry or NULL to lookup all.
+ * @param client_options The client options to use, as PLIST_DICT, or NULL.
+ *        Only "ReturnAttributes" is evaluated.
+ * @param result Pointer that will be set to a plist containing a PLIST_DICT
+ *        holding requested information about the application or NULL on
+ *        errors, in the same format as returned by instproxy_lookup().
+ *
+ * @return INSTPROXY_E_SUCCESS on success or an INSTPROXY_E_* error value if
+ *         an error occurred.
+ */
+LIBIMOBILEDEVICE_API instproxy_error_t instproxy_app_cache_lookup(instproxy_app_cache_t cache, const char** appids, plist_t client_options, plist_t *result);
+
+/**
+ * Free the application cache. Changes are stored on the host whenever the
+ * cache is revalidated, so nothing is lost here.
+ *
+ * @param cache The application cache to free.
+ *
+ * @return INSTPROXY_E_SUCCESS on success
+ *         or INSTPROXY_E_INVALID_ARG if cache is NULL.
+ */
+LIBIMOBILEDEVICE_API instproxy_error_t instproxy_app_cache_free(instproxy_app_cache_t cache);
+
 /**
  * Lookup information about specific applications from the device.
  *
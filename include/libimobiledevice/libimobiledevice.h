@@ -57,7 +57,9 @@ typedef enum {
 	IDEVICE_E_NOT_ENOUGH_DATA = -4,
 	IDEVICE_E_CONNREFUSED     = -5,
 	IDEVICE_E_SSL_ERROR       = -6,
-	IDEVICE_E_TIMEOUT         = -7
+	IDEVICE_E_TIMEOUT         = -7,
+	IDEVICE_E_WANT_READ       = -8,
+	IDEVICE_E_WANT_WRITE      = -9
 } idevice_error_t;
 
 typedef struct idevice_private idevice_private; /**< \private */
@@ -87,6 +89,9 @@ struct idevice_info {
 };
 typedef struct idevice_info* idevice_info_t;
 
+typedef struct idevice_registry_snapshot_private idevice_registry_snapshot_private; /**< \private */
+typedef idevice_registry_snapshot_private *idevice_registry_snapshot_t; /**< A snapshot of the device registry. */
+
 /* discovery (events/asynchronous) */
 /** The event type for device add or removal */
 enum idevice_event_type {
@@ -110,6 +115,30 @@ typedef void (*idevice_event_cb_t) (const idevice_event_t *event, void *user_dat
 /** Event subscription context type */
 typedef struct idevice_subscription_context* idevice_subscription_context_t;
 
+/** Number of buckets in the histograms of #idevice_connection_stats_t */
+#define IDEVICE_CONNECTION_STATS_BUCKETS 24
+
+/**
+ * I/O statistics of a connection, see idevice_connection_get_stats().
+ *
+ * Histogram bucket n counts values in the range [2^n, 2^(n+1)); bucket 0
+ * also counts 0 and the last bucket counts everything larger.
+ */
+typedef struct {
+	uint64_t bytes_sent; /**< Payload bytes sent */
+	uint64_t bytes_received; /**< Payload bytes received */
+	uint64_t send_calls; /**< Number of send calls */
+	uint64_t receive_calls; /**< Number of receive calls */
+	uint64_t send_time_us; /**< Time spent blocked in send calls, in microseconds */
+	uint64_t receive_time_us; /**< Time spent blocked in receive calls, in microseconds */
+	uint64_t tls_records_sent; /**< Number of TLS records written to the transport */
+	uint64_t tls_records_received; /**< Number of TLS records read from the transport */
+	uint64_t timeouts; /**< Number of receive calls that timed out */
+	uint64_t send_sizes[IDEVICE_CONNECTION_STATS_BUCKETS]; /**< Histogram of send sizes in bytes */
+	uint64_t receive_sizes[IDEVICE_CONNECTION_STATS_BUCKETS]; /**< Histogram of receive sizes in bytes */
+	uint64_t latencies[IDEVICE_CONNECTION_STATS_BUCKETS]; /**< Histogram of the time between a send and the first data received after it, in microseconds */
+} idevice_connection_stats_t;
+
 /* functions */
 
 /**
@@ -119,6 +148,40 @@ typedef struct idevice_subscription_context* idevice_subscription_context_t;
  */
 LIBIMOBILEDEVICE_API void idevice_set_debug_level(int level);
 
+/**
+ * Set the level of debugging for a single subsystem.
+ *
+ * The initial levels can also be set with the LIBIMOBILEDEVICE_DEBUG
+ * environment variable, either to a single level for all subsystems or to
+ * a comma separated list like "afc=1,plist=1".
+ *
+ * @param subsystem One of "default", "connection", "plist", "lockdown",
+ *    "afc" or "debugserver".
+ * @param level Set to 0 for no debug output or 1 to enable debug output.
+ *
+ * @return IDEVICE_E_SUCCESS on success, or IDEVICE_E_INVALID_ARG if the
+ *    subsystem is unknown.
+ */
+LIBIMOBILEDEVICE_API idevice_error_t idevice_set_debug_subsystem_level(const char *subsystem, int level);
+
+/**
+ * Keep debug output in memory instead of printing it.
+ *
+ * When enabled, only the last events are kept in a ring buffer and no
+ * output is written until idevice_dump_debug_ring() is called. Messages
+ * and buffers are truncated to 128 bytes per event. The ring buffer can
+ * also be enabled with the LIBIMOBILEDEVICE_DEBUG_RING environment variable.
+ *
+ * @param events The number of events to keep, or 0 to print debug output
+ *    directly again. Any recorded events are discarded.
+ */
+LIBIMOBILEDEVICE_API void idevice_set_debug_ring_size(unsigned int events);
+
+/**
+ * Print the events recorded in the debug ring buffer to stderr, oldest first.
+ */
+LIBIMOBILEDEVICE_API void idevice_dump_debug_ring(void);
+
 /**
  * Subscribe a callback function that will be called when device add/remove
  * events occur.
@@ -214,6 +277,72 @@ LIBIMOBILEDEVICE_API idevice_error_t idevice_get_device_list_extended(idevice_in
  */
 LIBIMOBILEDEVICE_API idevice_error_t idevice_device_list_extended_free(idevice_info_t *devices);
 
+/**
+ * Start the in-process device registry.
+ *
+ * The registry loads the current device list from usbmuxd once and is then
+ * kept current by device events. While it is running, idevice_new() and
+ * idevice_new_with_options() resolve UDIDs from it without contacting
+ * usbmuxd (falling back to usbmuxd for devices that are not known yet), and
+ * idevice_get_device_list_extended() is served from it as well.
+ * Calling this function again while the registry is running has no effect.
+ *
+ * @return IDEVICE_E_SUCCESS on success, IDEVICE_E_NO_DEVICE if usbmuxd is
+ *    not running, or another error value when an error occurred.
+ */
+LIBIMOBILEDEVICE_API idevice_error_t idevice_registry_start(void);
+
+/**
+ * Stop the in-process device registry.
+ * Snapshots that are still referenced remain valid until they are freed.
+ *
+ * @return IDEVICE_E_SUCCESS on success or an error value when an error occurred.
+ */
+LIBIMOBILEDEVICE_API idevice_error_t idevice_registry_stop(void);
+
+/**
+ * Get a snapshot of the devices currently known to the registry.
+ * This only takes a reference and does not copy the device list.
+ *
+ * @param snapshot Pointer that will be set to the snapshot. It has to be
+ *    freed with idevice_registry_snapshot_free().
+ *
+ * @return IDEVICE_E_SUCCESS on success or IDEVICE_E_INVALID_ARG if the
+ *    registry is not running.
+ */
+LIBIMOBILEDEVICE_API idevice_error_t idevice_registry_get_snapshot(idevice_registry_snapshot_t *snapshot);
+
+/**
+ * Get the number of devices in a registry snapshot.
+ *
+ * @param snapshot The registry snapshot.
+ *
+ * @return The number of devices, which may include the same device on
+ *    USB and network.
+ */
+LIBIMOBILEDEVICE_API int idevice_registry_snapshot_get_count(idevice_registry_snapshot_t snapshot);
+
+/**
+ * Get a device from a registry snapshot.
+ *
+ * @param snapshot The registry snapshot.
+ * @param index Index of the device, from 0 to the number of devices - 1.
+ *
+ * @return The device information or NULL if the index is out of range.
+ *    It belongs to the snapshot and must not be modified or freed.
+ */
+LIBIMOBILEDEVICE_API idevice_info_t idevice_registry_snapshot_get_item(idevice_registry_snapshot_t snapshot, int index);
+
+/**
+ * Release a registry snapshot.
+ *
+ * @param snapshot The registry snapshot to free.
+ *
+ * @return IDEVICE_E_SUCCESS on success or IDEVICE_E_INVALID_ARG if snapshot
+ *    is NULL.
+ */
+LIBIMOBILEDEVICE_API idevice_error_t idevice_registry_snapshot_free(idevice_registry_snapshot_t snapshot);
+
 /* device structure creation and destruction */
 
 /**
@@ -381,6 +510,66 @@ LIBIMOBILEDEVICE_API idevice_error_t idevice_connection_disable_bypass_ssl(idevi
  */
 LIBIMOBILEDEVICE_API idevice_error_t idevice_connection_get_fd(idevice_connection_t connection, int *fd);
 
+/**
+ * Switch a connection between blocking and non-blocking mode.
+ *
+ * In non-blocking mode the connection can be driven by an external event
+ * loop that waits on the file descriptor returned by
+ * idevice_connection_get_fd(). This also works with SSL enabled:
+ * - idevice_connection_send() sends as much as possible and returns
+ *   IDEVICE_E_SUCCESS with the number of bytes sent, or IDEVICE_E_WANT_WRITE
+ *   (or IDEVICE_E_WANT_READ) if nothing could be sent. After a WANT result
+ *   the same data has to be passed again once the fd is ready.
+ * - idevice_connection_receive() and idevice_connection_receive_timeout()
+ *   return whatever is available, or IDEVICE_E_WANT_READ (or
+ *   IDEVICE_E_WANT_WRITE) if nothing is. The timeout is ignored. Since
+ *   decrypted data can remain buffered in the SSL layer, keep receiving
+ *   until a WANT result is returned before waiting on the fd again.
+ *
+ * SSL has to be enabled before switching to non-blocking mode; the
+ * handshake itself is always performed in blocking mode.
+ *
+ * @param connection The connection to configure.
+ * @param nonblocking 1 to enable non-blocking mode, 0 to switch back to
+ *    blocking mode.
+ *
+ * @return IDEVICE_E_SUCCESS if ok, otherwise an error code.
+ */
+LIBIMOBILEDEVICE_API idevice_error_t idevice_connection_set_nonblocking(idevice_connection_t connection, int nonblocking);
+
+/**
+ * Enable or disable collecting I/O statistics for a connection.
+ *
+ * Statistics are collected for all connections when the
+ * LIBIMOBILEDEVICE_IO_STATS environment variable is set to a non-zero value.
+ * In that case they are also printed to stderr when the connection is
+ * closed, labeled with the name of the service it belongs to.
+ *
+ * Collecting can be stopped at any time, also while other threads send or
+ * receive on the connection. The first call enabling it however has to
+ * happen before the connection is used from more than one thread.
+ *
+ * @param connection The connection to collect statistics for.
+ * @param enable 1 to start collecting, 0 to stop and discard the statistics.
+ *
+ * @return IDEVICE_E_SUCCESS if ok, otherwise an error code.
+ */
+LIBIMOBILEDEVICE_API idevice_error_t idevice_connection_enable_stats(idevice_connection_t connection, int enable);
+
+/**
+ * Get the I/O statistics collected for a connection.
+ * For a service client, the connection can be obtained with
+ * service_get_connection().
+ *
+ * @param connection The connection to get the statistics of.
+ * @param stats Pointer to a structure that will be filled with a snapshot of
+ *    the statistics.
+ *
+ * @return IDEVICE_E_SUCCESS if ok, IDEVICE_E_INVALID_ARG if collecting
+ *    statistics is not enabled for the connection, otherwise an error code.
+ */
+LIBIMOBILEDEVICE_API idevice_error_t idevice_connection_get_stats(idevice_connection_t connection, idevice_connection_stats_t *stats);
+
 /* misc */
 
 /**
@@ -241,6 +241,30 @@ LIBIMOBILEDEVICE_API lockdownd_error_t lockdownd_start_service(lockdownd_client_
  */
 LIBIMOBILEDEVICE_API lockdownd_error_t lockdownd_start_service_with_escrow_bag(lockdownd_client_t client, const char *identifier, lockdownd_service_descriptor_t *service);
 
+/**
+ * Requests to start several services at once on the same session.
+ * All StartService requests are sent before the responses are read, so
+ * starting N services costs a single round trip to lockdownd.
+ *
+ * @param client The lockdownd client
+ * @param identifiers Array of count service identifiers to start
+ * @param send_escrow_bag Array of count flags telling whether the escrow bag
+ *  from the device's pair record should be sent with the matching request,
+ *  or NULL to send it with none of them
+ * @param count Number of services to start
+ * @param services Array of count service descriptors that will be set to the
+ *  descriptor of each started service, or NULL for services that could not be
+ *  started. Each descriptor must be freed with lockdownd_service_descriptor_free().
+ * @param results Array of count error codes receiving the result for each
+ *  service, or NULL if not needed
+ *
+ * @return LOCKDOWN_E_SUCCESS if all services have been started,
+ *  LOCKDOWN_E_INVALID_ARG if a parameter is NULL, or the first error that
+ *  occurred otherwise. Services that did start are still returned in
+ *  services in that case.
+ */
+LIBIMOBILEDEVICE_API lockdownd_error_t lockdownd_start_services(lockdownd_client_t client, const char **identifiers, const uint8_t *send_escrow_bag, unsigned int count, lockdownd_service_descriptor_t *services, lockdownd_error_t *results);
+
 /**
  * Opens a session with lockdownd and switches to SSL mode if device wants it.
  *
@@ -363,6 +387,26 @@ LIBIMOBILEDEVICE_API lockdownd_error_t lockdownd_validate_pair(lockdownd_client_
  */
 LIBIMOBILEDEVICE_API lockdownd_error_t lockdownd_unpair(lockdownd_client_t client, lockdownd_pair_record_t pair_record);
 
+/**
+ * Starts a background thread that keeps RSA keys ready for pairing.
+ * Creating a pair record requires two freshly generated 2048 bit RSA keys,
+ * which is the most expensive part of lockdownd_pair(). With the key pool
+ * running, pairing takes them from the pool instead and only generates
+ * them inline when the pool has run empty.
+ *
+ * @param num_keypairs Number of root/host key pairs to keep ready
+ *
+ * @return LOCKDOWN_E_SUCCESS on success (or if the pool is already running),
+ *  LOCKDOWN_E_INVALID_ARG if num_keypairs is 0.
+ */
+LIBIMOBILEDEVICE_API lockdownd_error_t lockdownd_pair_key_pool_start(unsigned int num_keypairs);
+
+/**
+ * Stops the key pool thread started with lockdownd_pair_key_pool_start()
+ * and discards all keys that have not been used.
+ */
+LIBIMOBILEDEVICE_API void lockdownd_pair_key_pool_stop(void);
+
 /**
  * Activates the device. Only works within an open session.
  * The ActivationRecord plist dictionary must be obtained using the
@@ -130,6 +130,27 @@ LIBIMOBILEDEVICE_API mobile_image_mounter_error_t mobile_image_mounter_lookup_im
  */
 LIBIMOBILEDEVICE_API mobile_image_mounter_error_t mobile_image_mounter_upload_image(mobile_image_mounter_client_t client, const char *image_type, size_t image_size, const unsigned char *signature, unsigned int signature_size, mobile_image_mounter_upload_cb_t upload_cb, void* userdata);
 
+/**
+ * Uploads an image from memory with an optional signature to the device.
+ *
+ * The data is sent directly from the given buffer in large chunks without
+ * being copied. This is the preferred way to upload an image that has been
+ * mapped into memory.
+ *
+ * @param client The connected mobile_image_mounter client.
+ * @param image_type Type of image that is being uploaded.
+ * @param image Buffer holding the complete image.
+ * @param image_size Total size of the image.
+ * @param signature Buffer with a signature of the image being uploaded. If
+ *    NULL, no signature will be used.
+ * @param signature_size Total size of the image signature buffer. If 0, no
+ *    signature will be used.
+ *
+ * @return MOBILE_IMAGE_MOUNTER_E_SUCCESS on succes, or a
+ *    MOBILE_IMAGE_MOUNTER_E_* error code otherwise.
+ */
+LIBIMOBILEDEVICE_API mobile_image_mounter_error_t mobile_image_mounter_upload_image_data(mobile_image_mounter_client_t client, const char *image_type, const unsigned char *image, size_t image_size, const unsigned char *signature, unsigned int signature_size);
+
 /**
  * Mounts an image on the device.
  *
@@ -48,6 +48,16 @@ typedef service_client_private* service_client_t; /**< The client handle. */
 /** service constructor cast */
 #define SERVICE_CONSTRUCTOR(x) (int32_t (*)(idevice_t, lockdownd_service_descriptor_t, void**))(x)
 
+/** A service to start with service_client_factory_start_services() */
+typedef struct {
+	const char *service_name; /**< The name of the service to start */
+	uint8_t send_escrow_bag; /**< Whether to send the escrow bag with the StartService request */
+	int32_t (*constructor_func)(idevice_t, lockdownd_service_descriptor_t, void**); /**< Constructor for the client (use SERVICE_CONSTRUCTOR()), or NULL for service_client_new() */
+	void *client; /**< Set to the newly created client on success, NULL otherwise */
+	int32_t error_code; /**< Set to the error code returned by the constructor */
+	lockdownd_error_t lockdown_error; /**< Set to the error lockdownd returned for the StartService request */
+} service_start_request_t;
+
 /* Interface */
 
 /**
@@ -83,6 +93,30 @@ LIBIMOBILEDEVICE_API service_error_t service_client_new(idevice_t device, lockdo
  */
 LIBIMOBILEDEVICE_API service_error_t service_client_factory_start_service(idevice_t device, const char* service_name, void **client, const char* label, int32_t (*constructor_func)(idevice_t, lockdownd_service_descriptor_t, void**), int32_t *error_code);
 
+/**
+ * Starts several services on the specified device and connects to them.
+ * All services are started on one lockdownd session with pipelined
+ * StartService requests, then the clients are constructed in parallel so
+ * the connection and SSL handshakes of the services overlap.
+ *
+ * @param device The device to connect to.
+ * @param lockdown An existing lockdownd session to start the services on,
+ *     or NULL to create one using label. The session is left open.
+ * @param requests Array of count service start requests. The client,
+ *     error_code and lockdown_error members are filled in for each entry. Clients that were
+ *     created must be freed with the matching *_client_free() function
+ *     by the caller, even if this function fails.
+ * @param count Number of entries in requests.
+ * @param label The label to use for communication. Usually the program name.
+ *  Pass NULL to disable sending the label in requests to lockdownd.
+ *
+ * @return SERVICE_E_SUCCESS if all clients have been created,
+ *     SERVICE_E_INVALID_ARG if a parameter is invalid, or
+ *     SERVICE_E_START_SERVICE_ERROR if at least one service could not be
+ *     started or connected to.
+ */
+LIBIMOBILEDEVICE_API service_error_t service_client_factory_start_services(idevice_t device, lockdownd_client_t lockdown, service_start_request_t *requests, unsigned int count, const char* label);
+
 /**
  * Frees a service instance.
  *
@@ -94,6 +128,30 @@ LIBIMOBILEDEVICE_API service_error_t service_client_factory_start_service(idevic
  */
 LIBIMOBILEDEVICE_API service_error_t service_client_free(service_client_t client);
 
+/**
+ * Sets how long connections to services used for single requests are kept
+ * open after their client has been freed, so that the next
+ * *_client_start_service() call for the same device and service in this
+ * process can reuse them instead of starting the service again.
+ *
+ * Only diagnostics_relay, heartbeat, sbservices and misagent connections
+ * are pooled, at most 4 per device and service. A pooled connection is
+ * checked before it is handed out and discarded if the device closed it
+ * or sent unexpected data. Expired connections are closed the next time
+ * the pool is used or by service_client_pool_flush().
+ *
+ * @param ttl Time in milliseconds to keep idle connections open.
+ *     0 (the default) disables pooling and closes all idle connections.
+ */
+LIBIMOBILEDEVICE_API void service_client_pool_set_ttl(unsigned int ttl);
+
+/**
+ * Closes all idle connections kept open by the service connection pool.
+ *
+ * @see service_client_pool_set_ttl
+ */
+LIBIMOBILEDEVICE_API void service_client_pool_flush(void);
+
 
 /**
  * Sends data using the given service client.
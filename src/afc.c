@@ -24,8 +24,11 @@
 #ifdef HAVE_CONFIG_H
 #include <config.h>
 #endif
+#define DEBUG_SUBSYSTEM DEBUG_SUBSYSTEM_AFC
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 
 #ifndef _MSC_VER
@@ -37,27 +40,8 @@
 #include "common/debug.h"
 #include "endianness.h"
 
-/**
- * Locks an AFC client, done for thread safety stuff
- *
- * @param client The AFC client connection to lock
- */
-static void afc_lock(afc_client_t client)
-{
-	debug_info("Locked");
-	mutex_lock(&client->mutex);
-}
-
-/**
- * Unlocks an AFC client, done for thread safety stuff.
- *
- * @param client The AFC
- */
-static void afc_unlock(afc_client_t client)
-{
-	debug_info("Unlocked");
-	mutex_unlock(&client->mutex);
-}
+/** Size of the stack buffer used to assemble small requests */
+#define AFC_PACKET_STACK_SIZE 256
 
 /**
  * Makes a connection to the AFC service on the device using the given
@@ -77,21 +61,17 @@ afc_error_t afc_client_new_with_service_client(service_client_t service_client,
 		return AFC_E_INVALID_ARG;
 
 	afc_client_t client_loc = (afc_client_t) malloc(sizeof(struct afc_client_private));
-	client_loc->parent = service_client;
-	client_loc->free_parent = 0;
-
-	/* allocate a packet */
-	client_loc->packet_extra = 1024;
-	client_loc->afc_packet = (AFCPacket *) malloc(sizeof(AFCPacket) + client_loc->packet_extra);
-	if (!client_loc->afc_packet) {
-		free(client_loc);
+	if (!client_loc) {
 		return AFC_E_NO_MEM;
 	}
-	client_loc->afc_packet->packet_num = 0;
-	client_loc->afc_packet->entire_length = 0;
-	client_loc->afc_packet->this_length = 0;
-	memcpy(client_loc->afc_packet->magic, AFC_MAGIC, AFC_MAGIC_LEN);
+	client_loc->parent = service_client;
+	client_loc->free_parent = 0;
+	client_loc->packet_num = 0;
+	client_loc->pending = NULL;
+	client_loc->receiving = 0;
 	mutex_init(&client_loc->mutex);
+	mutex_init(&client_loc->reply_mutex);
+	cond_init(&client_loc->reply_cond);
 
 	*client = client_loc;
 	return AFC_E_SUCCESS;
@@ -125,22 +105,54 @@ afc_error_t afc_client_start_service(idevice_t device, afc_client_t * client, co
 
 afc_error_t afc_client_free(afc_client_t client)
 {
-	if (!client || !client->afc_packet)
+	if (!client)
 		return AFC_E_INVALID_ARG;
 
 	if (client->free_parent && client->parent) {
 		service_client_free(client->parent);
 		client->parent = NULL;
 	}
-	free(client->afc_packet);
+	cond_destroy(&client->reply_cond);
+	mutex_destroy(&client->reply_mutex);
 	mutex_destroy(&client->mutex);
 	free(client);
 	return AFC_E_SUCCESS;
 }
 
+/**
+ * Removes a reply that could not be sent from the list of pending replies.
+ * If the receiving thread already claimed it, waits until it is done with it.
+ *
+ * @param client The AFC client the reply was registered with.
+ * @param reply The reply to remove.
+ */
+static void afc_unregister_reply(afc_client_t client, struct afc_reply *reply)
+{
+	struct afc_reply **r;
+
+	mutex_lock(&client->reply_mutex);
+	for (r = &client->pending; *r; r = &(*r)->next) {
+		if (*r == reply) {
+			*r = reply->next;
+			mutex_unlock(&client->reply_mutex);
+			return;
+		}
+	}
+	while (!reply->done) {
+		cond_wait(&client->reply_cond, &client->reply_mutex);
+	}
+	mutex_unlock(&client->reply_mutex);
+	free(reply->data);
+	reply->data = NULL;
+}
+
 /**
  * Dispatches an AFC packet over a client.
  *
+ * The packet is assigned the next packet number and the given reply is
+ * registered for it before anything is sent, so that the reply can be
+ * matched by whichever thread happens to be receiving.
+ *
  * @param client The client to send data through.
  * @param operation The operation to perform.
  * @param data The data to send together with the header.
@@ -148,14 +160,19 @@ afc_error_t afc_client_free(afc_client_t client)
  * @param payload The data to send after the header has been sent.
  * @param payload_length The length of data to send after the header.
  * @param bytes_sent The total number of bytes actually sent.
+ * @param reply The reply to register for this packet.
  *
  * @return AFC_E_SUCCESS on success or an AFC_E_* error value.
  */
-static afc_error_t afc_dispatch_packet(afc_client_t client, uint64_t operation, uint32_t data_length, const char* payload, uint32_t payload_length, uint32_t *bytes_sent)
+static afc_error_t afc_dispatch_packet(afc_client_t client, uint64_t operation, const char* data, uint32_t data_length, const char* payload, uint32_t payload_length, uint32_t *bytes_sent, struct afc_reply *reply)
 {
+	char stackbuf[sizeof(AFCPacket) + AFC_PACKET_STACK_SIZE];
+	char *packet = stackbuf;
+	AFCPacket *header = NULL;
 	uint32_t sent = 0;
+	afc_error_t ret = AFC_E_SUCCESS;
 
-	if (!client || !client->parent || !client->afc_packet)
+	if (!client || !client->parent)
 		return AFC_E_INVALID_ARG;
 
 	*bytes_sent = 0;
@@ -163,26 +180,46 @@ static afc_error_t afc_dispatch_packet(afc_client_t client, uint64_t operation,
 	if (!payload || !payload_length)
 		payload_length = 0;
 
-	client->afc_packet->packet_num++;
-	client->afc_packet->operation = operation;
-	client->afc_packet->entire_length = sizeof(AFCPacket) + data_length + payload_length;
-	client->afc_packet->this_length = sizeof(AFCPacket) + data_length;
+	if (data_length > AFC_PACKET_STACK_SIZE) {
+		packet = (char*)malloc(sizeof(AFCPacket) + data_length);
+		if (!packet) {
+			debug_info("Failed to allocate packet buffer");
+			return AFC_E_NO_MEM;
+		}
+	}
+	header = (AFCPacket*)packet;
+	memcpy(header->magic, AFC_MAGIC, AFC_MAGIC_LEN);
+	header->operation = operation;
+	header->entire_length = sizeof(AFCPacket) + data_length + payload_length;
+	header->this_length = sizeof(AFCPacket) + data_length;
+	if (data_length > 0) {
+		memcpy(packet + sizeof(AFCPacket), data, data_length);
+	}
+
+	memset(reply, '\0', offsetof(struct afc_reply, dest));
+	reply->error = AFC_E_SUCCESS;
+	reply->done = 0;
+
+	mutex_lock(&client->mutex);
+
+	header->packet_num = ++client->packet_num;
+	reply->packet_num = header->packet_num;
+
+	mutex_lock(&client->reply_mutex);
+	reply->next = client->pending;
+	client->pending = reply;
+	mutex_unlock(&client->reply_mutex);
 
-	debug_info("packet length = %i", client->afc_packet->this_length);
+	debug_info("packet length = %i", header->this_length);
 
 	/* send AFC packet header and data */
-	AFCPacket_to_LE(client->afc_packet);
-	debug_buffer((char*)client->afc_packet, sizeof(AFCPacket) + data_length);
-	sent = 0;
-	service_send(client->parent, (void*)client->afc_packet, sizeof(AFCPacket) + data_length, &sent);
-	AFCPacket_from_LE(client->afc_packet);
+	AFCPacket_to_LE(header);
+	debug_buffer(packet, sizeof(AFCPacket) + data_length);
+	service_send(client->parent, packet, sizeof(AFCPacket) + data_length, &sent);
 	*bytes_sent += sent;
 	if (sent < sizeof(AFCPacket) + data_length) {
-		return AFC_E_SUCCESS;
-	}
-
-	sent = 0;
-	if (payload_length > 0) {
+		ret = AFC_E_MUX_ERROR;
+	} else if (payload_length > 0) {
 		if (payload_length > 256) {
 			debug_info("packet payload follows (256/%u)", payload_length);
 			debug_buffer(payload, 256);
@@ -190,134 +227,263 @@ static afc_error_t afc_dispatch_packet(afc_client_t client, uint64_t operation,
 			debug_info("packet payload follows");
 			debug_buffer(payload, payload_length);
 		}
+		sent = 0;
 		service_send(client->parent, payload, payload_length, &sent);
+		*bytes_sent += sent;
+		if (sent < payload_length) {
+			ret = AFC_E_MUX_ERROR;
+		}
 	}
-	*bytes_sent += sent;
-	if (sent < payload_length) {
-		return AFC_E_SUCCESS;
+
+	mutex_unlock(&client->mutex);
+
+	if (packet != stackbuf) {
+		free(packet);
 	}
 
-	return AFC_E_SUCCESS;
+	if (ret != AFC_E_SUCCESS) {
+		debug_info("Could not send packet (%u bytes sent)", *bytes_sent);
+		afc_unregister_reply(client, reply);
+	}
+
+	return ret;
 }
 
 /**
- * Receives data through an AFC client and sets a variable to the received data.
+ * Receives exactly the given number of bytes from the AFC connection.
  *
- * @param client The client to receive data on.
- * @param bytes The char* to point to the newly-received data.
- * @param bytes_recv How much data was received.
- *
- * @return AFC_E_SUCCESS on success or an AFC_E_* error value.
+ * @return AFC_E_SUCCESS on success or AFC_E_NOT_ENOUGH_DATA if the
+ *  connection ran dry before all bytes were received.
  */
-static afc_error_t afc_receive_data(afc_client_t client, char **bytes, uint32_t *bytes_recv)
+static afc_error_t afc_receive_full(afc_client_t client, char *buf, uint32_t length)
 {
-	AFCPacket header;
-	uint32_t entire_len = 0;
-	uint32_t this_len = 0;
 	uint32_t current_count = 0;
-	uint64_t param1 = -1;
-	char *buf = NULL;
-	uint32_t recv_len = 0;
 
-	if (bytes_recv) {
-		*bytes_recv = 0;
+	while (current_count < length) {
+		uint32_t recv_len = 0;
+		service_receive(client->parent, buf + current_count, length - current_count, &recv_len);
+		if (recv_len == 0) {
+			debug_info("Error receiving data (got %u of %u bytes)", current_count, length);
+			return AFC_E_NOT_ENOUGH_DATA;
+		}
+		current_count += recv_len;
 	}
-	if (bytes) {
-		*bytes = NULL;
+
+	return AFC_E_SUCCESS;
+}
+
+/**
+ * Reads and drops the given number of bytes from the AFC connection.
+ */
+static afc_error_t afc_receive_discard(afc_client_t client, uint64_t length)
+{
+	char buf[4096];
+
+	while (length > 0) {
+		uint32_t chunk = (length > sizeof(buf)) ? sizeof(buf) : (uint32_t)length;
+		afc_error_t err = afc_receive_full(client, buf, chunk);
+		if (err != AFC_E_SUCCESS)
+			return err;
+		length -= chunk;
 	}
 
-	/* first, read the AFC header */
-	service_receive(client->parent, (char*)&header, sizeof(AFCPacket), &recv_len);
-	AFCPacket_from_LE(&header);
-	if (recv_len == 0) {
-		debug_info("Just didn't get enough.");
-		return AFC_E_MUX_ERROR;
+	return AFC_E_SUCCESS;
+}
+
+/**
+ * Marks all pending replies as failed. Must be called with reply_mutex held.
+ */
+static void afc_fail_pending(afc_client_t client, afc_error_t error)
+{
+	struct afc_reply *reply = client->pending;
+
+	while (reply) {
+		struct afc_reply *next = reply->next;
+		reply->error = error;
+		reply->done = 1;
+		reply->next = NULL;
+		reply = next;
 	}
+	client->pending = NULL;
+}
 
-	if (recv_len < sizeof(AFCPacket)) {
-		debug_info("Did not even get the AFCPacket header");
-		return AFC_E_MUX_ERROR;
+/**
+ * Reads one AFC packet from the connection and hands it to the pending
+ * reply with the matching packet number. Only one thread at a time may
+ * call this; see afc_receive_data().
+ *
+ * Replies to AFC_OP_DATA requests that supplied a destination buffer are
+ * read directly into that buffer.
+ */
+static void afc_receive_packet(afc_client_t client)
+{
+	AFCPacket header;
+	struct afc_reply *reply = NULL;
+	struct afc_reply **r;
+	char *buf = NULL;
+	uint32_t length = 0;
+	uint64_t entire_len = 0;
+	afc_error_t err = AFC_E_SUCCESS;
+	int ssl = (client->parent->connection->ssl_data) ? 1 : 0;
+
+	/* SSL sessions do not allow reading and writing at the same time */
+	if (ssl)
+		mutex_lock(&client->mutex);
+
+	/* first, read the AFC header */
+	if (afc_receive_full(client, (char*)&header, sizeof(AFCPacket)) != AFC_E_SUCCESS) {
+		debug_info("Did not get the AFCPacket header");
+		err = AFC_E_MUX_ERROR;
+		goto leave;
 	}
+	AFCPacket_from_LE(&header);
 
 	/* check if it's a valid AFC header */
 	if (strncmp(header.magic, AFC_MAGIC, AFC_MAGIC_LEN) != 0) {
 		debug_info("Invalid AFC packet received (magic != " AFC_MAGIC ")!");
 	}
 
-	/* check if it has the correct packet number */
-	if (header.packet_num != client->afc_packet->packet_num) {
-		/* otherwise print a warning but do not abort */
-		debug_info("ERROR: Unexpected packet number (%lld != %lld) aborting.", header.packet_num, client->afc_packet->packet_num);
-		return AFC_E_OP_HEADER_INVALID;
-	}
-
-	/* then, read the attached packet */
-	if (header.this_length < sizeof(AFCPacket)) {
+	if (header.this_length < sizeof(AFCPacket) || header.entire_length < header.this_length) {
 		debug_info("Invalid AFCPacket header received!");
-		return AFC_E_OP_HEADER_INVALID;
+		err = AFC_E_OP_HEADER_INVALID;
+		goto leave;
 	}
-	if ((header.this_length == header.entire_length)
-		&& header.entire_length == sizeof(AFCPacket)) {
-		debug_info("Empty AFCPacket received!");
-		if (header.operation == AFC_OP_DATA) {
-			return AFC_E_SUCCESS;
+
+	debug_info("received AFC packet %llu, full len=%lld, this len=%lld, operation=0x%llx", header.packet_num, header.entire_length, header.this_length, header.operation);
+
+	/* claim the reply waiting for this packet number */
+	mutex_lock(&client->reply_mutex);
+	for (r = &client->pending; *r; r = &(*r)->next) {
+		if ((*r)->packet_num == header.packet_num) {
+			reply = *r;
+			*r = reply->next;
+			reply->next = NULL;
+			break;
 		}
-		return AFC_E_IO_ERROR;
 	}
+	mutex_unlock(&client->reply_mutex);
 
-	debug_info("received AFC packet, full len=%lld, this len=%lld, operation=0x%llx", header.entire_length, header.this_length, header.operation);
+	entire_len = header.entire_length - sizeof(AFCPacket);
 
-	entire_len = (uint32_t)header.entire_length - sizeof(AFCPacket);
-	this_len = (uint32_t)header.this_length - sizeof(AFCPacket);
-
-	buf = (char*)malloc(entire_len);
-	if (this_len > 0) {
-		recv_len = 0;
-		service_receive(client->parent, buf, this_len, &recv_len);
-		if (recv_len <= 0) {
-			free(buf);
-			debug_info("Did not get packet contents!");
-			return AFC_E_NOT_ENOUGH_DATA;
+	if (!reply) {
+		debug_info("WARNING: Discarding packet with unexpected packet number %llu", header.packet_num);
+		err = afc_receive_discard(client, entire_len);
+	} else if (header.operation == AFC_OP_DATA && reply->dest) {
+		length = (entire_len > reply->dest_size) ? reply->dest_size : (uint32_t)entire_len;
+		err = afc_receive_full(client, reply->dest, length);
+		if (err == AFC_E_SUCCESS && entire_len > length) {
+			err = afc_receive_discard(client, entire_len - length);
+		}
+	} else if (entire_len > 0) {
+		buf = (char*)malloc(entire_len);
+		if (!buf) {
+			debug_info("Failed to allocate %llu bytes for packet data", entire_len);
+			err = afc_receive_discard(client, entire_len);
+			if (err == AFC_E_SUCCESS)
+				err = AFC_E_NO_MEM;
+		} else {
+			length = (uint32_t)entire_len;
+			err = afc_receive_full(client, buf, length);
 		}
-		if (recv_len < this_len) {
+	}
+
+leave:
+	if (ssl)
+		mutex_unlock(&client->mutex);
+
+	mutex_lock(&client->reply_mutex);
+	if (reply) {
+		reply->header = header;
+		reply->error = err;
+		if (err == AFC_E_SUCCESS) {
+			reply->data = buf;
+			reply->length = length;
+		} else {
 			free(buf);
-			debug_info("Could not receive this_len=%d bytes", this_len);
-			return AFC_E_NOT_ENOUGH_DATA;
 		}
+		reply->done = 1;
+	}
+	if (err != AFC_E_SUCCESS && err != AFC_E_NO_MEM) {
+		/* the stream is out of sync now, nobody will get a valid reply */
+		afc_fail_pending(client, err);
 	}
+	mutex_unlock(&client->reply_mutex);
+}
+
+/**
+ * Waits for the reply to a previously dispatched packet and evaluates it.
+ *
+ * Any number of threads may wait for their replies at the same time. The
+ * first one to find nobody else reading becomes the receiving thread and
+ * distributes incoming packets to their waiters until its own reply
+ * arrived; it then hands the role to the next waiter.
+ *
+ * @param client The client to receive data on.
+ * @param reply The reply registered by afc_dispatch_packet().
+ * @param bytes The char* to point to the newly-received data.
+ * @param bytes_recv How much data was received.
+ *
+ * @return AFC_E_SUCCESS on success or an AFC_E_* error value.
+ */
+static afc_error_t afc_receive_data(afc_client_t client, struct afc_reply *reply, char **bytes, uint32_t *bytes_recv)
+{
+	uint64_t param1 = -1;
+	char *buf = NULL;
 
-	current_count = this_len;
+	if (bytes_recv) {
+		*bytes_recv = 0;
+	}
+	if (bytes) {
+		*bytes = NULL;
+	}
 
-	if (entire_len > this_len) {
-		while (current_count < entire_len) {
-			recv_len = 0;
-			service_receive(client->parent, buf+current_count, entire_len - current_count, &recv_len);
-			if (recv_len <= 0) {
-				debug_info("Error receiving data (recv returned %d)", recv_len);
-				break;
-			}
-			current_count += recv_len;
+	mutex_lock(&client->reply_mutex);
+	while (!reply->done) {
+		if (client->receiving) {
+			cond_wait(&client->reply_cond, &client->reply_mutex);
+			continue;
 		}
-		if (current_count < entire_len) {
-			debug_info("WARNING: could not receive full packet (read %s, size %d)", current_count, entire_len);
+		client->receiving = 1;
+		mutex_unlock(&client->reply_mutex);
+		afc_receive_packet(client);
+		mutex_lock(&client->reply_mutex);
+		client->receiving = 0;
+		cond_broadcast(&client->reply_cond);
+	}
+	mutex_unlock(&client->reply_mutex);
+
+	if (reply->error != AFC_E_SUCCESS) {
+		return reply->error;
+	}
+
+	buf = reply->data;
+	reply->data = NULL;
+
+	if (reply->header.entire_length == sizeof(AFCPacket)) {
+		debug_info("Empty AFCPacket received!");
+		if (reply->header.operation == AFC_OP_DATA) {
+			return AFC_E_SUCCESS;
 		}
+		return AFC_E_IO_ERROR;
 	}
 
-	if (current_count >= sizeof(uint64_t)) {
+	if (buf && reply->length >= sizeof(uint64_t)) {
 		param1 = le64toh(*(uint64_t*)(buf));
 	}
 
-	debug_info("packet data size = %i", current_count);
-	if (current_count > 256) {
-		debug_info("packet data follows (256/%u)", current_count);
-		debug_buffer(buf, 256);
-	} else {
-		debug_info("packet data follows");
-		debug_buffer(buf, current_count);
+	debug_info("packet data size = %i", reply->length);
+	if (buf) {
+		if (reply->length > 256) {
+			debug_info("packet data follows (256/%u)", reply->length);
+			debug_buffer(buf, 256);
+		} else {
+			debug_info("packet data follows");
+			debug_buffer(buf, reply->length);
+		}
 	}
 
 	/* check operation types */
-	if (header.operation == AFC_OP_STATUS) {
+	if (reply->header.operation == AFC_OP_STATUS) {
 		/* status response */
 		debug_info("got a status response, code=%lld", param1);
 
@@ -327,22 +493,22 @@ static afc_error_t afc_receive_data(afc_client_t client, char **bytes, uint32_t
 			free(buf);
 			return (afc_error_t)param1;
 		}
-	} else if (header.operation == AFC_OP_DATA) {
+	} else if (reply->header.operation == AFC_OP_DATA) {
 		/* data response */
 		debug_info("got a data response");
-	} else if (header.operation == AFC_OP_FILE_OPEN_RES) {
+	} else if (reply->header.operation == AFC_OP_FILE_OPEN_RES) {
 		/* file handle response */
 		debug_info("got a file handle response, handle=%lld", param1);
-	} else if (header.operation == AFC_OP_FILE_TELL_RES) {
+	} else if (reply->header.operation == AFC_OP_FILE_TELL_RES) {
 		/* tell response */
 		debug_info("got a tell response, position=%lld", param1);
 	} else {
 		/* unknown operation code received */
 		free(buf);
 
-		debug_info("WARNING: Unknown operation code received 0x%llx param1=%lld", header.operation, param1);
+		debug_info("WARNING: Unknown operation code received 0x%llx param1=%lld", reply->header.operation, param1);
 #ifndef _WIN32
-		fprintf(stderr, "%s: WARNING: Unknown operation code received 0x%llx param1=%lld", __func__, (long long)header.operation, (long long)param1);
+		fprintf(stderr, "%s: WARNING: Unknown operation code received 0x%llx param1=%lld", __func__, (long long)reply->header.operation, (long long)param1);
 #endif
 
 		return AFC_E_OP_NOT_SUPPORTED;
@@ -354,10 +520,31 @@ static afc_error_t afc_receive_data(afc_client_t client, char **bytes, uint32_t
 		free(buf);
 	}
 
-	*bytes_recv = current_count;
+	if (bytes_recv) {
+		*bytes_recv = reply->length;
+	}
 	return AFC_E_SUCCESS;
 }
 
+/**
+ * Sends a request and waits for its reply.
+ *
+ * @return AFC_E_SUCCESS on success, AFC_E_NOT_ENOUGH_DATA if the request
+ *  could not be sent, or the AFC_E_* error value of the reply.
+ */
+static afc_error_t afc_request(afc_client_t client, uint64_t operation, const char *data, uint32_t data_length, char **bytes, uint32_t *bytes_recv)
+{
+	struct afc_reply reply;
+	uint32_t bytes_loc = 0;
+
+	reply.dest = NULL;
+	reply.dest_size = 0;
+	if (afc_dispatch_packet(client, operation, data, data_length, NULL, 0, &bytes_loc, &reply) != AFC_E_SUCCESS) {
+		return AFC_E_NOT_ENOUGH_DATA;
+	}
+	return afc_receive_data(client, &reply, bytes, bytes_recv);
+}
+
 /**
  * Returns counts of null characters within a string.
  */
@@ -446,21 +633,6 @@ static plist_t *make_dictionary(char *tokens, size_t length)
 	return dict;
 }
 
-static int _afc_check_packet_buffer(afc_client_t client, uint32_t data_len)
-{
-	if (data_len > client->packet_extra) {
-		client->packet_extra = (data_len & ~8) + 8;
-		AFCPacket* newpkt = (AFCPacket*)realloc(client->afc_packet, sizeof(AFCPacket) + client->packet_extra);
-		if (!newpkt) {
-			return -1;
-		}
-		client->afc_packet = newpkt;
-	}
-	return 0;
-}
-
-#define AFC_PACKET_DATA_PTR ((char*)client->afc_packet + sizeof(AFCPacket))
-
 afc_error_t afc_read_directory(afc_client_t client, const char *path, char ***directory_information)
 {
 	uint32_t bytes = 0;
@@ -470,28 +642,9 @@ afc_error_t afc_read_directory(afc_client_t client, const char *path, char ***di
 	if (!client || !path || !directory_information || (directory_information && *directory_information))
 		return AFC_E_INVALID_ARG;
 
-	afc_lock(client);
-
-	uint32_t data_len = (uint32_t)strlen(path)+1;
-	if (_afc_check_packet_buffer(client, data_len) < 0) {
-		afc_unlock(client);
-		debug_info("Failed to realloc packet buffer");
-		return AFC_E_NO_MEM;
-	}
-
-	/* Send the command */
-	memcpy(AFC_PACKET_DATA_PTR, path, data_len);
-	ret = afc_dispatch_packet(client, AFC_OP_READ_DIR, data_len, NULL, 0, &bytes);
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		return AFC_E_NOT_ENOUGH_DATA;
-	}
-	/* Receive the data */
-	ret = afc_receive_data(client, &data, &bytes);
+	/* Send the command and receive the data */
+	ret = afc_request(client, AFC_OP_READ_DIR, path, (uint32_t)strlen(path)+1, &data, &bytes);
 	if (ret != AFC_E_SUCCESS) {
-		if (data)
-			free(data);
-		afc_unlock(client);
 		return ret;
 	}
 	/* Parse the data */
@@ -499,7 +652,6 @@ afc_error_t afc_read_directory(afc_client_t client, const char *path, char ***di
 	if (data)
 		free(data);
 
-	afc_unlock(client);
 	*directory_information = list_loc;
 
 	return ret;
@@ -514,20 +666,9 @@ afc_error_t afc_get_device_info(afc_client_t client, char ***device_information)
 	if (!client || !device_information)
 		return AFC_E_INVALID_ARG;
 
-	afc_lock(client);
-
-	/* Send the command */
-	ret = afc_dispatch_packet(client, AFC_OP_GET_DEVINFO, 0, NULL, 0, &bytes);
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		return AFC_E_NOT_ENOUGH_DATA;
-	}
-	/* Receive the data */
-	ret = afc_receive_data(client, &data, &bytes);
+	/* Send the command and receive the data */
+	ret = afc_request(client, AFC_OP_GET_DEVINFO, NULL, 0, &data, &bytes);
 	if (ret != AFC_E_SUCCESS) {
-		if (data)
-			free(data);
-		afc_unlock(client);
 		return ret;
 	}
 	/* Parse the data */
@@ -535,8 +676,6 @@ afc_error_t afc_get_device_info(afc_client_t client, char ***device_information)
 	if (data)
 		free(data);
 
-	afc_unlock(client);
-
 	*device_information = list;
 
 	return ret;
@@ -551,28 +690,15 @@ afc_error_t afc_get_device_info_plist(afc_client_t client, plist_t *device_infor
 	if (!client || !device_information)
 		return AFC_E_INVALID_ARG;
 
-	afc_lock(client);
-
-	/* Send the command */
-	ret = afc_dispatch_packet(client, AFC_OP_GET_DEVINFO, 0, NULL, 0, &bytes);
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		return AFC_E_NOT_ENOUGH_DATA;
-	}
-	/* Receive the data */
-	ret = afc_receive_data(client, &data, &bytes);
+	/* Send the command and receive the data */
+	ret = afc_request(client, AFC_OP_GET_DEVINFO, NULL, 0, &data, &bytes);
 	if (ret != AFC_E_SUCCESS) {
-		if (data)
-			free(data);
-		afc_unlock(client);
 		return ret;
 	}
 	/* Parse the data */
 	*device_information = make_dictionary(data, bytes);
 	free(data);
 
-	afc_unlock(client);
-
 	return ret;
 }
 
@@ -605,109 +731,76 @@ afc_error_t afc_get_device_info_key(afc_client_t client, const char *key, char *
 
 afc_error_t afc_remove_path(afc_client_t client, const char *path)
 {
-	uint32_t bytes = 0;
 	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
 
-	if (!client || !path || !client->afc_packet || !client->parent)
+	if (!client || !path || !client->parent)
 		return AFC_E_INVALID_ARG;
 
-	afc_lock(client);
-
-	uint32_t data_len = (uint32_t)strlen(path)+1;
-	if (_afc_check_packet_buffer(client, data_len) < 0) {
-		afc_unlock(client);
-		debug_info("Failed to realloc packet buffer");
-		return AFC_E_NO_MEM;
-	}
-
-	/* Send command */
-	memcpy(AFC_PACKET_DATA_PTR, path, data_len);
-	ret = afc_dispatch_packet(client, AFC_OP_REMOVE_PATH, data_len, NULL, 0, &bytes);
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		return AFC_E_NOT_ENOUGH_DATA;
-	}
-	/* Receive response */
-	ret = afc_receive_data(client, NULL, &bytes);
+	/* Send command and receive response */
+	ret = afc_request(client, AFC_OP_REMOVE_PATH, path, (uint32_t)strlen(path)+1, NULL, NULL);
 
 	/* special case; unknown error actually means directory not empty */
 	if (ret == AFC_E_UNKNOWN_ERROR)
 		ret = AFC_E_DIR_NOT_EMPTY;
 
-	afc_unlock(client);
-
 	return ret;
 }
 
 afc_error_t afc_rename_path(afc_client_t client, const char *from, const char *to)
 {
-	if (!client || !from || !to || !client->afc_packet || !client->parent)
+	if (!client || !from || !to || !client->parent)
 		return AFC_E_INVALID_ARG;
 
-	uint32_t bytes = 0;
 	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
 
 	size_t from_len = strlen(from);
 	size_t to_len = strlen(to);
 
-	afc_lock(client);
-
 	uint32_t data_len = (uint32_t)(from_len+1 + to_len+1);
-	if (_afc_check_packet_buffer(client, data_len) < 0) {
-		afc_unlock(client);
-		debug_info("Failed to realloc packet buffer");
+	char *data = (char*)malloc(data_len);
+	if (!data) {
+		debug_info("Failed to allocate packet data");
 		return AFC_E_NO_MEM;
 	}
 
-	/* Send command */
-	memcpy(AFC_PACKET_DATA_PTR, from, from_len+1);
-	memcpy(AFC_PACKET_DATA_PTR + from_len+1, to, to_len+1);
-	ret = afc_dispatch_packet(client, AFC_OP_RENAME_PATH, data_len, NULL, 0, &bytes);
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		return AFC_E_NOT_ENOUGH_DATA;
-	}
-	/* Receive response */
-	ret = afc_receive_data(client, NULL, &bytes);
-
-	afc_unlock(client);
+	/* Send command and receive response */
+	memcpy(data, from, from_len+1);
+	memcpy(data + from_len+1, to, to_len+1);
+	ret = afc_request(client, AFC_OP_RENAME_PATH, data, data_len, NULL, NULL);
+	free(data);
 
 	return ret;
 }
 
 afc_error_t afc_make_directory(afc_client_t client, const char *path)
 {
+	if (!client || !path)
+		return AFC_E_INVALID_ARG;
+
+	/* Send command and receive response */
+	return afc_request(client, AFC_OP_MAKE_DIR, path, (uint32_t)strlen(path)+1, NULL, NULL);
+}
+
+afc_error_t afc_get_file_info(afc_client_t client, const char *path, char ***file_information)
+{
+	char *received = NULL;
 	uint32_t bytes = 0;
 	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
 
-	if (!client)
+	if (!client || !path || !file_information)
 		return AFC_E_INVALID_ARG;
 
-	afc_lock(client);
-
-	uint32_t data_len = (uint32_t)strlen(path)+1;
-	if (_afc_check_packet_buffer(client, data_len) < 0) {
-		afc_unlock(client);
-		debug_info("Failed to realloc packet buffer");
-		return AFC_E_NO_MEM;
-	}
-
-	/* Send command */
-	memcpy(AFC_PACKET_DATA_PTR, path, data_len);
-	ret = afc_dispatch_packet(client, AFC_OP_MAKE_DIR, data_len, NULL, 0, &bytes);
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		return AFC_E_NOT_ENOUGH_DATA;
+	/* Send command and receive data */
+	ret = afc_request(client, AFC_OP_GET_FILE_INFO, path, (uint32_t)strlen(path)+1, &received, &bytes);
+	if (received) {
+		*file_information = make_strings_list(received, bytes);
+		free(received);
 	}
-	/* Receive response */
-	ret = afc_receive_data(client, NULL, &bytes);
-
-	afc_unlock(client);
 
 	return ret;
 }
 
-afc_error_t afc_get_file_info(afc_client_t client, const char *path, char ***file_information)
+afc_error_t afc_get_file_info_plist(afc_client_t client, const char *path, plist_t *file_information)
 {
 	char *received = NULL;
 	uint32_t bytes = 0;
@@ -716,110 +809,250 @@ afc_error_t afc_get_file_info(afc_client_t client, const char *path, char ***fil
 	if (!client || !path || !file_information)
 		return AFC_E_INVALID_ARG;
 
-	afc_lock(client);
+	/* Send command and receive data */
+	ret = afc_request(client, AFC_OP_GET_FILE_INFO, path, (uint32_t)strlen(path)+1, &received, &bytes);
+	if (received) {
+		*file_information = make_dictionary(received, bytes);
+		free(received);
+	}
+
+	return ret;
+}
+
+/** Maximum number of file information requests afc_walk() keeps in flight */
+#define AFC_WALK_WINDOW 64
+
+struct afc_walk_dir {
+	char *path;
+	struct afc_walk_dir *next;
+};
+
+/**
+ * Returns non-zero if the error means the connection can't be used anymore.
+ */
+static int afc_is_connection_error(afc_error_t err)
+{
+	return (err == AFC_E_MUX_ERROR || err == AFC_E_NOT_ENOUGH_DATA || err == AFC_E_OP_HEADER_INVALID);
+}
+
+static char* afc_path_join(const char *dir, const char *name)
+{
+	size_t dir_len = strlen(dir);
+	size_t len = dir_len + 1 + strlen(name) + 1;
+	char *path = (char*)malloc(len);
+	if (!path)
+		return NULL;
+	if (dir_len > 0 && dir[dir_len-1] == '/') {
+		snprintf(path, len, "%s%s", dir, name);
+	} else {
+		snprintf(path, len, "%s/%s", dir, name);
+	}
+	return path;
+}
+
+static int afc_file_info_is_dir(plist_t file_information)
+{
+	const char *ifmt = plist_get_string_ptr(plist_dict_get_item(file_information, "st_ifmt"), NULL);
+	return (ifmt && !strcmp(ifmt, "S_IFDIR"));
+}
+
+/**
+ * Lists one directory for afc_walk(), requests the file information for
+ * its entries in batches and reports them. Subdirectories to descend into
+ * are pushed onto the given stack in listing order.
+ */
+static afc_error_t afc_walk_directory(afc_client_t client, const char *dir, afc_walk_filter_cb_t filter, afc_walk_cb_t callback, void *user_data, struct afc_walk_dir **stack, int *stop)
+{
+	struct afc_reply replies[AFC_WALK_WINDOW];
+	struct afc_walk_dir *subdirs = NULL;
+	char **entries = NULL;
+	char **paths = NULL;
+	uint32_t count = 0;
+	uint32_t start, i;
+	afc_error_t ret = AFC_E_SUCCESS;
 
-	uint32_t data_len = (uint32_t)strlen(path)+1;
-	if (_afc_check_packet_buffer(client, data_len) < 0) {
-		afc_unlock(client);
-		debug_info("Failed to realloc packet buffer");
+	afc_error_t err = afc_read_directory(client, dir, &entries);
+	if (err != AFC_E_SUCCESS) {
+		if (afc_is_connection_error(err))
+			return err;
+		if (callback(dir, NULL, err, user_data) == AFC_WALK_STOP)
+			*stop = 1;
+		return AFC_E_SUCCESS;
+	}
+	if (!entries) {
+		return AFC_E_SUCCESS;
+	}
+
+	for (i = 0; entries[i]; i++);
+	paths = (char**)malloc(sizeof(char*) * (i + 1));
+	if (!paths) {
+		afc_dictionary_free(entries);
 		return AFC_E_NO_MEM;
 	}
 
-	/* Send command */
-	memcpy(AFC_PACKET_DATA_PTR, path, data_len);
-	ret = afc_dispatch_packet(client, AFC_OP_GET_FILE_INFO, data_len, NULL, 0, &bytes);
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		return AFC_E_NOT_ENOUGH_DATA;
+	/* apply the filter before anything is requested */
+	for (i = 0; entries[i] && !*stop; i++) {
+		if (!strcmp(entries[i], ".") || !strcmp(entries[i], "..")) {
+			continue;
+		}
+		char *path = afc_path_join(dir, entries[i]);
+		if (!path) {
+			ret = AFC_E_NO_MEM;
+			break;
+		}
+		afc_walk_action_t action = (filter) ? filter(path, entries[i], user_data) : AFC_WALK_CONTINUE;
+		if (action == AFC_WALK_CONTINUE) {
+			paths[count++] = path;
+		} else {
+			free(path);
+			if (action == AFC_WALK_STOP)
+				*stop = 1;
+		}
 	}
+	afc_dictionary_free(entries);
 
-	/* Receive data */
-	ret = afc_receive_data(client, &received, &bytes);
-	if (received) {
-		*file_information = make_strings_list(received, bytes);
-		free(received);
+	for (start = 0; start < count && !*stop && ret == AFC_E_SUCCESS; start += AFC_WALK_WINDOW) {
+		uint32_t batch = (count - start > AFC_WALK_WINDOW) ? AFC_WALK_WINDOW : count - start;
+		uint32_t sent = 0;
+
+		/* send all requests of this batch before waiting for any reply */
+		for (sent = 0; sent < batch; sent++) {
+			const char *path = paths[start + sent];
+			uint32_t bytes = 0;
+			replies[sent].dest = NULL;
+			replies[sent].dest_size = 0;
+			if (afc_dispatch_packet(client, AFC_OP_GET_FILE_INFO, path, (uint32_t)strlen(path)+1, NULL, 0, &bytes, &replies[sent]) != AFC_E_SUCCESS) {
+				ret = AFC_E_NOT_ENOUGH_DATA;
+				break;
+			}
+		}
+
+		/* every dispatched reply has to be collected, even when stopping */
+		for (i = 0; i < sent; i++) {
+			char *path = paths[start + i];
+			char *data = NULL;
+			uint32_t bytes = 0;
+			plist_t info = NULL;
+
+			err = afc_receive_data(client, &replies[i], &data, &bytes);
+			if (err == AFC_E_SUCCESS) {
+				info = make_dictionary(data, bytes);
+			} else if (afc_is_connection_error(err)) {
+				ret = err;
+			}
+			free(data);
+
+			if (!*stop && ret == AFC_E_SUCCESS) {
+				afc_walk_action_t action = callback(path, info, err, user_data);
+				if (action == AFC_WALK_STOP) {
+					*stop = 1;
+				} else if (action == AFC_WALK_CONTINUE && info && afc_file_info_is_dir(info)) {
+					struct afc_walk_dir *subdir = (struct afc_walk_dir*)malloc(sizeof(struct afc_walk_dir));
+					if (subdir) {
+						subdir->path = path;
+						subdir->next = subdirs;
+						subdirs = subdir;
+						paths[start + i] = NULL;
+					} else {
+						ret = AFC_E_NO_MEM;
+					}
+				}
+			}
+			plist_free(info);
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		free(paths[i]);
 	}
+	free(paths);
 
-	afc_unlock(client);
+	/* subdirs is in reverse listing order, so the first one ends up on top */
+	while (subdirs) {
+		struct afc_walk_dir *next = subdirs->next;
+		subdirs->next = *stack;
+		*stack = subdirs;
+		subdirs = next;
+	}
 
 	return ret;
 }
 
-afc_error_t afc_get_file_info_plist(afc_client_t client, const char *path, plist_t *file_information)
+afc_error_t afc_walk(afc_client_t client, const char *path, afc_walk_filter_cb_t filter, afc_walk_cb_t callback, void *user_data)
 {
-	char *received = NULL;
-	uint32_t bytes = 0;
+	struct afc_walk_dir *stack = NULL;
+	plist_t info = NULL;
+	int stop = 0;
 	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
 
-	if (!client || !path || !file_information)
+	if (!client || !client->parent || !path || !callback)
 		return AFC_E_INVALID_ARG;
 
-	afc_lock(client);
+	ret = afc_get_file_info_plist(client, path, &info);
+	if (ret != AFC_E_SUCCESS) {
+		plist_free(info);
+		return ret;
+	}
 
-	uint32_t data_len = (uint32_t)strlen(path)+1;
-	if (_afc_check_packet_buffer(client, data_len) < 0) {
-		afc_unlock(client);
-		debug_info("Failed to realloc packet buffer");
-		return AFC_E_NO_MEM;
+	afc_walk_action_t action = callback(path, info, AFC_E_SUCCESS, user_data);
+	int is_dir = afc_file_info_is_dir(info);
+	plist_free(info);
+	if (action != AFC_WALK_CONTINUE || !is_dir) {
+		return AFC_E_SUCCESS;
 	}
 
-	/* Send command */
-	memcpy(AFC_PACKET_DATA_PTR, path, data_len);
-	ret = afc_dispatch_packet(client, AFC_OP_GET_FILE_INFO, data_len, NULL, 0, &bytes);
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		return AFC_E_NOT_ENOUGH_DATA;
+	stack = (struct afc_walk_dir*)malloc(sizeof(struct afc_walk_dir));
+	if (!stack) {
+		return AFC_E_NO_MEM;
 	}
+	stack->path = strdup(path);
+	stack->next = NULL;
 
-	/* Receive data */
-	ret = afc_receive_data(client, &received, &bytes);
-	if (received) {
-		*file_information = make_dictionary(received, bytes);
-		free(received);
+	while (stack && !stop && ret == AFC_E_SUCCESS) {
+		struct afc_walk_dir *dir = stack;
+		stack = dir->next;
+		ret = afc_walk_directory(client, dir->path, filter, callback, user_data, &stack, &stop);
+		free(dir->path);
+		free(dir);
 	}
 
-	afc_unlock(client);
+	while (stack) {
+		struct afc_walk_dir *next = stack->next;
+		free(stack->path);
+		free(stack);
+		stack = next;
+	}
 
 	return ret;
 }
 
 afc_error_t afc_file_open(afc_client_t client, const char *filename, afc_file_mode_t file_mode, uint64_t *handle)
 {
-	if (!client || !client->parent || !client->afc_packet)
+	if (!client || !client->parent || !filename || !handle)
 		return AFC_E_INVALID_ARG;
 
-	//uint64_t file_mode_loc = htole64(file_mode);
 	uint32_t bytes = 0;
 	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
 
 	/* set handle to 0 so in case an error occurs, the handle is invalid */
 	*handle = 0;
 
-	afc_lock(client);
-
 	uint32_t data_len = (uint32_t)(strlen(filename)+1 + 8);
-	if (_afc_check_packet_buffer(client, data_len) < 0) {
-		afc_unlock(client);
-		debug_info("Failed to realloc packet buffer");
+	char *packet_data = (char*)malloc(data_len);
+	if (!packet_data) {
+		debug_info("Failed to allocate packet data");
 		return AFC_E_NO_MEM;
 	}
 
 	/* Send command */
-	//memcpy(AFC_PACKET_DATA_PTR, &file_mode_loc, 8);
-	*(uint64_t*)(AFC_PACKET_DATA_PTR) = htole64(file_mode);
-	memcpy(AFC_PACKET_DATA_PTR + 8, filename, data_len-8);
-	ret = afc_dispatch_packet(client, AFC_OP_FILE_OPEN, data_len, NULL, 0, &bytes);
-	if (ret != AFC_E_SUCCESS) {
-		debug_info("Didn't receive a response to the command");
-		afc_unlock(client);
-		return AFC_E_NOT_ENOUGH_DATA;
-	}
+	*(uint64_t*)(packet_data) = htole64(file_mode);
+	memcpy(packet_data + 8, filename, data_len-8);
+
 	/* Receive the data */
 	char* data = NULL;
-	ret = afc_receive_data(client, &data, &bytes);
+	ret = afc_request(client, AFC_OP_FILE_OPEN, packet_data, data_len, &data, &bytes);
+	free(packet_data);
 	if ((ret == AFC_E_SUCCESS) && (bytes > 0) && data) {
-		afc_unlock(client);
-
 		/* Get the file handle */
 		memcpy(handle, data, sizeof(uint64_t));
 		free(data);
@@ -830,64 +1063,41 @@ afc_error_t afc_file_open(afc_client_t client, const char *filename, afc_file_mo
 
 	debug_info("Didn't get any further data");
 
-	afc_unlock(client);
-
 	return ret;
 }
 
 afc_error_t afc_file_read(afc_client_t client, uint64_t handle, char *data, uint32_t length, uint32_t *bytes_read)
 {
-	char *input = NULL;
-	uint32_t current_count = 0, bytes_loc = 0;
+	uint32_t bytes_loc = 0;
 	struct readinfo {
 		uint64_t handle;
 		uint64_t size;
-	};
+	} readinfo;
+	struct afc_reply reply;
 	afc_error_t ret = AFC_E_SUCCESS;
 
-	if (!client || !client->afc_packet || !client->parent || handle == 0)
+	if (!client || !client->parent || handle == 0)
 		return AFC_E_INVALID_ARG;
 	debug_info("called for length %i", length);
 
-	//uint32_t data_len = 8 + 8;
-
-	afc_lock(client);
-
-	/* Send the read command */
-	struct readinfo* readinfo = (struct readinfo*)(AFC_PACKET_DATA_PTR);
-	readinfo->handle = handle;
-	readinfo->size = htole64(length);
-	ret = afc_dispatch_packet(client, AFC_OP_FILE_READ, sizeof(struct readinfo), NULL, 0, &bytes_loc);
+	/* Send the read command, the data is received straight into the buffer */
+	readinfo.handle = handle;
+	readinfo.size = htole64(length);
+	reply.dest = data;
+	reply.dest_size = length;
+	ret = afc_dispatch_packet(client, AFC_OP_FILE_READ, (const char*)&readinfo, sizeof(struct readinfo), NULL, 0, &bytes_loc, &reply);
 	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
 		return AFC_E_NOT_ENOUGH_DATA;
 	}
 	/* Receive the data */
-	ret = afc_receive_data(client, &input, &bytes_loc);
+	ret = afc_receive_data(client, &reply, NULL, &bytes_loc);
 	debug_info("afc_receive_data returned error: %d", ret);
 	debug_info("bytes returned: %i", bytes_loc);
 	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
 		return ret;
 	}
-	if (bytes_loc == 0) {
-		if (input)
-			free(input);
-		afc_unlock(client);
-		*bytes_read = current_count;
-		/* FIXME: check that's actually a success */
-		return ret;
-	}
-	if (input) {
-		debug_info("%d", bytes_loc);
-		memcpy(data + current_count, input, (bytes_loc > length) ? length : bytes_loc);
-		free(input);
-		input = NULL;
-		current_count += (bytes_loc > length) ? length : bytes_loc;
-	}
 
-	afc_unlock(client);
-	*bytes_read = current_count;
+	*bytes_read = bytes_loc;
 	return ret;
 }
 
@@ -895,30 +1105,28 @@ afc_error_t afc_file_write(afc_client_t client, uint64_t handle, const char *dat
 {
 	uint32_t current_count = 0;
 	uint32_t bytes_loc = 0;
+	struct afc_reply reply;
 	afc_error_t ret = AFC_E_SUCCESS;
 
-	if (!client || !client->afc_packet || !client->parent || !bytes_written || (handle == 0))
+	if (!client || !client->parent || !bytes_written || (handle == 0))
 		return AFC_E_INVALID_ARG;
 
-	uint32_t data_len = 8;
-
-	afc_lock(client);
-
 	debug_info("Write length: %i", length);
 
-	*(uint64_t*)(AFC_PACKET_DATA_PTR) = handle;
-	ret = afc_dispatch_packet(client, AFC_OP_FILE_WRITE, data_len, data, length, &bytes_loc);
+	reply.dest = NULL;
+	reply.dest_size = 0;
+	ret = afc_dispatch_packet(client, AFC_OP_FILE_WRITE, (const char*)&handle, 8, data, length, &bytes_loc, &reply);
 
-	current_count += bytes_loc - (sizeof(AFCPacket) + 8);
+	if (bytes_loc > sizeof(AFCPacket) + 8) {
+		current_count += bytes_loc - (sizeof(AFCPacket) + 8);
+	}
 
 	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
 		*bytes_written = current_count;
 		return AFC_E_SUCCESS;
 	}
 
-	ret = afc_receive_data(client, NULL, &bytes_loc);
-	afc_unlock(client);
+	ret = afc_receive_data(client, &reply, NULL, &bytes_loc);
 	if (ret != AFC_E_SUCCESS) {
 		debug_info("Failed to receive reply (%d)", ret);
 	}
@@ -929,32 +1137,25 @@ afc_error_t afc_file_write(afc_client_t client, uint64_t handle, const char *dat
 afc_error_t afc_file_close(afc_client_t client, uint64_t handle)
 {
 	uint32_t bytes = 0;
+	struct afc_reply reply;
 	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
 
 	if (!client || (handle == 0))
 		return AFC_E_INVALID_ARG;
 
-	uint32_t data_len = 8;
-
-	afc_lock(client);
-
 	debug_info("File handle %i", handle);
 
 	/* Send command */
-	*(uint64_t*)(AFC_PACKET_DATA_PTR) = handle;
-	ret = afc_dispatch_packet(client, AFC_OP_FILE_CLOSE, data_len, NULL, 0, &bytes);
+	reply.dest = NULL;
+	reply.dest_size = 0;
+	ret = afc_dispatch_packet(client, AFC_OP_FILE_CLOSE, (const char*)&handle, 8, NULL, 0, &bytes, &reply);
 
 	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
 		return AFC_E_UNKNOWN_ERROR;
 	}
 
 	/* Receive the response */
-	ret = afc_receive_data(client, NULL, &bytes);
-
-	afc_unlock(client);
-
-	return ret;
+	return afc_receive_data(client, &reply, NULL, &bytes);
 }
 
 afc_error_t afc_file_lock(afc_client_t client, uint64_t handle, afc_lock_op_t operation)
@@ -963,66 +1164,45 @@ afc_error_t afc_file_lock(afc_client_t client, uint64_t handle, afc_lock_op_t op
 	struct lockinfo {
 		uint64_t handle;
 		uint64_t op;
-	};
+	} lockinfo;
+	struct afc_reply reply;
 	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
 
 	if (!client || (handle == 0))
 		return AFC_E_INVALID_ARG;
 
-	afc_lock(client);
-
 	debug_info("file handle %i", handle);
 
 	/* Send command */
-	struct lockinfo* lockinfo = (struct lockinfo*)(AFC_PACKET_DATA_PTR);
-	lockinfo->handle = handle;
-	lockinfo->op = htole64(operation);
-	ret = afc_dispatch_packet(client, AFC_OP_FILE_LOCK, sizeof(struct lockinfo), NULL, 0, &bytes);
+	lockinfo.handle = handle;
+	lockinfo.op = htole64(operation);
+	reply.dest = NULL;
+	reply.dest_size = 0;
+	ret = afc_dispatch_packet(client, AFC_OP_FILE_LOCK, (const char*)&lockinfo, sizeof(struct lockinfo), NULL, 0, &bytes, &reply);
 	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
 		debug_info("could not send lock command");
 		return AFC_E_UNKNOWN_ERROR;
 	}
 	/* Receive the response */
-	ret = afc_receive_data(client, NULL, &bytes);
-
-	afc_unlock(client);
-
-	return ret;
+	return afc_receive_data(client, &reply, NULL, &bytes);
 }
 
 afc_error_t afc_file_seek(afc_client_t client, uint64_t handle, int64_t offset, int whence)
 {
-	uint32_t bytes = 0;
 	struct seekinfo {
 		uint64_t handle;
 		uint64_t whence;
 		int64_t offset;
-	};
-	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
+	} seekinfo;
 
 	if (!client || (handle == 0))
 		return AFC_E_INVALID_ARG;
 
-	afc_lock(client);
-
-	/* Send the command */
-	struct seekinfo* seekinfo = (struct seekinfo*)(AFC_PACKET_DATA_PTR);
-	seekinfo->handle = handle;
-	seekinfo->whence = htole64(whence);
-	seekinfo->offset = (int64_t)htole64(offset);
-	ret = afc_dispatch_packet(client, AFC_OP_FILE_SEEK, sizeof(struct seekinfo), NULL, 0, &bytes);
-
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		return AFC_E_NOT_ENOUGH_DATA;
-	}
-	/* Receive response */
-	ret = afc_receive_data(client, NULL, &bytes);
-
-	afc_unlock(client);
-
-	return ret;
+	/* Send the command and receive response */
+	seekinfo.handle = handle;
+	seekinfo.whence = htole64(whence);
+	seekinfo.offset = (int64_t)htole64(offset);
+	return afc_request(client, AFC_OP_FILE_SEEK, (const char*)&seekinfo, sizeof(struct seekinfo), NULL, NULL);
 }
 
 afc_error_t afc_file_tell(afc_client_t client, uint64_t handle, uint64_t *position)
@@ -1034,20 +1214,8 @@ afc_error_t afc_file_tell(afc_client_t client, uint64_t handle, uint64_t *positi
 	if (!client || (handle == 0))
 		return AFC_E_INVALID_ARG;
 
-	uint32_t data_len = 8;
-
-	afc_lock(client);
-
-	/* Send the command */
-	*(uint64_t*)(AFC_PACKET_DATA_PTR) = handle;
-	ret = afc_dispatch_packet(client, AFC_OP_FILE_TELL, data_len, NULL, 0, &bytes);
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		return AFC_E_NOT_ENOUGH_DATA;
-	}
-
-	/* Receive the data */
-	ret = afc_receive_data(client, &buffer, &bytes);
+	/* Send the command and receive the data */
+	ret = afc_request(client, AFC_OP_FILE_TELL, (const char*)&handle, 8, &buffer, &bytes);
 	if (bytes > 0 && buffer) {
 		/* Get the position */
 		memcpy(position, buffer, sizeof(uint64_t));
@@ -1055,93 +1223,70 @@ afc_error_t afc_file_tell(afc_client_t client, uint64_t handle, uint64_t *positi
 	}
 	free(buffer);
 
-	afc_unlock(client);
-
 	return ret;
 }
 
 afc_error_t afc_file_truncate(afc_client_t client, uint64_t handle, uint64_t newsize)
 {
-	uint32_t bytes = 0;
 	struct truncinfo {
 		uint64_t handle;
 		uint64_t newsize;
-	};
-	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
+	} truncinfo;
 
 	if (!client || (handle == 0))
 		return AFC_E_INVALID_ARG;
 
-	afc_lock(client);
+	/* Send command and receive response */
+	truncinfo.handle = handle;
+	truncinfo.newsize = htole64(newsize);
+	return afc_request(client, AFC_OP_FILE_SET_SIZE, (const char*)&truncinfo, sizeof(struct truncinfo), NULL, NULL);
+}
 
-	/* Send command */
-	struct truncinfo* truncinfo = (struct truncinfo*)(AFC_PACKET_DATA_PTR);
-	truncinfo->handle = handle;
-	truncinfo->newsize = htole64(newsize);
-	ret = afc_dispatch_packet(client, AFC_OP_FILE_SET_SIZE, sizeof(struct truncinfo), NULL, 0, &bytes);
+/**
+ * Sends a request whose data is a 64 bit value followed by a path.
+ */
+static afc_error_t afc_path_request_u64(afc_client_t client, uint64_t operation, uint64_t value, const char *path)
+{
+	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
 
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		return AFC_E_NOT_ENOUGH_DATA;
+	uint32_t data_len = 8 + (uint32_t)(strlen(path)+1);
+	char *data = (char*)malloc(data_len);
+	if (!data) {
+		debug_info("Failed to allocate packet data");
+		return AFC_E_NO_MEM;
 	}
-	/* Receive response */
-	ret = afc_receive_data(client, NULL, &bytes);
 
-	afc_unlock(client);
+	*(uint64_t*)(data) = htole64(value);
+	memcpy(data + 8, path, data_len-8);
+	ret = afc_request(client, operation, data, data_len, NULL, NULL);
+	free(data);
 
 	return ret;
 }
 
 afc_error_t afc_truncate(afc_client_t client, const char *path, uint64_t newsize)
 {
-	if (!client || !path || !client->afc_packet || !client->parent)
+	if (!client || !path || !client->parent)
 		return AFC_E_INVALID_ARG;
 
-	uint32_t bytes = 0;
-	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
-
-	afc_lock(client);
-
-	uint32_t data_len = 8 + (uint32_t)(strlen(path)+1);
-	if (_afc_check_packet_buffer(client, data_len) < 0) {
-		afc_unlock(client);
-		debug_info("Failed to realloc packet buffer");
-		return AFC_E_NO_MEM;
-	}
-
-	/* Send command */
-	*(uint64_t*)(AFC_PACKET_DATA_PTR) = htole64(newsize);
-	memcpy(AFC_PACKET_DATA_PTR + 8, path, data_len-8);
-	ret = afc_dispatch_packet(client, AFC_OP_TRUNCATE, data_len, NULL, 0, &bytes);
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		return AFC_E_NOT_ENOUGH_DATA;
-	}
-	/* Receive response */
-	ret = afc_receive_data(client, NULL, &bytes);
-
-	afc_unlock(client);
-
-	return ret;
+	/* Send command and receive response */
+	return afc_path_request_u64(client, AFC_OP_TRUNCATE, newsize, path);
 }
 
 afc_error_t afc_make_link(afc_client_t client, afc_link_type_t linktype, const char *target, const char *linkname)
 {
-	if (!client || !target || !linkname || !client->afc_packet || !client->parent)
+	if (!client || !target || !linkname || !client->parent)
 		return AFC_E_INVALID_ARG;
 
-	uint32_t bytes = 0;
 	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
 
 	size_t target_len = strlen(target);
 	size_t link_len = strlen(linkname);
 
-	afc_lock(client);
-
 	uint32_t data_len = 8 + target_len + 1 + link_len + 1;
-	if (_afc_check_packet_buffer(client, data_len) < 0) {
-		afc_unlock(client);
-		debug_info("Failed to realloc packet buffer");
+	char *data = (char*)malloc(data_len);
+	if (!data) {
+		debug_info("Failed to allocate packet data");
 		return AFC_E_NO_MEM;
 	}
 
@@ -1149,86 +1294,32 @@ afc_error_t afc_make_link(afc_client_t client, afc_link_type_t linktype, const c
 	debug_info("target: %s, length:%d", target, target_len);
 	debug_info("linkname: %s, length:%d", linkname, link_len);
 
-	/* Send command */
-	*(uint64_t*)(AFC_PACKET_DATA_PTR) = htole64(linktype);
-	memcpy(AFC_PACKET_DATA_PTR + 8, target, target_len + 1);
-	memcpy(AFC_PACKET_DATA_PTR + 8 + target_len + 1, linkname, link_len + 1);
-	ret = afc_dispatch_packet(client, AFC_OP_MAKE_LINK, data_len, NULL, 0, &bytes);
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		return AFC_E_NOT_ENOUGH_DATA;
-	}
-	/* Receive response */
-	ret = afc_receive_data(client, NULL, &bytes);
-
-	afc_unlock(client);
+	/* Send command and receive response */
+	*(uint64_t*)(data) = htole64(linktype);
+	memcpy(data + 8, target, target_len + 1);
+	memcpy(data + 8 + target_len + 1, linkname, link_len + 1);
+	ret = afc_request(client, AFC_OP_MAKE_LINK, data, data_len, NULL, NULL);
+	free(data);
 
 	return ret;
 }
 
 afc_error_t afc_set_file_time(afc_client_t client, const char *path, uint64_t mtime)
 {
-	if (!client || !path || !client->afc_packet || !client->parent)
+	if (!client || !path || !client->parent)
 		return AFC_E_INVALID_ARG;
 
-	uint32_t bytes = 0;
-	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
-
-	afc_lock(client);
-
-	uint32_t data_len = 8 + strlen(path) + 1;
-	if (_afc_check_packet_buffer(client, data_len) < 0) {
-		afc_unlock(client);
-		debug_info("Failed to realloc packet buffer");
-		return AFC_E_NO_MEM;
-	}
-
-	/* Send command */
-	*(uint64_t*)(AFC_PACKET_DATA_PTR) = htole64(mtime);
-	memcpy(AFC_PACKET_DATA_PTR + 8, path, data_len-8);
-	ret = afc_dispatch_packet(client, AFC_OP_SET_FILE_MOD_TIME, data_len, NULL, 0, &bytes);
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		return AFC_E_NOT_ENOUGH_DATA;
-	}
-	/* Receive response */
-	ret = afc_receive_data(client, NULL, &bytes);
-
-	afc_unlock(client);
-
-	return ret;
+	/* Send command and receive response */
+	return afc_path_request_u64(client, AFC_OP_SET_FILE_MOD_TIME, mtime, path);
 }
 
 afc_error_t afc_remove_path_and_contents(afc_client_t client, const char *path)
 {
-	uint32_t bytes = 0;
-	afc_error_t ret = AFC_E_UNKNOWN_ERROR;
-
-	if (!client || !path || !client->afc_packet || !client->parent)
+	if (!client || !path || !client->parent)
 		return AFC_E_INVALID_ARG;
 
-	afc_lock(client);
-
-	uint32_t data_len = strlen(path) + 1;
-	if (_afc_check_packet_buffer(client, data_len) < 0) {
-		afc_unlock(client);
-		debug_info("Failed to realloc packet buffer");
-		return AFC_E_NO_MEM;
-	}
-
-	/* Send command */
-	memcpy(AFC_PACKET_DATA_PTR, path, data_len);
-	ret = afc_dispatch_packet(client, AFC_OP_REMOVE_PATH_AND_CONTENTS, data_len, NULL, 0, &bytes);
-	if (ret != AFC_E_SUCCESS) {
-		afc_unlock(client);
-		return AFC_E_NOT_ENOUGH_DATA;
-	}
-	/* Receive response */
-	ret = afc_receive_data(client, NULL, &bytes);
-
-	afc_unlock(client);
-
-	return ret;
+	/* Send command and receive response */
+	return afc_request(client, AFC_OP_REMOVE_PATH_AND_CONTENTS, path, (uint32_t)strlen(path)+1, NULL, NULL);
 }
 
 afc_error_t afc_dictionary_free(char **dictionary)
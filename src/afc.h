@@ -50,11 +50,30 @@ typedef struct {
 	(x)->packet_num    = le64toh((x)->packet_num); \
 	(x)->operation     = le64toh((x)->operation);
 
+/**
+ * A request that has been sent to the device and is waiting for its reply.
+ * Replies are matched to requests by their packet number.
+ */
+struct afc_reply {
+	uint64_t packet_num;
+	AFCPacket header;
+	char *data;
+	uint32_t length;
+	char *dest;
+	uint32_t dest_size;
+	afc_error_t error;
+	int done;
+	struct afc_reply *next;
+};
+
 struct afc_client_private {
 	service_client_t parent;
-	AFCPacket *afc_packet;
-	uint32_t packet_extra;
+	uint64_t packet_num;
 	mutex_t mutex;
+	mutex_t reply_mutex;
+	cond_t reply_cond;
+	struct afc_reply *pending;
+	int receiving;
 	int free_parent;
 };
 
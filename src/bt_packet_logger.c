@@ -29,16 +29,21 @@
 #include "lockdown.h"
 #include "common/debug.h"
 
+#define RX_READ_TIMEOUT 100
+
+/* Each packet is prefixed with its 16 bit length, so the receive buffer
+ * must be able to hold at least one maximum sized packet. Anything beyond
+ * that allows batching several packets into a single receive call. */
+#define BT_RX_BUFFER_SIZE (4 * (BT_MAX_PACKET_SIZE + sizeof(uint16_t)))
+
 struct bt_packet_logger_worker_thread {
 	bt_packet_logger_client_t client;
 	bt_packet_logger_receive_cb_t cbfunc;
 	void *user_data;
-	uint8_t rxbuff[BT_MAX_PACKET_SIZE];
+	uint32_t rxlen;
+	uint8_t rxbuff[BT_RX_BUFFER_SIZE];
 };
 
-#define SZ_READ_TIMEOUT 100
-#define PAYLOAD_READ_TIMEOUT 500
-
 /**
  * Convert a service_error_t value to a bt_packet_logger_error_t value.
  * Used internally to get correct error codes.
@@ -133,6 +138,39 @@ bt_packet_logger_error_t bt_packet_logger_receive_with_timeout(bt_packet_logger_
 	return res;
 }
 
+/**
+ * Dispatches all complete packets that are contained in the receive buffer
+ * of the worker thread and moves any trailing partial packet to the front.
+ */
+static void bt_packet_logger_dispatch_packets(struct bt_packet_logger_worker_thread *btwt)
+{
+	uint32_t pos = 0;
+
+	while (btwt->rxlen - pos >= sizeof(uint16_t)) {
+		uint16_t len;
+		memcpy(&len, btwt->rxbuff + pos, sizeof(uint16_t));
+		if (btwt->rxlen - pos - sizeof(uint16_t) < len) {
+			/* incomplete packet, wait for more data */
+			break;
+		}
+		pos += sizeof(uint16_t);
+		// sanity check received length
+		if (len > sizeof(bt_packet_logger_header_t)) {
+			btwt->cbfunc(btwt->rxbuff + pos, len, btwt->user_data);
+		} else {
+			debug_info("Dropping packet with invalid length %u", len);
+		}
+		pos += len;
+	}
+
+	if (pos > 0) {
+		btwt->rxlen -= pos;
+		if (btwt->rxlen > 0) {
+			memmove(btwt->rxbuff, btwt->rxbuff + pos, btwt->rxlen);
+		}
+	}
+}
+
 void *bt_packet_logger_worker(void *arg)
 {
 	bt_packet_logger_error_t ret = BT_PACKET_LOGGER_E_UNKNOWN_ERROR;
@@ -144,38 +182,23 @@ void *bt_packet_logger_worker(void *arg)
 
 	debug_info("Running");
 
+	btwt->rxlen = 0;
 	while (btwt->client->parent) {
 		uint32_t bytes = 0;
-		uint16_t len;
 
-		ret = bt_packet_logger_receive_with_timeout(btwt->client, (char*)&len, 2, &bytes, SZ_READ_TIMEOUT);
-
-		if (ret == BT_PACKET_LOGGER_E_TIMEOUT || ret == BT_PACKET_LOGGER_E_NOT_ENOUGH_DATA || ((bytes == 0) && (ret == BT_PACKET_LOGGER_E_SUCCESS))) {
-			continue;
-		} else if (ret < 0) {
+		/* read as much as is available so that bursts of packets are
+		 * handled with a single receive call */
+		ret = bt_packet_logger_receive_with_timeout(btwt->client, (char*)btwt->rxbuff + btwt->rxlen, BT_RX_BUFFER_SIZE - btwt->rxlen, &bytes, RX_READ_TIMEOUT);
+		if (ret < 0 && ret != BT_PACKET_LOGGER_E_TIMEOUT && ret != BT_PACKET_LOGGER_E_NOT_ENOUGH_DATA) {
 			debug_info("Connection to bt packet logger interrupted");
 			break;
 		}
-
-		// sanity check received length
-		if(bytes > 0 && len > sizeof(bt_packet_logger_header_t)) {
-			debug_info("Reading %u bytes\n", len);
-			ret = bt_packet_logger_receive_with_timeout(btwt->client, (char *)btwt->rxbuff, len, &bytes, PAYLOAD_READ_TIMEOUT);
-
-			if(len != bytes) {
-				debug_info("Failed Read Expected %u, Received %u\n", len, bytes);
-				continue;
-			}
-
-			if (ret == BT_PACKET_LOGGER_E_TIMEOUT || ret == BT_PACKET_LOGGER_E_NOT_ENOUGH_DATA || ((bytes == 0) && (ret == BT_PACKET_LOGGER_E_SUCCESS))) {
-				continue;
-			} else if (ret < 0) {
-				debug_info("Connection to bt packet logger interrupted");
-				break;
-			}
-
-			btwt->cbfunc(btwt->rxbuff, len, btwt->user_data);
+		if (bytes == 0) {
+			continue;
 		}
+
+		btwt->rxlen += bytes;
+		bt_packet_logger_dispatch_packets(btwt);
 	}
 
 	// null check performed above
@@ -23,6 +23,8 @@
 #ifdef HAVE_CONFIG_H
 #include <config.h>
 #endif
+#define DEBUG_SUBSYSTEM DEBUG_SUBSYSTEM_DEBUGSERVER
+
 #include <string.h>
 #include <stdlib.h>
 #define _GNU_SOURCE 1
@@ -91,6 +93,9 @@ debugserver_error_t debugserver_client_new(idevice_t device, lockdownd_service_d
 	client_loc->noack_mode = 0;
 	client_loc->cancel_receive = NULL;
 	client_loc->receive_loop_timeout = 1000;
+	client_loc->recv_buffer = NULL;
+	client_loc->recv_length = 0;
+	client_loc->recv_offset = 0;
 
 	*client = client_loc;
 
@@ -116,6 +121,7 @@ debugserver_error_t debugserver_client_free(debugserver_client_t client)
 
 	debugserver_error_t err = debugserver_error(service_client_free(client->parent));
 	client->parent = NULL;
+	free(client->recv_buffer);
 	free(client);
 
 	return err;
@@ -151,6 +157,20 @@ debugserver_error_t debugserver_client_receive_with_timeout(debugserver_client_t
 		return DEBUGSERVER_E_INVALID_ARG;
 	}
 
+	/* hand out data read ahead while parsing responses first */
+	if (client->recv_offset < client->recv_length) {
+		uint32_t avail = client->recv_length - client->recv_offset;
+		if (size > avail) {
+			size = avail;
+		}
+		memcpy(data, client->recv_buffer + client->recv_offset, size);
+		client->recv_offset += size;
+		if (received) {
+			*received = size;
+		}
+		return DEBUGSERVER_E_SUCCESS;
+	}
+
 	res = debugserver_error(service_receive_with_timeout(client->parent, data, size, (uint32_t*)&bytes, timeout));
 	if (bytes <= 0 && res != DEBUGSERVER_E_TIMEOUT) {
 		debug_info("Could not read data, error %d", res);
@@ -221,22 +241,55 @@ debugserver_error_t debugserver_command_free(debugserver_command_t command)
 	return res;
 }
 
+/* hex digit value of every byte, -1 for bytes that are not hex digits */
+static const signed char debugserver_hex_values[256] = {
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+	-1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
+/* the two (upper case) hex digits of every byte value */
+static const char debugserver_hex_pairs[512] =
+	"000102030405060708090A0B0C0D0E0F"
+	"101112131415161718191A1B1C1D1E1F"
+	"202122232425262728292A2B2C2D2E2F"
+	"303132333435363738393A3B3C3D3E3F"
+	"404142434445464748494A4B4C4D4E4F"
+	"505152535455565758595A5B5C5D5E5F"
+	"606162636465666768696A6B6C6D6E6F"
+	"707172737475767778797A7B7C7D7E7F"
+	"808182838485868788898A8B8C8D8E8F"
+	"909192939495969798999A9B9C9D9E9F"
+	"A0A1A2A3A4A5A6A7A8A9AAABACADAEAF"
+	"B0B1B2B3B4B5B6B7B8B9BABBBCBDBEBF"
+	"C0C1C2C3C4C5C6C7C8C9CACBCCCDCECF"
+	"D0D1D2D3D4D5D6D7D8D9DADBDCDDDEDF"
+	"E0E1E2E3E4E5E6E7E8E9EAEBECEDEEEF"
+	"F0F1F2F3F4F5F6F7F8F9FAFBFCFDFEFF";
+
 static int debugserver_hex2int(char c)
 {
-	if (c >= '0' && c <= '9')
-		return c - '0';
-	else if (c >= 'a' && c <= 'f')
-		return 10 + c - 'a';
-	else if (c >= 'A' && c <= 'F')
-		return 10 + c - 'A';
-	else
-		return c;
+	int value = debugserver_hex_values[(unsigned char)c];
+	/* non-hex characters are passed through, as they always have been */
+	return (value < 0) ? c : value;
 }
 
 static char debugserver_int2hex(int x)
 {
-	const char *hexchars = "0123456789ABCDEF";
-	return hexchars[x];
+	return debugserver_hex_pairs[(x & 0xf) * 2 + 1];
 }
 
 #define DEBUGSERVER_HEX_ENCODE_FIRST_BYTE(byte) debugserver_int2hex(((byte) >> 0x4) & 0xf)
@@ -244,16 +297,44 @@ static char debugserver_int2hex(int x)
 #define DEBUGSERVER_HEX_DECODE_FIRST_BYTE(byte) (((byte) >> 0x4) & 0xf)
 #define DEBUGSERVER_HEX_DECODE_SECOND_BYTE(byte) ((byte) & 0xf)
 
+#define DEBUGSERVER_BYTE_LANES 0x00FF00FF00FF00FFULL
+
+/* adds up the four 16 bit lanes; they are extracted separately as a
+ * multiply would let the carries of the lower lanes into the sum */
+#define DEBUGSERVER_FOLD_LANES(lanes) \
+	(uint32_t)(((lanes) & 0xffff) + (((lanes) >> 16) & 0xffff) + (((lanes) >> 32) & 0xffff) + ((lanes) >> 48))
+
+/**
+ * Computes the packet checksum, the sum of all bytes modulo 256, eight
+ * bytes at a time: the bytes of each word are added into four 16 bit
+ * lanes, which are folded before they can overflow.
+ */
 static uint32_t debugserver_get_checksum_for_buffer(const char* buffer, uint32_t size)
 {
+	const unsigned char* p = (const unsigned char*)buffer;
 	uint32_t checksum = 0;
-	uint32_t i;
-
-	for (i = 0; i < size; i++) {
-		checksum += buffer[i];
+	uint64_t lanes = 0;
+	uint64_t word;
+	uint32_t words = 0;
+
+	while (size >= sizeof(word)) {
+		memcpy(&word, p, sizeof(word));
+		lanes += (word & DEBUGSERVER_BYTE_LANES) + ((word >> 8) & DEBUGSERVER_BYTE_LANES);
+		p += sizeof(word);
+		size -= sizeof(word);
+		/* each lane grows by at most 510 per word */
+		if (++words == 128) {
+			checksum += DEBUGSERVER_FOLD_LANES(lanes);
+			lanes = 0;
+			words = 0;
+		}
+	}
+	checksum += DEBUGSERVER_FOLD_LANES(lanes);
+	while (size--) {
+		checksum += *p++;
 	}
 
-	return checksum;
+	return checksum & 0xff;
 }
 
 static int debugserver_response_is_checksum_valid(const char* response, uint32_t size)
@@ -277,33 +358,103 @@ static int debugserver_response_is_checksum_valid(const char* response, uint32_t
 
 void debugserver_encode_string(const char* buffer, char** encoded_buffer, uint32_t* encoded_length)
 {
-	uint32_t position;
-	uint32_t index;
+	const unsigned char* f = (const unsigned char*)buffer;
 	uint32_t length = strlen(buffer);
 	*encoded_length = (2 * length) + DEBUGSERVER_CHECKSUM_HASH_LENGTH + 1;
 
 	*encoded_buffer = malloc(sizeof(char) * (*encoded_length));
-	memset(*encoded_buffer, '\0', *encoded_length);
-	for (position = 0, index = 0; index < length; index++) {
-		position = (index * (2 * sizeof(char)));
-		(*encoded_buffer)[position] = DEBUGSERVER_HEX_ENCODE_FIRST_BYTE(buffer[index]);
-		(*encoded_buffer)[position + 1] = DEBUGSERVER_HEX_ENCODE_SECOND_BYTE(buffer[index]);
+	char* t = *encoded_buffer;
+	const unsigned char* fend = f + length;
+	while (f < fend) {
+		memcpy(t, &debugserver_hex_pairs[*f++ * 2], 2);
+		t += 2;
 	}
+	memset(t, '\0', DEBUGSERVER_CHECKSUM_HASH_LENGTH + 1);
 }
 
 void debugserver_decode_string(const char *encoded_buffer, size_t encoded_length, char** buffer)
 {
 	*buffer = malloc(sizeof(char) * ((encoded_length / 2)+1));
 	char* t = *buffer;
-	const char *f = encoded_buffer;
-	const char *fend = f + encoded_length;
+	const unsigned char *f = (const unsigned char*)encoded_buffer;
+	const unsigned char *fend = f + (encoded_length & ~(size_t)1);
 	while (f < fend) {
-		*t++ = debugserver_hex2int(*f) << 4 | debugserver_hex2int(f[1]);
+		int hi = debugserver_hex_values[f[0]];
+		int lo = debugserver_hex_values[f[1]];
+		if ((hi | lo) < 0) {
+			hi = debugserver_hex2int(f[0]);
+			lo = debugserver_hex2int(f[1]);
+		}
+		*t++ = hi << 4 | lo;
 		f += 2;
 	}
+	if (encoded_length & 1) {
+		/* a dangling digit only provides the high nibble */
+		*t++ = debugserver_hex2int(*f) << 4;
+	}
 	*t = '\0';
 }
 
+void debugserver_decode_binary(const char *encoded_buffer, size_t encoded_length, char** buffer, size_t* length)
+{
+	const char *f = encoded_buffer;
+	const char *fend = f + encoded_length;
+	size_t capacity = encoded_length + 1;
+	size_t n = 0;
+	char *t = malloc(capacity);
+
+	while (t && f < fend) {
+		const char *special = f;
+		/* copy runs of plain bytes in one go */
+		while (special < fend && *special != '}' && *special != '*') {
+			special++;
+		}
+		memcpy(t + n, f, special - f);
+		n += special - f;
+		f = special;
+		if (f >= fend) {
+			break;
+		}
+		if (*f == '}') {
+			/* escaped byte */
+			if (f + 1 >= fend) {
+				break;
+			}
+			t[n++] = f[1] ^ 0x20;
+			f += 2;
+		} else {
+			/* run-length encoding: repeat the previous byte */
+			if (n == 0 || f + 1 >= fend || (unsigned char)f[1] < 29) {
+				break;
+			}
+			size_t repeat = (unsigned char)f[1] - 29;
+			/* every other input byte yields at most one output byte, so
+			 * keeping room for the rest of the input covers all writes */
+			size_t needed = n + repeat + (size_t)(fend - (f + 2)) + 1;
+			if (needed > capacity) {
+				capacity = needed * 2;
+				char *grown = realloc(t, capacity);
+				if (!grown) {
+					free(t);
+					t = NULL;
+					break;
+				}
+				t = grown;
+			}
+			memset(t + n, t[n-1], repeat);
+			n += repeat;
+			f += 2;
+		}
+	}
+	if (t) {
+		t[n] = '\0';
+	}
+	*buffer = t;
+	if (length) {
+		*length = (t) ? n : 0;
+	}
+}
+
 static void debugserver_format_command(const char* prefix, const char* command, const char* arguments, int calculate_checksum, char** buffer, uint32_t* size)
 {
 	char checksum_hash[DEBUGSERVER_CHECKSUM_HASH_LENGTH + 1] = {'#', '0', '0', '\0'};
@@ -380,15 +531,36 @@ static debugserver_error_t debugserver_client_receive_internal_char(debugserver_
 	debugserver_error_t res = DEBUGSERVER_E_SUCCESS;
 	uint32_t bytes = 0;
 
-	/* we loop here as we expect an answer */
-	res = debugserver_client_receive(client, received_char, sizeof(char), &bytes);
-	if (res != DEBUGSERVER_E_SUCCESS) {
-		return res;
-	}
-	if (bytes != 1) {
-		debug_info("received %d bytes when asking for %d!", bytes, sizeof(char));
-		return DEBUGSERVER_E_UNKNOWN_ERROR;
+	if (client->recv_offset >= client->recv_length) {
+		/* read ahead as much as is available instead of a byte at a time */
+		if (!client->recv_buffer) {
+			client->recv_buffer = (char*)malloc(DEBUGSERVER_RECV_BUFFER_SIZE);
+			if (!client->recv_buffer) {
+				return DEBUGSERVER_E_UNKNOWN_ERROR;
+			}
+		}
+		client->recv_length = 0;
+		client->recv_offset = 0;
+
+		/* SSL reads only return once the full length arrived or the timeout
+		 * hit, so there only a single byte can be asked for without stalling */
+		uint32_t want = DEBUGSERVER_RECV_BUFFER_SIZE;
+		if (client->parent && client->parent->connection && client->parent->connection->ssl_data) {
+			want = sizeof(char);
+		}
+
+		/* we loop here as we expect an answer */
+		res = debugserver_client_receive(client, client->recv_buffer, want, &bytes);
+		if (res != DEBUGSERVER_E_SUCCESS) {
+			return res;
+		}
+		if (bytes == 0) {
+			debug_info("received no data when asking for at least %d bytes!", sizeof(char));
+			return DEBUGSERVER_E_UNKNOWN_ERROR;
+		}
+		client->recv_length = bytes;
 	}
+	*received_char = client->recv_buffer[client->recv_offset++];
 	return res;
 }
 
@@ -459,12 +631,13 @@ debugserver_error_t debugserver_client_receive_response(debugserver_client_t cli
 			checksum_length--;
 		}
 		if (buffer_size + 1 >= buffer_capacity) {
-			char* newbuffer = realloc(buffer, buffer_capacity+1024);
+			/* grow geometrically, large memory reads are megabytes */
+			char* newbuffer = realloc(buffer, buffer_capacity * 2);
 			if (!newbuffer) {
 				return DEBUGSERVER_E_UNKNOWN_ERROR;
 			}
 			buffer = newbuffer;
-			buffer_capacity += 1024;
+			buffer_capacity *= 2;
 		}
 		buffer[buffer_size] = data;
 		buffer_size += sizeof(char);
@@ -503,15 +676,9 @@ cleanup:
 	return res;
 }
 
-debugserver_error_t debugserver_client_send_command(debugserver_client_t client, debugserver_command_t command, char** response, size_t* response_size)
+static void debugserver_format_packet(debugserver_command_t command, char** buffer, uint32_t* size)
 {
-	debugserver_error_t res = DEBUGSERVER_E_SUCCESS;
 	int i;
-	uint32_t bytes = 0;
-
-	char* send_buffer = NULL;
-	uint32_t send_buffer_size = 0;
-
 	char* command_arguments = NULL;
 
 	/* concat all arguments */
@@ -523,7 +690,21 @@ debugserver_error_t debugserver_client_send_command(debugserver_client_t client,
 	debug_info("command_arguments(%d): %s", command->argc, command_arguments);
 
 	/* encode command arguments, add checksum if required and assemble entire command */
-	debugserver_format_command("$", command->name, command_arguments, 1, &send_buffer, &send_buffer_size);
+	debugserver_format_command("$", command->name, command_arguments, 1, buffer, size);
+
+	if (command_arguments)
+		free(command_arguments);
+}
+
+debugserver_error_t debugserver_client_send_command(debugserver_client_t client, debugserver_command_t command, char** response, size_t* response_size)
+{
+	debugserver_error_t res = DEBUGSERVER_E_SUCCESS;
+	uint32_t bytes = 0;
+
+	char* send_buffer = NULL;
+	uint32_t send_buffer_size = 0;
+
+	debugserver_format_packet(command, &send_buffer, &send_buffer_size);
 
 	debug_info("sending encoded command: %s", send_buffer);
 
@@ -550,15 +731,81 @@ debugserver_error_t debugserver_client_send_command(debugserver_client_t client,
 	}
 
 cleanup:
-	if (command_arguments)
-		free(command_arguments);
-
 	if (send_buffer)
 		free(send_buffer);
 
 	return res;
 }
 
+debugserver_error_t debugserver_client_send_commands(debugserver_client_t client, debugserver_command_t* commands, unsigned int count, char** responses, size_t* response_sizes)
+{
+	debugserver_error_t res = DEBUGSERVER_E_SUCCESS;
+	unsigned int sent = 0;
+	unsigned int received = 0;
+	unsigned int i;
+
+	if (!client || !commands || count == 0)
+		return DEBUGSERVER_E_INVALID_ARG;
+
+	if (responses) {
+		for (i = 0; i < count; i++) {
+			responses[i] = NULL;
+		}
+	}
+
+	if (!client->noack_mode) {
+		/* every packet needs to be acknowledged, no pipelining possible */
+		for (i = 0; i < count && res == DEBUGSERVER_E_SUCCESS; i++) {
+			res = debugserver_client_send_command(client, commands[i], (responses) ? &responses[i] : NULL, (response_sizes) ? &response_sizes[i] : NULL);
+		}
+		return res;
+	}
+
+	while (received < count) {
+		/* top up the window of outstanding commands with a single send */
+		if (sent < count && sent - received < DEBUGSERVER_PIPELINE_DEPTH / 2) {
+			char* send_buffer = NULL;
+			uint32_t send_buffer_size = 0;
+			uint32_t bytes = 0;
+			while (sent < count && sent - received < DEBUGSERVER_PIPELINE_DEPTH) {
+				char* packet = NULL;
+				uint32_t packet_size = 0;
+				debugserver_format_packet(commands[sent], &packet, &packet_size);
+				char* newbuffer = realloc(send_buffer, send_buffer_size + packet_size);
+				if (!newbuffer) {
+					free(packet);
+					break;
+				}
+				send_buffer = newbuffer;
+				memcpy(send_buffer + send_buffer_size, packet, packet_size);
+				send_buffer_size += packet_size;
+				free(packet);
+				sent++;
+			}
+			if (!send_buffer) {
+				res = DEBUGSERVER_E_UNKNOWN_ERROR;
+				break;
+			}
+			debug_info("sending %d pipelined commands", sent - received);
+			res = debugserver_client_send(client, send_buffer, send_buffer_size, &bytes);
+			free(send_buffer);
+			if (res != DEBUGSERVER_E_SUCCESS) {
+				break;
+			}
+		}
+
+		/* responses arrive in the order the commands were sent */
+		res = debugserver_client_receive_response(client, (responses) ? &responses[received] : NULL, (response_sizes) ? &response_sizes[received] : NULL);
+		if (res != DEBUGSERVER_E_SUCCESS) {
+			debug_info("receiving response %d of %d failed: %d", received + 1, count, res);
+			break;
+		}
+		received++;
+	}
+
+	return res;
+}
+
 debugserver_error_t debugserver_client_set_environment_hex_encoded(debugserver_client_t client, const char* env, char** response)
 {
 	if (!client || !env)
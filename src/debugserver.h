@@ -27,12 +27,17 @@
 #include "service.h"
 
 #define DEBUGSERVER_CHECKSUM_HASH_LENGTH 0x3
+#define DEBUGSERVER_RECV_BUFFER_SIZE 0x4000
+#define DEBUGSERVER_PIPELINE_DEPTH 64
 
 struct debugserver_client_private {
 	service_client_t parent;
 	int noack_mode;
 	int (*cancel_receive)();
 	int receive_loop_timeout;
+	char* recv_buffer;
+	uint32_t recv_length;
+	uint32_t recv_offset;
 };
 
 struct debugserver_command_private {
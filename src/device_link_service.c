@@ -22,6 +22,8 @@
 #ifdef HAVE_CONFIG_H
 #include <config.h>
 #endif
+#define DEBUG_SUBSYSTEM DEBUG_SUBSYSTEM_PLIST
+
 #include <string.h>
 #include <stdlib.h>
 #include "device_link_service.h"
@@ -376,23 +378,30 @@ device_link_service_error_t device_link_service_receive_message(device_link_serv
 }
 
 /**
- * Receives a DLMessageProcessMessage plist.
+ * Receives a DLMessageProcessMessage plist without copying its contents.
  *
  * @param client The connected device link service client used for receiving.
- * @param message Pointer to a plist that will be set to the contents of the
- *    message contents upon successful return.
+ * @param container Pointer to a plist that will be set to the complete
+ *    received message upon successful return. The caller is responsible
+ *    for freeing it with plist_free().
+ * @param message Pointer to a plist that will be set to the message contents
+ *    inside of container. It is only valid until container is freed and
+ *    must not be freed separately.
  *
  * @return DEVICE_LINK_SERVICE_E_SUCCESS when a DLMessageProcessMessage was
- *    received, DEVICE_LINK_SERVICE_E_INVALID_ARG when client or message is
- *    invalid, DEVICE_LINK_SERVICE_E_PLIST_ERROR if the received plist is
- *    invalid or is not a DLMessageProcessMessage,
+ *    received, DEVICE_LINK_SERVICE_E_INVALID_ARG when client, container or
+ *    message is invalid, DEVICE_LINK_SERVICE_E_PLIST_ERROR if the received
+ *    plist is invalid or is not a DLMessageProcessMessage,
  *    or DEVICE_LINK_SERVICE_E_MUX_ERROR if receiving from device fails.
  */
-device_link_service_error_t device_link_service_receive_process_message(device_link_service_client_t client, plist_t *message)
+device_link_service_error_t device_link_service_receive_process_message_borrowed(device_link_service_client_t client, plist_t *container, plist_t *message)
 {
-	if (!client || !client->parent || !message)
+	if (!client || !client->parent || !container || !message)
 		return DEVICE_LINK_SERVICE_E_INVALID_ARG;
 
+	*container = NULL;
+	*message = NULL;
+
 	plist_t pmsg = NULL;
 	device_link_service_error_t err = device_link_error(property_list_service_receive_plist(client->parent, &pmsg));
 	if (err != DEVICE_LINK_SERVICE_E_SUCCESS) {
@@ -417,10 +426,11 @@ device_link_service_error_t device_link_service_receive_process_message(device_l
 
 	plist_t msg_loc = plist_array_get_item(pmsg, 1);
 	if (msg_loc) {
-		*message = plist_copy(msg_loc);
+		*container = pmsg;
+		*message = msg_loc;
+		pmsg = NULL;
 		err = DEVICE_LINK_SERVICE_E_SUCCESS;
 	} else {
-		*message = NULL;
 		err = DEVICE_LINK_SERVICE_E_PLIST_ERROR;
 	}
 
@@ -433,6 +443,37 @@ leave:
 	return err;
 }
 
+/**
+ * Receives a DLMessageProcessMessage plist.
+ *
+ * @param client The connected device link service client used for receiving.
+ * @param message Pointer to a plist that will be set to the contents of the
+ *    message contents upon successful return.
+ *
+ * @return DEVICE_LINK_SERVICE_E_SUCCESS when a DLMessageProcessMessage was
+ *    received, DEVICE_LINK_SERVICE_E_INVALID_ARG when client or message is
+ *    invalid, DEVICE_LINK_SERVICE_E_PLIST_ERROR if the received plist is
+ *    invalid or is not a DLMessageProcessMessage,
+ *    or DEVICE_LINK_SERVICE_E_MUX_ERROR if receiving from device fails.
+ */
+device_link_service_error_t device_link_service_receive_process_message(device_link_service_client_t client, plist_t *message)
+{
+	if (!client || !client->parent || !message)
+		return DEVICE_LINK_SERVICE_E_INVALID_ARG;
+
+	plist_t container = NULL;
+	plist_t msg_loc = NULL;
+	device_link_service_error_t err = device_link_service_receive_process_message_borrowed(client, &container, &msg_loc);
+	if (err == DEVICE_LINK_SERVICE_E_SUCCESS) {
+		*message = plist_copy(msg_loc);
+		plist_free(container);
+	} else if (err == DEVICE_LINK_SERVICE_E_PLIST_ERROR) {
+		*message = NULL;
+	}
+
+	return err;
+}
+
 /**
  * Generic device link service send function.
  *
@@ -181,6 +181,9 @@ diagnostics_relay_error_t diagnostics_relay_goodbye(diagnostics_relay_client_t c
 	plist_free(dict);
 	dict = NULL;
 
+	/* the device ends the session, so the connection can't be reused */
+	service_client_set_reusable(client->parent->parent, 0);
+
 	ret = diagnostics_relay_receive(client, &dict);
 	if (!dict) {
 		debug_info("did not get goodbye response back");
@@ -22,6 +22,8 @@
 #ifdef HAVE_CONFIG_H
 #include <config.h>
 #endif
+#define DEBUG_SUBSYSTEM DEBUG_SUBSYSTEM_AFC
+
 #include <string.h>
 #include <stdlib.h>
 
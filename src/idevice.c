@@ -24,11 +24,14 @@
 #ifdef HAVE_CONFIG_H
 #include <config.h>
 #endif
+#define DEBUG_SUBSYSTEM DEBUG_SUBSYSTEM_CONNECTION
 
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <time.h>
+#include <inttypes.h>
+#include <sys/time.h>
 
 #ifdef _WIN32
 #include <winsock2.h>
@@ -36,7 +39,9 @@
 #include <windows.h>
 #else
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <netinet/in.h>
+#include <fcntl.h>
 #endif
 
 #include <usbmuxd.h>
@@ -181,8 +186,17 @@ static void internal_idevice_deinit(void)
 #endif
 }
 
+static int io_stats_enabled = 0;
+
 INITIALIZER(internal_idevice_init)
 {
+	internal_debug_init();
+
+	const char *env = getenv("LIBIMOBILEDEVICE_IO_STATS");
+	if (env && *env && strcmp(env, "0") != 0) {
+		io_stats_enabled = 1;
+	}
+
 #if defined(HAVE_OPENSSL)
 #if OPENSSL_VERSION_NUMBER < 0x10100000L || defined(LIBRESSL_VERSION_NUMBER)
 	int i;
@@ -302,57 +316,445 @@ idevice_error_t idevice_event_unsubscribe(void)
 	return idevice_events_unsubscribe(event_ctx);
 }
 
-idevice_error_t idevice_get_device_list_extended(idevice_info_t **devices, int *count)
+static size_t muxdev_addr_len(const usbmuxd_device_info_t *muxdev)
 {
-	usbmuxd_device_info_t *dev_list;
+	const struct sockaddr* saddr = (const struct sockaddr*)(muxdev->conn_data);
+	switch (saddr->sa_family) {
+		case AF_INET:
+			return sizeof(struct sockaddr_in);
+#ifdef AF_INET6
+		case AF_INET6:
+			return sizeof(struct sockaddr_in6);
+#endif
+		default:
+			debug_info("Unsupported address family 0x%02x\n", saddr->sa_family);
+			return 0;
+	}
+}
 
-	*devices = NULL;
-	*count = 0;
+static idevice_info_t idevice_info_from_mux_device(const usbmuxd_device_info_t *muxdev)
+{
+	size_t addrlen = 0;
+	if (muxdev->conn_type == CONNECTION_TYPE_NETWORK) {
+		addrlen = muxdev_addr_len(muxdev);
+		if (addrlen == 0) {
+			return NULL;
+		}
+	}
+	idevice_info_t info = (idevice_info_t)malloc(sizeof(struct idevice_info));
+	if (!info) {
+		return NULL;
+	}
+	info->udid = strdup(muxdev->udid);
+	info->conn_type = (muxdev->conn_type == CONNECTION_TYPE_NETWORK) ? CONNECTION_NETWORK : CONNECTION_USBMUXD;
+	info->conn_data = NULL;
+	if (addrlen > 0) {
+		info->conn_data = malloc(addrlen);
+		memcpy(info->conn_data, muxdev->conn_data, addrlen);
+	}
+	return info;
+}
 
-	if (usbmuxd_get_device_list(&dev_list) < 0) {
-		debug_info("ERROR: usbmuxd is not running!", __func__);
+/*
+ * In-process device registry, kept current by usbmuxd device events.
+ * Readers take a reference to an immutable snapshot; every device event
+ * builds a new snapshot and swaps it in, so lookups never wait on usbmuxd.
+ */
+
+struct idevice_registry_entry {
+	struct idevice_info info;
+	usbmuxd_device_info_t muxdev;
+};
+
+struct idevice_registry_snapshot_private {
+	unsigned int refcount;
+	int count;
+	struct idevice_registry_entry *entries;
+	int *index; /* open addressing hash table of entry indices keyed by udid, -1 if empty */
+	unsigned int index_mask;
+};
+
+static mutex_t registry_mutex;
+static thread_once_t registry_once = THREAD_ONCE_INIT;
+static usbmuxd_subscription_context_t registry_ctx = NULL;
+static idevice_registry_snapshot_t registry_current = NULL;
+
+static void registry_init(void)
+{
+	mutex_init(&registry_mutex);
+}
+
+static unsigned int registry_hash(const char *udid)
+{
+	/* FNV-1a */
+	unsigned int hash = 2166136261u;
+	while (*udid) {
+		hash ^= (unsigned char)*udid++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static idevice_registry_snapshot_t registry_snapshot_new(const usbmuxd_device_info_t *devices, int count)
+{
+	idevice_registry_snapshot_t snapshot = (idevice_registry_snapshot_t)calloc(1, sizeof(struct idevice_registry_snapshot_private));
+	if (!snapshot) {
+		return NULL;
+	}
+	unsigned int index_size = 8;
+	while (index_size < (unsigned int)count * 2) {
+		index_size <<= 1;
+	}
+	snapshot->entries = (struct idevice_registry_entry*)calloc((count > 0) ? count : 1, sizeof(struct idevice_registry_entry));
+	snapshot->index = (int*)malloc(index_size * sizeof(int));
+	if (!snapshot->entries || !snapshot->index) {
+		free(snapshot->entries);
+		free(snapshot->index);
+		free(snapshot);
+		return NULL;
+	}
+	memset(snapshot->index, 0xFF, index_size * sizeof(int));
+	snapshot->index_mask = index_size - 1;
+	snapshot->refcount = 1;
+
+	int i;
+	for (i = 0; i < count; i++) {
+		if (devices[i].conn_type == CONNECTION_TYPE_NETWORK && muxdev_addr_len(&devices[i]) == 0) {
+			continue;
+		}
+		struct idevice_registry_entry *entry = &snapshot->entries[snapshot->count];
+		entry->muxdev = devices[i];
+		entry->info.udid = entry->muxdev.udid;
+		if (entry->muxdev.conn_type == CONNECTION_TYPE_NETWORK) {
+			entry->info.conn_type = CONNECTION_NETWORK;
+			entry->info.conn_data = entry->muxdev.conn_data;
+		} else {
+			entry->info.conn_type = CONNECTION_USBMUXD;
+			entry->info.conn_data = NULL;
+		}
+		unsigned int slot = registry_hash(entry->muxdev.udid) & snapshot->index_mask;
+		while (snapshot->index[slot] != -1) {
+			slot = (slot + 1) & snapshot->index_mask;
+		}
+		snapshot->index[slot] = snapshot->count;
+		snapshot->count++;
+	}
+
+	return snapshot;
+}
+
+/* must be called with registry_mutex held */
+static void registry_snapshot_release(idevice_registry_snapshot_t snapshot)
+{
+	if (snapshot && --snapshot->refcount == 0) {
+		free(snapshot->entries);
+		free(snapshot->index);
+		free(snapshot);
+	}
+}
+
+/* must be called with registry_mutex held */
+static const usbmuxd_device_info_t* registry_snapshot_lookup(idevice_registry_snapshot_t snapshot, const char *udid, int usbmux_options)
+{
+	const usbmuxd_device_info_t *usb = NULL;
+	const usbmuxd_device_info_t *net = NULL;
+	unsigned int slot = registry_hash(udid) & snapshot->index_mask;
+	while (snapshot->index[slot] != -1) {
+		const usbmuxd_device_info_t *muxdev = &snapshot->entries[snapshot->index[slot]].muxdev;
+		if (strcmp(muxdev->udid, udid) == 0) {
+			if (muxdev->conn_type == CONNECTION_TYPE_NETWORK) {
+				net = muxdev;
+			} else {
+				usb = muxdev;
+			}
+		}
+		slot = (slot + 1) & snapshot->index_mask;
+	}
+	/* same semantics as usbmuxd_get_device() */
+	if (usbmux_options == 0) {
+		usbmux_options = DEVICE_LOOKUP_USBMUX;
+	}
+	if ((usbmux_options & DEVICE_LOOKUP_PREFER_NETWORK) && (usbmux_options & DEVICE_LOOKUP_NETWORK) && net) {
+		return net;
+	}
+	if ((usbmux_options & DEVICE_LOOKUP_USBMUX) && usb) {
+		return usb;
+	}
+	if ((usbmux_options & DEVICE_LOOKUP_NETWORK) && net) {
+		return net;
+	}
+	return NULL;
+}
+
+/* Devices seen by the event callback while idevice_registry_start() is still
+ * fetching the initial device list; merged with that list before the first
+ * snapshot is published. */
+static int registry_starting = 0;
+static idevice_registry_snapshot_t registry_pending = NULL;
+static uint32_t *registry_removed = NULL;
+static int registry_removed_count = 0;
+
+/* must be called with registry_mutex held */
+static idevice_registry_snapshot_t registry_snapshot_apply(idevice_registry_snapshot_t current, const usbmuxd_event_t *event)
+{
+	usbmuxd_device_info_t *devices = (usbmuxd_device_info_t*)malloc((current->count + 1) * sizeof(usbmuxd_device_info_t));
+	if (!devices) {
+		return NULL;
+	}
+	int i, count = 0;
+	for (i = 0; i < current->count; i++) {
+		/* the initial events for already known devices replace their entries */
+		if (current->entries[i].muxdev.handle != event->device.handle) {
+			devices[count++] = current->entries[i].muxdev;
+		}
+	}
+	if (event->event == UE_DEVICE_ADD) {
+		devices[count++] = event->device;
+	}
+	idevice_registry_snapshot_t snapshot = registry_snapshot_new(devices, count);
+	free(devices);
+	return snapshot;
+}
+
+static void registry_event_cb(const usbmuxd_event_t *event, void *user_data)
+{
+	if (event->event != UE_DEVICE_ADD && event->event != UE_DEVICE_REMOVE) {
+		return;
+	}
+	mutex_lock(&registry_mutex);
+	if (registry_current) {
+		idevice_registry_snapshot_t snapshot = registry_snapshot_apply(registry_current, event);
+		if (snapshot) {
+			debug_info("device registry now has %d devices", snapshot->count);
+			registry_snapshot_release(registry_current);
+			registry_current = snapshot;
+		}
+	} else if (registry_starting && registry_pending) {
+		/* not published yet, idevice_registry_start() merges these */
+		idevice_registry_snapshot_t snapshot = registry_snapshot_apply(registry_pending, event);
+		if (snapshot) {
+			registry_snapshot_release(registry_pending);
+			registry_pending = snapshot;
+		}
+		if (event->event == UE_DEVICE_REMOVE) {
+			uint32_t *removed = (uint32_t*)realloc(registry_removed, (registry_removed_count + 1) * sizeof(uint32_t));
+			if (removed) {
+				registry_removed = removed;
+				registry_removed[registry_removed_count++] = event->device.handle;
+			}
+		}
+	}
+	mutex_unlock(&registry_mutex);
+}
+
+/* must be called with registry_mutex held */
+static idevice_registry_snapshot_t registry_snapshot_merge_pending(const usbmuxd_device_info_t *dev_list, int count)
+{
+	usbmuxd_device_info_t *devices = (usbmuxd_device_info_t*)malloc((count + registry_pending->count + 1) * sizeof(usbmuxd_device_info_t));
+	if (!devices) {
+		return NULL;
+	}
+	int i, j, merged = 0;
+	/* devices the events reported are more recent than the device list */
+	for (i = 0; i < registry_pending->count; i++) {
+		devices[merged++] = registry_pending->entries[i].muxdev;
+	}
+	for (i = 0; i < count; i++) {
+		int skip = 0;
+		for (j = 0; j < registry_pending->count && !skip; j++) {
+			skip = (registry_pending->entries[j].muxdev.handle == dev_list[i].handle);
+		}
+		for (j = 0; j < registry_removed_count && !skip; j++) {
+			skip = (registry_removed[j] == dev_list[i].handle);
+		}
+		if (!skip) {
+			devices[merged++] = dev_list[i];
+		}
+	}
+	idevice_registry_snapshot_t snapshot = registry_snapshot_new(devices, merged);
+	free(devices);
+	return snapshot;
+}
+
+/* must be called with registry_mutex held */
+static void registry_pending_clear(void)
+{
+	registry_snapshot_release(registry_pending);
+	registry_pending = NULL;
+	free(registry_removed);
+	registry_removed = NULL;
+	registry_removed_count = 0;
+	registry_starting = 0;
+}
+
+idevice_error_t idevice_registry_start(void)
+{
+	thread_once(&registry_once, registry_init);
+
+	mutex_lock(&registry_mutex);
+	if (registry_ctx || registry_starting) {
+		mutex_unlock(&registry_mutex);
+		return IDEVICE_E_SUCCESS;
+	}
+	registry_pending = registry_snapshot_new(NULL, 0);
+	if (!registry_pending) {
+		mutex_unlock(&registry_mutex);
+		return IDEVICE_E_UNKNOWN_ERROR;
+	}
+	registry_starting = 1;
+	mutex_unlock(&registry_mutex);
+
+	/* libusbmuxd may invoke the callback synchronously from here, and it
+	 * holds its own listener lock while doing so, so registry_mutex must
+	 * not be held across the call */
+	usbmuxd_subscription_context_t ctx = NULL;
+	if (usbmuxd_events_subscribe(&ctx, registry_event_cb, NULL) != 0) {
+		debug_info("ERROR: usbmuxd_events_subscribe() failed");
+		mutex_lock(&registry_mutex);
+		registry_pending_clear();
+		mutex_unlock(&registry_mutex);
+		return IDEVICE_E_UNKNOWN_ERROR;
+	}
+
+	usbmuxd_device_info_t *dev_list = NULL;
+	int count = usbmuxd_get_device_list(&dev_list);
+	if (count < 0) {
+		debug_info("ERROR: usbmuxd is not running!");
+		usbmuxd_events_unsubscribe(ctx);
+		mutex_lock(&registry_mutex);
+		registry_pending_clear();
+		mutex_unlock(&registry_mutex);
 		return IDEVICE_E_NO_DEVICE;
 	}
 
+	mutex_lock(&registry_mutex);
+	idevice_registry_snapshot_t snapshot = registry_snapshot_merge_pending(dev_list, count);
+	registry_pending_clear();
+	if (snapshot) {
+		registry_current = snapshot;
+		registry_ctx = ctx;
+	}
+	mutex_unlock(&registry_mutex);
+	usbmuxd_device_list_free(&dev_list);
+
+	if (!snapshot) {
+		usbmuxd_events_unsubscribe(ctx);
+		return IDEVICE_E_UNKNOWN_ERROR;
+	}
+
+	return IDEVICE_E_SUCCESS;
+}
+
+idevice_error_t idevice_registry_stop(void)
+{
+	thread_once(&registry_once, registry_init);
+
+	mutex_lock(&registry_mutex);
+	usbmuxd_subscription_context_t ctx = registry_ctx;
+	registry_ctx = NULL;
+	mutex_unlock(&registry_mutex);
+
+	if (!ctx) {
+		return IDEVICE_E_SUCCESS;
+	}
+	/* joins the event thread, so it must not be called with the lock held */
+	usbmuxd_events_unsubscribe(ctx);
+
+	mutex_lock(&registry_mutex);
+	registry_snapshot_release(registry_current);
+	registry_current = NULL;
+	mutex_unlock(&registry_mutex);
+
+	return IDEVICE_E_SUCCESS;
+}
+
+idevice_error_t idevice_registry_get_snapshot(idevice_registry_snapshot_t *snapshot)
+{
+	if (!snapshot) {
+		return IDEVICE_E_INVALID_ARG;
+	}
+	thread_once(&registry_once, registry_init);
+
+	mutex_lock(&registry_mutex);
+	*snapshot = registry_current;
+	if (registry_current) {
+		registry_current->refcount++;
+	}
+	mutex_unlock(&registry_mutex);
+
+	return (*snapshot) ? IDEVICE_E_SUCCESS : IDEVICE_E_INVALID_ARG;
+}
+
+int idevice_registry_snapshot_get_count(idevice_registry_snapshot_t snapshot)
+{
+	return (snapshot) ? snapshot->count : 0;
+}
+
+idevice_info_t idevice_registry_snapshot_get_item(idevice_registry_snapshot_t snapshot, int index)
+{
+	if (!snapshot || index < 0 || index >= snapshot->count) {
+		return NULL;
+	}
+	return &snapshot->entries[index].info;
+}
+
+idevice_error_t idevice_registry_snapshot_free(idevice_registry_snapshot_t snapshot)
+{
+	if (!snapshot) {
+		return IDEVICE_E_INVALID_ARG;
+	}
+	mutex_lock(&registry_mutex);
+	registry_snapshot_release(snapshot);
+	mutex_unlock(&registry_mutex);
+	return IDEVICE_E_SUCCESS;
+}
+
+idevice_error_t idevice_get_device_list_extended(idevice_info_t **devices, int *count)
+{
+	idevice_registry_snapshot_t snapshot = NULL;
 	idevice_info_t *newlist = NULL;
 	int i, newcount = 0;
 
-	for (i = 0; dev_list[i].handle > 0; i++) {
-		newlist = realloc(*devices, sizeof(idevice_info_t) * (newcount+1));
-		newlist[newcount] = malloc(sizeof(struct idevice_info));
-		newlist[newcount]->udid = strdup(dev_list[i].udid);
-		if (dev_list[i].conn_type == CONNECTION_TYPE_USB) {
-			newlist[newcount]->conn_type = CONNECTION_USBMUXD;
-			newlist[newcount]->conn_data = NULL;
-		} else if (dev_list[i].conn_type == CONNECTION_TYPE_NETWORK) {
-			newlist[newcount]->conn_type = CONNECTION_NETWORK;
-			struct sockaddr* saddr = (struct sockaddr*)(dev_list[i].conn_data);
-			size_t addrlen = 0;
-			switch (saddr->sa_family) {
-				case AF_INET:
-					addrlen = sizeof(struct sockaddr_in);
-					break;
-#ifdef AF_INET6
-				case AF_INET6:
-					addrlen = sizeof(struct sockaddr_in6);
-					break;
-#endif
-				default:
-					debug_info("Unsupported address family 0x%02x\n", saddr->sa_family);
-					continue;
+	*devices = NULL;
+	*count = 0;
+
+	if (idevice_registry_get_snapshot(&snapshot) == IDEVICE_E_SUCCESS) {
+		newlist = (idevice_info_t*)malloc(sizeof(idevice_info_t) * (snapshot->count + 1));
+		if (!newlist) {
+			idevice_registry_snapshot_free(snapshot);
+			return IDEVICE_E_UNKNOWN_ERROR;
+		}
+		for (i = 0; i < snapshot->count; i++) {
+			idevice_info_t info = idevice_info_from_mux_device(&snapshot->entries[i].muxdev);
+			if (info) {
+				newlist[newcount++] = info;
+			}
+		}
+		idevice_registry_snapshot_free(snapshot);
+	} else {
+		usbmuxd_device_info_t *dev_list;
+		int dev_count = usbmuxd_get_device_list(&dev_list);
+		if (dev_count < 0) {
+			debug_info("ERROR: usbmuxd is not running!");
+			return IDEVICE_E_NO_DEVICE;
+		}
+		newlist = (idevice_info_t*)malloc(sizeof(idevice_info_t) * (dev_count + 1));
+		if (!newlist) {
+			usbmuxd_device_list_free(&dev_list);
+			return IDEVICE_E_UNKNOWN_ERROR;
+		}
+		for (i = 0; i < dev_count && dev_list[i].handle > 0; i++) {
+			idevice_info_t info = idevice_info_from_mux_device(&dev_list[i]);
+			if (info) {
+				newlist[newcount++] = info;
 			}
-			newlist[newcount]->conn_data = malloc(addrlen);
-			memcpy(newlist[newcount]->conn_data, dev_list[i].conn_data, addrlen);
 		}
-		newcount++;
-		*devices = newlist;
+		usbmuxd_device_list_free(&dev_list);
 	}
-	usbmuxd_device_list_free(&dev_list);
-
-	*count = newcount;
-	newlist = realloc(*devices, sizeof(idevice_info_t) * (newcount+1));
 	newlist[newcount] = NULL;
+
 	*devices = newlist;
+	*count = newcount;
 
 	return IDEVICE_E_SUCCESS;
 }
@@ -422,6 +824,122 @@ void idevice_set_debug_level(int level)
 	internal_set_debug_level(level);
 }
 
+idevice_error_t idevice_set_debug_subsystem_level(const char *subsystem, int level)
+{
+	if (internal_set_debug_subsystem_level(subsystem, level) < 0) {
+		return IDEVICE_E_INVALID_ARG;
+	}
+	return IDEVICE_E_SUCCESS;
+}
+
+void idevice_set_debug_ring_size(unsigned int events)
+{
+	internal_set_debug_ring_size(events);
+}
+
+void idevice_dump_debug_ring(void)
+{
+	internal_dump_debug_ring();
+}
+
+/**
+ * Name of the per-device cache file holding attributes that don't change
+ * while the device stays attached.
+ */
+#define DEVICE_ATTRIBUTES_CACHE "attributes"
+
+/**
+ * Identifies the running usbmuxd instance. Device handles are only unique
+ * within one instance, they start over at 1 when usbmuxd or the host
+ * restarts. The listening socket is created anew by every instance, so its
+ * inode and change time tell instances apart.
+ *
+ * @return 0 on success, -1 if the instance can't be identified, e.g. when
+ *     usbmuxd is reached through TCP.
+ */
+static int usbmuxd_instance_id(char *buf, size_t size)
+{
+#ifdef _WIN32
+	return -1;
+#else
+	const char *path = "/var/run/usbmuxd";
+	const char *env = getenv("USBMUXD_SOCKET_ADDRESS");
+	if (env && *env) {
+		if (strncmp(env, "UNIX:", 5) != 0) {
+			return -1;
+		}
+		path = env + 5;
+	}
+	struct stat st;
+	if (stat(path, &st) != 0) {
+		return -1;
+	}
+	snprintf(buf, size, "%llx:%llx:%llx", (unsigned long long)st.st_dev, (unsigned long long)st.st_ino, (unsigned long long)st.st_ctime);
+	return 0;
+#endif
+}
+
+/**
+ * Loads the version and device class of a device from the attribute cache
+ * stored next to its pair record. The cache is only used if it was written
+ * during the current attachment of the device to the same usbmuxd instance,
+ * i.e. it is invalidated when the device reconnects, which includes the
+ * reboot after an OS update, and when usbmuxd restarts.
+ */
+static void device_attributes_load(idevice_t device)
+{
+	char instance[64];
+	if (usbmuxd_instance_id(instance, sizeof(instance)) != 0) {
+		return;
+	}
+
+	plist_t cache = NULL;
+	if (!device->udid || userpref_read_device_cache(device->udid, DEVICE_ATTRIBUTES_CACHE, &cache) != USERPREF_E_SUCCESS) {
+		return;
+	}
+	uint64_t mux_id = 0;
+	uint64_t conn_type = 0;
+	uint64_t version = 0;
+	uint64_t device_class = 0;
+	plist_get_uint_val(plist_dict_get_item(cache, "MuxId"), &mux_id);
+	plist_get_uint_val(plist_dict_get_item(cache, "ConnectionType"), &conn_type);
+	plist_get_uint_val(plist_dict_get_item(cache, "Version"), &version);
+	plist_get_uint_val(plist_dict_get_item(cache, "DeviceClass"), &device_class);
+	plist_t node = plist_dict_get_item(cache, "MuxInstance");
+	const char *cached_instance = (node && plist_get_node_type(node) == PLIST_STRING) ? plist_get_string_ptr(node, NULL) : NULL;
+	int same_instance = (cached_instance && strcmp(cached_instance, instance) == 0);
+	plist_free(cache);
+
+	if (!same_instance || mux_id != device->mux_id || conn_type != (uint64_t)device->conn_type) {
+		debug_info("Ignoring stale attribute cache for %s", device->udid);
+		return;
+	}
+	device->version = (int)version;
+	device->device_class = (int)device_class;
+	debug_info("Using cached attributes for %s: version 0x%x, class %d", device->udid, device->version, device->device_class);
+}
+
+void idevice_store_device_attributes(idevice_t device)
+{
+	char instance[64];
+	if (!device || !device->udid || !device->version || !device->device_class) {
+		return;
+	}
+	if (usbmuxd_instance_id(instance, sizeof(instance)) != 0) {
+		return;
+	}
+	plist_t cache = plist_new_dict();
+	plist_dict_set_item(cache, "MuxInstance", plist_new_string(instance));
+	plist_dict_set_item(cache, "MuxId", plist_new_uint(device->mux_id));
+	plist_dict_set_item(cache, "ConnectionType", plist_new_uint(device->conn_type));
+	plist_dict_set_item(cache, "Version", plist_new_uint(device->version));
+	plist_dict_set_item(cache, "DeviceClass", plist_new_uint(device->device_class));
+	if (userpref_save_device_cache(device->udid, DEVICE_ATTRIBUTES_CACHE, cache) != USERPREF_E_SUCCESS) {
+		debug_info("Failed to store attribute cache for %s", device->udid);
+	}
+	plist_free(cache);
+}
+
 static idevice_t idevice_from_mux_device(usbmuxd_device_info_t *muxdev)
 {
 	if (!muxdev)
@@ -467,6 +985,7 @@ static idevice_t idevice_from_mux_device(usbmuxd_device_info_t *muxdev)
 		device->conn_data = NULL;
 		break;
 	}
+	device_attributes_load(device);
 	return device;
 }
 
@@ -483,6 +1002,27 @@ idevice_error_t idevice_new_with_options(idevice_t * device, const char *udid, e
 	if (options & IDEVICE_LOOKUP_PREFER_NETWORK) {
 		usbmux_options |= DEVICE_LOOKUP_PREFER_NETWORK;
 	}
+	if (udid) {
+		/* consult the device registry first to avoid a usbmuxd round trip */
+		int found = 0;
+		thread_once(&registry_once, registry_init);
+		mutex_lock(&registry_mutex);
+		if (registry_current) {
+			const usbmuxd_device_info_t *entry = registry_snapshot_lookup(registry_current, udid, usbmux_options);
+			if (entry) {
+				muxdev = *entry;
+				found = 1;
+			}
+		}
+		mutex_unlock(&registry_mutex);
+		if (found) {
+			*device = idevice_from_mux_device(&muxdev);
+			if (!*device) {
+				return IDEVICE_E_UNKNOWN_ERROR;
+			}
+			return IDEVICE_E_SUCCESS;
+		}
+	}
 	int res = usbmuxd_get_device(udid, &muxdev, usbmux_options);
 	if (res > 0) {
 		*device = idevice_from_mux_device(&muxdev);
@@ -516,6 +1056,181 @@ idevice_error_t idevice_free(idevice_t device)
 	return ret;
 }
 
+/* monotonic, so durations stay correct when the wall clock is adjusted */
+static uint64_t stats_time_us(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000 + (uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000 / frequency.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+static unsigned int stats_bucket(uint64_t value)
+{
+	unsigned int bucket = 0;
+	while (value > 1 && bucket < IDEVICE_CONNECTION_STATS_BUCKETS-1) {
+		value >>= 1;
+		bucket++;
+	}
+	return bucket;
+}
+
+static void stats_record_send(idevice_connection_t connection, uint32_t bytes, uint64_t start)
+{
+	idevice_connection_stats_private_t st = connection->stats;
+	uint64_t now = stats_time_us();
+	mutex_lock(&st->mutex);
+	if (!st->enabled) {
+		mutex_unlock(&st->mutex);
+		return;
+	}
+	st->stats.send_calls++;
+	st->stats.bytes_sent += bytes;
+	st->stats.send_time_us += now - start;
+	st->stats.send_sizes[stats_bucket(bytes)]++;
+	if (!st->awaiting_reply) {
+		st->request_time = now;
+		st->awaiting_reply = 1;
+	}
+	mutex_unlock(&st->mutex);
+}
+
+static void stats_record_receive(idevice_connection_t connection, uint32_t bytes, uint64_t start, idevice_error_t result)
+{
+	idevice_connection_stats_private_t st = connection->stats;
+	uint64_t now = stats_time_us();
+	mutex_lock(&st->mutex);
+	if (!st->enabled) {
+		mutex_unlock(&st->mutex);
+		return;
+	}
+	st->stats.receive_calls++;
+	st->stats.receive_time_us += now - start;
+	if (result == IDEVICE_E_TIMEOUT) {
+		st->stats.timeouts++;
+	}
+	if (bytes > 0) {
+		st->stats.bytes_received += bytes;
+		st->stats.receive_sizes[stats_bucket(bytes)]++;
+		if (st->awaiting_reply) {
+			st->stats.latencies[stats_bucket(now - st->request_time)]++;
+			st->awaiting_reply = 0;
+		}
+	}
+	mutex_unlock(&st->mutex);
+}
+
+static void stats_count_tls_record(idevice_connection_t connection, int sent)
+{
+	idevice_connection_stats_private_t st = connection->stats;
+	mutex_lock(&st->mutex);
+	if (st->enabled) {
+		if (sent) {
+			st->stats.tls_records_sent++;
+		} else {
+			st->stats.tls_records_received++;
+		}
+	}
+	mutex_unlock(&st->mutex);
+}
+
+static void stats_print_histogram(const char *name, const uint64_t *buckets, const char *unit)
+{
+	int i;
+	int empty = 1;
+	for (i = 0; i < IDEVICE_CONNECTION_STATS_BUCKETS; i++) {
+		if (buckets[i]) {
+			empty = 0;
+			break;
+		}
+	}
+	if (empty) {
+		return;
+	}
+	fprintf(stderr, "[io-stats]   %s:", name);
+	for (i = 0; i < IDEVICE_CONNECTION_STATS_BUCKETS; i++) {
+		if (buckets[i]) {
+			fprintf(stderr, " >=%" PRIu64 "%s:%" PRIu64, (i == 0) ? 0 : ((uint64_t)1 << i), unit, buckets[i]);
+		}
+	}
+	fprintf(stderr, "\n");
+}
+
+static void connection_dump_stats(idevice_connection_t connection)
+{
+	idevice_connection_stats_t stats;
+	if (idevice_connection_get_stats(connection, &stats) != IDEVICE_E_SUCCESS) {
+		return;
+	}
+	fprintf(stderr, "[io-stats] %s (port %u): sent %" PRIu64 " bytes in %" PRIu64 " calls (%.3f ms blocked), received %" PRIu64 " bytes in %" PRIu64 " calls (%.3f ms blocked), %" PRIu64 " timeouts, TLS records %" PRIu64 " sent %" PRIu64 " received\n",
+		(connection->label) ? connection->label : "connection", connection->port,
+		stats.bytes_sent, stats.send_calls, stats.send_time_us / 1000.0,
+		stats.bytes_received, stats.receive_calls, stats.receive_time_us / 1000.0,
+		stats.timeouts, stats.tls_records_sent, stats.tls_records_received);
+	stats_print_histogram("send sizes", stats.send_sizes, "B");
+	stats_print_histogram("receive sizes", stats.receive_sizes, "B");
+	stats_print_histogram("round trips", stats.latencies, "us");
+}
+
+idevice_error_t idevice_connection_enable_stats(idevice_connection_t connection, int enable)
+{
+	if (!connection) {
+		return IDEVICE_E_INVALID_ARG;
+	}
+	if (enable && !connection->stats) {
+		idevice_connection_stats_private_t st = (idevice_connection_stats_private_t)calloc(1, sizeof(struct idevice_connection_stats_private));
+		if (!st) {
+			return IDEVICE_E_UNKNOWN_ERROR;
+		}
+		mutex_init(&st->mutex);
+		st->enabled = 1;
+		connection->stats = st;
+	} else if (connection->stats) {
+		/* I/O on other threads may still be using the block, so it is only
+		 * freed with the connection; disabling discards what was collected */
+		idevice_connection_stats_private_t st = connection->stats;
+		mutex_lock(&st->mutex);
+		if (enable && !st->enabled) {
+			memset(&st->stats, 0, sizeof(st->stats));
+			st->awaiting_reply = 0;
+		}
+		st->enabled = (enable) ? 1 : 0;
+		mutex_unlock(&st->mutex);
+	}
+	return IDEVICE_E_SUCCESS;
+}
+
+idevice_error_t idevice_connection_get_stats(idevice_connection_t connection, idevice_connection_stats_t *stats)
+{
+	idevice_error_t res = IDEVICE_E_INVALID_ARG;
+	if (!connection || !connection->stats || !stats) {
+		return IDEVICE_E_INVALID_ARG;
+	}
+	mutex_lock(&connection->stats->mutex);
+	if (connection->stats->enabled) {
+		*stats = connection->stats->stats;
+		res = IDEVICE_E_SUCCESS;
+	}
+	mutex_unlock(&connection->stats->mutex);
+	return res;
+}
+
+void idevice_connection_set_label(idevice_connection_t connection, const char *label)
+{
+	if (!connection) {
+		return;
+	}
+	free(connection->label);
+	connection->label = (label) ? strdup(label) : NULL;
+}
+
 idevice_error_t idevice_connect(idevice_t device, uint16_t port, idevice_connection_t *connection)
 {
 	if (!device) {
@@ -543,6 +1258,13 @@ idevice_error_t idevice_connect(idevice_t device, uint16_t port, idevice_connect
 		new_connection->device = device;
 		new_connection->ssl_recv_timeout = (unsigned int)-1;
 		new_connection->status = IDEVICE_E_SUCCESS;
+		new_connection->nonblocking = 0;
+		new_connection->port = port;
+		new_connection->label = NULL;
+		new_connection->stats = NULL;
+		if (io_stats_enabled) {
+			idevice_connection_enable_stats(new_connection, 1);
+		}
 		*connection = new_connection;
 		return IDEVICE_E_SUCCESS;
 	}
@@ -587,6 +1309,13 @@ idevice_error_t idevice_connect(idevice_t device, uint16_t port, idevice_connect
 		new_connection->ssl_data = NULL;
 		new_connection->device = device;
 		new_connection->ssl_recv_timeout = (unsigned int)-1;
+		new_connection->nonblocking = 0;
+		new_connection->port = port;
+		new_connection->label = NULL;
+		new_connection->stats = NULL;
+		if (io_stats_enabled) {
+			idevice_connection_enable_stats(new_connection, 1);
+		}
 
 		*connection = new_connection;
 
@@ -619,12 +1348,168 @@ idevice_error_t idevice_disconnect(idevice_connection_t connection)
 		debug_info("Unknown connection type %d", connection->type);
 	}
 
+	if (connection->stats) {
+		if (io_stats_enabled) {
+			connection_dump_stats(connection);
+		}
+		mutex_destroy(&connection->stats->mutex);
+		free(connection->stats);
+		connection->stats = NULL;
+	}
+	free(connection->label);
 	free(connection);
 	connection = NULL;
 
 	return result;
 }
 
+static int connection_would_block(void)
+{
+#ifdef _WIN32
+	return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+	return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
+
+/**
+ * Internally used function to send raw data over a connection in
+ * non-blocking mode. Sends at most once and never waits.
+ */
+static idevice_error_t internal_connection_send_nonblocking(idevice_connection_t connection, const char *data, uint32_t len, uint32_t *sent_bytes)
+{
+	int flags = 0;
+#ifdef MSG_NOSIGNAL
+	flags |= MSG_NOSIGNAL;
+#endif
+	*sent_bytes = 0;
+	int s = send((int)(uintptr_t)connection->data, data, len, flags);
+	if (s < 0) {
+		if (connection_would_block()) {
+			return IDEVICE_E_WANT_WRITE;
+		}
+		debug_info("ERROR: send failed (%s)", strerror(errno));
+		return IDEVICE_E_UNKNOWN_ERROR;
+	}
+	*sent_bytes = (uint32_t)s;
+	return IDEVICE_E_SUCCESS;
+}
+
+/**
+ * Internally used function to receive raw data over a connection in
+ * non-blocking mode. Returns whatever is available and never waits.
+ */
+static idevice_error_t internal_connection_receive_nonblocking(idevice_connection_t connection, char *data, uint32_t len, uint32_t *recv_bytes)
+{
+	*recv_bytes = 0;
+	int r = recv((int)(uintptr_t)connection->data, data, len, 0);
+	if (r < 0) {
+		if (connection_would_block()) {
+			return IDEVICE_E_WANT_READ;
+		}
+		debug_info("ERROR: recv failed (%s)", strerror(errno));
+		return IDEVICE_E_UNKNOWN_ERROR;
+	}
+	if (r == 0) {
+		debug_info("connection closed");
+		return IDEVICE_E_UNKNOWN_ERROR;
+	}
+	*recv_bytes = (uint32_t)r;
+	return IDEVICE_E_SUCCESS;
+}
+
+/**
+ * Internally used function to send data over a connection in non-blocking
+ * mode, with or without SSL.
+ */
+static idevice_error_t connection_send_nonblocking(idevice_connection_t connection, const char *data, uint32_t len, uint32_t *sent_bytes)
+{
+	if (!connection->ssl_data) {
+		return internal_connection_send_nonblocking(connection, data, len, sent_bytes);
+	}
+	*sent_bytes = 0;
+	connection->status = IDEVICE_E_SUCCESS;
+#if defined(HAVE_OPENSSL)
+	int s = SSL_write(connection->ssl_data->session, (const void*)data, (int)len);
+	if (s <= 0) {
+		switch (SSL_get_error(connection->ssl_data->session, s)) {
+		case SSL_ERROR_WANT_READ:
+			return IDEVICE_E_WANT_READ;
+		case SSL_ERROR_WANT_WRITE:
+			return IDEVICE_E_WANT_WRITE;
+		default:
+			return IDEVICE_E_SSL_ERROR;
+		}
+	}
+#elif defined(HAVE_GNUTLS)
+	ssize_t s = gnutls_record_send(connection->ssl_data->session, (const void*)data, (size_t)len);
+	if (s < 0) {
+		if (s == GNUTLS_E_AGAIN || s == GNUTLS_E_INTERRUPTED) {
+			return (gnutls_record_get_direction(connection->ssl_data->session)) ? IDEVICE_E_WANT_WRITE : IDEVICE_E_WANT_READ;
+		}
+		return IDEVICE_E_SSL_ERROR;
+	}
+#elif defined(HAVE_MBEDTLS)
+	int s = mbedtls_ssl_write(&connection->ssl_data->ctx, (const unsigned char*)data, (size_t)len);
+	if (s < 0) {
+		if (s == MBEDTLS_ERR_SSL_WANT_READ) {
+			return IDEVICE_E_WANT_READ;
+		} else if (s == MBEDTLS_ERR_SSL_WANT_WRITE) {
+			return IDEVICE_E_WANT_WRITE;
+		}
+		return IDEVICE_E_SSL_ERROR;
+	}
+#endif
+	*sent_bytes = (uint32_t)s;
+	return IDEVICE_E_SUCCESS;
+}
+
+/**
+ * Internally used function to receive data over a connection in
+ * non-blocking mode, with or without SSL.
+ */
+static idevice_error_t connection_receive_nonblocking(idevice_connection_t connection, char *data, uint32_t len, uint32_t *recv_bytes)
+{
+	if (!connection->ssl_data) {
+		return internal_connection_receive_nonblocking(connection, data, len, recv_bytes);
+	}
+	*recv_bytes = 0;
+	connection->status = IDEVICE_E_SUCCESS;
+#if defined(HAVE_OPENSSL)
+	int r = SSL_read(connection->ssl_data->session, (void*)data, (int)len);
+	if (r <= 0) {
+		switch (SSL_get_error(connection->ssl_data->session, r)) {
+		case SSL_ERROR_WANT_READ:
+			return IDEVICE_E_WANT_READ;
+		case SSL_ERROR_WANT_WRITE:
+			return IDEVICE_E_WANT_WRITE;
+		default:
+			return IDEVICE_E_SSL_ERROR;
+		}
+	}
+#elif defined(HAVE_GNUTLS)
+	ssize_t r = gnutls_record_recv(connection->ssl_data->session, (void*)data, (size_t)len);
+	if (r <= 0) {
+		if (r == GNUTLS_E_AGAIN || r == GNUTLS_E_INTERRUPTED) {
+			return (gnutls_record_get_direction(connection->ssl_data->session)) ? IDEVICE_E_WANT_WRITE : IDEVICE_E_WANT_READ;
+		}
+		return IDEVICE_E_SSL_ERROR;
+	}
+#elif defined(HAVE_MBEDTLS)
+	int r = mbedtls_ssl_read(&connection->ssl_data->ctx, (unsigned char*)data, (size_t)len);
+	if (r <= 0) {
+		if (r == MBEDTLS_ERR_SSL_WANT_READ) {
+			return IDEVICE_E_WANT_READ;
+		} else if (r == MBEDTLS_ERR_SSL_WANT_WRITE) {
+			return IDEVICE_E_WANT_WRITE;
+		}
+		return IDEVICE_E_SSL_ERROR;
+	}
+#endif
+	*recv_bytes = (uint32_t)r;
+	return IDEVICE_E_SUCCESS;
+}
+
 /**
  * Internally used function to send raw data over the given connection.
  */
@@ -660,7 +1545,7 @@ static idevice_error_t internal_connection_send(idevice_connection_t connection,
 
 }
 
-idevice_error_t idevice_connection_send(idevice_connection_t connection, const char *data, uint32_t len, uint32_t *sent_bytes)
+static idevice_error_t connection_send(idevice_connection_t connection, const char *data, uint32_t len, uint32_t *sent_bytes)
 {
 	if (!connection || !data
 #if defined(HAVE_OPENSSL) || defined(HAVE_GNUTLS)
@@ -670,6 +1555,10 @@ idevice_error_t idevice_connection_send(idevice_connection_t connection, const c
 		return IDEVICE_E_INVALID_ARG;
 	}
 
+	if (connection->nonblocking) {
+		return connection_send_nonblocking(connection, data, len, sent_bytes);
+	}
+
 	if (connection->ssl_data) {
 		connection->status = IDEVICE_E_SUCCESS;
 		uint32_t sent = 0;
@@ -722,6 +1611,19 @@ idevice_error_t idevice_connection_send(idevice_connection_t connection, const c
 	return IDEVICE_E_SUCCESS;
 }
 
+idevice_error_t idevice_connection_send(idevice_connection_t connection, const char *data, uint32_t len, uint32_t *sent_bytes)
+{
+	if (!connection || !connection->stats) {
+		return connection_send(connection, data, len, sent_bytes);
+	}
+	uint32_t bytes = 0;
+	uint64_t start = stats_time_us();
+	idevice_error_t res = connection_send(connection, data, len, &bytes);
+	stats_record_send(connection, bytes, start);
+	*sent_bytes = bytes;
+	return res;
+}
+
 static inline idevice_error_t socket_recv_to_idevice_error(int conn_error, uint32_t len, uint32_t received)
 {
 	if (conn_error < 0) {
@@ -775,7 +1677,7 @@ static idevice_error_t internal_connection_receive_timeout(idevice_connection_t
 	return IDEVICE_E_UNKNOWN_ERROR;
 }
 
-idevice_error_t idevice_connection_receive_timeout(idevice_connection_t connection, char *data, uint32_t len, uint32_t *recv_bytes, unsigned int timeout)
+static idevice_error_t connection_receive_timeout(idevice_connection_t connection, char *data, uint32_t len, uint32_t *recv_bytes, unsigned int timeout)
 {
 	if (!connection
 #if defined(HAVE_OPENSSL) || defined(HAVE_GNUTLS)
@@ -786,6 +1688,10 @@ idevice_error_t idevice_connection_receive_timeout(idevice_connection_t connecti
 		return IDEVICE_E_INVALID_ARG;
 	}
 
+	if (connection->nonblocking) {
+		return connection_receive_nonblocking(connection, data, len, recv_bytes);
+	}
+
 	if (connection->ssl_data) {
 		uint32_t received = 0;
 
@@ -843,6 +1749,19 @@ idevice_error_t idevice_connection_receive_timeout(idevice_connection_t connecti
 	return internal_connection_receive_timeout(connection, data, len, recv_bytes, timeout);
 }
 
+idevice_error_t idevice_connection_receive_timeout(idevice_connection_t connection, char *data, uint32_t len, uint32_t *recv_bytes, unsigned int timeout)
+{
+	if (!connection || !connection->stats) {
+		return connection_receive_timeout(connection, data, len, recv_bytes, timeout);
+	}
+	uint32_t bytes = 0;
+	uint64_t start = stats_time_us();
+	idevice_error_t res = connection_receive_timeout(connection, data, len, &bytes, timeout);
+	stats_record_receive(connection, bytes, start, res);
+	*recv_bytes = bytes;
+	return res;
+}
+
 /**
  * Internally used function for receiving raw data over the given connection.
  */
@@ -874,7 +1793,7 @@ static idevice_error_t internal_connection_receive(idevice_connection_t connecti
 	return IDEVICE_E_UNKNOWN_ERROR;
 }
 
-idevice_error_t idevice_connection_receive(idevice_connection_t connection, char *data, uint32_t len, uint32_t *recv_bytes)
+static idevice_error_t connection_receive(idevice_connection_t connection, char *data, uint32_t len, uint32_t *recv_bytes)
 {
 	if (!connection
 #if defined(HAVE_OPENSSL) || defined(HAVE_GNUTLS)
@@ -884,6 +1803,10 @@ idevice_error_t idevice_connection_receive(idevice_connection_t connection, char
 		return IDEVICE_E_INVALID_ARG;
 	}
 
+	if (connection->nonblocking) {
+		return connection_receive_nonblocking(connection, data, len, recv_bytes);
+	}
+
 	if (connection->ssl_data) {
 		if (connection->ssl_recv_timeout != (unsigned int)-1) {
 			debug_info("WARNING: ssl_recv_timeout was not properly reset in idevice_connection_receive_timeout");
@@ -907,6 +1830,19 @@ idevice_error_t idevice_connection_receive(idevice_connection_t connection, char
 	return internal_connection_receive(connection, data, len, recv_bytes);
 }
 
+idevice_error_t idevice_connection_receive(idevice_connection_t connection, char *data, uint32_t len, uint32_t *recv_bytes)
+{
+	if (!connection || !connection->stats) {
+		return connection_receive(connection, data, len, recv_bytes);
+	}
+	uint32_t bytes = 0;
+	uint64_t start = stats_time_us();
+	idevice_error_t res = connection_receive(connection, data, len, &bytes);
+	stats_record_receive(connection, bytes, start, res);
+	*recv_bytes = bytes;
+	return res;
+}
+
 idevice_error_t idevice_connection_get_fd(idevice_connection_t connection, int *fd)
 {
 	if (!connection || !fd) {
@@ -926,6 +1862,46 @@ idevice_error_t idevice_connection_get_fd(idevice_connection_t connection, int *
 	return IDEVICE_E_UNKNOWN_ERROR;
 }
 
+idevice_error_t idevice_connection_set_nonblocking(idevice_connection_t connection, int nonblocking)
+{
+	if (!connection) {
+		return IDEVICE_E_INVALID_ARG;
+	}
+	if (connection->type != CONNECTION_USBMUXD && connection->type != CONNECTION_NETWORK) {
+		debug_info("Unknown connection type %d", connection->type);
+		return IDEVICE_E_UNKNOWN_ERROR;
+	}
+
+	int fd = (int)(uintptr_t)connection->data;
+#ifdef _WIN32
+	u_long mode = (nonblocking) ? 1 : 0;
+	if (ioctlsocket(fd, FIONBIO, &mode) != 0) {
+		debug_info("ERROR: Failed to change blocking mode of fd %d", fd);
+		return IDEVICE_E_UNKNOWN_ERROR;
+	}
+#else
+	int flags = fcntl(fd, F_GETFL, 0);
+	if (flags < 0 || fcntl(fd, F_SETFL, (nonblocking) ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK)) < 0) {
+		debug_info("ERROR: Failed to change blocking mode of fd %d: %s", fd, strerror(errno));
+		return IDEVICE_E_UNKNOWN_ERROR;
+	}
+#endif
+#if defined(HAVE_OPENSSL)
+	if (connection->ssl_data) {
+		/* allow SSL_write to return after a partial write, and to be retried
+		 * with a buffer at a different address after SSL_ERROR_WANT_WRITE */
+		if (nonblocking) {
+			SSL_set_mode(connection->ssl_data->session, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+		} else {
+			SSL_clear_mode(connection->ssl_data->session, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+		}
+	}
+#endif
+	connection->nonblocking = (nonblocking) ? 1 : 0;
+
+	return IDEVICE_E_SUCCESS;
+}
+
 idevice_error_t idevice_get_handle(idevice_t device, uint32_t *handle)
 {
 	if (!device || !handle)
@@ -978,6 +1954,27 @@ static ssl_cb_ret_type_t internal_ssl_read(idevice_connection_t connection, char
 
 	debug_info("pre-read length = %zi bytes", length);
 
+	/* the TLS implementations read each record header (5 bytes) separately */
+	if (connection->stats && length == 5) {
+		stats_count_tls_record(connection, 0);
+	}
+
+	if (connection->nonblocking) {
+		res = internal_connection_receive_nonblocking(connection, buffer, (uint32_t)length, &bytes);
+		connection->status = res;
+		if (res == IDEVICE_E_SUCCESS) {
+			return bytes;
+		} else if (res == IDEVICE_E_WANT_READ) {
+#if defined(HAVE_GNUTLS)
+			gnutls_transport_set_errno(connection->ssl_data->session, EAGAIN);
+#elif defined(HAVE_MBEDTLS)
+			return MBEDTLS_ERR_SSL_WANT_READ;
+#endif
+		}
+		/* OpenSSL: the BIO callback flags the retry based on status */
+		return -1;
+	}
+
 	/* repeat until we have the full data or an error occurs */
 	do {
 		bytes = 0;
@@ -1015,6 +2012,23 @@ static ssl_cb_ret_type_t internal_ssl_write(idevice_connection_t connection, con
 	uint32_t bytes = 0;
 	idevice_error_t res;
 	debug_info("pre-send length = %zi bytes", length);
+	if (connection->stats) {
+		stats_count_tls_record(connection, 1);
+	}
+	if (connection->nonblocking) {
+		res = internal_connection_send_nonblocking(connection, buffer, (uint32_t)length, &bytes);
+		connection->status = res;
+		if (res == IDEVICE_E_SUCCESS) {
+			return bytes;
+		} else if (res == IDEVICE_E_WANT_WRITE) {
+#if defined(HAVE_GNUTLS)
+			gnutls_transport_set_errno(connection->ssl_data->session, EAGAIN);
+#elif defined(HAVE_MBEDTLS)
+			return MBEDTLS_ERR_SSL_WANT_WRITE;
+#endif
+		}
+		return -1;
+	}
 	if ((res = internal_connection_send(connection, buffer, length, &bytes)) != IDEVICE_E_SUCCESS) {
 		debug_info("ERROR: internal_connection_send returned %d", res);
 		connection->status = res;
@@ -1082,8 +2096,12 @@ static long ssl_idevice_bio_callback(BIO *b, int oper, const char *argp, int arg
 #endif
 	switch (oper) {
 	case (BIO_CB_READ|BIO_CB_RETURN):
+		BIO_clear_retry_flags(b);
 		if (argp) {
 			bytes = internal_ssl_read(conn, (char *)argp, len);
+			if (bytes < 0 && conn->nonblocking && conn->status == IDEVICE_E_WANT_READ) {
+				BIO_set_retry_read(b);
+			}
 #if OPENSSL_VERSION_NUMBER >= 0x30000000L
 			*processed = (size_t)(bytes < 0) ? 0 : bytes;
 #endif
@@ -1094,7 +2112,11 @@ static long ssl_idevice_bio_callback(BIO *b, int oper, const char *argp, int arg
 		len = strlen(argp);
 		// fallthrough
 	case (BIO_CB_WRITE|BIO_CB_RETURN):
+		BIO_clear_retry_flags(b);
 		bytes = internal_ssl_write(conn, argp, len);
+		if (bytes < 0 && conn->nonblocking && conn->status == IDEVICE_E_WANT_WRITE) {
+			BIO_set_retry_write(b);
+		}
 #if OPENSSL_VERSION_NUMBER >= 0x30000000L
 		*processed = (size_t)(bytes < 0) ? 0 : bytes;
 #endif
@@ -1203,7 +2225,7 @@ static int _mbedtls_f_rng(void* p_rng, unsigned char* buf, size_t len)
 
 idevice_error_t idevice_connection_enable_ssl(idevice_connection_t connection)
 {
-	if (!connection || connection->ssl_data)
+	if (!connection || connection->ssl_data || connection->nonblocking)
 		return IDEVICE_E_INVALID_ARG;
 
 	idevice_error_t ret = IDEVICE_E_SSL_ERROR;
@@ -51,6 +51,7 @@
 
 #include "common/userpref.h"
 #include "libimobiledevice/libimobiledevice.h"
+#include <libimobiledevice-glue/thread.h>
 
 #define DEVICE_CLASS_IPHONE  1
 #define DEVICE_CLASS_IPAD    2
@@ -81,6 +82,17 @@ struct ssl_data_private {
 };
 typedef struct ssl_data_private *ssl_data_t;
 
+/* allocated when collecting is first enabled and only freed with the
+ * connection; enabled and all counters are protected by mutex */
+struct idevice_connection_stats_private {
+	mutex_t mutex;
+	int enabled;
+	idevice_connection_stats_t stats;
+	uint64_t request_time;
+	int awaiting_reply;
+};
+typedef struct idevice_connection_stats_private *idevice_connection_stats_private_t;
+
 struct idevice_connection_private {
 	idevice_t device;
 	enum idevice_connection_type type;
@@ -88,6 +100,10 @@ struct idevice_connection_private {
 	ssl_data_t ssl_data;
 	unsigned int ssl_recv_timeout;
 	idevice_error_t status;
+	int nonblocking;
+	uint16_t port;
+	char *label;
+	idevice_connection_stats_private_t stats;
 };
 
 struct idevice_private {
@@ -99,4 +115,7 @@ struct idevice_private {
 	int device_class;
 };
 
+void idevice_connection_set_label(idevice_connection_t connection, const char *label);
+void idevice_store_device_attributes(idevice_t device);
+
 #endif
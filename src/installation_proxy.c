@@ -36,6 +36,7 @@
 #include "installation_proxy.h"
 #include "property_list_service.h"
 #include "common/debug.h"
+#include "common/userpref.h"
 
 typedef enum {
 	INSTPROXY_COMMAND_TYPE_ASYNC,
@@ -306,24 +307,25 @@ static instproxy_error_t instproxy_send_command(instproxy_client_t client, plist
 }
 
 /**
- * Internally used function that will synchronously receive messages from
- * the specified installation_proxy until it completes or an error occurs.
- *
- * If status_cb is not NULL, the callback function will be called each time
- * a status update or error message is received.
+ * Internally used function that receives and evaluates a single status
+ * message of a command.
  *
  * @param client The connected installation proxy client
- * @param status_cb Pointer to a callback function or NULL
- * @param command Operation specificiation in plist. Will be passed to the
- *        status_cb callback.
- * @param user_data Callback data passed to status_cb.
+ * @param command_name Name of the command, used for debug messages.
+ * @param status Pointer that will be set to the received status message or
+ *        NULL if nothing was received. Must be freed by the caller.
+ * @param complete Will be set to 1 if the command has completed or failed.
+ *
+ * @return INSTPROXY_E_SUCCESS if the command completed,
+ *         INSTPROXY_E_OP_IN_PROGRESS if it is still running,
+ *         INSTPROXY_E_RECEIVE_TIMEOUT if no message was received in time,
+ *         or an INSTPROXY_E_* error value reported by the device or caused
+ *         by a communication problem.
  */
-static instproxy_error_t instproxy_receive_status_loop(instproxy_client_t client, plist_t command, instproxy_status_cb_t status_cb, void *user_data)
+static instproxy_error_t instproxy_receive_status(instproxy_client_t client, const char *command_name, plist_t *status, int *complete)
 {
 	instproxy_error_t res = INSTPROXY_E_UNKNOWN_ERROR;
-	int complete = 0;
 	plist_t node = NULL;
-	char* command_name = NULL;
 	char* status_name = NULL;
 	char* error_name = NULL;
 	char* error_description = NULL;
@@ -332,71 +334,104 @@ static instproxy_error_t instproxy_receive_status_loop(instproxy_client_t client
 	int percent_complete = 0;
 #endif
 
-	instproxy_command_get_name(command, &command_name);
+	*status = NULL;
 
-	do {
-		/* receive status response */
-		instproxy_lock(client);
-		res = instproxy_error(property_list_service_receive_plist_with_timeout(client->parent, &node, 1000));
-		instproxy_unlock(client);
-
-		/* break out if we have a communication problem */
-		if (res != INSTPROXY_E_SUCCESS && res != INSTPROXY_E_RECEIVE_TIMEOUT) {
-			debug_info("could not receive plist, error %d", res);
-			break;
-		}
+	/* receive status response */
+	instproxy_lock(client);
+	res = instproxy_error(property_list_service_receive_plist_with_timeout(client->parent, &node, 1000));
+	instproxy_unlock(client);
 
-		/* parse status response */
-		if (node) {
-			/* check status for possible error to allow reporting it and aborting it gracefully */
-			res = instproxy_status_get_error(node, &error_name, &error_description, &error_code);
-			if (res != INSTPROXY_E_SUCCESS) {
-				debug_info("command: %s, error %d, code 0x%08"PRIx64", name: %s, description: \"%s\"", command_name, res, error_code, error_name, error_description ? error_description: "N/A");
-				complete = 1;
-			}
+	/* break out if we have a communication problem */
+	if (res != INSTPROXY_E_SUCCESS && res != INSTPROXY_E_RECEIVE_TIMEOUT) {
+		debug_info("could not receive plist, error %d", res);
+		return res;
+	}
 
-			if (error_name) {
-				free(error_name);
-				error_name = NULL;
-			}
+	if (!node) {
+		return res;
+	}
 
-			if (error_description) {
-				free(error_description);
-				error_description = NULL;
-			}
+	/* check status for possible error to allow reporting it and aborting it gracefully */
+	res = instproxy_status_get_error(node, &error_name, &error_description, &error_code);
+	if (res != INSTPROXY_E_SUCCESS) {
+		debug_info("command: %s, error %d, code 0x%08"PRIx64", name: %s, description: \"%s\"", command_name, res, error_code, error_name, error_description ? error_description: "N/A");
+		*complete = 1;
+	}
 
-			/* check status from response */
-			instproxy_status_get_name(node, &status_name);
-			if (!status_name) {
-				debug_info("ignoring message without Status key:");
-				debug_plist(node);
-			} else {
-				if (!strcmp(status_name, "Complete")) {
-					complete = 1;
-				} else {
-					res = INSTPROXY_E_OP_IN_PROGRESS;
-				}
+	if (error_name) {
+		free(error_name);
+	}
+
+	if (error_description) {
+		free(error_description);
+	}
+
+	/* check status from response */
+	instproxy_status_get_name(node, &status_name);
+	if (!status_name) {
+		debug_info("ignoring message without Status key:");
+		debug_plist(node);
+	} else {
+		if (!strcmp(status_name, "Complete")) {
+			*complete = 1;
+		} else if (res == INSTPROXY_E_SUCCESS) {
+			res = INSTPROXY_E_OP_IN_PROGRESS;
+		}
 #ifndef STRIP_DEBUG_CODE
-				percent_complete = -1;
-				instproxy_status_get_percent_complete(node, &percent_complete);
-				if (percent_complete >= 0) {
-					debug_info("command: %s, status: %s, percent (%d%%)", command_name, status_name, percent_complete);
-				} else {
-					debug_info("command: %s, status: %s", command_name, status_name);
-				}
+		percent_complete = -1;
+		instproxy_status_get_percent_complete(node, &percent_complete);
+		if (percent_complete >= 0) {
+			debug_info("command: %s, status: %s, percent (%d%%)", command_name, status_name, percent_complete);
+		} else {
+			debug_info("command: %s, status: %s", command_name, status_name);
+		}
 #endif
-				free(status_name);
-				status_name = NULL;
-			}
+		free(status_name);
+	}
+
+	*status = node;
+
+	return res;
+}
+
+/**
+ * Internally used function that will synchronously receive messages from
+ * the specified installation_proxy until it completes or an error occurs.
+ *
+ * If status_cb is not NULL, the callback function will be called each time
+ * a status update or error message is received.
+ *
+ * @param client The connected installation proxy client
+ * @param status_cb Pointer to a callback function or NULL
+ * @param command Operation specificiation in plist. Will be passed to the
+ *        status_cb callback.
+ * @param user_data Callback data passed to status_cb.
+ */
+static instproxy_error_t instproxy_receive_status_loop(instproxy_client_t client, plist_t command, instproxy_status_cb_t status_cb, void *user_data)
+{
+	instproxy_error_t res = INSTPROXY_E_UNKNOWN_ERROR;
+	int complete = 0;
+	plist_t node = NULL;
+	char* command_name = NULL;
+
+	instproxy_command_get_name(command, &command_name);
 
-			/* invoke status callback function */
-			if (status_cb) {
-				status_cb(command, node, user_data);
+	do {
+		res = instproxy_receive_status(client, command_name, &node, &complete);
+		if (!node) {
+			if (res != INSTPROXY_E_SUCCESS && res != INSTPROXY_E_RECEIVE_TIMEOUT) {
+				break;
 			}
+			continue;
+		}
 
-			plist_free(node);
-			node = NULL;
+		/* invoke status callback function */
+		if (status_cb) {
+			status_cb(command, node, user_data);
 		}
+
+		plist_free(node);
+		node = NULL;
 	} while (!complete && client->parent);
 
 	if (command_name)
@@ -548,26 +583,126 @@ instproxy_error_t instproxy_browse_with_callback(instproxy_client_t client, plis
 	return res;
 }
 
+struct instproxy_browse_iterator_private {
+	instproxy_client_t client;
+	int complete;
+	instproxy_error_t error;
+};
+
+instproxy_error_t instproxy_browse_iterator_new(instproxy_client_t client, plist_t client_options, instproxy_browse_iterator_t *iterator)
+{
+	if (!client || !client->parent || !iterator)
+		return INSTPROXY_E_INVALID_ARG;
+
+	if (client->receive_status_thread) {
+		return INSTPROXY_E_OP_IN_PROGRESS;
+	}
+
+	instproxy_browse_iterator_t iter = (instproxy_browse_iterator_t)malloc(sizeof(struct instproxy_browse_iterator_private));
+	if (!iter) {
+		return INSTPROXY_E_UNKNOWN_ERROR;
+	}
+
+	plist_t command = plist_new_dict();
+	plist_dict_set_item(command, "Command", plist_new_string("Browse"));
+	if (client_options)
+		plist_dict_set_item(command, "ClientOptions", plist_copy(client_options));
+
+	instproxy_lock(client);
+	instproxy_error_t res = instproxy_send_command(client, command);
+	instproxy_unlock(client);
+
+	plist_free(command);
+
+	if (res != INSTPROXY_E_SUCCESS) {
+		free(iter);
+		return res;
+	}
+
+	iter->client = client;
+	iter->complete = 0;
+	iter->error = INSTPROXY_E_SUCCESS;
+	*iterator = iter;
+
+	return INSTPROXY_E_SUCCESS;
+}
+
+instproxy_error_t instproxy_browse_iterator_next(instproxy_browse_iterator_t iterator, plist_t *apps)
+{
+	if (!iterator || !apps)
+		return INSTPROXY_E_INVALID_ARG;
+
+	*apps = NULL;
+
+	while (!iterator->complete && iterator->client->parent) {
+		plist_t node = NULL;
+		instproxy_error_t res = instproxy_receive_status(iterator->client, "Browse", &node, &iterator->complete);
+		if (!node) {
+			if (res != INSTPROXY_E_SUCCESS && res != INSTPROXY_E_RECEIVE_TIMEOUT) {
+				iterator->complete = 1;
+				iterator->error = res;
+			}
+			continue;
+		}
+		if (iterator->complete && res != INSTPROXY_E_SUCCESS) {
+			iterator->error = res;
+		}
+
+		plist_t current_list = plist_dict_get_item(node, "CurrentList");
+		if (current_list && plist_get_node_type(current_list) == PLIST_ARRAY && plist_array_get_size(current_list) > 0) {
+			*apps = plist_copy(current_list);
+		}
+		plist_free(node);
+
+		if (*apps) {
+			return INSTPROXY_E_SUCCESS;
+		}
+	}
+
+	return iterator->error;
+}
+
+instproxy_error_t instproxy_browse_iterator_free(instproxy_browse_iterator_t iterator)
+{
+	if (!iterator)
+		return INSTPROXY_E_INVALID_ARG;
+
+	/* drain the remaining pages so the next command gets its own replies */
+	while (!iterator->complete && iterator->client->parent) {
+		plist_t node = NULL;
+		instproxy_error_t res = instproxy_receive_status(iterator->client, "Browse", &node, &iterator->complete);
+		if (!node && res != INSTPROXY_E_SUCCESS && res != INSTPROXY_E_RECEIVE_TIMEOUT) {
+			break;
+		}
+		plist_free(node);
+	}
+	free(iterator);
+
+	return INSTPROXY_E_SUCCESS;
+}
+
 static void instproxy_append_current_list_to_result_cb(plist_t command, plist_t status, void *user_data)
 {
 	plist_t *result_array = (plist_t*)user_data;
 	uint64_t current_amount = 0;
-	plist_t current_list = NULL;
 	uint64_t i;
 
-	instproxy_status_get_current_list(status, NULL, NULL, &current_amount, &current_list);
+	/* use the list in status directly, only the items themselves are copied */
+	plist_t current_list = plist_dict_get_item(status, "CurrentList");
+	if (!current_list || plist_get_node_type(current_list) != PLIST_ARRAY)
+		return;
+
+	current_amount = plist_array_get_size(current_list);
+	instproxy_status_get_current_list(status, NULL, NULL, &current_amount, NULL);
 
 	debug_info("current_amount: %d", current_amount);
 
-	if (current_amount > 0) {
-		for (i = 0; current_list && (i < current_amount); i++) {
-			plist_t item = plist_array_get_item(current_list, i);
-			plist_array_append_item(*result_array, plist_copy(item));
-		}
+	for (i = 0; i < current_amount; i++) {
+		plist_t item = plist_array_get_item(current_list, i);
+		if (!item)
+			break;
+		plist_array_append_item(*result_array, plist_copy(item));
 	}
-
-	if (current_list)
-		plist_free(current_list);
 }
 
 instproxy_error_t instproxy_browse(instproxy_client_t client, plist_t client_options, plist_t *result)
@@ -654,6 +789,289 @@ instproxy_error_t instproxy_lookup(instproxy_client_t client, const char** appid
 	return res;
 }
 
+struct instproxy_app_cache_private {
+	instproxy_client_t client;
+	np_client_t np;
+	char *udid;
+	plist_t apps;
+	mutex_t mutex;
+	int stale;
+};
+
+static int instproxy_app_info_equal(plist_t a, plist_t b, const char *key)
+{
+	const char *va = plist_get_string_ptr(plist_dict_get_item(a, key), NULL);
+	const char *vb = plist_get_string_ptr(plist_dict_get_item(b, key), NULL);
+	if (!va || !vb)
+		return va == vb;
+	return strcmp(va, vb) == 0;
+}
+
+/**
+ * Validates the cached applications against a Browse that only returns the
+ * attributes needed to detect changes and looks up the applications that
+ * were added or changed. Removed applications are dropped from the cache
+ * once the lookup succeeded. Must be called with the cache mutex held.
+ */
+static instproxy_error_t instproxy_app_cache_refresh(instproxy_app_cache_t cache)
+{
+	plist_t options = instproxy_client_options_new();
+	instproxy_client_options_add(options, "ApplicationType", "Any", NULL);
+	instproxy_client_options_set_return_attributes(options, "CFBundleIdentifier", "CFBundleVersion", "Path", NULL);
+
+	plist_t list = NULL;
+	instproxy_error_t res = instproxy_browse(cache->client, options, &list);
+	instproxy_client_options_free(options);
+	if (res != INSTPROXY_E_SUCCESS)
+		return res;
+
+	uint32_t count = plist_array_get_size(list);
+	uint32_t num_cached = plist_dict_get_size(cache->apps);
+	const char **changed = (const char**)calloc(count + 1, sizeof(char*));
+	char **removed = (char**)calloc(num_cached + 1, sizeof(char*));
+	if (!changed || !removed) {
+		free(changed);
+		free(removed);
+		plist_free(list);
+		return INSTPROXY_E_UNKNOWN_ERROR;
+	}
+	plist_t present = plist_new_dict();
+	uint32_t num_changed = 0;
+	uint32_t num_removed = 0;
+	int modified = 0;
+	uint32_t i;
+
+	for (i = 0; i < count; i++) {
+		plist_t item = plist_array_get_item(list, i);
+		const char *appid = plist_get_string_ptr(plist_dict_get_item(item, "CFBundleIdentifier"), NULL);
+		if (!appid)
+			continue;
+		plist_dict_set_item(present, appid, plist_new_bool(1));
+		plist_t cached = plist_dict_get_item(cache->apps, appid);
+		if (!cached || !instproxy_app_info_equal(cached, item, "CFBundleVersion") || !instproxy_app_info_equal(cached, item, "Path")) {
+			changed[num_changed++] = appid;
+		}
+	}
+
+	/* collect removed applications first, the dictionary can't be modified while iterating */
+	plist_dict_iter iter = NULL;
+	plist_dict_new_iter(cache->apps, &iter);
+	if (iter) {
+		char *key = NULL;
+		do {
+			key = NULL;
+			plist_dict_next_item(cache->apps, iter, &key, NULL);
+			if (!key)
+				break;
+			if (!plist_dict_get_item(present, key) && num_removed < num_cached) {
+				removed[num_removed++] = key;
+			} else {
+				free(key);
+			}
+		} while (1);
+		free(iter);
+	}
+	plist_free(present);
+
+	debug_info("%u applications, %u changed, %u removed", count, num_changed, num_removed);
+
+	if (num_changed > 0) {
+		plist_t lookup = NULL;
+		res = instproxy_lookup(cache->client, changed, NULL, &lookup);
+		if (res == INSTPROXY_E_SUCCESS && lookup) {
+			iter = NULL;
+			plist_dict_new_iter(lookup, &iter);
+			if (iter) {
+				char *key = NULL;
+				plist_t info = NULL;
+				do {
+					key = NULL;
+					info = NULL;
+					plist_dict_next_item(lookup, iter, &key, &info);
+					if (!key)
+						break;
+					plist_dict_set_item(cache->apps, key, plist_copy(info));
+					free(key);
+					modified = 1;
+				} while (1);
+				free(iter);
+			}
+		}
+		plist_free(lookup);
+	}
+
+	/* a failed lookup leaves the cache as it was, so the next refresh sees the same difference */
+	for (i = 0; i < num_removed; i++) {
+		if (res == INSTPROXY_E_SUCCESS) {
+			plist_dict_remove_item(cache->apps, removed[i]);
+			modified = 1;
+		}
+		free(removed[i]);
+	}
+	free(removed);
+	free(changed);
+	plist_free(list);
+
+	if (res == INSTPROXY_E_SUCCESS) {
+		cache->stale = 0;
+	}
+	if (modified && cache->udid) {
+		if (userpref_save_device_cache(cache->udid, "apps", cache->apps) != USERPREF_E_SUCCESS) {
+			debug_info("WARNING: could not store application cache for device %s", cache->udid);
+		}
+	}
+
+	return res;
+}
+
+instproxy_error_t instproxy_app_cache_new(instproxy_client_t client, instproxy_app_cache_t *cache)
+{
+	if (!client || !client->parent || !cache)
+		return INSTPROXY_E_INVALID_ARG;
+
+	instproxy_app_cache_t c = (instproxy_app_cache_t)calloc(1, sizeof(struct instproxy_app_cache_private));
+	if (!c)
+		return INSTPROXY_E_UNKNOWN_ERROR;
+
+	c->client = client;
+	mutex_init(&c->mutex);
+
+	idevice_connection_t connection = client->parent->parent->connection;
+	if (connection && connection->device && connection->device->udid) {
+		c->udid = strdup(connection->device->udid);
+		if (userpref_read_device_cache(c->udid, "apps", &c->apps) != USERPREF_E_SUCCESS || plist_get_node_type(c->apps) != PLIST_DICT) {
+			plist_free(c->apps);
+			c->apps = NULL;
+		}
+	}
+	if (!c->apps) {
+		c->apps = plist_new_dict();
+	}
+
+	mutex_lock(&c->mutex);
+	instproxy_error_t res = instproxy_app_cache_refresh(c);
+	mutex_unlock(&c->mutex);
+	if (res != INSTPROXY_E_SUCCESS) {
+		instproxy_app_cache_free(c);
+		return res;
+	}
+
+	*cache = c;
+
+	return INSTPROXY_E_SUCCESS;
+}
+
+static void instproxy_app_cache_notify_cb(const char *notification, void *user_data)
+{
+	instproxy_app_cache_t cache = (instproxy_app_cache_t)user_data;
+
+	debug_info("received %s, invalidating application cache", notification);
+	mutex_lock(&cache->mutex);
+	cache->stale = 1;
+	mutex_unlock(&cache->mutex);
+}
+
+instproxy_error_t instproxy_app_cache_watch(instproxy_app_cache_t cache, np_client_t np)
+{
+	if (!cache || !np)
+		return INSTPROXY_E_INVALID_ARG;
+
+	const char *spec[] = {
+		NP_APP_INSTALLED,
+		NP_APP_UNINSTALLED,
+		NULL
+	};
+	if (np_observe_notifications(np, spec) != NP_E_SUCCESS) {
+		return INSTPROXY_E_CONN_FAILED;
+	}
+	if (np_set_notify_callback(np, instproxy_app_cache_notify_cb, cache) != NP_E_SUCCESS) {
+		return INSTPROXY_E_UNKNOWN_ERROR;
+	}
+	cache->np = np;
+
+	return INSTPROXY_E_SUCCESS;
+}
+
+static plist_t instproxy_app_cache_copy_info(plist_t info, plist_t attributes)
+{
+	if (plist_get_node_type(attributes) != PLIST_ARRAY)
+		return plist_copy(info);
+
+	plist_t result = plist_new_dict();
+	uint32_t i;
+	for (i = 0; i < plist_array_get_size(attributes); i++) {
+		const char *key = plist_get_string_ptr(plist_array_get_item(attributes, i), NULL);
+		plist_t node = (key) ? plist_dict_get_item(info, key) : NULL;
+		if (node) {
+			plist_dict_set_item(result, key, plist_copy(node));
+		}
+	}
+	return result;
+}
+
+instproxy_error_t instproxy_app_cache_lookup(instproxy_app_cache_t cache, const char** appids, plist_t client_options, plist_t *result)
+{
+	if (!cache || !result)
+		return INSTPROXY_E_INVALID_ARG;
+
+	instproxy_error_t res = INSTPROXY_E_SUCCESS;
+	plist_t attributes = (client_options) ? plist_dict_get_item(client_options, "ReturnAttributes") : NULL;
+
+	mutex_lock(&cache->mutex);
+	if (cache->stale) {
+		res = instproxy_app_cache_refresh(cache);
+	}
+	if (res == INSTPROXY_E_SUCCESS) {
+		plist_t dict = plist_new_dict();
+		if (appids) {
+			int i;
+			for (i = 0; appids[i]; i++) {
+				plist_t info = plist_dict_get_item(cache->apps, appids[i]);
+				if (info) {
+					plist_dict_set_item(dict, appids[i], instproxy_app_cache_copy_info(info, attributes));
+				}
+			}
+		} else {
+			plist_dict_iter iter = NULL;
+			plist_dict_new_iter(cache->apps, &iter);
+			if (iter) {
+				char *key = NULL;
+				plist_t info = NULL;
+				do {
+					key = NULL;
+					info = NULL;
+					plist_dict_next_item(cache->apps, iter, &key, &info);
+					if (!key)
+						break;
+					plist_dict_set_item(dict, key, instproxy_app_cache_copy_info(info, attributes));
+					free(key);
+				} while (1);
+				free(iter);
+			}
+		}
+		*result = dict;
+	}
+	mutex_unlock(&cache->mutex);
+
+	return res;
+}
+
+instproxy_error_t instproxy_app_cache_free(instproxy_app_cache_t cache)
+{
+	if (!cache)
+		return INSTPROXY_E_INVALID_ARG;
+
+	if (cache->np) {
+		np_set_notify_callback(cache->np, NULL, NULL);
+	}
+	plist_free(cache->apps);
+	free(cache->udid);
+	mutex_destroy(&cache->mutex);
+	free(cache);
+
+	return INSTPROXY_E_SUCCESS;
+}
+
 instproxy_error_t instproxy_install(instproxy_client_t client, const char *pkg_path, plist_t client_options, instproxy_status_cb_t status_cb, void *user_data)
 {
 	instproxy_error_t res = INSTPROXY_E_UNKNOWN_ERROR;
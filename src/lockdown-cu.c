@@ -22,6 +22,8 @@
 #ifdef HAVE_CONFIG_H
 #include <config.h>
 #endif
+#define DEBUG_SUBSYSTEM DEBUG_SUBSYSTEM_LOCKDOWN
+
 
 #include <string.h>
 #include <stdlib.h>
@@ -46,6 +48,7 @@
 #include <libimobiledevice-glue/socket.h>
 #include <libimobiledevice-glue/opack.h>
 #include <libimobiledevice-glue/tlv.h>
+#include <libimobiledevice-glue/thread.h>
 
 #if defined(HAVE_OPENSSL)
 #include <openssl/hmac.h>
@@ -106,6 +109,17 @@ static const unsigned char kSRPModulus3072[384] = {
 };
 
 static const unsigned char kSRPGenerator5 = 5;
+
+/* precomputed powers of the generator, shared by all pairing sessions */
+static SRP_GROUP* srp_group_3072 = NULL;
+static thread_once_t srp_group_once = THREAD_ONCE_INIT;
+
+static void srp_group_init(void)
+{
+	SRP_initialize_library();
+	/* the exponents are x (SHA-512 output) and the 256 bit secret a */
+	srp_group_3072 = SRP_group_new(kSRPModulus3072, sizeof(kSRPModulus3072), &kSRPGenerator5, 1, 512);
+}
 /* }}} */
 
 /* {{{ HKDF */
@@ -531,13 +545,14 @@ lockdownd_error_t lockdownd_cu_pairing_create(lockdownd_client_t client, lockdow
 	}
 	unsigned int pairing_uuid_len = strlen(pairing_uuid);
 
-	SRP_initialize_library();
+	thread_once(&srp_group_once, srp_group_init);
 
 	SRP* srp = SRP_new(SRP6a_sha512_client_method());
 	if (!srp) {
 		PAIRING_ERROR("Failed to initialize SRP")
 		return LOCKDOWN_E_UNKNOWN_ERROR;
 	}
+	SRP_set_group(srp, srp_group_3072);
 
 	char tmp[256];
 	plist_t dict = NULL;
@@ -25,6 +25,8 @@
 #ifdef HAVE_CONFIG_H
 #include <config.h>
 #endif
+#define DEBUG_SUBSYSTEM DEBUG_SUBSYSTEM_LOCKDOWN
+
 
 #include <string.h>
 #include <stdlib.h>
@@ -655,6 +657,7 @@ lockdownd_error_t lockdownd_client_new(idevice_t device, lockdownd_client_t *cli
 
 	*client = client_loc;
 
+	int attributes_changed = 0;
 	if (is_lockdownd && device->version == 0) {
 		plist_t p_version = NULL;
 		if (lockdownd_get_value(client_loc, NULL, "ProductVersion", &p_version) == LOCKDOWN_E_SUCCESS) {
@@ -663,6 +666,7 @@ lockdownd_error_t lockdownd_client_new(idevice_t device, lockdownd_client_t *cli
 			plist_get_string_val(p_version, &s_version);
 			if (s_version && sscanf(s_version, "%d.%d.%d", &vers[0], &vers[1], &vers[2]) >= 2) {
 				device->version = IDEVICE_DEVICE_VERSION(vers[0], vers[1], vers[2]);
+				attributes_changed = 1;
 			}
 			free(s_version);
 		}
@@ -687,11 +691,16 @@ lockdownd_error_t lockdownd_client_new(idevice_t device, lockdownd_client_t *cli
 				} else {
 					device->device_class = DEVICE_CLASS_UNKNOWN;
 				}
+				attributes_changed = 1;
 				free(s_device_class);
 			}
 		}
 		plist_free(p_device_class);
 	}
+	if (attributes_changed) {
+		/* remember them so the next client for this device can skip the queries */
+		idevice_store_device_attributes(device);
+	}
 
 	return LOCKDOWN_E_SUCCESS;
 }
@@ -1091,6 +1100,19 @@ lockdownd_error_t lockdownd_unpair(lockdownd_client_t client, lockdownd_pair_rec
 	return lockdownd_do_pair(client, pair_record, "Unpair", NULL, NULL);
 }
 
+lockdownd_error_t lockdownd_pair_key_pool_start(unsigned int num_keypairs)
+{
+	if (num_keypairs == 0)
+		return LOCKDOWN_E_INVALID_ARG;
+
+	return (userpref_key_pool_start(num_keypairs) == USERPREF_E_SUCCESS) ? LOCKDOWN_E_SUCCESS : LOCKDOWN_E_UNKNOWN_ERROR;
+}
+
+void lockdownd_pair_key_pool_stop(void)
+{
+	userpref_key_pool_stop();
+}
+
 lockdownd_error_t lockdownd_enter_recovery(lockdownd_client_t client)
 {
 	if (!client)
@@ -1303,6 +1325,61 @@ static lockdownd_error_t lockdownd_build_start_service_request(lockdownd_client_
 	return LOCKDOWN_E_SUCCESS;
 }
 
+/**
+ * Parses a StartService response into a service descriptor.
+ *
+ * @param dict The StartService response received from lockdownd
+ * @param identifier The identifier of the service that was requested
+ * @param service The service descriptor to fill; allocated if it points to NULL
+ *
+ * @return LOCKDOWN_E_SUCCESS on success, or the error reported by the device
+ */
+static lockdownd_error_t lockdownd_parse_start_service_response(plist_t dict, const char *identifier, lockdownd_service_descriptor_t *service)
+{
+	uint16_t port_loc = 0;
+	lockdownd_error_t ret = lockdown_check_result(dict, "StartService");
+	if (ret == LOCKDOWN_E_SUCCESS) {
+		if (*service == NULL)
+			*service = (lockdownd_service_descriptor_t)malloc(sizeof(struct lockdownd_service_descriptor));
+		(*service)->port = 0;
+		(*service)->ssl_enabled = 0;
+		(*service)->identifier = strdup(identifier);
+
+		/* read service port number */
+		plist_t node = plist_dict_get_item(dict, "Port");
+		if (node && (plist_get_node_type(node) == PLIST_UINT)) {
+			uint64_t port_value = 0;
+			plist_get_uint_val(node, &port_value);
+
+			if (port_value) {
+				port_loc = port_value;
+				ret = LOCKDOWN_E_SUCCESS;
+			}
+			if (port_loc && ret == LOCKDOWN_E_SUCCESS) {
+				(*service)->port = port_loc;
+			}
+		}
+
+		/* check if the service requires SSL */
+		node = plist_dict_get_item(dict, "EnableServiceSSL");
+		if (node && (plist_get_node_type(node) == PLIST_BOOLEAN)) {
+			uint8_t b = 0;
+			plist_get_bool_val(node, &b);
+			(*service)->ssl_enabled = b;
+		}
+	} else {
+		plist_t error_node = plist_dict_get_item(dict, "Error");
+		if (error_node && PLIST_STRING == plist_get_node_type(error_node)) {
+			char *error = NULL;
+			plist_get_string_val(error_node, &error);
+			ret = lockdownd_strtoerr(error);
+			free(error);
+		}
+	}
+
+	return ret;
+}
+
 /**
  * Function used internally by lockdownd_start_service and lockdownd_start_service_with_escrow_bag.
  *
@@ -1329,7 +1406,6 @@ static lockdownd_error_t lockdownd_do_start_service(lockdownd_client_t client, c
 	}
 
 	plist_t dict = NULL;
-	uint16_t port_loc = 0;
 	lockdownd_error_t ret = LOCKDOWN_E_UNKNOWN_ERROR;
 
 	/* create StartService request */
@@ -1353,45 +1429,7 @@ static lockdownd_error_t lockdownd_do_start_service(lockdownd_client_t client, c
 	if (!dict)
 		return LOCKDOWN_E_PLIST_ERROR;
 
-	ret = lockdown_check_result(dict, "StartService");
-	if (ret == LOCKDOWN_E_SUCCESS) {
-		if (*service == NULL)
-			*service = (lockdownd_service_descriptor_t)malloc(sizeof(struct lockdownd_service_descriptor));
-		(*service)->port = 0;
-		(*service)->ssl_enabled = 0;
-		(*service)->identifier = strdup(identifier);
-
-		/* read service port number */
-		plist_t node = plist_dict_get_item(dict, "Port");
-		if (node && (plist_get_node_type(node) == PLIST_UINT)) {
-			uint64_t port_value = 0;
-			plist_get_uint_val(node, &port_value);
-
-			if (port_value) {
-				port_loc = port_value;
-				ret = LOCKDOWN_E_SUCCESS;
-			}
-			if (port_loc && ret == LOCKDOWN_E_SUCCESS) {
-				(*service)->port = port_loc;
-			}
-		}
-
-		/* check if the service requires SSL */
-		node = plist_dict_get_item(dict, "EnableServiceSSL");
-		if (node && (plist_get_node_type(node) == PLIST_BOOLEAN)) {
-			uint8_t b = 0;
-			plist_get_bool_val(node, &b);
-			(*service)->ssl_enabled = b;
-		}
-	} else {
-		plist_t error_node = plist_dict_get_item(dict, "Error");
-		if (error_node && PLIST_STRING == plist_get_node_type(error_node)) {
-			char *error = NULL;
-			plist_get_string_val(error_node, &error);
-			ret = lockdownd_strtoerr(error);
-			free(error);
-		}
-	}
+	ret = lockdownd_parse_start_service_response(dict, identifier, service);
 
 	plist_free(dict);
 	dict = NULL;
@@ -1409,6 +1447,95 @@ lockdownd_error_t lockdownd_start_service_with_escrow_bag(lockdownd_client_t cli
 	return lockdownd_do_start_service(client, identifier, 1, service);
 }
 
+lockdownd_error_t lockdownd_start_services(lockdownd_client_t client, const char **identifiers, const uint8_t *send_escrow_bag, unsigned int count, lockdownd_service_descriptor_t *services, lockdownd_error_t *results)
+{
+	if (!client || !identifiers || !services || count == 0)
+		return LOCKDOWN_E_INVALID_ARG;
+
+	unsigned int i;
+	for (i = 0; i < count; i++) {
+		if (!identifiers[i])
+			return LOCKDOWN_E_INVALID_ARG;
+	}
+
+	lockdownd_error_t *errs = (lockdownd_error_t*)malloc(sizeof(lockdownd_error_t) * count);
+	if (!errs)
+		return LOCKDOWN_E_UNKNOWN_ERROR;
+
+	lockdownd_error_t ret = LOCKDOWN_E_SUCCESS;
+	unsigned int sent = 0;
+
+	/* lockdownd answers the requests of a session strictly in order, so all
+	 * StartService requests are sent before the first response is read. This
+	 * costs one round trip for the whole batch instead of one per service. */
+	for (i = 0; i < count; i++) {
+		services[i] = NULL;
+		errs[i] = LOCKDOWN_E_UNKNOWN_ERROR;
+		if (ret != LOCKDOWN_E_SUCCESS)
+			continue;
+
+		plist_t dict = NULL;
+		errs[i] = lockdownd_build_start_service_request(client, identifiers[i], (send_escrow_bag) ? send_escrow_bag[i] : 0, &dict);
+		if (errs[i] != LOCKDOWN_E_SUCCESS) {
+			/* nothing was sent for this one, it won't get a response */
+			continue;
+		}
+		errs[i] = lockdownd_send(client, dict);
+		plist_free(dict);
+		if (errs[i] != LOCKDOWN_E_SUCCESS) {
+			/* the session can't be trusted anymore */
+			ret = errs[i];
+			continue;
+		}
+		/* mark as pending */
+		errs[i] = LOCKDOWN_E_SUCCESS;
+		sent++;
+	}
+
+	debug_info("sent %u of %u StartService requests", sent, count);
+
+	for (i = 0; i < count && sent > 0; i++) {
+		if (errs[i] != LOCKDOWN_E_SUCCESS)
+			continue;
+		sent--;
+
+		if (ret != LOCKDOWN_E_SUCCESS) {
+			errs[i] = ret;
+			continue;
+		}
+
+		plist_t dict = NULL;
+		errs[i] = lockdownd_receive(client, &dict);
+		if (errs[i] != LOCKDOWN_E_SUCCESS) {
+			/* responses for the remaining requests are lost now */
+			ret = errs[i];
+			continue;
+		}
+		if (!dict) {
+			errs[i] = LOCKDOWN_E_PLIST_ERROR;
+			continue;
+		}
+
+		errs[i] = lockdownd_parse_start_service_response(dict, identifiers[i], &services[i]);
+		plist_free(dict);
+		if (errs[i] != LOCKDOWN_E_SUCCESS) {
+			debug_info("Could not start service %s: %s", identifiers[i], lockdownd_strerror(errs[i]));
+			lockdownd_service_descriptor_free(services[i]);
+			services[i] = NULL;
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		if (ret == LOCKDOWN_E_SUCCESS && errs[i] != LOCKDOWN_E_SUCCESS)
+			ret = errs[i];
+		if (results)
+			results[i] = errs[i];
+	}
+	free(errs);
+
+	return ret;
+}
+
 lockdownd_error_t lockdownd_activate(lockdownd_client_t client, plist_t activation_record)
 {
 	if (!client)
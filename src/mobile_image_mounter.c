@@ -35,6 +35,8 @@
 #include "property_list_service.h"
 #include "common/debug.h"
 
+#define MIM_UPLOAD_CHUNK_SIZE (1024*1024)
+
 /**
  * Locks a mobile_image_mounter client, used for thread safety.
  *
@@ -185,12 +187,12 @@ static mobile_image_mounter_error_t process_result(plist_t result, const char *e
 	return res;
 }
 
-mobile_image_mounter_error_t mobile_image_mounter_upload_image(mobile_image_mounter_client_t client, const char *image_type, size_t image_size, const unsigned char *signature, unsigned int signature_size, mobile_image_mounter_upload_cb_t upload_cb, void* userdata)
+/**
+ * Sends the ReceiveBytes command and waits for the device to acknowledge it.
+ * Must be called with the client locked.
+ */
+static mobile_image_mounter_error_t mobile_image_mounter_receive_bytes_begin(mobile_image_mounter_client_t client, const char *image_type, size_t image_size, const unsigned char *signature, unsigned int signature_size)
 {
-	if (!client || !image_type || (image_size == 0) || !upload_cb) {
-		return MOBILE_IMAGE_MOUNTER_E_INVALID_ARG;
-	}
-	mobile_image_mounter_lock(client);
 	plist_t result = NULL;
 
 	plist_t dict = plist_new_dict();
@@ -205,15 +207,47 @@ mobile_image_mounter_error_t mobile_image_mounter_upload_image(mobile_image_moun
 
 	if (res != MOBILE_IMAGE_MOUNTER_E_SUCCESS) {
 		debug_info("Error sending XML plist to device!");
-		goto leave_unlock;
+		return res;
 	}
 
 	res = mobile_image_mounter_error(property_list_service_receive_plist(client->parent, &result));
 	if (res != MOBILE_IMAGE_MOUNTER_E_SUCCESS) {
 		debug_info("Error receiving response from device!");
-		goto leave_unlock;
+	} else {
+		res = process_result(result, "ReceiveBytesAck");
 	}
-	res = process_result(result, "ReceiveBytesAck");
+	plist_free(result);
+
+	return res;
+}
+
+/**
+ * Waits for the device to confirm that the image data has been received.
+ * Must be called with the client locked.
+ */
+static mobile_image_mounter_error_t mobile_image_mounter_receive_bytes_end(mobile_image_mounter_client_t client)
+{
+	plist_t result = NULL;
+
+	mobile_image_mounter_error_t res = mobile_image_mounter_error(property_list_service_receive_plist(client->parent, &result));
+	if (res != MOBILE_IMAGE_MOUNTER_E_SUCCESS) {
+		debug_info("Error receiving response from device!");
+	} else {
+		res = process_result(result, "Complete");
+	}
+	plist_free(result);
+
+	return res;
+}
+
+mobile_image_mounter_error_t mobile_image_mounter_upload_image(mobile_image_mounter_client_t client, const char *image_type, size_t image_size, const unsigned char *signature, unsigned int signature_size, mobile_image_mounter_upload_cb_t upload_cb, void* userdata)
+{
+	if (!client || !image_type || (image_size == 0) || !upload_cb) {
+		return MOBILE_IMAGE_MOUNTER_E_INVALID_ARG;
+	}
+	mobile_image_mounter_lock(client);
+
+	mobile_image_mounter_error_t res = mobile_image_mounter_receive_bytes_begin(client, image_type, image_size, signature, signature_size);
 	if (res != MOBILE_IMAGE_MOUNTER_E_SUCCESS) {
 		goto leave_unlock;
 	}
@@ -250,19 +284,50 @@ mobile_image_mounter_error_t mobile_image_mounter_upload_image(mobile_image_moun
 	}
 	debug_info("image uploaded");
 
-	res = mobile_image_mounter_error(property_list_service_receive_plist(client->parent, &result));
+	res = mobile_image_mounter_receive_bytes_end(client);
+
+leave_unlock:
+	mobile_image_mounter_unlock(client);
+	return res;
+}
+
+mobile_image_mounter_error_t mobile_image_mounter_upload_image_data(mobile_image_mounter_client_t client, const char *image_type, const unsigned char *image, size_t image_size, const unsigned char *signature, unsigned int signature_size)
+{
+	if (!client || !image_type || !image || (image_size == 0)) {
+		return MOBILE_IMAGE_MOUNTER_E_INVALID_ARG;
+	}
+	mobile_image_mounter_lock(client);
+
+	mobile_image_mounter_error_t res = mobile_image_mounter_receive_bytes_begin(client, image_type, image_size, signature, signature_size);
 	if (res != MOBILE_IMAGE_MOUNTER_E_SUCCESS) {
-		debug_info("Error receiving response from device!");
 		goto leave_unlock;
 	}
-	res = process_result(result, "Complete");
+
+	/* send straight from the caller's buffer, no intermediate copy */
+	size_t tx = 0;
+	debug_info("uploading image (%d bytes)", (int)image_size);
+	while (tx < image_size) {
+		size_t remaining = image_size - tx;
+		uint32_t amount = (remaining < MIM_UPLOAD_CHUNK_SIZE) ? (uint32_t)remaining : MIM_UPLOAD_CHUNK_SIZE;
+		uint32_t sent = 0;
+		if (service_send(client->parent->parent, (const char*)image + tx, amount, &sent) != SERVICE_E_SUCCESS || sent == 0) {
+			debug_info("service_send failed");
+			break;
+		}
+		tx += sent;
+	}
+	if (tx < image_size) {
+		debug_info("Error: failed to upload image");
+		res = MOBILE_IMAGE_MOUNTER_E_COMMAND_FAILED;
+		goto leave_unlock;
+	}
+	debug_info("image uploaded");
+
+	res = mobile_image_mounter_receive_bytes_end(client);
 
 leave_unlock:
 	mobile_image_mounter_unlock(client);
-	if (result)
-		plist_free(result);
 	return res;
-
 }
 
 mobile_image_mounter_error_t mobile_image_mounter_mount_image_with_options(mobile_image_mounter_client_t client, const char *image_path, const unsigned char *signature, unsigned int signature_size, const char *image_type, plist_t options, plist_t *result)
@@ -181,11 +181,14 @@ static mobilebackup_error_t mobilebackup_send_message(mobilebackup_client_t clie
  *
  * @param client The connected MobileBackup client to use.
  * @param message The expected message to check.
- * @param result Pointer to a plist_t that will be set to the received plist
- *    for further processing. The caller has to free it using plist_free().
- *    Note that it will be set to NULL if the operation itself fails due to
- *    a communication or plist error.
- *    If this parameter is NULL, it will be ignored.
+ * @param container Pointer to a plist_t that will be set to the complete
+ *    DLMessageProcessMessage as received. Ownership is handed over to the
+ *    caller, who has to free it using plist_free(). Note that it will be
+ *    set to NULL if the operation itself fails due to a communication or
+ *    plist error.
+ * @param result Pointer to a plist_t that will be set to the received
+ *    message inside of container for further processing. It is only valid
+ *    until container is freed and must not be freed separately.
  *
  * @return MOBILEBACKUP_E_SUCCESS on success, MOBILEBACKUP_E_INVALID_ARG if
  *    client or message is invalid, MOBILEBACKUP_E_REPLY_NOT_OK if the
@@ -194,21 +197,21 @@ static mobilebackup_error_t mobilebackup_send_message(mobilebackup_client_t clie
  *    BackupMessageTypeKey is not present), or MOBILEBACKUP_E_MUX_ERROR
  *    if a communication error occurs.
  */
-static mobilebackup_error_t mobilebackup_receive_message(mobilebackup_client_t client, const char *message, plist_t *result)
+static mobilebackup_error_t mobilebackup_receive_message(mobilebackup_client_t client, const char *message, plist_t *container, plist_t *result)
 {
-	if (!client || !client->parent || !message)
+	if (!client || !client->parent || !message || !container || !result)
 		return MOBILEBACKUP_E_INVALID_ARG;
 
-	if (result)
-		*result = NULL;
+	*container = NULL;
+	*result = NULL;
 	mobilebackup_error_t err;
 
 	plist_t dict = NULL;
 
-	/* receive DLMessageProcessMessage */
-	err = mobilebackup_error(device_link_service_receive_process_message(client->parent, &dict));
+	/* receive DLMessageProcessMessage, dict points into container */
+	err = mobilebackup_error(device_link_service_receive_process_message_borrowed(client->parent, container, &dict));
 	if (err != MOBILEBACKUP_E_SUCCESS) {
-		goto leave;
+		return err;
 	}
 
 	plist_t node = plist_dict_get_item(dict, "BackupMessageTypeKey");
@@ -229,14 +232,12 @@ static mobilebackup_error_t mobilebackup_receive_message(mobilebackup_client_t c
 	if (str)
 		free(str);
 
-	if (result) {
-		*result = dict;
-		dict = NULL;
-	}
+	*result = dict;
+	return err;
+
 leave:
-	if (dict) {
-		plist_free(dict);
-	}
+	plist_free(*container);
+	*container = NULL;
 
 	return err;
 }
@@ -250,6 +251,7 @@ mobilebackup_error_t mobilebackup_request_backup(mobilebackup_client_t client, p
 		return MOBILEBACKUP_E_PLIST_ERROR;
 
 	mobilebackup_error_t err;
+	plist_t container = NULL;
 
 	/* construct request plist */
 	plist_t dict = plist_new_dict();
@@ -269,7 +271,7 @@ mobilebackup_error_t mobilebackup_request_backup(mobilebackup_client_t client, p
 	}
 
 	/* now receive and hopefully get a BackupMessageBackupReplyOK */
-	err = mobilebackup_receive_message(client, "BackupMessageBackupReplyOK", &dict);
+	err = mobilebackup_receive_message(client, "BackupMessageBackupReplyOK", &container, &dict);
 	if (err != MOBILEBACKUP_E_SUCCESS) {
 		debug_info("ERROR: Could not receive BackupReplyOK message (%d)!", err);
 		goto leave;
@@ -297,15 +299,15 @@ mobilebackup_error_t mobilebackup_request_backup(mobilebackup_client_t client, p
 	if (err != MOBILEBACKUP_E_SUCCESS)
 		goto leave;
 
-	/* BackupMessageBackupReplyOK received, send it back */
-	err = mobilebackup_send_message(client, NULL, dict);
+	/* BackupMessageBackupReplyOK received, send the message back as is */
+	err = mobilebackup_error(device_link_service_send(client->parent, container));
 	if (err != MOBILEBACKUP_E_SUCCESS) {
 		debug_info("ERROR: Could not send BackupReplyOK ACK (%d)", err);
 	}
 
 leave:
-	if (dict)
-		plist_free(dict);
+	if (container)
+		plist_free(container);
 	return err;
 }
 
@@ -323,6 +325,7 @@ mobilebackup_error_t mobilebackup_request_restore(mobilebackup_client_t client,
 		return MOBILEBACKUP_E_PLIST_ERROR;
 
 	mobilebackup_error_t err;
+	plist_t container = NULL;
 
 	/* construct request plist */
 	plist_t dict = plist_new_dict();
@@ -344,7 +347,7 @@ mobilebackup_error_t mobilebackup_request_restore(mobilebackup_client_t client,
 	}
 
 	/* now receive and hopefully get a BackupMessageRestoreReplyOK */
-	err = mobilebackup_receive_message(client, "BackupMessageRestoreReplyOK", &dict);
+	err = mobilebackup_receive_message(client, "BackupMessageRestoreReplyOK", &container, &dict);
 	if (err != MOBILEBACKUP_E_SUCCESS) {
 		debug_info("ERROR: Could not receive RestoreReplyOK message (%d)!", err);
 		goto leave;
@@ -371,19 +374,43 @@ mobilebackup_error_t mobilebackup_request_restore(mobilebackup_client_t client,
 	}
 
 leave:
-	if (dict)
-		plist_free(dict);
+	if (container)
+		plist_free(container);
+	return err;
+}
+
+/**
+ * Receives a backup message plist that is returned to the caller on its own.
+ *
+ * libplist cannot detach a node from its parent, so the message has to be
+ * copied out of the received container. This only happens if the caller
+ * asks for it by passing a non-NULL result.
+ */
+static mobilebackup_error_t mobilebackup_receive_message_copy(mobilebackup_client_t client, const char *message, plist_t *result)
+{
+	plist_t container = NULL;
+	plist_t dict = NULL;
+
+	if (result)
+		*result = NULL;
+
+	mobilebackup_error_t err = mobilebackup_receive_message(client, message, &container, &dict);
+	if (container) {
+		if (result)
+			*result = plist_copy(dict);
+		plist_free(container);
+	}
 	return err;
 }
 
 mobilebackup_error_t mobilebackup_receive_restore_file_received(mobilebackup_client_t client, plist_t *result)
 {
-	return mobilebackup_receive_message(client, "BackupMessageRestoreFileReceived", result);
+	return mobilebackup_receive_message_copy(client, "BackupMessageRestoreFileReceived", result);
 }
 
 mobilebackup_error_t mobilebackup_receive_restore_application_received(mobilebackup_client_t client, plist_t *result)
 {
-	return mobilebackup_receive_message(client, "BackupMessageRestoreApplicationReceived", result);
+	return mobilebackup_receive_message_copy(client, "BackupMessageRestoreApplicationReceived", result);
 }
 
 mobilebackup_error_t mobilebackup_send_restore_complete(mobilebackup_client_t client)
@@ -154,11 +154,14 @@ mobilebackup2_error_t mobilebackup2_send_message(mobilebackup2_client_t client,
  *
  * @param client The connected MobileBackup client to use.
  * @param message The expected message to check.
- * @param result Pointer to a plist_t that will be set to the received plist
- *    for further processing. The caller has to free it using plist_free().
- *    Note that it will be set to NULL if the operation itself fails due to
- *    a communication or plist error.
- *    If this parameter is NULL, it will be ignored.
+ * @param container Pointer to a plist_t that will be set to the complete
+ *    DLMessageProcessMessage as received. Ownership is handed over to the
+ *    caller, who has to free it using plist_free(). Note that it will be
+ *    set to NULL if the operation itself fails due to a communication or
+ *    plist error.
+ * @param result Pointer to a plist_t that will be set to the received
+ *    message inside of container for further processing. It is only valid
+ *    until container is freed and must not be freed separately.
  *
  * @return MOBILEBACKUP2_E_SUCCESS on success, MOBILEBACKUP2_E_INVALID_ARG if
  *    client or message is invalid, MOBILEBACKUP2_E_REPLY_NOT_OK if the
@@ -167,21 +170,21 @@ mobilebackup2_error_t mobilebackup2_send_message(mobilebackup2_client_t client,
  *    MessageName key is not present), or MOBILEBACKUP2_E_MUX_ERROR
  *    if a communication error occurs.
  */
-static mobilebackup2_error_t internal_mobilebackup2_receive_message(mobilebackup2_client_t client, const char *message, plist_t *result)
+static mobilebackup2_error_t internal_mobilebackup2_receive_message(mobilebackup2_client_t client, const char *message, plist_t *container, plist_t *result)
 {
-	if (!client || !client->parent || !message)
+	if (!client || !client->parent || !message || !container || !result)
 		return MOBILEBACKUP2_E_INVALID_ARG;
 
-	if (result)
-		*result = NULL;
+	*container = NULL;
+	*result = NULL;
 	mobilebackup2_error_t err;
 
 	plist_t dict = NULL;
 
-	/* receive DLMessageProcessMessage */
-	err = mobilebackup2_error(device_link_service_receive_process_message(client->parent, &dict));
+	/* receive DLMessageProcessMessage, dict points into container */
+	err = mobilebackup2_error(device_link_service_receive_process_message_borrowed(client->parent, container, &dict));
 	if (err != MOBILEBACKUP2_E_SUCCESS) {
-		goto leave;
+		return err;
 	}
 
 	plist_t node = plist_dict_get_item(dict, "MessageName");
@@ -202,14 +205,12 @@ static mobilebackup2_error_t internal_mobilebackup2_receive_message(mobilebackup
 	if (str)
 		free(str);
 
-	if (result) {
-		*result = dict;
-		dict = NULL;
-	}
+	*result = dict;
+	return err;
+
 leave:
-	if (dict) {
-		plist_free(dict);
-	}
+	plist_free(*container);
+	*container = NULL;
 
 	return err;
 }
@@ -274,6 +275,7 @@ mobilebackup2_error_t mobilebackup2_receive_raw(mobilebackup2_client_t client, c
 mobilebackup2_error_t mobilebackup2_version_exchange(mobilebackup2_client_t client, double local_versions[], char count, double *remote_version)
 {
 	int i;
+	plist_t container = NULL;
 
 	if (!client || !client->parent)
 		return MOBILEBACKUP2_E_INVALID_ARG;
@@ -292,7 +294,7 @@ mobilebackup2_error_t mobilebackup2_version_exchange(mobilebackup2_client_t clie
 		goto leave;
 
 	dict = NULL;
-	err = internal_mobilebackup2_receive_message(client, "Response", &dict);
+	err = internal_mobilebackup2_receive_message(client, "Response", &container, &dict);
 	if (err != MOBILEBACKUP2_E_SUCCESS)
 		goto leave;
 
@@ -324,8 +326,8 @@ mobilebackup2_error_t mobilebackup2_version_exchange(mobilebackup2_client_t clie
 	*remote_version = 0.0;
 	plist_get_real_val(node, remote_version);
 leave:
-	if (dict)
-		plist_free(dict);
+	if (container)
+		plist_free(container);
 	return err;
 }
 
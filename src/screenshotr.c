@@ -116,6 +116,7 @@ screenshotr_error_t screenshotr_take_screenshot(screenshotr_client_t client, cha
 		return SCREENSHOTR_E_INVALID_ARG;
 
 	screenshotr_error_t res = SCREENSHOTR_E_UNKNOWN_ERROR;
+	plist_t container = NULL;
 
 	plist_t dict = plist_new_dict();
 	plist_dict_set_item(dict, "MessageType", plist_new_string("ScreenShotRequest"));
@@ -128,7 +129,7 @@ screenshotr_error_t screenshotr_take_screenshot(screenshotr_client_t client, cha
 	}
 
 	dict = NULL;
-	res = screenshotr_error(device_link_service_receive_process_message(client->parent, &dict));
+	res = screenshotr_error(device_link_service_receive_process_message_borrowed(client->parent, &container, &dict));
 	if (res != SCREENSHOTR_E_SUCCESS) {
 		debug_info("could not get screenshot data, error %d", res);
 		goto leave;
@@ -158,8 +159,8 @@ screenshotr_error_t screenshotr_take_screenshot(screenshotr_client_t client, cha
 	res = SCREENSHOTR_E_SUCCESS;
 
 leave:
-	if (dict)
-		plist_free(dict);
+	if (container)
+		plist_free(container);
 
 	return res;
 }
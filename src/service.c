@@ -21,8 +21,15 @@
 #ifdef HAVE_CONFIG_H
 #include <config.h>
 #endif
+#define DEBUG_SUBSYSTEM DEBUG_SUBSYSTEM_CONNECTION
+
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <sys/time.h>
+
+#include <libimobiledevice-glue/thread.h>
+#include <libimobiledevice-glue/socket.h>
 
 #include "service.h"
 #include "idevice.h"
@@ -56,20 +63,299 @@ static service_error_t idevice_to_service_error(idevice_error_t err)
 	return SERVICE_E_UNKNOWN_ERROR;
 }
 
+/* Services that are used for single requests and can safely be used again
+ * by the next client after the previous one is done with the connection */
+static const char *service_pool_identifiers[] = {
+	"com.apple.mobile.diagnostics_relay",
+	"com.apple.mobile.heartbeat",
+	"com.apple.springboardservices",
+	"com.apple.misagent",
+	NULL
+};
+
+#define SERVICE_POOL_MAX_PER_SERVICE 4
+
+struct service_pool_entry {
+	service_client_t client;
+	uint64_t expires;
+	struct service_pool_entry *next;
+};
+
+/* A pooled connection on its way from service_client_factory_start_service
+ * to service_client_new, matched by the service descriptor passed along */
+struct service_pool_handoff {
+	lockdownd_service_descriptor_t service;
+	service_client_t client;
+	struct service_pool_handoff *next;
+};
+
+/* all pool state below is protected by pool_mutex */
+static mutex_t pool_mutex;
+static thread_once_t pool_once = THREAD_ONCE_INIT;
+static unsigned int pool_ttl = 0;
+static struct service_pool_entry *pool_entries = NULL;
+static struct service_pool_handoff *pool_handoffs = NULL;
+
+static void service_pool_init(void)
+{
+	mutex_init(&pool_mutex);
+}
+
+static uint64_t service_pool_time_ms(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+/* the TTL can be changed by another thread at any time */
+static unsigned int service_pool_get_ttl(void)
+{
+	unsigned int ttl;
+
+	thread_once(&pool_once, service_pool_init);
+	mutex_lock(&pool_mutex);
+	ttl = pool_ttl;
+	mutex_unlock(&pool_mutex);
+	return ttl;
+}
+
+static int service_pool_is_poolable(const char *service_name)
+{
+	int i;
+	if (!service_name)
+		return 0;
+	for (i = 0; service_pool_identifiers[i]; i++) {
+		if (!strcmp(service_pool_identifiers[i], service_name))
+			return 1;
+	}
+	return 0;
+}
+
+static service_error_t service_client_close(service_client_t client)
+{
+	service_error_t err = idevice_to_service_error(idevice_disconnect(client->connection));
+	free(client->pool_udid);
+	free(client->pool_service);
+	free(client);
+	return err;
+}
+
+/* An idle connection is healthy if there is nothing to read from it: any
+ * pending data is either unexpected or the device closing the connection */
+static int service_pool_is_healthy(service_client_t client)
+{
+	int fd = -1;
+	if (idevice_connection_get_fd(client->connection, &fd) != IDEVICE_E_SUCCESS || fd < 0)
+		return 0;
+	return socket_check_fd(fd, FDM_READ, 1) == -ETIMEDOUT;
+}
+
+/* unlinks expired entries, the caller closes them after unlocking */
+static struct service_pool_entry *service_pool_take_expired(uint64_t now)
+{
+	struct service_pool_entry *expired = NULL;
+	struct service_pool_entry **pe = &pool_entries;
+	while (*pe) {
+		struct service_pool_entry *e = *pe;
+		if (pool_ttl == 0 || e->expires <= now) {
+			*pe = e->next;
+			e->next = expired;
+			expired = e;
+		} else {
+			pe = &e->next;
+		}
+	}
+	return expired;
+}
+
+static void service_pool_entries_free(struct service_pool_entry *entries)
+{
+	while (entries) {
+		struct service_pool_entry *next = entries->next;
+		service_client_close(entries->client);
+		free(entries);
+		entries = next;
+	}
+}
+
+static service_client_t service_pool_checkout(idevice_t device, const char *service_name)
+{
+	service_client_t client = NULL;
+	struct service_pool_entry *expired;
+	struct service_pool_entry *unhealthy = NULL;
+
+	thread_once(&pool_once, service_pool_init);
+	mutex_lock(&pool_mutex);
+	expired = service_pool_take_expired(service_pool_time_ms());
+	struct service_pool_entry **pe = &pool_entries;
+	while (*pe && !client) {
+		struct service_pool_entry *e = *pe;
+		if (strcmp(e->client->pool_udid, device->udid) != 0 || strcmp(e->client->pool_service, service_name) != 0) {
+			pe = &e->next;
+			continue;
+		}
+		*pe = e->next;
+		if (service_pool_is_healthy(e->client)) {
+			client = e->client;
+			free(e);
+		} else {
+			e->next = unhealthy;
+			unhealthy = e;
+		}
+	}
+	mutex_unlock(&pool_mutex);
+
+	service_pool_entries_free(expired);
+	if (unhealthy) {
+		debug_info("Discarding stale pooled connections to %s", service_name);
+		service_pool_entries_free(unhealthy);
+	}
+	if (client) {
+		/* the device the connection was made with might be gone by now */
+		client->connection->device = device;
+		debug_info("Reusing pooled connection to %s", service_name);
+	}
+	return client;
+}
+
+static int service_pool_checkin(service_client_t client)
+{
+	struct service_pool_entry *expired;
+	int count = 0;
+	int res = -1;
+
+	thread_once(&pool_once, service_pool_init);
+	if (!service_pool_is_healthy(client))
+		return -1;
+
+	struct service_pool_entry *entry = (struct service_pool_entry*)malloc(sizeof(struct service_pool_entry));
+	if (!entry)
+		return -1;
+
+	mutex_lock(&pool_mutex);
+	uint64_t now = service_pool_time_ms();
+	expired = service_pool_take_expired(now);
+	struct service_pool_entry *e;
+	for (e = pool_entries; e; e = e->next) {
+		if (!strcmp(e->client->pool_udid, client->pool_udid) && !strcmp(e->client->pool_service, client->pool_service))
+			count++;
+	}
+	if (pool_ttl > 0 && count < SERVICE_POOL_MAX_PER_SERVICE) {
+		entry->client = client;
+		entry->expires = now + pool_ttl;
+		entry->next = pool_entries;
+		pool_entries = entry;
+		entry = NULL;
+		res = 0;
+	}
+	mutex_unlock(&pool_mutex);
+
+	free(entry);
+	service_pool_entries_free(expired);
+	return res;
+}
+
+static void service_pool_handoff_add(lockdownd_service_descriptor_t service, service_client_t client)
+{
+	struct service_pool_handoff *h = (struct service_pool_handoff*)malloc(sizeof(struct service_pool_handoff));
+	if (!h) {
+		service_client_close(client);
+		return;
+	}
+	h->service = service;
+	h->client = client;
+	mutex_lock(&pool_mutex);
+	h->next = pool_handoffs;
+	pool_handoffs = h;
+	mutex_unlock(&pool_mutex);
+}
+
+static service_client_t service_pool_handoff_take(lockdownd_service_descriptor_t service)
+{
+	service_client_t client = NULL;
+	thread_once(&pool_once, service_pool_init);
+	mutex_lock(&pool_mutex);
+	struct service_pool_handoff **ph = &pool_handoffs;
+	while (*ph) {
+		struct service_pool_handoff *h = *ph;
+		if (h->service == service) {
+			*ph = h->next;
+			client = h->client;
+			free(h);
+			break;
+		}
+		ph = &h->next;
+	}
+	mutex_unlock(&pool_mutex);
+	return client;
+}
+
+void service_client_pool_set_ttl(unsigned int ttl)
+{
+	struct service_pool_entry *expired;
+
+	thread_once(&pool_once, service_pool_init);
+	mutex_lock(&pool_mutex);
+	pool_ttl = ttl;
+	expired = service_pool_take_expired(service_pool_time_ms());
+	mutex_unlock(&pool_mutex);
+	service_pool_entries_free(expired);
+}
+
+void service_client_pool_flush(void)
+{
+	struct service_pool_entry *entries;
+
+	thread_once(&pool_once, service_pool_init);
+	mutex_lock(&pool_mutex);
+	entries = pool_entries;
+	pool_entries = NULL;
+	mutex_unlock(&pool_mutex);
+	service_pool_entries_free(entries);
+}
+
+void service_client_set_reusable(service_client_t client, int reusable)
+{
+	if (!client || reusable)
+		return;
+	free(client->pool_udid);
+	free(client->pool_service);
+	client->pool_udid = NULL;
+	client->pool_service = NULL;
+}
+
 service_error_t service_client_new(idevice_t device, lockdownd_service_descriptor_t service, service_client_t *client)
 {
 	if (!device || !service || service->port == 0 || !client || *client)
 		return SERVICE_E_INVALID_ARG;
 
+	/* pick up a pooled connection handed over by the factory */
+	service_client_t pooled = service_pool_handoff_take(service);
+	if (pooled) {
+		*client = pooled;
+		return SERVICE_E_SUCCESS;
+	}
+
 	/* Attempt connection */
 	idevice_connection_t connection = NULL;
 	if (idevice_connect(device, service->port, &connection) != IDEVICE_E_SUCCESS) {
 		return SERVICE_E_MUX_ERROR;
 	}
 
+	if (service->identifier) {
+		idevice_connection_set_label(connection, service->identifier);
+	}
+
 	/* create client object */
 	service_client_t client_loc = (service_client_t)malloc(sizeof(struct service_client_private));
 	client_loc->connection = connection;
+	client_loc->pool_udid = NULL;
+	client_loc->pool_service = NULL;
+	if (device->udid && service_pool_is_poolable(service->identifier) && service_pool_get_ttl() > 0) {
+		client_loc->pool_udid = strdup(device->udid);
+		client_loc->pool_service = strdup(service->identifier);
+	}
 
 	/* enable SSL if requested */
 	if (service->ssl_enabled == 1)
@@ -84,6 +370,38 @@ service_error_t service_client_factory_start_service(idevice_t device, const cha
 {
 	*client = NULL;
 
+	if (device && device->udid && service_pool_is_poolable(service_name) && service_pool_get_ttl() > 0) {
+		service_client_t pooled = service_pool_checkout(device, service_name);
+		if (pooled) {
+			/* skip lockdownd entirely, the connection (and its SSL session)
+			 * is passed to service_client_new through the constructor */
+			struct lockdownd_service_descriptor pooled_service;
+			pooled_service.port = pooled->connection->port;
+			pooled_service.ssl_enabled = 0;
+			pooled_service.identifier = (char*)service_name;
+			service_pool_handoff_add(&pooled_service, pooled);
+			int32_t ec;
+			if (constructor_func) {
+				ec = (int32_t)constructor_func(device, &pooled_service, client);
+			} else {
+				ec = service_client_new(device, &pooled_service, (service_client_t*)client);
+			}
+			/* a constructor that failed early never took the connection */
+			pooled = service_pool_handoff_take(&pooled_service);
+			if (pooled) {
+				service_client_close(pooled);
+			}
+			if (ec == SERVICE_E_SUCCESS) {
+				if (error_code) {
+					*error_code = ec;
+				}
+				return SERVICE_E_SUCCESS;
+			}
+			debug_info("Could not reuse pooled connection to %s, error: %i", service_name, ec);
+			*client = NULL;
+		}
+	}
+
 	lockdownd_client_t lckd = NULL;
 	if (LOCKDOWN_E_SUCCESS != lockdownd_client_new_with_handshake(device, &lckd, label)) {
 		debug_info("Could not create a lockdown client.");
@@ -119,17 +437,141 @@ service_error_t service_client_factory_start_service(idevice_t device, const cha
 	return (ec == SERVICE_E_SUCCESS) ? SERVICE_E_SUCCESS : SERVICE_E_START_SERVICE_ERROR;
 }
 
+struct service_start_job {
+	idevice_t device;
+	lockdownd_service_descriptor_t service;
+	service_start_request_t *request;
+	THREAD_T thread;
+	int running;
+};
+
+static int32_t service_start_job_construct(struct service_start_job *job)
+{
+	service_start_request_t *req = job->request;
+	if (req->constructor_func) {
+		return (int32_t)req->constructor_func(job->device, job->service, &req->client);
+	}
+	return service_client_new(job->device, job->service, (service_client_t*)&req->client);
+}
+
+static void* service_start_job_run(void* arg)
+{
+	struct service_start_job *job = (struct service_start_job*)arg;
+	job->request->error_code = service_start_job_construct(job);
+	return NULL;
+}
+
+service_error_t service_client_factory_start_services(idevice_t device, lockdownd_client_t lockdown, service_start_request_t *requests, unsigned int count, const char* label)
+{
+	unsigned int i;
+
+	if (!device || !requests || count == 0)
+		return SERVICE_E_INVALID_ARG;
+
+	for (i = 0; i < count; i++) {
+		if (!requests[i].service_name)
+			return SERVICE_E_INVALID_ARG;
+		requests[i].client = NULL;
+		requests[i].error_code = SERVICE_E_START_SERVICE_ERROR;
+		requests[i].lockdown_error = LOCKDOWN_E_UNKNOWN_ERROR;
+	}
+
+	const char **identifiers = (const char**)malloc(sizeof(char*) * count);
+	uint8_t *escrow = (uint8_t*)malloc(count);
+	lockdownd_service_descriptor_t *services = (lockdownd_service_descriptor_t*)calloc(count, sizeof(lockdownd_service_descriptor_t));
+	lockdownd_error_t *lerrs = (lockdownd_error_t*)malloc(sizeof(lockdownd_error_t) * count);
+	struct service_start_job *jobs = (struct service_start_job*)calloc(count, sizeof(struct service_start_job));
+	if (!identifiers || !escrow || !services || !lerrs || !jobs) {
+		free(identifiers);
+		free(escrow);
+		free(services);
+		free(lerrs);
+		free(jobs);
+		return SERVICE_E_UNKNOWN_ERROR;
+	}
+	for (i = 0; i < count; i++) {
+		identifiers[i] = requests[i].service_name;
+		escrow[i] = requests[i].send_escrow_bag;
+	}
+
+	service_error_t res = SERVICE_E_SUCCESS;
+
+	lockdownd_client_t lckd = lockdown;
+	if (!lckd) {
+		lockdownd_error_t lerr = lockdownd_client_new_with_handshake(device, &lckd, label);
+		if (lerr != LOCKDOWN_E_SUCCESS) {
+			debug_info("Could not create a lockdown client.");
+			for (i = 0; i < count; i++) {
+				requests[i].lockdown_error = lerr;
+			}
+			res = SERVICE_E_START_SERVICE_ERROR;
+			goto leave;
+		}
+	}
+
+	lockdownd_start_services(lckd, identifiers, escrow, count, services, lerrs);
+	if (lckd != lockdown) {
+		lockdownd_client_free(lckd);
+	}
+
+	/* the constructors connect and possibly do a SSL handshake, which
+	 * involves several round trips each, so let them run concurrently */
+	for (i = 0; i < count; i++) {
+		requests[i].lockdown_error = lerrs[i];
+		if (lerrs[i] != LOCKDOWN_E_SUCCESS || !services[i]) {
+			debug_info("Could not start service %s: %s", identifiers[i], lockdownd_strerror(lerrs[i]));
+			res = SERVICE_E_START_SERVICE_ERROR;
+			continue;
+		}
+		jobs[i].device = device;
+		jobs[i].service = services[i];
+		jobs[i].request = &requests[i];
+		if (i + 1 < count && thread_new(&jobs[i].thread, service_start_job_run, &jobs[i]) == 0) {
+			jobs[i].running = 1;
+		} else {
+			/* the last one (or any that failed to spawn) runs right here */
+			service_start_job_run(&jobs[i]);
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		if (jobs[i].running) {
+			thread_join(jobs[i].thread);
+			thread_free(jobs[i].thread);
+		}
+		if (!jobs[i].request) {
+			continue;
+		}
+		if (requests[i].error_code != SERVICE_E_SUCCESS) {
+			debug_info("Could not connect to service %s! Port: %i, error: %i", identifiers[i], services[i]->port, requests[i].error_code);
+			res = SERVICE_E_START_SERVICE_ERROR;
+		}
+	}
+
+leave:
+	for (i = 0; i < count; i++) {
+		lockdownd_service_descriptor_free(services[i]);
+	}
+	free(identifiers);
+	free(escrow);
+	free(services);
+	free(lerrs);
+	free(jobs);
+
+	return res;
+}
+
 service_error_t service_client_free(service_client_t client)
 {
 	if (!client)
 		return SERVICE_E_INVALID_ARG;
 
-	service_error_t err = idevice_to_service_error(idevice_disconnect(client->connection));
-
-	free(client);
-	client = NULL;
+	/* keep connections to reusable services open for the next client */
+	if (client->pool_service && service_pool_checkin(client) == 0) {
+		return SERVICE_E_SUCCESS;
+	}
 
-	return err;
+	return service_client_close(client);
 }
 
 service_error_t service_send(service_client_t client, const char* data, uint32_t size, uint32_t *sent)
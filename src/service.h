@@ -27,6 +27,10 @@
 
 struct service_client_private {
 	idevice_connection_t connection;
+	char *pool_udid;
+	char *pool_service;
 };
 
+void service_client_set_reusable(service_client_t client, int reusable);
+
 #endif
@@ -0,0 +1,283 @@
+/*
+ * bench.c
+ * Timing, latency and allocation accounting for the benchmarks
+ *
+ * Copyright (c) 2026 libimobiledevice project. All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "bench.h"
+
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+/*
+ * glibc lets a program replace malloc for itself and all libraries it
+ * uses, so the allocations made inside libimobiledevice and libplist are
+ * counted here. Counts and heap usage are kept per thread so the emulator
+ * threads serving the other end of a connection do not show up in the
+ * numbers. Memory is charged to the thread that frees it, which is the
+ * allocating thread for everything the benchmarks measure.
+ */
+#define BENCH_TRACK_ALLOCS
+#include <malloc.h>
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *ptr);
+
+static __thread uint64_t thread_allocs = 0;
+static __thread uint64_t thread_alloc_bytes = 0;
+static __thread int64_t heap_current = 0;
+static __thread int64_t heap_peak = 0;
+
+static void bench_account_alloc(void *ptr)
+{
+	if (!ptr) {
+		return;
+	}
+	int64_t size = (int64_t)malloc_usable_size(ptr);
+	thread_allocs++;
+	thread_alloc_bytes += size;
+	heap_current += size;
+	if (heap_current > heap_peak) {
+		heap_peak = heap_current;
+	}
+}
+
+static void bench_account_free(void *ptr)
+{
+	if (ptr) {
+		heap_current -= (int64_t)malloc_usable_size(ptr);
+	}
+}
+
+void *malloc(size_t size)
+{
+	void *ptr = __libc_malloc(size);
+	bench_account_alloc(ptr);
+	return ptr;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	void *ptr = __libc_calloc(nmemb, size);
+	bench_account_alloc(ptr);
+	return ptr;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	int64_t old_size = (ptr) ? (int64_t)malloc_usable_size(ptr) : 0;
+	void *newptr = __libc_realloc(ptr, size);
+	if (newptr || size == 0) {
+		heap_current -= old_size;
+	}
+	bench_account_alloc(newptr);
+	return newptr;
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+	void *ptr = __libc_memalign(alignment, size);
+	bench_account_alloc(ptr);
+	return ptr;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+	return memalign(alignment, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+	void *ptr = memalign(alignment, size);
+	if (!ptr) {
+		return ENOMEM;
+	}
+	*memptr = ptr;
+	return 0;
+}
+
+void free(void *ptr)
+{
+	bench_account_free(ptr);
+	__libc_free(ptr);
+}
+#endif
+
+static const char *bench_filter = NULL;
+static unsigned int bench_divisor = 1;
+
+double bench_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+void bench_init(int argc, char **argv)
+{
+	int i;
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-q")) {
+			bench_divisor = 10;
+		} else {
+			bench_filter = argv[i];
+		}
+	}
+}
+
+int bench_selected(const char *name)
+{
+	return (!bench_filter || strstr(name, bench_filter) != NULL);
+}
+
+unsigned int bench_iterations(unsigned int count)
+{
+	count /= bench_divisor;
+	return (count > 0) ? count : 1;
+}
+
+void bench_get_allocs(uint64_t *count, uint64_t *bytes)
+{
+#ifdef BENCH_TRACK_ALLOCS
+	*count = thread_allocs;
+	*bytes = thread_alloc_bytes;
+#else
+	*count = 0;
+	*bytes = 0;
+#endif
+}
+
+void bench_get_heap(int64_t *current, int64_t *peak)
+{
+#ifdef BENCH_TRACK_ALLOCS
+	*current = heap_current;
+	*peak = heap_peak;
+#else
+	*current = 0;
+	*peak = 0;
+#endif
+}
+
+void bench_reset_heap_peak(void)
+{
+#ifdef BENCH_TRACK_ALLOCS
+	heap_peak = heap_current;
+#endif
+}
+
+uint64_t bench_get_peak_rss(void)
+{
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) {
+		return 0;
+	}
+#ifdef __APPLE__
+	return (uint64_t)usage.ru_maxrss / 1024;
+#else
+	return (uint64_t)usage.ru_maxrss;
+#endif
+}
+
+void bench_begin(bench_t *bench, const char *name, unsigned int count)
+{
+	memset(bench, 0, sizeof(bench_t));
+	bench->name = name;
+	bench->count = count;
+	bench->samples = (double*)calloc(count, sizeof(double));
+	bench_get_allocs(&bench->allocs, &bench->alloc_bytes);
+}
+
+void bench_op_begin(bench_t *bench)
+{
+	bench->start = bench_now();
+}
+
+void bench_op_end(bench_t *bench, uint64_t bytes)
+{
+	double duration = bench_now() - bench->start;
+	if (bench->samples && bench->done < bench->count) {
+		bench->samples[bench->done++] = duration;
+	}
+	bench->elapsed += duration;
+	bench->bytes += bytes;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, unsigned int count, unsigned int p)
+{
+	if (count == 0) {
+		return 0;
+	}
+	unsigned int i = (unsigned int)(((uint64_t)count * p) / 100);
+	return sorted[(i < count) ? i : count - 1];
+}
+
+void bench_end(bench_t *bench)
+{
+	uint64_t allocs = 0;
+	uint64_t alloc_bytes = 0;
+	char rate[32];
+
+	bench_get_allocs(&allocs, &alloc_bytes);
+	allocs -= bench->allocs;
+	alloc_bytes -= bench->alloc_bytes;
+
+	unsigned int n = bench->done;
+	if (n == 0) {
+		printf("%-40s no operations completed\n", bench->name);
+		free(bench->samples);
+		bench->samples = NULL;
+		return;
+	}
+	qsort(bench->samples, n, sizeof(double), compare_double);
+
+	if (bench->bytes > 0 && bench->elapsed > 0) {
+		snprintf(rate, sizeof(rate), "%9.1f MB/s", (double)bench->bytes / bench->elapsed / 1e6);
+	} else {
+		snprintf(rate, sizeof(rate), "%9.0f op/s", (double)n / bench->elapsed);
+	}
+	printf("%-40s %7u ops %s  p50 %9.1f us  p90 %9.1f us  p99 %9.1f us  %7.1f allocs/op %9.0f B/op\n",
+		bench->name, n, rate,
+		percentile(bench->samples, n, 50) * 1e6,
+		percentile(bench->samples, n, 90) * 1e6,
+		percentile(bench->samples, n, 99) * 1e6,
+		(double)allocs / n, (double)alloc_bytes / n);
+	fflush(stdout);
+
+	free(bench->samples);
+	bench->samples = NULL;
+}
@@ -0,0 +1,100 @@
+/*
+ * bench.h
+ * Timing, latency and allocation accounting for the benchmarks
+ *
+ * Copyright (c) 2026 libimobiledevice project. All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __BENCH_H
+#define __BENCH_H
+
+#include <stdint.h>
+
+typedef struct {
+	const char *name;
+	unsigned int count;
+	unsigned int done;
+	double *samples;
+	double start;
+	double elapsed;
+	uint64_t bytes;
+	uint64_t allocs;
+	uint64_t alloc_bytes;
+} bench_t;
+
+/**
+ * Returns a monotonic timestamp in seconds.
+ */
+double bench_now(void);
+
+/**
+ * Returns non-zero if the benchmark with the given name was selected on
+ * the command line, i.e. no filter was given or the name contains it.
+ */
+int bench_selected(const char *name);
+
+/**
+ * Parses the common command line options of the benchmark programs.
+ * Usage: [-q] [FILTER]; -q divides all iteration counts by 10.
+ */
+void bench_init(int argc, char **argv);
+
+/**
+ * Scales an iteration count according to the command line options.
+ */
+unsigned int bench_iterations(unsigned int count);
+
+/**
+ * Prepares a benchmark run of count operations. Allocations made by the
+ * calling thread between bench_begin() and bench_end() are accounted to
+ * the benchmark.
+ */
+void bench_begin(bench_t *bench, const char *name, unsigned int count);
+
+/* marks the start of an operation */
+void bench_op_begin(bench_t *bench);
+
+/* marks the end of an operation that transferred bytes */
+void bench_op_end(bench_t *bench, uint64_t bytes);
+
+/**
+ * Finishes the run, prints throughput, latency percentiles and
+ * allocations per operation, and frees the samples.
+ */
+void bench_end(bench_t *bench);
+
+/**
+ * Returns the number of allocations and allocated bytes of the calling
+ * thread so far. Both are 0 if allocations cannot be tracked here.
+ */
+void bench_get_allocs(uint64_t *count, uint64_t *bytes);
+
+/**
+ * Returns the peak resident set size of the process in KiB, or 0.
+ */
+uint64_t bench_get_peak_rss(void);
+
+/**
+ * Returns the number of bytes currently allocated by the calling thread
+ * and the peak since its last call to bench_reset_heap_peak(). Both are 0
+ * if allocations cannot be tracked here.
+ */
+void bench_get_heap(int64_t *current, int64_t *peak);
+
+void bench_reset_heap_peak(void);
+
+#endif
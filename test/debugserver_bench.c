@@ -0,0 +1,189 @@
+/*
+ * debugserver_bench.c
+ * Throughput benchmarks of the debugserver packet encoding, decoding and
+ * checksum
+ *
+ * Copyright (c) 2026 libimobiledevice project. All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* the checksum is internal, so the implementation is compiled in */
+#include "src/debugserver.c"
+
+#include <stdio.h>
+
+#include "bench.h"
+
+#define PAYLOAD_SIZE 0x100000
+
+static int failures = 0;
+
+/* pseudo-random bytes without NUL, as encode_string works on C strings */
+static char* new_payload(void)
+{
+	char *payload = (char*)malloc(PAYLOAD_SIZE + 1);
+	uint32_t x = 0x12345678;
+	size_t i;
+
+	if (!payload) {
+		return NULL;
+	}
+	for (i = 0; i < PAYLOAD_SIZE; i++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		payload[i] = (char)((x % 255) + 1);
+	}
+	payload[PAYLOAD_SIZE] = '\0';
+	return payload;
+}
+
+static void bench_encode(const char *payload, unsigned int count)
+{
+	const char *name = "encode_string 1 MiB";
+	bench_t bench;
+	unsigned int i;
+
+	if (!bench_selected(name)) {
+		return;
+	}
+	bench_begin(&bench, name, count);
+	for (i = 0; i < count; i++) {
+		char *encoded = NULL;
+		uint32_t encoded_length = 0;
+		bench_op_begin(&bench);
+		debugserver_encode_string(payload, &encoded, &encoded_length);
+		bench_op_end(&bench, PAYLOAD_SIZE);
+		free(encoded);
+	}
+	bench_end(&bench);
+}
+
+static void bench_decode(const char *payload, unsigned int count)
+{
+	const char *name = "decode_string 1 MiB";
+	char *encoded = NULL;
+	uint32_t encoded_length = 0;
+	bench_t bench;
+	unsigned int i;
+
+	if (!bench_selected(name)) {
+		return;
+	}
+	debugserver_encode_string(payload, &encoded, &encoded_length);
+	bench_begin(&bench, name, count);
+	for (i = 0; i < count; i++) {
+		char *decoded = NULL;
+		bench_op_begin(&bench);
+		debugserver_decode_string(encoded, 2 * PAYLOAD_SIZE, &decoded);
+		bench_op_end(&bench, PAYLOAD_SIZE);
+		if (i == 0 && (!decoded || memcmp(decoded, payload, PAYLOAD_SIZE) != 0)) {
+			fprintf(stderr, "%s: decoded data does not match\n", name);
+			failures++;
+		}
+		free(decoded);
+	}
+	bench_end(&bench);
+	free(encoded);
+}
+
+static void bench_checksum(const char *payload, unsigned int count)
+{
+	const char *name = "checksum 1 MiB";
+	uint32_t expected = 0;
+	bench_t bench;
+	unsigned int i;
+
+	if (!bench_selected(name)) {
+		return;
+	}
+	for (i = 0; i < PAYLOAD_SIZE; i++) {
+		expected += (unsigned char)payload[i];
+	}
+	bench_begin(&bench, name, count);
+	for (i = 0; i < count; i++) {
+		bench_op_begin(&bench);
+		uint32_t checksum = debugserver_get_checksum_for_buffer(payload, PAYLOAD_SIZE);
+		bench_op_end(&bench, PAYLOAD_SIZE);
+		if (checksum != (expected & 0xff)) {
+			fprintf(stderr, "%s: got 0x%02x, expected 0x%02x\n", name, checksum, expected & 0xff);
+			failures++;
+			break;
+		}
+	}
+	bench_end(&bench);
+}
+
+static void bench_decode_binary(const char *payload, unsigned int count)
+{
+	const char *name = "decode_binary 1 MiB";
+	char *encoded = (char*)malloc(2 * PAYLOAD_SIZE);
+	size_t encoded_length = 0;
+	bench_t bench;
+	unsigned int i;
+
+	if (!bench_selected(name)) {
+		free(encoded);
+		return;
+	}
+	if (!encoded) {
+		failures++;
+		return;
+	}
+	/* escape the special bytes like debugserver does, runs are left alone */
+	for (i = 0; i < PAYLOAD_SIZE; i++) {
+		char c = payload[i];
+		if (c == '$' || c == '#' || c == '}' || c == '*') {
+			encoded[encoded_length++] = '}';
+			c ^= 0x20;
+		}
+		encoded[encoded_length++] = c;
+	}
+	bench_begin(&bench, name, count);
+	for (i = 0; i < count; i++) {
+		char *decoded = NULL;
+		size_t length = 0;
+		bench_op_begin(&bench);
+		debugserver_decode_binary(encoded, encoded_length, &decoded, &length);
+		bench_op_end(&bench, PAYLOAD_SIZE);
+		if (i == 0 && (!decoded || length != PAYLOAD_SIZE || memcmp(decoded, payload, PAYLOAD_SIZE) != 0)) {
+			fprintf(stderr, "%s: decoded data does not match\n", name);
+			failures++;
+		}
+		free(decoded);
+	}
+	bench_end(&bench);
+	free(encoded);
+}
+
+int main(int argc, char **argv)
+{
+	bench_init(argc, argv);
+
+	char *payload = new_payload();
+	if (!payload) {
+		fprintf(stderr, "could not allocate the payload\n");
+		return 1;
+	}
+
+	bench_encode(payload, bench_iterations(200));
+	bench_decode(payload, bench_iterations(200));
+	bench_checksum(payload, bench_iterations(1000));
+	bench_decode_binary(payload, bench_iterations(200));
+
+	free(payload);
+	return (failures > 0) ? 1 : 0;
+}
@@ -0,0 +1,170 @@
+/*
+ * debugserver_checksum.c
+ * Checks the debugserver packet checksums against the emulator, which
+ * computes them as a plain byte sum
+ *
+ * Copyright (c) 2026 libimobiledevice project. All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libimobiledevice/libimobiledevice.h>
+#include <libimobiledevice/debugserver.h>
+
+#include "emulator.h"
+
+#define ROUNDS 256
+#define MIN_LENGTH 4096
+#define MAX_LENGTH 65536
+
+static const char hex_digits[] = "0123456789abcdef";
+
+/* sends a raw packet and returns the response; in ack mode a checksum
+ * mismatch in either direction makes this fail */
+static char* send_packet(debugserver_client_t client, const char *packet, size_t *response_size)
+{
+	debugserver_command_t command = NULL;
+	char *response = NULL;
+
+	if (debugserver_command_new(packet, 0, NULL, &command) != DEBUGSERVER_E_SUCCESS) {
+		return NULL;
+	}
+	if (debugserver_client_send_command(client, command, &response, response_size) != DEBUGSERVER_E_SUCCESS) {
+		free(response);
+		response = NULL;
+	}
+	debugserver_command_free(command);
+	return response;
+}
+
+/* reads memory as hex ('m') or binary ('x') and compares it with what the emulator holds */
+static int check_read(debugserver_client_t client, char type, uint64_t address, size_t length, const char *expected)
+{
+	char packet[64];
+	char *response = NULL;
+	char *data = NULL;
+	size_t response_size = 0;
+	size_t data_length = 0;
+
+	snprintf(packet, sizeof(packet), "%c%llx,%zx", type, (unsigned long long)address, length);
+	response = send_packet(client, packet, &response_size);
+	if (!response) {
+		fprintf(stderr, "%s: no valid response\n", packet);
+		return 0;
+	}
+	if (type == 'm') {
+		debugserver_decode_string(response, response_size, &data);
+		data_length = response_size / 2;
+	} else {
+		debugserver_decode_binary(response, response_size, &data, &data_length);
+	}
+	free(response);
+	int ok = (data && data_length == length && memcmp(data, expected, length) == 0);
+	if (!ok) {
+		fprintf(stderr, "%s: got %zu bytes that do not match\n", packet, data_length);
+	}
+	free(data);
+	return ok;
+}
+
+/* writes memory with a large hex packet the emulator verifies */
+static int check_write(debugserver_client_t client, uint64_t address, size_t length, const char *data)
+{
+	char *packet = (char*)malloc(64 + 2 * length);
+	size_t i;
+
+	if (!packet) {
+		return 0;
+	}
+	char *p = packet + sprintf(packet, "M%llx,%zx:", (unsigned long long)address, length);
+	for (i = 0; i < length; i++) {
+		*p++ = hex_digits[(unsigned char)data[i] >> 4];
+		*p++ = hex_digits[(unsigned char)data[i] & 0xf];
+	}
+	*p = '\0';
+	char *response = send_packet(client, packet, NULL);
+	int ok = (response && strcmp(response, "OK") == 0);
+	if (!ok) {
+		fprintf(stderr, "M%llx,%zx: got %s\n", (unsigned long long)address, length, (response) ? response : "no valid response");
+	}
+	free(response);
+	free(packet);
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	emulator_t emulator = NULL;
+	idevice_t device = NULL;
+	debugserver_client_t client = NULL;
+	struct lockdownd_service_descriptor service;
+	char *expected = NULL;
+	int failed = 0;
+	int i;
+
+	unsigned int seed = (argc > 1) ? (unsigned int)strtoul(argv[1], NULL, 0) : (unsigned int)time(NULL);
+	srand(seed);
+	printf("seed %u\n", seed);
+
+	if (emulator_start(&emulator) < 0) {
+		fprintf(stderr, "could not start the emulator\n");
+		return 1;
+	}
+	device = emulator_new_device(emulator);
+	emulator_get_service_descriptor(emulator, EMULATOR_SERVICE_DEBUGSERVER, &service);
+	expected = (char*)malloc(MAX_LENGTH);
+	if (!device || !expected || debugserver_client_new(device, &service, &client) != DEBUGSERVER_E_SUCCESS) {
+		fprintf(stderr, "could not connect to the emulated debugserver\n");
+		failed++;
+		goto leave;
+	}
+
+	/* the connection stays in ack mode, so every packet checksum gets checked */
+	for (i = 0; i < ROUNDS && failed < 10; i++) {
+		uint64_t address = ((uint64_t)rand() << 16) ^ (uint64_t)rand();
+		size_t length = MIN_LENGTH + (size_t)rand() % (MAX_LENGTH - MIN_LENGTH + 1);
+		emulator_fill_memory(address, expected, length);
+		if (!check_read(client, 'm', address, length, expected)) {
+			failed++;
+		}
+		if (!check_read(client, 'x', address, length, expected)) {
+			failed++;
+		}
+		if (!check_write(client, address, length, expected)) {
+			failed++;
+		}
+	}
+
+leave:
+	debugserver_client_free(client);
+	idevice_free(device);
+	emulator_stop(emulator);
+	free(expected);
+
+	if (failed > 0) {
+		fprintf(stderr, "%d test(s) failed\n", failed);
+		return 1;
+	}
+	return 0;
+}
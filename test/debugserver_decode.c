@@ -0,0 +1,113 @@
+/*
+ * debugserver_decode.c
+ * Regression tests for the debugserver binary and string decoders
+ *
+ * Copyright (c) 2026 libimobiledevice project. All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libimobiledevice/debugserver.h>
+
+struct binary_case {
+	const char *encoded;
+	size_t encoded_length;
+	const char *decoded;
+	size_t decoded_length;
+};
+
+static const struct binary_case binary_cases[] = {
+	/* plain bytes */
+	{ "abc", 3, "abc", 3 },
+	/* escaped byte: '}' followed by the byte xor 0x20 */
+	{ "a}]b", 4, "a}b", 3 },
+	/* run-length expansion at the end of the input */
+	{ "a* ", 3, "aaaa", 4 },
+	/* plain bytes after an expansion used to overflow the output buffer */
+	{ "a* bcdefghi", 11, "aaaabcdefghi", 12 },
+	{ "x*#yz", 5, "xxxxxxxyz", 9 },
+	/* multiple expansions back to back */
+	{ "a* * b", 6, "aaaaaaab", 8 },
+	/* a run without a previous byte, a truncated run and a truncated
+	 * escape stop decoding */
+	{ "* abc", 5, "", 0 },
+	{ "ab*", 3, "ab", 2 },
+	{ "ab}", 3, "ab", 2 },
+	/* run counts below 29 are invalid */
+	{ "a*\x01" "bc", 5, "a", 1 },
+};
+
+static int test_decode_binary(const struct binary_case *tc)
+{
+	char *buffer = NULL;
+	size_t length = (size_t)-1;
+
+	debugserver_decode_binary(tc->encoded, tc->encoded_length, &buffer, &length);
+	if (!buffer) {
+		fprintf(stderr, "decode_binary(\"%s\"): no buffer returned\n", tc->encoded);
+		return 0;
+	}
+	int ok = (length == tc->decoded_length && memcmp(buffer, tc->decoded, length) == 0 && buffer[length] == '\0');
+	if (!ok) {
+		fprintf(stderr, "decode_binary(\"%s\"): got %zu bytes \"%.*s\", expected %zu bytes \"%s\"\n", tc->encoded, length, (int)length, buffer, tc->decoded_length, tc->decoded);
+	}
+	free(buffer);
+	return ok;
+}
+
+static int test_decode_string(const char *encoded, const char *decoded)
+{
+	char *buffer = NULL;
+
+	debugserver_decode_string(encoded, strlen(encoded), &buffer);
+	int ok = (buffer && strcmp(buffer, decoded) == 0);
+	if (!ok) {
+		fprintf(stderr, "decode_string(\"%s\"): got \"%s\", expected \"%s\"\n", encoded, (buffer) ? buffer : "(null)", decoded);
+	}
+	free(buffer);
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	int failed = 0;
+	size_t i;
+
+	for (i = 0; i < sizeof(binary_cases) / sizeof(binary_cases[0]); i++) {
+		if (!test_decode_binary(&binary_cases[i])) {
+			failed++;
+		}
+	}
+	if (!test_decode_string("48656c6c6f", "Hello")) {
+		failed++;
+	}
+	if (!test_decode_string("4F4B", "OK")) {
+		failed++;
+	}
+
+	if (failed > 0) {
+		fprintf(stderr, "%d test(s) failed\n", failed);
+		return 1;
+	}
+	return 0;
+}
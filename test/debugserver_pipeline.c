@@ -0,0 +1,162 @@
+/*
+ * debugserver_pipeline.c
+ * Checks that pipelined debugserver commands get their own responses in
+ * order once acknowledgements are disabled
+ *
+ * Copyright (c) 2026 libimobiledevice project. All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libimobiledevice/libimobiledevice.h>
+#include <libimobiledevice/debugserver.h>
+
+#include "emulator.h"
+
+#define COMMAND_COUNT 1000
+#define READ_LENGTH 64
+
+/* every third command is unsupported, the others read memory at an
+ * address derived from their index */
+static void format_command(unsigned int index, char *packet, size_t size)
+{
+	if (index % 3 == 2) {
+		snprintf(packet, size, "qEmulatorUnsupported%u", index);
+	} else {
+		snprintf(packet, size, "%c%x,%x", (index % 3 == 0) ? 'm' : 'x', index * 0x1000, READ_LENGTH);
+	}
+}
+
+static int check_response(unsigned int index, const char *response, size_t response_size)
+{
+	char expected[READ_LENGTH];
+	char *data = NULL;
+	size_t data_length = 0;
+
+	if (!response) {
+		fprintf(stderr, "command %u: no response\n", index);
+		return 0;
+	}
+	if (index % 3 == 2) {
+		if (response_size != 0) {
+			fprintf(stderr, "command %u: expected an empty response, got \"%s\"\n", index, response);
+			return 0;
+		}
+		return 1;
+	}
+	if (index % 3 == 0) {
+		debugserver_decode_string(response, response_size, &data);
+		data_length = response_size / 2;
+	} else {
+		debugserver_decode_binary(response, response_size, &data, &data_length);
+	}
+	emulator_fill_memory(index * 0x1000, expected, READ_LENGTH);
+	int ok = (data && data_length == READ_LENGTH && memcmp(data, expected, READ_LENGTH) == 0);
+	if (!ok) {
+		fprintf(stderr, "command %u: response does not match the memory it asked for\n", index);
+	}
+	free(data);
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	emulator_t emulator = NULL;
+	idevice_t device = NULL;
+	debugserver_client_t client = NULL;
+	debugserver_command_t commands[COMMAND_COUNT];
+	char *responses[COMMAND_COUNT];
+	size_t response_sizes[COMMAND_COUNT];
+	struct lockdownd_service_descriptor service;
+	debugserver_command_t noack = NULL;
+	char *response = NULL;
+	char packet[64];
+	int failed = 0;
+	unsigned int i;
+
+	memset(commands, 0, sizeof(commands));
+	memset(responses, 0, sizeof(responses));
+
+	if (emulator_start(&emulator) < 0) {
+		fprintf(stderr, "could not start the emulator\n");
+		return 1;
+	}
+	device = emulator_new_device(emulator);
+	emulator_get_service_descriptor(emulator, EMULATOR_SERVICE_DEBUGSERVER, &service);
+	if (!device || debugserver_client_new(device, &service, &client) != DEBUGSERVER_E_SUCCESS) {
+		fprintf(stderr, "could not connect to the emulated debugserver\n");
+		failed++;
+		goto leave;
+	}
+
+	/* the same sequence as idevicedebug's batch command */
+	debugserver_command_new("QStartNoAckMode", 0, NULL, &noack);
+	debugserver_client_send_command(client, noack, &response, NULL);
+	debugserver_command_free(noack);
+	if (!response || strcmp(response, "OK") != 0) {
+		fprintf(stderr, "QStartNoAckMode: got %s\n", (response) ? response : "no response");
+		failed++;
+		goto leave;
+	}
+	debugserver_client_set_ack_mode(client, 0);
+
+	for (i = 0; i < COMMAND_COUNT; i++) {
+		format_command(i, packet, sizeof(packet));
+		debugserver_command_new(packet, 0, NULL, &commands[i]);
+	}
+	debugserver_error_t res = debugserver_client_send_commands(client, commands, COMMAND_COUNT, responses, response_sizes);
+	if (res != DEBUGSERVER_E_SUCCESS) {
+		fprintf(stderr, "send_commands failed: %d\n", res);
+		failed++;
+	}
+	for (i = 0; i < COMMAND_COUNT && failed < 10; i++) {
+		if (!check_response(i, responses[i], response_sizes[i])) {
+			failed++;
+		}
+	}
+
+	/* commands sent one at a time would each have arrived on their own */
+	unsigned int pipelined = emulator_get_debugserver_pipelined(emulator);
+	if (pipelined < 2) {
+		fprintf(stderr, "commands were not pipelined (at most %u arrived at once)\n", pipelined);
+		failed++;
+	}
+
+leave:
+	for (i = 0; i < COMMAND_COUNT; i++) {
+		if (commands[i]) {
+			debugserver_command_free(commands[i]);
+		}
+		free(responses[i]);
+	}
+	free(response);
+	debugserver_client_free(client);
+	idevice_free(device);
+	emulator_stop(emulator);
+
+	if (failed > 0) {
+		fprintf(stderr, "%d test(s) failed\n", failed);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,203 @@
+/*
+ * ed25519_backends.c
+ * Known answer tests that every ed25519 field arithmetic backend has to
+ * reproduce byte for byte
+ *
+ * Copyright (c) 2026 libimobiledevice project. All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ed25519.h"
+#include "sha512.h"
+
+/* the field arithmetic the ed25519 library linked in was built with */
+#ifdef ED25519_FE51
+#define BACKEND "fe51"
+#else
+#define BACKEND "ref10"
+#endif
+
+#define NUM_GENERATED 256
+
+struct vector {
+	const char *seed;
+	const char *public_key;
+	const char *message;
+	const char *signature;
+};
+
+/* RFC 8032, section 7.1, tests 1 to 3 */
+static const struct vector vectors[] = {
+	{
+		"9d61b19deffd5a60ba844af492ec2cc44449c5697b326919703bac031cae7f60",
+		"d75a980182b10ab7d54bfed3c964073a0ee172f3daa62325af021a68f707511a",
+		"",
+		"e5564300c360ac729086e2cc806e828a84877f1eb8e5d974d873e06522490155"
+		"5fb8821590a33bacc61e39701cf9b46bd25bf5f0595bbe24655141438e7a100b"
+	},
+	{
+		"4ccd089b28ff96da9db6c346ec114e0f5b8a319f35aba624da8cf6ed4fb8a6fb",
+		"3d4017c3e843895a92b70aa74d1b7ebc9c982ccf2ec4968cc0cd55f12af4660c",
+		"72",
+		"92a009a9f0d4cab8720e820b5f642540a2b27b5416503f8fb3762223ebdb69da"
+		"085ac1e43e15996e458f3613d0f11d8c387b2eaeb4302aeeb00d291612bb0c00"
+	},
+	{
+		"c5aa8df43f9f837bedb7442f31dcb7b166d38535076f094b85ce3a2e0b4458f7",
+		"fc51cd8e6218a1a38da47ed00230f0580816ed13ba3303ac5deb911548908025",
+		"af82",
+		"6291d657deec24024827e69c3abe01a30ce548a284743a445e3680d7db5ac3ac"
+		"18ff9b538d16f290ae67f760984dc6594a7c15e9716ed28dc027beceea1ec40a"
+	}
+};
+
+/* SHA-512 over the public keys, signatures and shared secrets of the
+ * generated cases, as produced by the ref10 backend */
+static const char generated_digest[] =
+	"89dd61e0834e54c5ec9ef2466f9fe750da05664c9e6e666c03f22cb2c0257001"
+	"f2eb677669a4292680eb4a9ad3dc130ab5e1fab0e4563b0dc2bdd4ff98b22b45";
+
+static int failed = 0;
+
+static void from_hex(const char *hex, unsigned char *out, size_t length)
+{
+	size_t i;
+	for (i = 0; i < length; i++) {
+		unsigned int byte = 0;
+		sscanf(hex + 2 * i, "%2x", &byte);
+		out[i] = (unsigned char)byte;
+	}
+}
+
+static void to_hex(const unsigned char *data, size_t length, char *out)
+{
+	size_t i;
+	for (i = 0; i < length; i++) {
+		sprintf(out + 2 * i, "%02x", data[i]);
+	}
+}
+
+static void check_bytes(const char *what, unsigned int index, const unsigned char *got, const char *expected, size_t length)
+{
+	char hex[129];
+
+	to_hex(got, length, hex);
+	if (strcmp(hex, expected) != 0) {
+		fprintf(stderr, BACKEND ": %s %u is %s, expected %s\n", what, index, hex, expected);
+		failed++;
+	}
+}
+
+static void check_signature(unsigned int index, const unsigned char *signature, const unsigned char *message, size_t message_len, const unsigned char *public_key)
+{
+	unsigned char tampered[64];
+
+	if (!ed25519_verify(signature, message, message_len, public_key)) {
+		fprintf(stderr, BACKEND ": signature %u does not verify\n", index);
+		failed++;
+	}
+	memcpy(tampered, signature, sizeof(tampered));
+	tampered[index % sizeof(tampered)] ^= 0x01;
+	if (ed25519_verify(tampered, message, message_len, public_key)) {
+		fprintf(stderr, BACKEND ": tampered signature %u verifies\n", index);
+		failed++;
+	}
+}
+
+static void test_vectors(void)
+{
+	unsigned char seed[32];
+	unsigned char public_key[32];
+	unsigned char private_key[64];
+	unsigned char message[64];
+	unsigned char signature[64];
+	unsigned int i;
+
+	for (i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+		size_t message_len = strlen(vectors[i].message) / 2;
+		from_hex(vectors[i].seed, seed, sizeof(seed));
+		from_hex(vectors[i].message, message, message_len);
+		ed25519_create_keypair(public_key, private_key, seed);
+		check_bytes("public key", i, public_key, vectors[i].public_key, sizeof(public_key));
+		ed25519_sign(signature, message, message_len, public_key, private_key);
+		check_bytes("signature", i, signature, vectors[i].signature, sizeof(signature));
+		check_signature(i, signature, message, message_len, public_key);
+	}
+}
+
+/* keys and messages derived from a hash chain, so they are the same everywhere */
+static void test_generated(void)
+{
+	unsigned char chain[64];
+	unsigned char public_key[32];
+	unsigned char private_key[64];
+	unsigned char previous_public_key[32];
+	unsigned char message[NUM_GENERATED * 4];
+	unsigned char signature[64];
+	unsigned char shared_secret[32];
+	unsigned char digest[64];
+	char hex[129];
+	sha512_context ctx;
+	unsigned int i;
+	size_t j;
+
+	memset(chain, 0, sizeof(chain));
+	memset(previous_public_key, 0, sizeof(previous_public_key));
+	sha512_init(&ctx);
+	for (i = 0; i < NUM_GENERATED; i++) {
+		size_t message_len = i * 4;
+		sha512(chain, sizeof(chain), chain);
+		ed25519_create_keypair(public_key, private_key, chain);
+		for (j = 0; j < message_len; j++) {
+			message[j] = chain[j % sizeof(chain)] ^ (unsigned char)j;
+		}
+		ed25519_sign(signature, message, message_len, public_key, private_key);
+		check_signature(i, signature, message, message_len, public_key);
+		ed25519_key_exchange(shared_secret, previous_public_key, private_key);
+
+		sha512_update(&ctx, public_key, sizeof(public_key));
+		sha512_update(&ctx, signature, sizeof(signature));
+		sha512_update(&ctx, shared_secret, sizeof(shared_secret));
+		memcpy(previous_public_key, public_key, sizeof(public_key));
+	}
+	sha512_final(&ctx, digest);
+
+	to_hex(digest, sizeof(digest), hex);
+	if (strcmp(hex, generated_digest) != 0) {
+		fprintf(stderr, BACKEND ": generated cases digest is %s, expected %s\n", hex, generated_digest);
+		failed++;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	test_vectors();
+	test_generated();
+
+	if (failed > 0) {
+		fprintf(stderr, BACKEND ": %d test(s) failed\n", failed);
+		return 1;
+	}
+	return 0;
+}
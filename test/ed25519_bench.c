@@ -0,0 +1,178 @@
+/*
+ * ed25519_bench.c
+ * Benchmark of the bundled ed25519 implementation used for wireless pairing
+ *
+ * Copyright (c) 2026 libimobiledevice project. All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ed25519.h"
+#include "bench.h"
+
+/* the field arithmetic the ed25519 library linked in was built with */
+#ifdef ED25519_FE51
+#define BACKEND "fe51"
+#else
+#define BACKEND "ref10"
+#endif
+
+#define NUM_KEYS 16
+
+struct keypair {
+	unsigned char public_key[32];
+	unsigned char private_key[64];
+};
+
+static struct keypair keys[NUM_KEYS];
+static unsigned char message[256];
+static unsigned char signatures[NUM_KEYS][64];
+static int failures = 0;
+
+/* deterministic seeds, so every backend works on the same keys */
+static void make_seed(unsigned char *seed, unsigned int n)
+{
+	unsigned int i;
+	for (i = 0; i < 32; i++) {
+		seed[i] = (unsigned char)(n * 131 + i * 7 + 1);
+	}
+}
+
+static void bench_keypair(unsigned int count)
+{
+	const char *name = "ed25519 " BACKEND " create_keypair";
+	unsigned char seed[32];
+	bench_t bench;
+	unsigned int i;
+
+	if (!bench_selected(name)) {
+		return;
+	}
+	bench_begin(&bench, name, count);
+	for (i = 0; i < count; i++) {
+		struct keypair *kp = &keys[i % NUM_KEYS];
+		make_seed(seed, i % NUM_KEYS);
+		bench_op_begin(&bench);
+		ed25519_create_keypair(kp->public_key, kp->private_key, seed);
+		bench_op_end(&bench, 0);
+	}
+	bench_end(&bench);
+}
+
+static void bench_sign(unsigned int count)
+{
+	const char *name = "ed25519 " BACKEND " sign 256 bytes";
+	bench_t bench;
+	unsigned int i;
+
+	if (!bench_selected(name)) {
+		return;
+	}
+	bench_begin(&bench, name, count);
+	for (i = 0; i < count; i++) {
+		struct keypair *kp = &keys[i % NUM_KEYS];
+		bench_op_begin(&bench);
+		ed25519_sign(signatures[i % NUM_KEYS], message, sizeof(message), kp->public_key, kp->private_key);
+		bench_op_end(&bench, 0);
+	}
+	bench_end(&bench);
+}
+
+static void bench_verify(unsigned int count)
+{
+	const char *name = "ed25519 " BACKEND " verify 256 bytes";
+	bench_t bench;
+	unsigned int i;
+
+	if (!bench_selected(name)) {
+		return;
+	}
+	bench_begin(&bench, name, count);
+	for (i = 0; i < count; i++) {
+		struct keypair *kp = &keys[i % NUM_KEYS];
+		bench_op_begin(&bench);
+		int ok = ed25519_verify(signatures[i % NUM_KEYS], message, sizeof(message), kp->public_key);
+		bench_op_end(&bench, 0);
+		if (!ok) {
+			fprintf(stderr, "%s: signature %u did not verify\n", name, i % NUM_KEYS);
+			failures++;
+			break;
+		}
+	}
+	bench_end(&bench);
+}
+
+static void bench_key_exchange(unsigned int count)
+{
+	const char *name = "ed25519 " BACKEND " key_exchange";
+	unsigned char shared_secret[32];
+	unsigned char other_secret[32];
+	bench_t bench;
+	unsigned int i;
+
+	if (!bench_selected(name)) {
+		return;
+	}
+	bench_begin(&bench, name, count);
+	for (i = 0; i < count; i++) {
+		struct keypair *a = &keys[i % NUM_KEYS];
+		struct keypair *b = &keys[(i + 1) % NUM_KEYS];
+		bench_op_begin(&bench);
+		ed25519_key_exchange(shared_secret, b->public_key, a->private_key);
+		bench_op_end(&bench, 0);
+		if (i < NUM_KEYS) {
+			ed25519_key_exchange(other_secret, a->public_key, b->private_key);
+			if (memcmp(shared_secret, other_secret, sizeof(shared_secret)) != 0) {
+				fprintf(stderr, "%s: shared secrets of keys %u and %u differ\n", name, i % NUM_KEYS, (i + 1) % NUM_KEYS);
+				failures++;
+				break;
+			}
+		}
+	}
+	bench_end(&bench);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned char seed[32];
+	unsigned int i;
+
+	bench_init(argc, argv);
+
+	for (i = 0; i < sizeof(message); i++) {
+		message[i] = (unsigned char)i;
+	}
+	/* the keys and signatures are needed even if only some benchmarks run */
+	for (i = 0; i < NUM_KEYS; i++) {
+		make_seed(seed, i);
+		ed25519_create_keypair(keys[i].public_key, keys[i].private_key, seed);
+		ed25519_sign(signatures[i], message, sizeof(message), keys[i].public_key, keys[i].private_key);
+	}
+
+	bench_keypair(bench_iterations(20000));
+	bench_sign(bench_iterations(20000));
+	bench_verify(bench_iterations(10000));
+	bench_key_exchange(bench_iterations(10000));
+
+	return (failures > 0) ? 1 : 0;
+}
@@ -0,0 +1,1058 @@
+/*
+ * emulator.c
+ * Loopback device emulator for tests and benchmarks
+ *
+ * Copyright (c) 2026 libimobiledevice project. All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <plist/plist.h>
+#include <libimobiledevice-glue/thread.h>
+
+#include "src/idevice.h"
+#include "src/afc.h"
+#include "emulator.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define EMULATOR_LOCKDOWN_PORT 0xf27e
+/* how often blocked sockets check if the emulator is stopping (ms) */
+#define EMULATOR_POLL_INTERVAL 100
+/* size of the fill pattern for file data and of the receive buffers */
+#define EMULATOR_BUFFER_SIZE 0x100000
+#define EMULATOR_MAX_PLIST_SIZE 0x1000000
+#define EMULATOR_SCREENSHOT_SIZE 4096
+/* size of the read ahead buffer of debugserver connections */
+#define EMULATOR_DEBUGSERVER_READ_SIZE 0x4000
+
+#define CODE_SUCCESS 0x00
+#define CODE_FILE_DATA 0x0c
+
+struct emulator_listener {
+	emulator_t emulator;
+	emulator_service_t service;
+	int fd;
+	uint16_t port;
+	THREAD_T thread;
+	int running;
+};
+
+struct emulator_private {
+	struct emulator_listener listener[EMULATOR_SERVICE_COUNT];
+	volatile int stopping;
+	mutex_t mutex;
+	cond_t cond;
+	int connections;
+	char *fill;
+	plist_t values;
+	char *screenshot_reply;
+	uint32_t screenshot_reply_length;
+	unsigned int debugserver_pipelined;
+};
+
+struct emulator_connection {
+	emulator_t emulator;
+	emulator_service_t service;
+	int fd;
+	char *buffer;
+};
+
+static const char *emulator_service_names[EMULATOR_SERVICE_COUNT] = {
+	"com.apple.mobile.lockdown",
+	AFC_SERVICE_NAME,
+	EMULATOR_ECHO_SERVICE_NAME,
+	"com.apple.mobilebackup2",
+	"com.apple.mobile.screenshotr",
+	"com.apple.debugserver"
+};
+
+static int emulator_receive(struct emulator_connection *conn, void *data, size_t length)
+{
+	size_t done = 0;
+
+	while (done < length) {
+		ssize_t r = recv(conn->fd, (char*)data + done, length - done, 0);
+		if (r > 0) {
+			done += r;
+			continue;
+		}
+		if (r == 0) {
+			return -1;
+		}
+		if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
+			return -1;
+		}
+		if (conn->emulator->stopping) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int emulator_discard(struct emulator_connection *conn, uint64_t length)
+{
+	while (length > 0) {
+		size_t chunk = (length > EMULATOR_BUFFER_SIZE) ? EMULATOR_BUFFER_SIZE : (size_t)length;
+		if (emulator_receive(conn, conn->buffer, chunk) < 0) {
+			return -1;
+		}
+		length -= chunk;
+	}
+	return 0;
+}
+
+static int emulator_send(struct emulator_connection *conn, const void *data, size_t length)
+{
+	size_t done = 0;
+
+	while (done < length) {
+		ssize_t r = send(conn->fd, (const char*)data + done, length - done, MSG_NOSIGNAL);
+		if (r > 0) {
+			done += r;
+			continue;
+		}
+		if (r < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) && !conn->emulator->stopping) {
+			continue;
+		}
+		return -1;
+	}
+	return 0;
+}
+
+/* sends length bytes of the fill pattern */
+static int emulator_send_fill(struct emulator_connection *conn, uint64_t length)
+{
+	while (length > 0) {
+		size_t chunk = (length > EMULATOR_BUFFER_SIZE) ? EMULATOR_BUFFER_SIZE : (size_t)length;
+		if (emulator_send(conn, conn->emulator->fill, chunk) < 0) {
+			return -1;
+		}
+		length -= chunk;
+	}
+	return 0;
+}
+
+static int emulator_receive_plist(struct emulator_connection *conn, plist_t *plist)
+{
+	uint32_t pktlen = 0;
+
+	*plist = NULL;
+	if (emulator_receive(conn, &pktlen, sizeof(pktlen)) < 0) {
+		return -1;
+	}
+	pktlen = be32toh(pktlen);
+	if (pktlen == 0 || pktlen > EMULATOR_MAX_PLIST_SIZE) {
+		return -1;
+	}
+	char *content = (char*)malloc(pktlen);
+	if (!content || emulator_receive(conn, content, pktlen) < 0) {
+		free(content);
+		return -1;
+	}
+	plist_from_memory(content, pktlen, plist, NULL);
+	free(content);
+	return (*plist) ? 0 : -1;
+}
+
+/* serializes a plist into a packet with the length prefix of property list services */
+static char* emulator_plist_to_packet(plist_t plist, uint32_t *packet_length)
+{
+	char *content = NULL;
+	uint32_t length = 0;
+
+	plist_to_bin(plist, &content, &length);
+	if (!content || length == 0) {
+		free(content);
+		return NULL;
+	}
+	char *packet = (char*)malloc(sizeof(uint32_t) + length);
+	if (!packet) {
+		free(content);
+		return NULL;
+	}
+	*(uint32_t*)packet = htobe32(length);
+	memcpy(packet + sizeof(uint32_t), content, length);
+	free(content);
+	*packet_length = sizeof(uint32_t) + length;
+	return packet;
+}
+
+static int emulator_send_plist(struct emulator_connection *conn, plist_t plist)
+{
+	uint32_t length = 0;
+	char *packet = emulator_plist_to_packet(plist, &length);
+	if (!packet) {
+		return -1;
+	}
+	int res = emulator_send(conn, packet, length);
+	free(packet);
+	return res;
+}
+
+static const char* emulator_get_string(plist_t node)
+{
+	if (!node || plist_get_node_type(node) != PLIST_STRING) {
+		return NULL;
+	}
+	return plist_get_string_ptr(node, NULL);
+}
+
+static void emulator_serve_lockdown(struct emulator_connection *conn)
+{
+	emulator_t emulator = conn->emulator;
+	plist_t request = NULL;
+
+	while (emulator_receive_plist(conn, &request) == 0) {
+		const char *name = emulator_get_string(plist_dict_get_item(request, "Request"));
+		plist_t reply = plist_new_dict();
+		int done = 0;
+
+		if (name) {
+			plist_dict_set_item(reply, "Request", plist_new_string(name));
+		}
+		if (!name) {
+			plist_dict_set_item(reply, "Error", plist_new_string("InvalidRequest"));
+		} else if (!strcmp(name, "QueryType")) {
+			plist_dict_set_item(reply, "Type", plist_new_string("com.apple.mobile.lockdown"));
+		} else if (!strcmp(name, "GetValue")) {
+			const char *key = emulator_get_string(plist_dict_get_item(request, "Key"));
+			if (key) {
+				plist_t value = plist_dict_get_item(emulator->values, key);
+				plist_dict_set_item(reply, "Key", plist_new_string(key));
+				if (value) {
+					plist_dict_set_item(reply, "Value", plist_copy(value));
+				} else {
+					plist_dict_set_item(reply, "Error", plist_new_string("MissingValue"));
+				}
+			} else {
+				plist_dict_set_item(reply, "Value", plist_copy(emulator->values));
+			}
+		} else if (!strcmp(name, "StartService")) {
+			const char *service = emulator_get_string(plist_dict_get_item(request, "Service"));
+			uint16_t port = 0;
+			int i;
+			for (i = EMULATOR_SERVICE_LOCKDOWN + 1; service && i < EMULATOR_SERVICE_COUNT; i++) {
+				if (!strcmp(service, emulator_service_names[i])) {
+					port = emulator->listener[i].port;
+					break;
+				}
+			}
+			if (service) {
+				plist_dict_set_item(reply, "Service", plist_new_string(service));
+			}
+			if (port) {
+				plist_dict_set_item(reply, "Port", plist_new_uint(port));
+			} else {
+				plist_dict_set_item(reply, "Error", plist_new_string("InvalidService"));
+			}
+		} else if (!strcmp(name, "Goodbye")) {
+			done = 1;
+		} else {
+			plist_dict_set_item(reply, "Error", plist_new_string("InvalidRequest"));
+		}
+		plist_free(request);
+		request = NULL;
+
+		int res = emulator_send_plist(conn, reply);
+		plist_free(reply);
+		if (res < 0 || done) {
+			break;
+		}
+	}
+}
+
+static int emulator_afc_reply(struct emulator_connection *conn, uint64_t packet_num, uint64_t operation, const char *data, uint64_t length)
+{
+	char packet[sizeof(AFCPacket) + sizeof(uint64_t)];
+	AFCPacket *header = (AFCPacket*)packet;
+	uint32_t inline_length = (data) ? (uint32_t)length : 0;
+
+	memcpy(header->magic, AFC_MAGIC, AFC_MAGIC_LEN);
+	header->entire_length = sizeof(AFCPacket) + length;
+	header->this_length = sizeof(AFCPacket) + length;
+	header->packet_num = packet_num;
+	header->operation = operation;
+	AFCPacket_to_LE(header);
+	if (inline_length > 0) {
+		memcpy(packet + sizeof(AFCPacket), data, inline_length);
+	}
+	if (emulator_send(conn, packet, sizeof(AFCPacket) + inline_length) < 0) {
+		return -1;
+	}
+	if (!data) {
+		return emulator_send_fill(conn, length);
+	}
+	return 0;
+}
+
+static int emulator_afc_status(struct emulator_connection *conn, uint64_t packet_num, uint64_t status)
+{
+	uint64_t value = htole64(status);
+	return emulator_afc_reply(conn, packet_num, AFC_OP_STATUS, (const char*)&value, sizeof(value));
+}
+
+static void emulator_serve_afc(struct emulator_connection *conn)
+{
+	AFCPacket header;
+	char data[4096];
+	uint64_t next_handle = 1;
+	int res = 0;
+
+	while (res == 0 && emulator_receive(conn, &header, sizeof(AFCPacket)) == 0) {
+		AFCPacket_from_LE(&header);
+		if (memcmp(header.magic, AFC_MAGIC, AFC_MAGIC_LEN) != 0
+		    || header.this_length < sizeof(AFCPacket)
+		    || header.entire_length < header.this_length
+		    || header.this_length - sizeof(AFCPacket) > sizeof(data)) {
+			fprintf(stderr, "emulator: invalid AFC packet\n");
+			break;
+		}
+		uint32_t data_length = (uint32_t)(header.this_length - sizeof(AFCPacket));
+		if (emulator_receive(conn, data, data_length) < 0
+		    || emulator_discard(conn, header.entire_length - header.this_length) < 0) {
+			break;
+		}
+
+		switch (header.operation) {
+		case AFC_OP_FILE_OPEN: {
+			uint64_t handle = htole64(next_handle++);
+			res = emulator_afc_reply(conn, header.packet_num, AFC_OP_FILE_OPEN_RES, (const char*)&handle, sizeof(handle));
+			break;
+		}
+		case AFC_OP_FILE_READ:
+			if (data_length < 2 * sizeof(uint64_t)) {
+				res = emulator_afc_status(conn, header.packet_num, AFC_E_INVALID_ARG);
+			} else {
+				uint64_t size = le64toh(*(uint64_t*)(data + sizeof(uint64_t)));
+				res = emulator_afc_reply(conn, header.packet_num, AFC_OP_DATA, NULL, size);
+			}
+			break;
+		case AFC_OP_FILE_WRITE:
+		case AFC_OP_FILE_CLOSE:
+			res = emulator_afc_status(conn, header.packet_num, AFC_E_SUCCESS);
+			break;
+		default:
+			res = emulator_afc_status(conn, header.packet_num, AFC_E_OP_NOT_SUPPORTED);
+			break;
+		}
+	}
+}
+
+static void emulator_serve_echo(struct emulator_connection *conn)
+{
+	uint32_t pktlen = 0;
+
+	while (emulator_receive(conn, &pktlen, sizeof(pktlen)) == 0) {
+		uint32_t length = be32toh(pktlen);
+		if (length > EMULATOR_BUFFER_SIZE - sizeof(pktlen)) {
+			fprintf(stderr, "emulator: echo message too large (%u bytes)\n", length);
+			break;
+		}
+		memcpy(conn->buffer, &pktlen, sizeof(pktlen));
+		if (emulator_receive(conn, conn->buffer + sizeof(pktlen), length) < 0
+		    || emulator_send(conn, conn->buffer, sizeof(pktlen) + length) < 0) {
+			break;
+		}
+	}
+}
+
+static int emulator_send_dl_message(struct emulator_connection *conn, const char *dlmessage, plist_t argument)
+{
+	plist_t array = plist_new_array();
+	plist_array_append_item(array, plist_new_string(dlmessage));
+	if (argument) {
+		plist_array_append_item(array, argument);
+	}
+	int res = emulator_send_plist(conn, array);
+	plist_free(array);
+	return res;
+}
+
+static int emulator_send_response(struct emulator_connection *conn, int error_code)
+{
+	plist_t dict = plist_new_dict();
+	plist_dict_set_item(dict, "MessageName", plist_new_string("Response"));
+	plist_dict_set_item(dict, "ErrorCode", plist_new_uint(error_code));
+	if (error_code == 0) {
+		plist_dict_set_item(dict, "ProtocolVersion", plist_new_real(2.1));
+	}
+	return emulator_send_dl_message(conn, "DLMessageProcessMessage", dict);
+}
+
+static int emulator_send_filename(struct emulator_connection *conn, const char *name)
+{
+	uint32_t nlen = htobe32((uint32_t)strlen(name));
+	if (emulator_send(conn, &nlen, sizeof(nlen)) < 0) {
+		return -1;
+	}
+	return emulator_send(conn, name, strlen(name));
+}
+
+static int emulator_send_code(struct emulator_connection *conn, uint32_t length, char code)
+{
+	char block[5];
+	*(uint32_t*)block = htobe32(length + 1);
+	block[4] = code;
+	return emulator_send(conn, block, sizeof(block));
+}
+
+/* streams a DLMessageUploadFiles request as a device does during a backup */
+static int emulator_upload_files(struct emulator_connection *conn, uint64_t count, uint64_t size)
+{
+	char name[64];
+	uint64_t i;
+
+	plist_t array = plist_new_array();
+	plist_array_append_item(array, plist_new_string("DLMessageUploadFiles"));
+	plist_array_append_item(array, plist_new_dict());
+	plist_array_append_item(array, plist_new_real(0.0));
+	plist_array_append_item(array, plist_new_uint(count * size));
+	int res = emulator_send_plist(conn, array);
+	plist_free(array);
+
+	for (i = 0; res == 0 && i < count; i++) {
+		snprintf(name, sizeof(name), "%02x/emulator-%016llx", (unsigned int)(i & 0xff), (unsigned long long)i);
+		if (emulator_send_filename(conn, "emulator") < 0 || emulator_send_filename(conn, name) < 0) {
+			return -1;
+		}
+		uint64_t remaining = size;
+		while (remaining > 0) {
+			uint32_t block = (remaining > EMULATOR_BACKUP_BLOCK_SIZE) ? EMULATOR_BACKUP_BLOCK_SIZE : (uint32_t)remaining;
+			if (emulator_send_code(conn, block, CODE_FILE_DATA) < 0 || emulator_send_fill(conn, block) < 0) {
+				return -1;
+			}
+			remaining -= block;
+		}
+		res = emulator_send_code(conn, 0, CODE_SUCCESS);
+	}
+	if (res == 0) {
+		uint32_t zero = 0;
+		res = emulator_send(conn, &zero, sizeof(zero));
+	}
+	return res;
+}
+
+/* performs the device side of the device link version exchange */
+static int emulator_dl_version_exchange(struct emulator_connection *conn)
+{
+	plist_t msg = plist_new_array();
+	plist_array_append_item(msg, plist_new_string("DLMessageVersionExchange"));
+	plist_array_append_item(msg, plist_new_uint(400));
+	plist_array_append_item(msg, plist_new_uint(0));
+	int res = emulator_send_plist(conn, msg);
+	plist_free(msg);
+	msg = NULL;
+	if (res < 0 || emulator_receive_plist(conn, &msg) < 0) {
+		return -1;
+	}
+	const char *status = emulator_get_string(plist_array_get_item(msg, 1));
+	if (!status || strcmp(status, "DLVersionsOk") != 0) {
+		fprintf(stderr, "emulator: device link version exchange failed\n");
+		plist_free(msg);
+		return -1;
+	}
+	plist_free(msg);
+	return emulator_send_dl_message(conn, "DLMessageDeviceReady", NULL);
+}
+
+static void emulator_serve_mobilebackup2(struct emulator_connection *conn)
+{
+	plist_t msg = NULL;
+	int res = emulator_dl_version_exchange(conn);
+	if (res < 0) {
+		return;
+	}
+
+	while (res == 0 && emulator_receive_plist(conn, &msg) == 0) {
+		const char *dlmessage = emulator_get_string(plist_array_get_item(msg, 0));
+		if (!dlmessage || !strcmp(dlmessage, "DLMessageDisconnect")) {
+			plist_free(msg);
+			break;
+		}
+		if (!strcmp(dlmessage, "DLMessageProcessMessage")) {
+			plist_t dict = plist_array_get_item(msg, 1);
+			const char *name = emulator_get_string(plist_dict_get_item(dict, "MessageName"));
+			if (name && !strcmp(name, "Hello")) {
+				res = emulator_send_response(conn, 0);
+			} else if (name && !strcmp(name, "Backup")) {
+				uint64_t count = 0;
+				uint64_t size = 0;
+				plist_get_uint_val(plist_dict_get_item(dict, EMULATOR_BACKUP_FILE_COUNT), &count);
+				plist_get_uint_val(plist_dict_get_item(dict, EMULATOR_BACKUP_FILE_SIZE), &size);
+				res = emulator_upload_files(conn, count, size);
+				if (res == 0) {
+					/* wait for the DLMessageStatusResponse of the host */
+					plist_t reply = NULL;
+					res = emulator_receive_plist(conn, &reply);
+					plist_free(reply);
+				}
+				if (res == 0) {
+					res = emulator_send_response(conn, 0);
+				}
+			} else {
+				res = emulator_send_response(conn, 1);
+			}
+		}
+		plist_free(msg);
+		msg = NULL;
+	}
+}
+
+static void emulator_serve_screenshotr(struct emulator_connection *conn)
+{
+	emulator_t emulator = conn->emulator;
+	plist_t msg = NULL;
+	int res = emulator_dl_version_exchange(conn);
+
+	while (res == 0 && emulator_receive_plist(conn, &msg) == 0) {
+		const char *dlmessage = emulator_get_string(plist_array_get_item(msg, 0));
+		if (!dlmessage || strcmp(dlmessage, "DLMessageProcessMessage") != 0) {
+			plist_free(msg);
+			break;
+		}
+		plist_free(msg);
+		msg = NULL;
+		res = emulator_send(conn, emulator->screenshot_reply, emulator->screenshot_reply_length);
+	}
+}
+
+struct emulator_debugserver {
+	struct emulator_connection *conn;
+	int noack_mode;
+	char data[EMULATOR_DEBUGSERVER_READ_SIZE];
+	size_t offset;
+	size_t length;
+};
+
+static const char emulator_hex_digits[] = "0123456789abcdef";
+
+/* returns the next byte of the connection, or -1 once it is closed */
+static int emulator_debugserver_getc(struct emulator_debugserver *ds)
+{
+	while (ds->offset >= ds->length) {
+		ssize_t r = recv(ds->conn->fd, ds->data, sizeof(ds->data), 0);
+		if (r > 0) {
+			ds->offset = 0;
+			ds->length = r;
+			break;
+		}
+		if (r == 0 || (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) || ds->conn->emulator->stopping) {
+			return -1;
+		}
+	}
+	return (unsigned char)ds->data[ds->offset++];
+}
+
+static uint8_t emulator_debugserver_checksum(const char *data, size_t length)
+{
+	uint8_t checksum = 0;
+	size_t i;
+
+	for (i = 0; i < length; i++) {
+		checksum += (unsigned char)data[i];
+	}
+	return checksum;
+}
+
+static int emulator_debugserver_reply(struct emulator_debugserver *ds, const char *payload, size_t length)
+{
+	char trailer[4];
+	int res;
+
+	snprintf(trailer, sizeof(trailer), "#%02x", emulator_debugserver_checksum(payload, length));
+	res = emulator_send(ds->conn, "$", 1);
+	if (res == 0) {
+		res = emulator_send(ds->conn, payload, length);
+	}
+	if (res == 0) {
+		res = emulator_send(ds->conn, trailer, 3);
+	}
+	return res;
+}
+
+/* answers a memory read with hex ('m') or escaped binary ('x') data */
+static int emulator_debugserver_read_memory(struct emulator_debugserver *ds, const char *packet)
+{
+	unsigned long long address = 0;
+	unsigned long length = 0;
+	size_t size = 0;
+	size_t i;
+
+	if (sscanf(packet + 1, "%llx,%lx", &address, &length) != 2 || length > EMULATOR_BUFFER_SIZE) {
+		return emulator_debugserver_reply(ds, "E01", 3);
+	}
+	char *memory = (char*)malloc(length + 1);
+	char *payload = (char*)malloc(2 * length + 1);
+	if (!memory || !payload) {
+		free(memory);
+		free(payload);
+		return -1;
+	}
+	emulator_fill_memory(address, memory, length);
+	for (i = 0; i < length; i++) {
+		unsigned char c = (unsigned char)memory[i];
+		if (packet[0] == 'm') {
+			payload[size++] = emulator_hex_digits[c >> 4];
+			payload[size++] = emulator_hex_digits[c & 0xf];
+		} else if (c == '$' || c == '#' || c == '}' || c == '*') {
+			payload[size++] = '}';
+			payload[size++] = (char)(c ^ 0x20);
+		} else {
+			payload[size++] = (char)c;
+		}
+	}
+	int res = emulator_debugserver_reply(ds, payload, size);
+	free(memory);
+	free(payload);
+	return res;
+}
+
+/* checks that a memory write ('M') carries what a read would return */
+static int emulator_debugserver_write_memory(struct emulator_debugserver *ds, const char *packet)
+{
+	unsigned long long address = 0;
+	unsigned long length = 0;
+	const char *data = strchr(packet, ':');
+	int ok = 0;
+
+	if (data && sscanf(packet + 1, "%llx,%lx", &address, &length) == 2 && strlen(data + 1) == 2 * length) {
+		char *memory = (char*)malloc(length + 1);
+		if (!memory) {
+			return -1;
+		}
+		emulator_fill_memory(address, memory, length);
+		unsigned long i;
+		ok = 1;
+		for (i = 0; ok && i < length; i++) {
+			unsigned char c = (unsigned char)memory[i];
+			ok = (data[1 + 2 * i] == emulator_hex_digits[c >> 4] && data[2 + 2 * i] == emulator_hex_digits[c & 0xf]);
+		}
+		free(memory);
+	}
+	return emulator_debugserver_reply(ds, (ok) ? "OK" : "E02", (ok) ? 2 : 3);
+}
+
+static void emulator_serve_debugserver(struct emulator_connection *conn)
+{
+	emulator_t emulator = conn->emulator;
+	struct emulator_debugserver *ds = (struct emulator_debugserver*)calloc(1, sizeof(struct emulator_debugserver));
+	unsigned int pipelined = 0;
+	int res = 0;
+	int c;
+
+	if (!ds) {
+		return;
+	}
+	ds->conn = conn;
+
+	while (res == 0 && (c = emulator_debugserver_getc(ds)) >= 0) {
+		/* acknowledgements of the host carry no information here */
+		if (c != '$') {
+			continue;
+		}
+		size_t length = 0;
+		while ((c = emulator_debugserver_getc(ds)) >= 0 && c != '#' && length < EMULATOR_BUFFER_SIZE - 1) {
+			conn->buffer[length++] = (char)c;
+		}
+		char checksum[3] = { 0, 0, 0 };
+		if (c != '#' || (c = emulator_debugserver_getc(ds)) < 0) {
+			break;
+		}
+		checksum[0] = (char)c;
+		if ((c = emulator_debugserver_getc(ds)) < 0) {
+			break;
+		}
+		checksum[1] = (char)c;
+		conn->buffer[length] = '\0';
+
+		if (strtoul(checksum, NULL, 16) != emulator_debugserver_checksum(conn->buffer, length)) {
+			/* without acknowledgements an error reply has to do */
+			res = (ds->noack_mode) ? emulator_debugserver_reply(ds, "E03", 3) : emulator_send(conn, "-", 1);
+			continue;
+		}
+		if (!ds->noack_mode && emulator_send(conn, "+", 1) < 0) {
+			break;
+		}
+
+		if (!strcmp(conn->buffer, "QStartNoAckMode")) {
+			res = emulator_debugserver_reply(ds, "OK", 2);
+			/* the host still acknowledges this reply, which is skipped like any other */
+			ds->noack_mode = 1;
+		} else if (conn->buffer[0] == 'm' || conn->buffer[0] == 'x') {
+			res = emulator_debugserver_read_memory(ds, conn->buffer);
+		} else if (conn->buffer[0] == 'M') {
+			res = emulator_debugserver_write_memory(ds, conn->buffer);
+		} else {
+			/* an empty reply means the packet is not supported */
+			res = emulator_debugserver_reply(ds, "", 0);
+		}
+
+		/* count how many packets in a row were sent without waiting for a reply */
+		if (ds->offset < ds->length && memchr(ds->data + ds->offset, '$', ds->length - ds->offset)) {
+			pipelined++;
+		} else {
+			pipelined = 0;
+		}
+		mutex_lock(&emulator->mutex);
+		if (pipelined + 1 > emulator->debugserver_pipelined) {
+			emulator->debugserver_pipelined = pipelined + 1;
+		}
+		mutex_unlock(&emulator->mutex);
+	}
+	free(ds);
+}
+
+static void* emulator_connection_thread(void *arg)
+{
+	struct emulator_connection *conn = (struct emulator_connection*)arg;
+	emulator_t emulator = conn->emulator;
+
+	switch (conn->service) {
+	case EMULATOR_SERVICE_LOCKDOWN:
+		emulator_serve_lockdown(conn);
+		break;
+	case EMULATOR_SERVICE_AFC:
+		emulator_serve_afc(conn);
+		break;
+	case EMULATOR_SERVICE_ECHO:
+		emulator_serve_echo(conn);
+		break;
+	case EMULATOR_SERVICE_MOBILEBACKUP2:
+		emulator_serve_mobilebackup2(conn);
+		break;
+	case EMULATOR_SERVICE_SCREENSHOTR:
+		emulator_serve_screenshotr(conn);
+		break;
+	case EMULATOR_SERVICE_DEBUGSERVER:
+		emulator_serve_debugserver(conn);
+		break;
+	default:
+		break;
+	}
+
+	close(conn->fd);
+	free(conn->buffer);
+	free(conn);
+
+	mutex_lock(&emulator->mutex);
+	emulator->connections--;
+	cond_signal(&emulator->cond);
+	mutex_unlock(&emulator->mutex);
+
+	return NULL;
+}
+
+static void* emulator_listener_thread(void *arg)
+{
+	struct emulator_listener *listener = (struct emulator_listener*)arg;
+	emulator_t emulator = listener->emulator;
+	struct timeval tv = { 0, EMULATOR_POLL_INTERVAL * 1000 };
+	int yes = 1;
+
+	while (!emulator->stopping) {
+		struct pollfd pfd;
+		pfd.fd = listener->fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		if (poll(&pfd, 1, EMULATOR_POLL_INTERVAL) <= 0) {
+			continue;
+		}
+		int fd = accept(listener->fd, NULL, NULL);
+		if (fd < 0) {
+			continue;
+		}
+		/* blocked calls time out periodically so connections notice emulator_stop() */
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (void*)&tv, sizeof(tv));
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, (void*)&tv, sizeof(tv));
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (void*)&yes, sizeof(yes));
+
+		struct emulator_connection *conn = (struct emulator_connection*)calloc(1, sizeof(struct emulator_connection));
+		if (conn) {
+			conn->buffer = (char*)malloc(EMULATOR_BUFFER_SIZE);
+		}
+		if (!conn || !conn->buffer) {
+			if (conn) {
+				free(conn);
+			}
+			close(fd);
+			continue;
+		}
+		conn->emulator = emulator;
+		conn->service = listener->service;
+		conn->fd = fd;
+
+		mutex_lock(&emulator->mutex);
+		emulator->connections++;
+		mutex_unlock(&emulator->mutex);
+
+		THREAD_T thread;
+		if (thread_new(&thread, emulator_connection_thread, conn) == 0) {
+			thread_detach(thread);
+		} else {
+			emulator_connection_thread(conn);
+		}
+	}
+
+	return NULL;
+}
+
+static int emulator_listen(struct emulator_listener *listener, uint16_t port)
+{
+	struct sockaddr_in saddr;
+	socklen_t len = sizeof(saddr);
+	int yes = 1;
+
+	listener->fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (listener->fd < 0) {
+		return -1;
+	}
+	setsockopt(listener->fd, SOL_SOCKET, SO_REUSEADDR, (void*)&yes, sizeof(yes));
+
+	memset(&saddr, 0, sizeof(saddr));
+	saddr.sin_family = AF_INET;
+	saddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	saddr.sin_port = htons(port);
+	if (bind(listener->fd, (struct sockaddr*)&saddr, sizeof(saddr)) < 0
+	    || listen(listener->fd, 16) < 0
+	    || getsockname(listener->fd, (struct sockaddr*)&saddr, &len) < 0) {
+		close(listener->fd);
+		listener->fd = -1;
+		return -1;
+	}
+	listener->port = ntohs(saddr.sin_port);
+	return 0;
+}
+
+int emulator_start(emulator_t *emulator)
+{
+	int i;
+
+	if (!emulator) {
+		return -1;
+	}
+
+	emulator_t emu = (emulator_t)calloc(1, sizeof(struct emulator_private));
+	if (!emu) {
+		return -1;
+	}
+	mutex_init(&emu->mutex);
+	cond_init(&emu->cond);
+
+	emu->fill = (char*)malloc(EMULATOR_BUFFER_SIZE);
+	if (!emu->fill) {
+		emulator_stop(emu);
+		return -1;
+	}
+	for (i = 0; i < EMULATOR_BUFFER_SIZE; i++) {
+		emu->fill[i] = (char)(i * 7);
+	}
+
+	emu->values = plist_new_dict();
+	plist_dict_set_item(emu->values, "DeviceName", plist_new_string("Emulator"));
+	plist_dict_set_item(emu->values, "DeviceClass", plist_new_string("iPhone"));
+	plist_dict_set_item(emu->values, "ProductType", plist_new_string("iPhone15,2"));
+	plist_dict_set_item(emu->values, "ProductVersion", plist_new_string("17.0"));
+	plist_dict_set_item(emu->values, "BuildVersion", plist_new_string("21A329"));
+	plist_dict_set_item(emu->values, "UniqueDeviceID", plist_new_string(EMULATOR_UDID));
+
+	if (emulator_set_screenshot_size(emu, EMULATOR_SCREENSHOT_SIZE) < 0) {
+		emulator_stop(emu);
+		return -1;
+	}
+
+	for (i = 0; i < EMULATOR_SERVICE_COUNT; i++) {
+		emu->listener[i].emulator = emu;
+		emu->listener[i].service = (emulator_service_t)i;
+		emu->listener[i].fd = -1;
+	}
+	for (i = 0; i < EMULATOR_SERVICE_COUNT; i++) {
+		if (i == EMULATOR_SERVICE_LOCKDOWN) {
+			/* clients always reach lockdownd on its well-known port */
+			if (emulator_listen(&emu->listener[i], EMULATOR_LOCKDOWN_PORT) < 0) {
+				fprintf(stderr, "emulator: lockdownd port %d not available, lockdownd is disabled\n", EMULATOR_LOCKDOWN_PORT);
+			}
+		} else if (emulator_listen(&emu->listener[i], 0) < 0) {
+			fprintf(stderr, "emulator: could not listen for %s: %s\n", emulator_service_names[i], strerror(errno));
+			emulator_stop(emu);
+			return -1;
+		}
+	}
+	for (i = 0; i < EMULATOR_SERVICE_COUNT; i++) {
+		if (emu->listener[i].fd < 0) {
+			continue;
+		}
+		if (thread_new(&emu->listener[i].thread, emulator_listener_thread, &emu->listener[i]) != 0) {
+			emulator_stop(emu);
+			return -1;
+		}
+		emu->listener[i].running = 1;
+	}
+
+	*emulator = emu;
+	return 0;
+}
+
+void emulator_stop(emulator_t emulator)
+{
+	int i;
+
+	if (!emulator) {
+		return;
+	}
+
+	emulator->stopping = 1;
+	for (i = 0; i < EMULATOR_SERVICE_COUNT; i++) {
+		if (emulator->listener[i].running) {
+			thread_join(emulator->listener[i].thread);
+			thread_free(emulator->listener[i].thread);
+		}
+		if (emulator->listener[i].fd >= 0) {
+			close(emulator->listener[i].fd);
+		}
+	}
+
+	/* connections give up within EMULATOR_POLL_INTERVAL */
+	mutex_lock(&emulator->mutex);
+	while (emulator->connections > 0) {
+		cond_wait(&emulator->cond, &emulator->mutex);
+	}
+	mutex_unlock(&emulator->mutex);
+
+	cond_destroy(&emulator->cond);
+	mutex_destroy(&emulator->mutex);
+	plist_free(emulator->values);
+	free(emulator->screenshot_reply);
+	free(emulator->fill);
+	free(emulator);
+}
+
+uint16_t emulator_get_port(emulator_t emulator, emulator_service_t service)
+{
+	if (!emulator || service >= EMULATOR_SERVICE_COUNT) {
+		return 0;
+	}
+	return emulator->listener[service].port;
+}
+
+int emulator_set_screenshot_size(emulator_t emulator, uint32_t size)
+{
+	uint32_t done = 0;
+	uint32_t length = 0;
+
+	if (!emulator) {
+		return -1;
+	}
+	char *data = (char*)malloc((size > 0) ? size : 1);
+	if (!data) {
+		return -1;
+	}
+	while (done < size) {
+		uint32_t chunk = (size - done > EMULATOR_BUFFER_SIZE) ? EMULATOR_BUFFER_SIZE : size - done;
+		memcpy(data + done, emulator->fill, chunk);
+		done += chunk;
+	}
+	plist_t dict = plist_new_dict();
+	plist_dict_set_item(dict, "MessageType", plist_new_string("ScreenShotReply"));
+	plist_dict_set_item(dict, "ScreenShotData", plist_new_data(data, size));
+	free(data);
+	plist_t array = plist_new_array();
+	plist_array_append_item(array, plist_new_string("DLMessageProcessMessage"));
+	plist_array_append_item(array, dict);
+	char *packet = emulator_plist_to_packet(array, &length);
+	plist_free(array);
+	if (!packet) {
+		return -1;
+	}
+
+	free(emulator->screenshot_reply);
+	emulator->screenshot_reply = packet;
+	emulator->screenshot_reply_length = length;
+	return 0;
+}
+
+void emulator_fill_memory(uint64_t address, char *buffer, size_t length)
+{
+	size_t i;
+
+	for (i = 0; i < length; i++) {
+		/* every address has a fixed value, so overlapping reads agree */
+		uint64_t x = (address + i) * 0x9e3779b97f4a7c15ULL;
+		x ^= x >> 29;
+		buffer[i] = (char)(x >> 56);
+	}
+}
+
+unsigned int emulator_get_debugserver_pipelined(emulator_t emulator)
+{
+	unsigned int pipelined;
+
+	if (!emulator) {
+		return 0;
+	}
+	mutex_lock(&emulator->mutex);
+	pipelined = emulator->debugserver_pipelined;
+	mutex_unlock(&emulator->mutex);
+	return pipelined;
+}
+
+idevice_t emulator_new_device(emulator_t emulator)
+{
+	idevice_t device = (idevice_t)calloc(1, sizeof(struct idevice_private));
+	struct sockaddr_in *saddr = (struct sockaddr_in*)calloc(1, sizeof(struct sockaddr_in));
+	if (!device || !saddr) {
+		free(device);
+		free(saddr);
+		return NULL;
+	}
+	saddr->sin_family = AF_INET;
+	saddr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	device->udid = strdup(EMULATOR_UDID);
+	device->mux_id = 0;
+	device->conn_type = CONNECTION_NETWORK;
+	device->conn_data = saddr;
+	/* known up front, so lockdownd clients do not query or cache them */
+	device->version = IDEVICE_DEVICE_VERSION(17, 0, 0);
+	device->device_class = DEVICE_CLASS_IPHONE;
+
+	return device;
+}
+
+void emulator_get_service_descriptor(emulator_t emulator, emulator_service_t service, struct lockdownd_service_descriptor *descriptor)
+{
+	descriptor->port = emulator_get_port(emulator, service);
+	descriptor->ssl_enabled = 0;
+	descriptor->identifier = (char*)((service < EMULATOR_SERVICE_COUNT) ? emulator_service_names[service] : NULL);
+}
@@ -0,0 +1,123 @@
+/*
+ * emulator.h
+ * Loopback device emulator for tests and benchmarks
+ *
+ * Copyright (c) 2026 libimobiledevice project. All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __EMULATOR_H
+#define __EMULATOR_H
+
+#include <stdint.h>
+#include <libimobiledevice/libimobiledevice.h>
+#include <libimobiledevice/lockdown.h>
+
+#define EMULATOR_UDID "00000000-0000000000000000"
+#define EMULATOR_ECHO_SERVICE_NAME "org.libimobiledevice.emulator.echo"
+
+/* options of the mobilebackup2 "Backup" message the emulator understands */
+#define EMULATOR_BACKUP_FILE_COUNT "EmulatorFileCount"
+#define EMULATOR_BACKUP_FILE_SIZE "EmulatorFileSize"
+
+/* block size the emulated backup stream uses for file data */
+#define EMULATOR_BACKUP_BLOCK_SIZE 0x10000
+
+typedef enum {
+	EMULATOR_SERVICE_LOCKDOWN = 0,
+	EMULATOR_SERVICE_AFC,
+	EMULATOR_SERVICE_ECHO,
+	EMULATOR_SERVICE_MOBILEBACKUP2,
+	EMULATOR_SERVICE_SCREENSHOTR,
+	EMULATOR_SERVICE_DEBUGSERVER,
+	EMULATOR_SERVICE_COUNT
+} emulator_service_t;
+
+typedef struct emulator_private emulator_private;
+typedef emulator_private *emulator_t;
+
+/**
+ * Starts an emulated device listening on 127.0.0.1.
+ *
+ * Every service gets its own listening socket on an ephemeral port and
+ * serves each connection in its own thread:
+ * - lockdownd (QueryType, GetValue, StartService, Goodbye without a
+ *   session) on the fixed lockdownd port, if it is available
+ * - AFC file reads, writes, open and close on a virtual file of
+ *   unlimited size
+ * - a property list service that echoes every message back
+ * - mobilebackup2 device link framing and a file upload stream of
+ *   configurable size in response to a "Backup" message
+ * - screenshotr replying to every request with a screenshot of
+ *   configurable size
+ * - debugserver checking the checksum of every packet with a plain byte
+ *   sum, answering memory reads ("m" as hex, "x" as escaped binary)
+ *   with the contents emulator_fill_memory() produces, verifying memory
+ *   writes ("M") against them and supporting QStartNoAckMode
+ *
+ * @param emulator Pointer that receives the new emulator.
+ *
+ * @return 0 on success, -1 if any of the data services could not be
+ *    started.
+ */
+int emulator_start(emulator_t *emulator);
+
+/**
+ * Stops the emulator, closing all connections, and frees it.
+ */
+void emulator_stop(emulator_t emulator);
+
+/**
+ * Returns the port a service is listening on, or 0 if it is not available.
+ */
+uint16_t emulator_get_port(emulator_t emulator, emulator_service_t service);
+
+/**
+ * Sets the size of the screenshot data screenshotr replies with; the
+ * default is 4096 bytes. The reply is serialized right away, so serving
+ * it does not allocate. Must not be called while a screenshotr connection
+ * is open.
+ *
+ * @return 0 on success, -1 if the reply could not be created.
+ */
+int emulator_set_screenshot_size(emulator_t emulator, uint32_t size);
+
+/**
+ * Fills a buffer with the pseudo-random memory contents the emulated
+ * debugserver reports for the given address range.
+ */
+void emulator_fill_memory(uint64_t address, char *buffer, size_t length);
+
+/**
+ * Returns the largest number of debugserver packets that had already
+ * arrived when the emulator answered the packet before them, which is 1
+ * as long as the host waits for every response before sending on.
+ */
+unsigned int emulator_get_debugserver_pipelined(emulator_t emulator);
+
+/**
+ * Creates a network device handle that connects to the emulator.
+ * Free it with idevice_free().
+ */
+idevice_t emulator_new_device(emulator_t emulator);
+
+/**
+ * Fills in a service descriptor for connecting to a service directly,
+ * without going through lockdownd.
+ */
+void emulator_get_service_descriptor(emulator_t emulator, emulator_service_t service, struct lockdownd_service_descriptor *descriptor);
+
+#endif
@@ -0,0 +1,117 @@
+/*
+ * keypool_bench.c
+ * Benchmark of pair record creation with and without the key pool
+ *
+ * Copyright (c) 2026 libimobiledevice project. All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libimobiledevice/libimobiledevice.h>
+#include <plist/plist.h>
+
+#include "common/userpref.h"
+#include "bench.h"
+
+/* stands in for the public key a device sends when pairing */
+static const char device_public_key[] =
+	"-----BEGIN RSA PUBLIC KEY-----\n"
+	"MIIBCgKCAQEAvD64QA877mSENGL2YHJZX2xIWrP3Dn7zAPEIRw77es+5hBjO2J64\n"
+	"fweWehNvIp/vVoMD/jNhD/iDDiWjaOGNNVhmM0T0mV0v68qk58Ri657iw5tiWfkp\n"
+	"kyDWBhI8Odnel74LL0QKl8oWrpfv+xLiwILVUZJ+nATeetyRT1rVluBaNPMRp74K\n"
+	"q5mFR7OsKBilEfcp9OXNoZYpQxV6Sc+9gtnwkwwTiHaLIJPaFUAo3kpx3oxzom6i\n"
+	"OGBMO1odkUOoGTOY+oK5hzZF5HL5vX/FgkoIl5BPDjon7LRnu2rfBoHUrZntegTg\n"
+	"IKOgZ/XU6evs8wP9bRawDsXWF4CWu/pVBQIDAQAB\n"
+	"-----END RSA PUBLIC KEY-----\n";
+
+static int failures = 0;
+
+/* waits until the pool holds the keys of count pair records */
+static int wait_for_pool(unsigned int count)
+{
+	double deadline = bench_now() + 60.0 * count;
+	while (userpref_key_pool_get_count() < count * 2) {
+		if (bench_now() > deadline) {
+			return -1;
+		}
+		usleep(10000);
+	}
+	return 0;
+}
+
+static void bench_pair_record(int warm, unsigned int count)
+{
+	const char *name = (warm) ? "pair_record warm key pool" : "pair_record cold";
+	key_data_t public_key;
+	bench_t bench;
+	unsigned int i;
+
+	if (!bench_selected(name)) {
+		return;
+	}
+
+	public_key.data = (unsigned char*)device_public_key;
+	public_key.size = sizeof(device_public_key) - 1;
+
+	if (warm && userpref_key_pool_start(1) != USERPREF_E_SUCCESS) {
+		fprintf(stderr, "%s: could not start the key pool\n", name);
+		failures++;
+		return;
+	}
+
+	bench_begin(&bench, name, count);
+	for (i = 0; i < count; i++) {
+		/* refilling the pool is not part of the measurement */
+		if (warm && wait_for_pool(1) < 0) {
+			fprintf(stderr, "%s: key pool did not fill up\n", name);
+			failures++;
+			break;
+		}
+		plist_t pair_record = plist_new_dict();
+		bench_op_begin(&bench);
+		userpref_error_t err = pair_record_generate_keys_and_certs(pair_record, public_key, IDEVICE_DEVICE_VERSION(17, 0, 0));
+		bench_op_end(&bench, 0);
+		plist_free(pair_record);
+		if (err != USERPREF_E_SUCCESS) {
+			fprintf(stderr, "%s: failed (%d)\n", name, err);
+			failures++;
+			break;
+		}
+	}
+	bench_end(&bench);
+
+	if (warm) {
+		userpref_key_pool_stop();
+	}
+}
+
+int main(int argc, char **argv)
+{
+	bench_init(argc, argv);
+
+	bench_pair_record(0, bench_iterations(20));
+	bench_pair_record(1, bench_iterations(20));
+
+	return (failures > 0) ? 1 : 0;
+}
@@ -0,0 +1,195 @@
+/*
+ * message_bench.c
+ * Memory benchmarks of receiving device link messages against the
+ * loopback device emulator
+ *
+ * Copyright (c) 2026 libimobiledevice project. All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+
+#include <libimobiledevice/libimobiledevice.h>
+#include <libimobiledevice/lockdown.h>
+#include <libimobiledevice/screenshotr.h>
+#include <libimobiledevice/mobilebackup2.h>
+#include <plist/plist.h>
+
+#include "emulator.h"
+#include "bench.h"
+
+static emulator_t emulator = NULL;
+static idevice_t device = NULL;
+static int failures = 0;
+
+/*
+ * Prints the peak heap of the benchmark thread above its usage before the
+ * operation, relative to the payload size, and the peak RSS of the process
+ * so far. A receive path that hands the received message over instead of
+ * copying it stays close to the size of the receive buffer plus the
+ * parsed message.
+ */
+static void print_peak(const char *name, int64_t peak_heap, uint32_t payload)
+{
+	if (peak_heap > 0) {
+		printf("%-40s peak heap %9.2f MiB (%.2fx payload)  peak RSS %9llu KiB\n",
+			name, (double)peak_heap / 1048576, (payload > 0) ? (double)peak_heap / payload : 0.0,
+			(unsigned long long)bench_get_peak_rss());
+	} else {
+		printf("%-40s peak RSS %9llu KiB\n", name, (unsigned long long)bench_get_peak_rss());
+	}
+	fflush(stdout);
+}
+
+static void bench_screenshot(uint32_t size, unsigned int count)
+{
+	struct lockdownd_service_descriptor service;
+	screenshotr_client_t client = NULL;
+	char name[64];
+	bench_t bench;
+	int64_t peak_heap = 0;
+	unsigned int i;
+
+	snprintf(name, sizeof(name), "screenshotr %u KiB", size / 1024);
+	if (!bench_selected(name)) {
+		return;
+	}
+
+	if (emulator_set_screenshot_size(emulator, size) < 0) {
+		fprintf(stderr, "%s: could not create the screenshot\n", name);
+		failures++;
+		return;
+	}
+	emulator_get_service_descriptor(emulator, EMULATOR_SERVICE_SCREENSHOTR, &service);
+	if (screenshotr_client_new(device, &service, &client) != SCREENSHOTR_E_SUCCESS) {
+		fprintf(stderr, "%s: could not connect\n", name);
+		failures++;
+		return;
+	}
+
+	bench_begin(&bench, name, count);
+	for (i = 0; i < count; i++) {
+		char *imgdata = NULL;
+		uint64_t imgsize = 0;
+		int64_t start = 0;
+		int64_t current = 0;
+		int64_t peak = 0;
+
+		bench_reset_heap_peak();
+		bench_get_heap(&start, &peak);
+		bench_op_begin(&bench);
+		screenshotr_error_t err = screenshotr_take_screenshot(client, &imgdata, &imgsize);
+		bench_op_end(&bench, imgsize);
+		bench_get_heap(&current, &peak);
+		peak -= start;
+		if (peak > peak_heap) {
+			peak_heap = peak;
+		}
+		free(imgdata);
+		if (err != SCREENSHOTR_E_SUCCESS || imgsize != size) {
+			fprintf(stderr, "%s: failed (%d, %llu bytes)\n", name, err, (unsigned long long)imgsize);
+			failures++;
+			break;
+		}
+	}
+	bench_end(&bench);
+	print_peak(name, peak_heap, size);
+
+	screenshotr_client_free(client);
+}
+
+static void bench_backup_version_exchange(unsigned int count)
+{
+	struct lockdownd_service_descriptor service;
+	mobilebackup2_client_t mb2 = NULL;
+	const char *name = "mobilebackup2_version_exchange";
+	double local_versions[2] = { 2.0, 2.1 };
+	bench_t bench;
+	int64_t peak_heap = 0;
+	unsigned int i;
+
+	if (!bench_selected(name)) {
+		return;
+	}
+
+	emulator_get_service_descriptor(emulator, EMULATOR_SERVICE_MOBILEBACKUP2, &service);
+	if (mobilebackup2_client_new(device, &service, &mb2) != MOBILEBACKUP2_E_SUCCESS) {
+		fprintf(stderr, "%s: could not connect\n", name);
+		failures++;
+		return;
+	}
+
+	bench_begin(&bench, name, count);
+	for (i = 0; i < count; i++) {
+		double remote_version = 0.0;
+		int64_t start = 0;
+		int64_t current = 0;
+		int64_t peak = 0;
+
+		bench_reset_heap_peak();
+		bench_get_heap(&start, &peak);
+		bench_op_begin(&bench);
+		mobilebackup2_error_t err = mobilebackup2_version_exchange(mb2, local_versions, 2, &remote_version);
+		bench_op_end(&bench, 0);
+		bench_get_heap(&current, &peak);
+		peak -= start;
+		if (peak > peak_heap) {
+			peak_heap = peak;
+		}
+		if (err != MOBILEBACKUP2_E_SUCCESS) {
+			fprintf(stderr, "%s: failed (%d)\n", name, err);
+			failures++;
+			break;
+		}
+	}
+	bench_end(&bench);
+	print_peak(name, peak_heap, 0);
+
+	mobilebackup2_client_free(mb2);
+}
+
+int main(int argc, char **argv)
+{
+#ifdef SIGPIPE
+	signal(SIGPIPE, SIG_IGN);
+#endif
+	bench_init(argc, argv);
+
+	if (emulator_start(&emulator) < 0) {
+		fprintf(stderr, "ERROR: Could not start the device emulator\n");
+		return 1;
+	}
+	device = emulator_new_device(emulator);
+
+	/* ascending sizes, as the peak RSS never goes down */
+	bench_screenshot(65536, bench_iterations(2000));
+	bench_screenshot(1048576, bench_iterations(500));
+	bench_screenshot(8388608, bench_iterations(100));
+	bench_screenshot(33554432, bench_iterations(30));
+	bench_backup_version_exchange(bench_iterations(20000));
+
+	idevice_free(device);
+	emulator_stop(emulator);
+
+	return (failures > 0) ? 1 : 0;
+}
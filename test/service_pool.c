@@ -0,0 +1,252 @@
+/*
+ * service_pool.c
+ * Checks reuse, expiry and health checks of the service connection pool
+ * against the loopback device emulator
+ *
+ * Copyright (c) 2026 libimobiledevice project. All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#include <libimobiledevice/libimobiledevice.h>
+#include <libimobiledevice/service.h>
+
+#include "emulator.h"
+
+/* a service that is pooled; the connections actually go to the echo
+ * service, the pool only goes by the name */
+#define POOLED_SERVICE "com.apple.misagent"
+#define LONG_TTL 60000
+#define SHORT_TTL 100
+
+static emulator_t emulator = NULL;
+static idevice_t device = NULL;
+static int failed = 0;
+
+static service_client_t connect_pooled(void)
+{
+	struct lockdownd_service_descriptor service;
+	service_client_t client = NULL;
+
+	emulator_get_service_descriptor(emulator, EMULATOR_SERVICE_ECHO, &service);
+	service.identifier = (char*)POOLED_SERVICE;
+	if (service_client_new(device, &service, &client) != SERVICE_E_SUCCESS) {
+		return NULL;
+	}
+	return client;
+}
+
+static int get_fd(service_client_t client)
+{
+	idevice_connection_t connection = NULL;
+	int fd = -1;
+
+	if (service_get_connection(client, &connection) != SERVICE_E_SUCCESS
+	    || idevice_connection_get_fd(connection, &fd) != IDEVICE_E_SUCCESS) {
+		return -1;
+	}
+	return fd;
+}
+
+/* waits until there is something to read on the socket or it got closed */
+static int wait_readable(int fd)
+{
+	struct pollfd pfd;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	return (poll(&pfd, 1, 5000) == 1) ? 0 : -1;
+}
+
+static int send_ping(service_client_t client)
+{
+	static const char ping[] = { 0, 0, 0, 4, 'p', 'i', 'n', 'g' };
+	uint32_t sent = 0;
+
+	if (service_send(client, ping, sizeof(ping), &sent) != SERVICE_E_SUCCESS || sent != sizeof(ping)) {
+		return -1;
+	}
+	return 0;
+}
+
+static int echo(service_client_t client)
+{
+	static const char ping[] = { 0, 0, 0, 4, 'p', 'i', 'n', 'g' };
+	char reply[sizeof(ping)];
+	uint32_t done = 0;
+
+	if (send_ping(client) < 0) {
+		return -1;
+	}
+	while (done < sizeof(reply)) {
+		uint32_t received = 0;
+		if (service_receive_with_timeout(client, reply + done, sizeof(reply) - done, &received, 5000) != SERVICE_E_SUCCESS || received == 0) {
+			return -1;
+		}
+		done += received;
+	}
+	return (memcmp(reply, ping, sizeof(ping)) == 0) ? 0 : -1;
+}
+
+/* The emulator does not support pairing, so the factory can only succeed
+ * by checking out a pooled connection. Returns the client it got. */
+static service_client_t checkout(void)
+{
+	service_client_t client = NULL;
+	int32_t error_code = 0;
+
+	if (service_client_factory_start_service(device, POOLED_SERVICE, (void**)&client, "service_pool", NULL, &error_code) != SERVICE_E_SUCCESS) {
+		return NULL;
+	}
+	return client;
+}
+
+static void test_reuse(void)
+{
+	service_client_pool_set_ttl(LONG_TTL);
+
+	service_client_t client = connect_pooled();
+	if (!client || echo(client) < 0) {
+		fprintf(stderr, "reuse: could not talk to the echo service\n");
+		failed++;
+		return;
+	}
+	service_client_free(client);
+
+	service_client_t pooled = checkout();
+	if (!pooled || pooled != client) {
+		fprintf(stderr, "reuse: the idle connection was not checked out\n");
+		failed++;
+	} else if (echo(pooled) < 0) {
+		fprintf(stderr, "reuse: the checked out connection does not work\n");
+		failed++;
+	}
+	if (pooled) {
+		service_client_free(pooled);
+	}
+
+	/* it went back into the pool, a flush closes it */
+	service_client_pool_flush();
+	pooled = checkout();
+	if (pooled) {
+		fprintf(stderr, "reuse: a flushed connection was checked out\n");
+		failed++;
+		service_client_free(pooled);
+	}
+}
+
+static void test_expiry(void)
+{
+	service_client_pool_set_ttl(SHORT_TTL);
+
+	service_client_t client = connect_pooled();
+	if (!client) {
+		fprintf(stderr, "expiry: could not connect\n");
+		failed++;
+		return;
+	}
+	service_client_free(client);
+	usleep(SHORT_TTL * 3 * 1000);
+
+	service_client_t pooled = checkout();
+	if (pooled) {
+		fprintf(stderr, "expiry: an expired connection was checked out\n");
+		failed++;
+		service_client_free(pooled);
+	}
+}
+
+static void test_unhealthy(void)
+{
+	service_client_pool_set_ttl(LONG_TTL);
+
+	/* the device closing an idle connection is noticed at checkout */
+	service_client_t client = connect_pooled();
+	int fd = (client) ? get_fd(client) : -1;
+	if (fd < 0) {
+		fprintf(stderr, "unhealthy: could not connect\n");
+		failed++;
+		return;
+	}
+	service_client_free(client);
+	shutdown(fd, SHUT_WR);
+	if (wait_readable(fd) < 0) {
+		fprintf(stderr, "unhealthy: the emulator did not close the connection\n");
+		failed++;
+	}
+	service_client_t pooled = checkout();
+	if (pooled) {
+		fprintf(stderr, "unhealthy: a closed connection was checked out\n");
+		failed++;
+		service_client_free(pooled);
+	}
+
+	/* a connection with unread data does not go into the pool at all */
+	client = connect_pooled();
+	fd = (client) ? get_fd(client) : -1;
+	if (fd < 0 || send_ping(client) < 0 || wait_readable(fd) < 0) {
+		fprintf(stderr, "unhealthy: could not get a reply pending\n");
+		failed++;
+	}
+	if (client) {
+		service_client_free(client);
+	}
+	pooled = checkout();
+	if (pooled) {
+		fprintf(stderr, "unhealthy: a connection with pending data was checked out\n");
+		failed++;
+		service_client_free(pooled);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	if (emulator_start(&emulator) < 0) {
+		fprintf(stderr, "could not start the emulator\n");
+		return 1;
+	}
+	device = emulator_new_device(emulator);
+	if (!device) {
+		fprintf(stderr, "could not create the device\n");
+		emulator_stop(emulator);
+		return 1;
+	}
+
+	test_reuse();
+	test_expiry();
+	test_unhealthy();
+
+	service_client_pool_set_ttl(0);
+	idevice_free(device);
+	emulator_stop(emulator);
+
+	if (failed > 0) {
+		fprintf(stderr, "%d test(s) failed\n", failed);
+		return 1;
+	}
+	return 0;
+}
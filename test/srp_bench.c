@@ -0,0 +1,267 @@
+/*
+ * srp_bench.c
+ * Benchmark of the SRP client math used for wireless pairing
+ *
+ * Copyright (c) 2026 libimobiledevice project. All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "srp.h"
+#include "srp_aux.h"
+#include "t_sha.h"
+#include "bench.h"
+
+#define SHA512_DIGESTSIZE 64
+
+#define PAIR_SETUP "Pair-Setup"
+#define PIN "000000"
+
+/* the group lockdown-cu.c uses: RFC 5054 3072-bit modulus, generator 5 */
+static const unsigned char kSRPModulus3072[384] = {
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xc9, 0x0f, 0xda, 0xa2, 0x21, 0x68, 0xc2, 0x34,
+	0xc4, 0xc6, 0x62, 0x8b, 0x80, 0xdc, 0x1c, 0xd1, 0x29, 0x02, 0x4e, 0x08, 0x8a, 0x67, 0xcc, 0x74,
+	0x02, 0x0b, 0xbe, 0xa6, 0x3b, 0x13, 0x9b, 0x22, 0x51, 0x4a, 0x08, 0x79, 0x8e, 0x34, 0x04, 0xdd,
+	0xef, 0x95, 0x19, 0xb3, 0xcd, 0x3a, 0x43, 0x1b, 0x30, 0x2b, 0x0a, 0x6d, 0xf2, 0x5f, 0x14, 0x37,
+	0x4f, 0xe1, 0x35, 0x6d, 0x6d, 0x51, 0xc2, 0x45, 0xe4, 0x85, 0xb5, 0x76, 0x62, 0x5e, 0x7e, 0xc6,
+	0xf4, 0x4c, 0x42, 0xe9, 0xa6, 0x37, 0xed, 0x6b, 0x0b, 0xff, 0x5c, 0xb6, 0xf4, 0x06, 0xb7, 0xed,
+	0xee, 0x38, 0x6b, 0xfb, 0x5a, 0x89, 0x9f, 0xa5, 0xae, 0x9f, 0x24, 0x11, 0x7c, 0x4b, 0x1f, 0xe6,
+	0x49, 0x28, 0x66, 0x51, 0xec, 0xe4, 0x5b, 0x3d, 0xc2, 0x00, 0x7c, 0xb8, 0xa1, 0x63, 0xbf, 0x05,
+	0x98, 0xda, 0x48, 0x36, 0x1c, 0x55, 0xd3, 0x9a, 0x69, 0x16, 0x3f, 0xa8, 0xfd, 0x24, 0xcf, 0x5f,
+	0x83, 0x65, 0x5d, 0x23, 0xdc, 0xa3, 0xad, 0x96, 0x1c, 0x62, 0xf3, 0x56, 0x20, 0x85, 0x52, 0xbb,
+	0x9e, 0xd5, 0x29, 0x07, 0x70, 0x96, 0x96, 0x6d, 0x67, 0x0c, 0x35, 0x4e, 0x4a, 0xbc, 0x98, 0x04,
+	0xf1, 0x74, 0x6c, 0x08, 0xca, 0x18, 0x21, 0x7c, 0x32, 0x90, 0x5e, 0x46, 0x2e, 0x36, 0xce, 0x3b,
+	0xe3, 0x9e, 0x77, 0x2c, 0x18, 0x0e, 0x86, 0x03, 0x9b, 0x27, 0x83, 0xa2, 0xec, 0x07, 0xa2, 0x8f,
+	0xb5, 0xc5, 0x5d, 0xf0, 0x6f, 0x4c, 0x52, 0xc9, 0xde, 0x2b, 0xcb, 0xf6, 0x95, 0x58, 0x17, 0x18,
+	0x39, 0x95, 0x49, 0x7c, 0xea, 0x95, 0x6a, 0xe5, 0x15, 0xd2, 0x26, 0x18, 0x98, 0xfa, 0x05, 0x10,
+	0x15, 0x72, 0x8e, 0x5a, 0x8a, 0xaa, 0xc4, 0x2d, 0xad, 0x33, 0x17, 0x0d, 0x04, 0x50, 0x7a, 0x33,
+	0xa8, 0x55, 0x21, 0xab, 0xdf, 0x1c, 0xba, 0x64, 0xec, 0xfb, 0x85, 0x04, 0x58, 0xdb, 0xef, 0x0a,
+	0x8a, 0xea, 0x71, 0x57, 0x5d, 0x06, 0x0c, 0x7d, 0xb3, 0x97, 0x0f, 0x85, 0xa6, 0xe1, 0xe4, 0xc7,
+	0xab, 0xf5, 0xae, 0x8c, 0xdb, 0x09, 0x33, 0xd7, 0x1e, 0x8c, 0x94, 0xe0, 0x4a, 0x25, 0x61, 0x9d,
+	0xce, 0xe3, 0xd2, 0x26, 0x1a, 0xd2, 0xee, 0x6b, 0xf1, 0x2f, 0xfa, 0x06, 0xd9, 0x8a, 0x08, 0x64,
+	0xd8, 0x76, 0x02, 0x73, 0x3e, 0xc8, 0x6a, 0x64, 0x52, 0x1f, 0x2b, 0x18, 0x17, 0x7b, 0x20, 0x0c,
+	0xbb, 0xe1, 0x17, 0x57, 0x7a, 0x61, 0x5d, 0x6c, 0x77, 0x09, 0x88, 0xc0, 0xba, 0xd9, 0x46, 0xe2,
+	0x08, 0xe2, 0x4f, 0xa0, 0x74, 0xe5, 0xab, 0x31, 0x43, 0xdb, 0x5b, 0xfc, 0xe0, 0xfd, 0x10, 0x8e,
+	0x4b, 0x82, 0xd1, 0x20, 0xa9, 0x3a, 0xd2, 0xca, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+};
+static const unsigned char kSRPGenerator5 = 5;
+
+/*
+ * Stands in for the device: holds the verifier for PIN and a fixed
+ * ephemeral key pair, so the session keys the client computes can be
+ * checked. It uses the BigInteger API of libsrp, so it works with every
+ * TLS backend.
+ */
+struct verifier {
+	unsigned char salt[16];
+	BigInteger modulus;
+	BigInteger verifier;
+	BigInteger secret;
+	cstr *pubkey;
+	BigIntegerCtx ctx;
+};
+
+static int failures = 0;
+
+static void sha512(unsigned char *digest, const void *data1, unsigned int len1, const void *data2, unsigned int len2, const void *data3, unsigned int len3)
+{
+	SHA512_CTX ctxt;
+	SHA512Init(&ctxt);
+	SHA512Update(&ctxt, data1, len1);
+	if (data2) {
+		SHA512Update(&ctxt, data2, len2);
+	}
+	if (data3) {
+		SHA512Update(&ctxt, data3, len3);
+	}
+	SHA512Final(digest, &ctxt);
+}
+
+static void verifier_init(struct verifier *vf)
+{
+	unsigned char digest[SHA512_DIGESTSIZE];
+	unsigned char b[32];
+	unsigned int i;
+
+	for (i = 0; i < sizeof(vf->salt); i++) {
+		vf->salt[i] = (unsigned char)(i * 17 + 3);
+	}
+	for (i = 0; i < sizeof(b); i++) {
+		b[i] = (unsigned char)(i * 29 + 11);
+	}
+	vf->ctx = BigIntegerCtxNew();
+	vf->modulus = BigIntegerFromBytes(kSRPModulus3072, sizeof(kSRPModulus3072));
+	BigInteger g = BigIntegerFromInt(kSRPGenerator5);
+
+	/* x = H(s | H(U | ":" | P)), v = g^x */
+	sha512(digest, PAIR_SETUP, sizeof(PAIR_SETUP)-1, ":", 1, PIN, sizeof(PIN)-1);
+	sha512(digest, vf->salt, sizeof(vf->salt), digest, sizeof(digest), NULL, 0);
+	BigInteger x = BigIntegerFromBytes(digest, sizeof(digest));
+	vf->verifier = BigIntegerFromInt(0);
+	BigIntegerModExp(vf->verifier, g, x, vf->modulus, vf->ctx, NULL);
+
+	/* k = H(N | PAD(g)), B = k*v + g^b; the client pads to the modulus length */
+	unsigned char padded_g[sizeof(kSRPModulus3072)];
+	memset(padded_g, 0, sizeof(padded_g));
+	padded_g[sizeof(padded_g)-1] = kSRPGenerator5;
+	sha512(digest, kSRPModulus3072, sizeof(kSRPModulus3072), padded_g, sizeof(padded_g), NULL, 0);
+	BigInteger k = BigIntegerFromBytes(digest, sizeof(digest));
+	BigInteger kv = BigIntegerFromInt(0);
+	BigInteger gb = BigIntegerFromInt(0);
+	BigInteger pub = BigIntegerFromInt(0);
+	vf->secret = BigIntegerFromBytes(b, sizeof(b));
+	BigIntegerModMul(kv, k, vf->verifier, vf->modulus, vf->ctx);
+	BigIntegerModExp(gb, g, vf->secret, vf->modulus, vf->ctx, NULL);
+	BigIntegerAdd(kv, kv, gb);
+	BigIntegerMod(pub, kv, vf->modulus, vf->ctx);
+	vf->pubkey = cstr_new();
+	BigIntegerToCstrEx(pub, vf->pubkey, sizeof(kSRPModulus3072));
+
+	BigIntegerFree(pub);
+	BigIntegerFree(gb);
+	BigIntegerFree(kv);
+	BigIntegerFree(k);
+	BigIntegerClearFree(x);
+	BigIntegerFree(g);
+}
+
+static void verifier_free(struct verifier *vf)
+{
+	cstr_free(vf->pubkey);
+	BigIntegerClearFree(vf->secret);
+	BigIntegerFree(vf->verifier);
+	BigIntegerFree(vf->modulus);
+	BigIntegerCtxFree(vf->ctx);
+}
+
+/*
+ * Computes the session key K = H((A * v^u)^b) with u = H(PAD(A) | PAD(B))
+ * and the server proof H(A | M | K) for the client public key A and
+ * client proof M.
+ */
+static void verifier_check(struct verifier *vf, cstr *client_pub, cstr *client_proof, unsigned char *key, unsigned char *proof)
+{
+	unsigned char digest[SHA512_DIGESTSIZE];
+
+	BigInteger a = BigIntegerFromBytes((const unsigned char*)client_pub->data, client_pub->length);
+	BigInteger t = BigIntegerFromInt(0);
+	BigInteger s = BigIntegerFromInt(0);
+	cstr *sstr = cstr_new();
+
+	BigIntegerToCstrEx(a, sstr, sizeof(kSRPModulus3072));
+	sha512(digest, sstr->data, sstr->length, vf->pubkey->data, vf->pubkey->length, NULL, 0);
+	BigInteger u = BigIntegerFromBytes(digest, sizeof(digest));
+
+	BigIntegerModExp(t, vf->verifier, u, vf->modulus, vf->ctx, NULL);
+	BigIntegerModMul(t, t, a, vf->modulus, vf->ctx);
+	BigIntegerModExp(s, t, vf->secret, vf->modulus, vf->ctx, NULL);
+	BigIntegerToCstr(s, sstr);
+	sha512(key, sstr->data, sstr->length, NULL, 0, NULL, 0);
+	sha512(proof, client_pub->data, client_pub->length, client_proof->data, client_proof->length, key, SHA512_DIGESTSIZE);
+
+	cstr_clear_free(sstr);
+	BigIntegerClearFree(s);
+	BigIntegerClearFree(t);
+	BigIntegerFree(a);
+	BigIntegerFree(u);
+}
+
+/* runs the client side of pair setup like lockdown-cu.c does */
+static void bench_client(struct verifier *vf, SRP_GROUP *group, unsigned int count)
+{
+	const char *name = (group) ? "srp client shared group" : "srp client per-session params";
+	bench_t bench;
+	unsigned int i;
+
+	if (!bench_selected(name)) {
+		return;
+	}
+
+	bench_begin(&bench, name, count);
+	for (i = 0; i < count; i++) {
+		cstr *pub = NULL;
+		cstr *key = NULL;
+		cstr *response = NULL;
+		int res = 0;
+
+		bench_op_begin(&bench);
+		SRP *srp = SRP_new(SRP6a_sha512_client_method());
+		if (group) {
+			SRP_set_group(srp, group);
+		}
+		res |= SRP_set_user_raw(srp, (const unsigned char*)PAIR_SETUP, sizeof(PAIR_SETUP)-1);
+		res |= SRP_set_params(srp, kSRPModulus3072, sizeof(kSRPModulus3072), &kSRPGenerator5, 1, vf->salt, sizeof(vf->salt));
+		res |= SRP_set_auth_password_raw(srp, (const unsigned char*)PIN, sizeof(PIN)-1);
+		res |= SRP_gen_pub(srp, &pub);
+		res |= SRP_compute_key(srp, &key, (const unsigned char*)vf->pubkey->data, vf->pubkey->length);
+		res |= SRP_respond(srp, &response);
+		bench_op_end(&bench, 0);
+
+		if (res == 0) {
+			unsigned char server_key[SHA512_DIGESTSIZE];
+			unsigned char server_proof[SHA512_DIGESTSIZE];
+			verifier_check(vf, pub, response, server_key, server_proof);
+			if (key->length != SHA512_DIGESTSIZE || memcmp(key->data, server_key, SHA512_DIGESTSIZE) != 0) {
+				fprintf(stderr, "%s: session key %u does not match the verifier\n", name, i);
+				res = -1;
+			} else if (SRP_verify(srp, server_proof, sizeof(server_proof)) != 0) {
+				fprintf(stderr, "%s: server proof %u was rejected\n", name, i);
+				res = -1;
+			}
+		} else {
+			fprintf(stderr, "%s: SRP failed\n", name);
+		}
+		cstr_free(response);
+		cstr_free(key);
+		cstr_free(pub);
+		SRP_free(srp);
+		if (res != 0) {
+			failures++;
+			break;
+		}
+	}
+	bench_end(&bench);
+}
+
+int main(int argc, char **argv)
+{
+	struct verifier vf;
+
+	bench_init(argc, argv);
+	SRP_initialize_library();
+
+	verifier_init(&vf);
+	SRP_GROUP *group = SRP_group_new(kSRPModulus3072, sizeof(kSRPModulus3072), &kSRPGenerator5, 1, 512);
+	if (!group) {
+		fprintf(stderr, "ERROR: Could not create the SRP group\n");
+		return 1;
+	}
+
+	bench_client(&vf, NULL, bench_iterations(500));
+	bench_client(&vf, group, bench_iterations(500));
+
+	SRP_group_free(group);
+	verifier_free(&vf);
+
+	return (failures > 0) ? 1 : 0;
+}
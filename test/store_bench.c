@@ -0,0 +1,443 @@
+/*
+ * store_bench.c
+ * Disk usage and throughput benchmarks of the deduplicating backup store
+ *
+ * Copyright (c) 2026 libimobiledevice project. All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <libimobiledevice-glue/sha.h>
+#include <libimobiledevice-glue/utils.h>
+
+#include "tools/mb2_store.h"
+#include "bench.h"
+
+/*
+ * Models several similar devices backed up into the same directory: the
+ * first SHARED_PERCENT of the files of every backup have the same contents
+ * on all devices (OS and app files), the others are unique per device.
+ * Files are received like idevicebackup2 does: written to a .partial file
+ * while being hashed, renamed into place and then added to the store.
+ */
+#define NUM_DEVICES 4
+#define SHARED_PERCENT 70
+#define MAX_FILE_SIZE (64 * 1024)
+#define BLOCK_SIZE 8192
+
+struct inode_usage {
+	dev_t dev;
+	ino_t ino;
+	uint64_t blocks;
+};
+
+struct usage {
+	struct inode_usage *inodes;
+	unsigned int count;
+	unsigned int capacity;
+	/* backup files outside the store and the space they would take as copies */
+	unsigned int files;
+	uint64_t copies;
+};
+
+static char *root = NULL;
+static char *plain_dir = NULL;
+static char *dedup_dir = NULL;
+static char *store_dir = NULL;
+static unsigned int num_files = 0;
+static unsigned int num_shared = 0;
+static unsigned char content[MAX_FILE_SIZE];
+static int failures = 0;
+
+static uint32_t content_id(unsigned int device, unsigned int file)
+{
+	return (file < num_shared) ? file : ((device + 1) << 20) + file;
+}
+
+static uint32_t content_size(uint32_t id)
+{
+	uint32_t h = id * 2654435761u;
+	return 512 + (h >> 8) % (MAX_FILE_SIZE - 512);
+}
+
+static void content_fill(uint32_t id, uint32_t size)
+{
+	uint32_t x = id * 2246822519u + 1;
+	uint32_t i;
+	for (i = 0; i < size; i++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		content[i] = (unsigned char)x;
+	}
+}
+
+static char *device_dir(const char *tree, unsigned int device)
+{
+	char udid[32];
+	snprintf(udid, sizeof(udid), "%08x-%016x", device + 1, device + 1);
+	return string_build_path(tree, udid, NULL);
+}
+
+/* receives one file into tree, returns its size or 0 on error */
+static uint32_t receive_file(bench_t *bench, const char *tree, const char *store, unsigned int device, unsigned int file)
+{
+	char name[48];
+	char subdir[3];
+	unsigned char hash[MB2_STORE_HASH_LEN];
+	sha256_context sha;
+	uint32_t id = content_id(device, file);
+	uint32_t size = content_size(id);
+	uint32_t done = 0;
+	int ok = 1;
+
+	content_fill(id, size);
+	/* spread like the SHA-1 names of a real backup */
+	snprintf(name, sizeof(name), "%02x%06x%08x%024x", (file * 151) & 0xff, device + 1, file, 0);
+	subdir[0] = name[0];
+	subdir[1] = name[1];
+	subdir[2] = '\0';
+	char *ddir = device_dir(tree, device);
+	char *dir = string_build_path(ddir, subdir, NULL);
+	char *bname = string_build_path(dir, name, NULL);
+	char *pname = string_concat(bname, ".partial", NULL);
+	mkdir(ddir, 0755);
+	mkdir(dir, 0755);
+
+	if (bench) {
+		bench_op_begin(bench);
+	}
+	/* files are always removed and recreated, never rewritten in place */
+	remove(pname);
+	FILE *f = fopen(pname, "wb");
+	if (!f) {
+		ok = 0;
+	}
+	if (store) {
+		sha256_init(&sha);
+	}
+	while (ok && done < size) {
+		uint32_t len = (size - done < BLOCK_SIZE) ? size - done : BLOCK_SIZE;
+		if (fwrite(content + done, 1, len, f) != len) {
+			ok = 0;
+		}
+		if (store) {
+			sha256_update(&sha, content + done, len);
+		}
+		done += len;
+	}
+	if (f) {
+		if (fclose(f) != 0) {
+			ok = 0;
+		}
+	}
+	if (ok && rename(pname, bname) < 0) {
+		ok = 0;
+	}
+	if (ok && store) {
+		sha256_final(&sha, hash);
+		if (mb2_store_ingest(store, bname, hash, size) < 0) {
+			ok = 0;
+		}
+	}
+	if (bench) {
+		bench_op_end(bench, size);
+	}
+
+	if (!ok) {
+		fprintf(stderr, "Could not receive '%s': %s\n", bname, strerror(errno));
+	}
+	free(pname);
+	free(bname);
+	free(dir);
+	free(ddir);
+	return (ok) ? size : 0;
+}
+
+static int receive_backup(bench_t *bench, const char *tree, const char *store, unsigned int device)
+{
+	unsigned int i;
+	for (i = 0; i < num_files; i++) {
+		if (receive_file(bench, tree, store, device, i) == 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void remove_tree(const char *path)
+{
+	DIR *dir = opendir(path);
+	struct dirent *ep;
+	if (dir) {
+		while ((ep = readdir(dir))) {
+			struct stat st;
+			if (!strcmp(ep->d_name, ".") || !strcmp(ep->d_name, "..")) {
+				continue;
+			}
+			char *fpath = string_build_path(path, ep->d_name, NULL);
+			if (lstat(fpath, &st) == 0 && S_ISDIR(st.st_mode)) {
+				remove_tree(fpath);
+			} else {
+				remove(fpath);
+			}
+			free(fpath);
+		}
+		closedir(dir);
+	}
+	remove(path);
+}
+
+static void usage_scan(const char *path, struct usage *usage, int in_store)
+{
+	DIR *dir = opendir(path);
+	struct dirent *ep;
+	if (!dir) {
+		return;
+	}
+	while ((ep = readdir(dir))) {
+		struct stat st;
+		if (!strcmp(ep->d_name, ".") || !strcmp(ep->d_name, "..")) {
+			continue;
+		}
+		char *fpath = string_build_path(path, ep->d_name, NULL);
+		if (lstat(fpath, &st) == 0) {
+			if (S_ISDIR(st.st_mode)) {
+				usage_scan(fpath, usage, in_store || !strcmp(ep->d_name, MB2_STORE_DIR));
+			} else if (S_ISREG(st.st_mode)) {
+				uint64_t blocks = (uint64_t)st.st_blocks * 512;
+				if (usage->count == usage->capacity) {
+					usage->capacity = (usage->capacity) ? usage->capacity * 2 : 1024;
+					usage->inodes = realloc(usage->inodes, usage->capacity * sizeof(struct inode_usage));
+				}
+				usage->inodes[usage->count].dev = st.st_dev;
+				usage->inodes[usage->count].ino = st.st_ino;
+				usage->inodes[usage->count].blocks = blocks;
+				usage->count++;
+				if (!in_store) {
+					usage->files++;
+					usage->copies += blocks;
+				}
+			}
+		}
+		free(fpath);
+	}
+	closedir(dir);
+}
+
+static int inode_cmp(const void *a, const void *b)
+{
+	const struct inode_usage *ia = a;
+	const struct inode_usage *ib = b;
+	if (ia->dev != ib->dev) {
+		return (ia->dev < ib->dev) ? -1 : 1;
+	}
+	if (ia->ino != ib->ino) {
+		return (ia->ino < ib->ino) ? -1 : 1;
+	}
+	return 0;
+}
+
+/*
+ * Prints the disk space the backup files below path take, counting every
+ * inode once like 'du' does, next to the space they would take as copies.
+ */
+static void print_usage(const char *name, const char *path)
+{
+	struct usage usage;
+	uint64_t ondisk = 0;
+	unsigned int inodes = 0;
+	unsigned int i;
+
+	memset(&usage, 0, sizeof(usage));
+	usage_scan(path, &usage, 0);
+	qsort(usage.inodes, usage.count, sizeof(struct inode_usage), inode_cmp);
+	for (i = 0; i < usage.count; i++) {
+		if (i == 0 || inode_cmp(&usage.inodes[i-1], &usage.inodes[i]) != 0) {
+			ondisk += usage.inodes[i].blocks;
+			inodes++;
+		}
+	}
+	printf("%-40s %6u files %6u inodes  copies %9.2f MiB  on disk %9.2f MiB (%.0f%%)\n",
+		name, usage.files, inodes, (double)usage.copies / 1048576, (double)ondisk / 1048576,
+		(usage.copies > 0) ? 100.0 * ondisk / usage.copies : 0.0);
+	fflush(stdout);
+	free(usage.inodes);
+}
+
+static unsigned int count_objects(const char *store)
+{
+	struct usage usage;
+	memset(&usage, 0, sizeof(usage));
+	usage_scan(store, &usage, 1);
+	free(usage.inodes);
+	return usage.count;
+}
+
+/* backs up all devices into tree, using the store if given */
+static void bench_backups(const char *name, const char *tree, const char *store)
+{
+	bench_t bench;
+	unsigned int d;
+
+	bench_begin(&bench, name, NUM_DEVICES * num_files);
+	for (d = 0; d < NUM_DEVICES; d++) {
+		if (receive_backup(&bench, tree, store, d) < 0) {
+			failures++;
+			break;
+		}
+	}
+	bench_end(&bench);
+	print_usage(name, tree);
+}
+
+static void bench_plain(void)
+{
+	const char *name = "store backup without store";
+
+	if (!bench_selected(name)) {
+		return;
+	}
+	bench_backups(name, plain_dir, NULL);
+	remove_tree(plain_dir);
+}
+
+static void bench_dedup(void)
+{
+	const char *name = "store backup with store";
+	unsigned int expected = num_shared + NUM_DEVICES * (num_files - num_shared);
+	unsigned int objects;
+
+	if (!bench_selected(name)) {
+		return;
+	}
+	bench_backups(name, dedup_dir, store_dir);
+	objects = count_objects(store_dir);
+	if (objects != expected) {
+		fprintf(stderr, "%s: store holds %u objects instead of %u\n", name, objects, expected);
+		failures++;
+	}
+}
+
+/* a new backup of a device that is already in the store */
+static void bench_repeat(void)
+{
+	const char *name = "store backup again with store";
+	unsigned int before;
+	unsigned int after;
+	bench_t bench;
+
+	if (!bench_selected(name)) {
+		return;
+	}
+	before = count_objects(store_dir);
+	bench_begin(&bench, name, num_files);
+	if (receive_backup(&bench, dedup_dir, store_dir, 0) < 0) {
+		failures++;
+	}
+	bench_end(&bench);
+	print_usage(name, dedup_dir);
+	after = count_objects(store_dir);
+	if (after != before) {
+		fprintf(stderr, "%s: store grew from %u to %u objects\n", name, before, after);
+		failures++;
+	}
+}
+
+/* drops the backup of one device and prunes its unique contents */
+static void bench_prune(void)
+{
+	const char *name = "store prune after removing a backup";
+	unsigned int before;
+	unsigned int pruned;
+	bench_t bench;
+
+	if (!bench_selected(name)) {
+		return;
+	}
+	before = count_objects(store_dir);
+	char *ddir = device_dir(dedup_dir, 0);
+	remove_tree(ddir);
+	free(ddir);
+
+	bench_begin(&bench, name, 1);
+	bench_op_begin(&bench);
+	pruned = mb2_store_prune(store_dir);
+	bench_op_end(&bench, 0);
+	bench_end(&bench);
+	print_usage(name, dedup_dir);
+	if (pruned != num_files - num_shared || count_objects(store_dir) != before - pruned) {
+		fprintf(stderr, "%s: pruned %u objects instead of %u\n", name, pruned, num_files - num_shared);
+		failures++;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const char *tmpdir = getenv("TMPDIR");
+
+	bench_init(argc, argv);
+
+	num_files = bench_iterations(1000);
+	num_shared = num_files * SHARED_PERCENT / 100;
+
+	root = string_build_path((tmpdir) ? tmpdir : "/tmp", "store_bench.XXXXXX", NULL);
+	if (!mkdtemp(root)) {
+		fprintf(stderr, "ERROR: Could not create a temporary directory: %s\n", strerror(errno));
+		return 1;
+	}
+	plain_dir = string_build_path(root, "plain", NULL);
+	dedup_dir = string_build_path(root, "dedup", NULL);
+	store_dir = string_build_path(dedup_dir, MB2_STORE_DIR, NULL);
+	mkdir(plain_dir, 0755);
+	mkdir(dedup_dir, 0755);
+	mkdir(store_dir, 0755);
+
+	bench_plain();
+	/* the later benchmarks work on the backups this one creates */
+	if (bench_selected("store backup with store")) {
+		bench_dedup();
+	} else {
+		unsigned int d;
+		for (d = 0; d < NUM_DEVICES; d++) {
+			if (receive_backup(NULL, dedup_dir, store_dir, d) < 0) {
+				failures++;
+				break;
+			}
+		}
+	}
+	bench_repeat();
+	bench_prune();
+
+	remove_tree(root);
+	free(store_dir);
+	free(dedup_dir);
+	free(plain_dir);
+	free(root);
+
+	return (failures > 0) ? 1 : 0;
+}
@@ -0,0 +1,366 @@
+/*
+ * transport_bench.c
+ * Throughput, latency and allocation benchmarks of the service framing
+ * layers against the loopback device emulator
+ *
+ * Copyright (c) 2026 libimobiledevice project. All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+
+#include <libimobiledevice/libimobiledevice.h>
+#include <libimobiledevice/lockdown.h>
+#include <libimobiledevice/afc.h>
+#include <libimobiledevice/property_list_service.h>
+#include <libimobiledevice/mobilebackup2.h>
+#include <plist/plist.h>
+#include <endianness.h>
+
+#include "emulator.h"
+#include "bench.h"
+
+#define CODE_SUCCESS 0x00
+#define CODE_FILE_DATA 0x0c
+
+static emulator_t emulator = NULL;
+static idevice_t device = NULL;
+static int failures = 0;
+
+static void bench_afc(int write, uint32_t size, unsigned int count)
+{
+	struct lockdownd_service_descriptor service;
+	afc_client_t afc = NULL;
+	uint64_t handle = 0;
+	char name[64];
+	bench_t bench;
+	unsigned int i;
+
+	snprintf(name, sizeof(name), "afc_file_%s %u KiB", (write) ? "write" : "read", size / 1024);
+	if (!bench_selected(name)) {
+		return;
+	}
+
+	char *buf = (char*)malloc(size);
+	memset(buf, 'x', size);
+	emulator_get_service_descriptor(emulator, EMULATOR_SERVICE_AFC, &service);
+	if (afc_client_new(device, &service, &afc) != AFC_E_SUCCESS
+	    || afc_file_open(afc, "/bench", (write) ? AFC_FOPEN_WRONLY : AFC_FOPEN_RDONLY, &handle) != AFC_E_SUCCESS) {
+		fprintf(stderr, "%s: could not open AFC file\n", name);
+		failures++;
+		goto leave;
+	}
+
+	bench_begin(&bench, name, count);
+	for (i = 0; i < count; i++) {
+		uint32_t bytes = 0;
+		afc_error_t err;
+		bench_op_begin(&bench);
+		if (write) {
+			err = afc_file_write(afc, handle, buf, size, &bytes);
+		} else {
+			err = afc_file_read(afc, handle, buf, size, &bytes);
+		}
+		bench_op_end(&bench, bytes);
+		if (err != AFC_E_SUCCESS || bytes != size) {
+			fprintf(stderr, "%s: operation failed (%d, %u bytes)\n", name, err, bytes);
+			failures++;
+			break;
+		}
+	}
+	bench_end(&bench);
+	afc_file_close(afc, handle);
+
+leave:
+	afc_client_free(afc);
+	free(buf);
+}
+
+/* a message shaped like a lockdownd or instproxy reply with items entries */
+static plist_t build_message(unsigned int items)
+{
+	char key[32];
+	unsigned int i;
+
+	plist_t dict = plist_new_dict();
+	plist_dict_set_item(dict, "Request", plist_new_string("GetValue"));
+	plist_dict_set_item(dict, "Status", plist_new_string("Complete"));
+	if (items > 0) {
+		plist_t array = plist_new_array();
+		for (i = 0; i < items; i++) {
+			plist_t item = plist_new_dict();
+			snprintf(key, sizeof(key), "com.example.app%u", i);
+			plist_dict_set_item(item, "CFBundleIdentifier", plist_new_string(key));
+			plist_dict_set_item(item, "CFBundleVersion", plist_new_string("1.0"));
+			plist_dict_set_item(item, "StaticDiskUsage", plist_new_uint(1000000 + i));
+			plist_dict_set_item(item, "IsUpgradeable", plist_new_bool(1));
+			plist_array_append_item(array, item);
+		}
+		plist_dict_set_item(dict, "CurrentList", array);
+	}
+	return dict;
+}
+
+static void bench_plist_echo(unsigned int items, unsigned int count)
+{
+	struct lockdownd_service_descriptor service;
+	property_list_service_client_t client = NULL;
+	char name[64];
+	bench_t bench;
+	unsigned int i;
+
+	snprintf(name, sizeof(name), "property_list_service %u items", items);
+	if (!bench_selected(name)) {
+		return;
+	}
+
+	plist_t message = build_message(items);
+	emulator_get_service_descriptor(emulator, EMULATOR_SERVICE_ECHO, &service);
+	if (property_list_service_client_new(device, &service, &client) != PROPERTY_LIST_SERVICE_E_SUCCESS) {
+		fprintf(stderr, "%s: could not connect\n", name);
+		failures++;
+		plist_free(message);
+		return;
+	}
+
+	bench_begin(&bench, name, count);
+	for (i = 0; i < count; i++) {
+		plist_t reply = NULL;
+		bench_op_begin(&bench);
+		property_list_service_error_t err = property_list_service_send_binary_plist(client, message);
+		if (err == PROPERTY_LIST_SERVICE_E_SUCCESS) {
+			err = property_list_service_receive_plist(client, &reply);
+		}
+		plist_free(reply);
+		bench_op_end(&bench, 0);
+		if (err != PROPERTY_LIST_SERVICE_E_SUCCESS) {
+			fprintf(stderr, "%s: round trip failed (%d)\n", name, err);
+			failures++;
+			break;
+		}
+	}
+	bench_end(&bench);
+
+	property_list_service_client_free(client);
+	plist_free(message);
+}
+
+static int receive_raw_full(mobilebackup2_client_t mb2, char *data, uint32_t length)
+{
+	uint32_t done = 0;
+	while (done < length) {
+		uint32_t bytes = 0;
+		if (mobilebackup2_receive_raw(mb2, data + done, length - done, &bytes) != MOBILEBACKUP2_E_SUCCESS || bytes == 0) {
+			return -1;
+		}
+		done += bytes;
+	}
+	return 0;
+}
+
+static int receive_name(mobilebackup2_client_t mb2, char *name, uint32_t size)
+{
+	uint32_t nlen = 0;
+	if (receive_raw_full(mb2, (char*)&nlen, sizeof(nlen)) < 0) {
+		return -1;
+	}
+	nlen = be32toh(nlen);
+	if (nlen == 0) {
+		return 0;
+	}
+	if (nlen >= size || receive_raw_full(mb2, name, nlen) < 0) {
+		return -1;
+	}
+	name[nlen] = '\0';
+	return (int)nlen;
+}
+
+/* receives the file stream of a DLMessageUploadFiles the way idevicebackup2 does */
+static int receive_files(mobilebackup2_client_t mb2, bench_t *bench, char *buf, uint32_t bufsize)
+{
+	char dname[256];
+	char fname[256];
+
+	while (1) {
+		bench_op_begin(bench);
+		int res = receive_name(mb2, dname, sizeof(dname));
+		if (res <= 0) {
+			return res;
+		}
+		if (receive_name(mb2, fname, sizeof(fname)) <= 0) {
+			return -1;
+		}
+		uint64_t fsize = 0;
+		while (1) {
+			uint32_t nlen = 0;
+			char code = 0;
+			if (receive_raw_full(mb2, (char*)&nlen, sizeof(nlen)) < 0 || receive_raw_full(mb2, &code, 1) < 0) {
+				return -1;
+			}
+			nlen = be32toh(nlen);
+			if (code != CODE_FILE_DATA) {
+				break;
+			}
+			uint32_t remaining = nlen - 1;
+			while (remaining > 0) {
+				uint32_t chunk = (remaining > bufsize) ? bufsize : remaining;
+				if (receive_raw_full(mb2, buf, chunk) < 0) {
+					return -1;
+				}
+				remaining -= chunk;
+				fsize += chunk;
+			}
+		}
+		bench_op_end(bench, fsize);
+	}
+}
+
+static void bench_backup_stream(uint32_t file_size, unsigned int count)
+{
+	struct lockdownd_service_descriptor service;
+	mobilebackup2_client_t mb2 = NULL;
+	plist_t msg = NULL;
+	char *dlmessage = NULL;
+	char name[64];
+	bench_t bench;
+
+	snprintf(name, sizeof(name), "mobilebackup2 stream %u KiB files", file_size / 1024);
+	if (!bench_selected(name)) {
+		return;
+	}
+
+	uint32_t bufsize = 32768;
+	char *buf = (char*)malloc(bufsize);
+	emulator_get_service_descriptor(emulator, EMULATOR_SERVICE_MOBILEBACKUP2, &service);
+	if (mobilebackup2_client_new(device, &service, &mb2) != MOBILEBACKUP2_E_SUCCESS) {
+		fprintf(stderr, "%s: could not connect\n", name);
+		failures++;
+		free(buf);
+		return;
+	}
+
+	plist_t opts = plist_new_dict();
+	plist_dict_set_item(opts, EMULATOR_BACKUP_FILE_COUNT, plist_new_uint(count));
+	plist_dict_set_item(opts, EMULATOR_BACKUP_FILE_SIZE, plist_new_uint(file_size));
+	mobilebackup2_error_t err = mobilebackup2_send_message(mb2, "Backup", opts);
+	plist_free(opts);
+	if (err == MOBILEBACKUP2_E_SUCCESS) {
+		err = mobilebackup2_receive_message(mb2, &msg, &dlmessage);
+	}
+	if (err != MOBILEBACKUP2_E_SUCCESS || !dlmessage || strcmp(dlmessage, "DLMessageUploadFiles") != 0) {
+		fprintf(stderr, "%s: did not receive DLMessageUploadFiles\n", name);
+		failures++;
+		goto leave;
+	}
+
+	bench_begin(&bench, name, count);
+	if (receive_files(mb2, &bench, buf, bufsize) < 0 || bench.done != count) {
+		fprintf(stderr, "%s: file stream broken after %u files\n", name, bench.done);
+		failures++;
+	}
+	bench_end(&bench);
+
+	plist_t empty = plist_new_dict();
+	mobilebackup2_send_status_response(mb2, 0, NULL, empty);
+	plist_free(empty);
+	plist_free(msg);
+	msg = NULL;
+	free(dlmessage);
+	dlmessage = NULL;
+	mobilebackup2_receive_message(mb2, &msg, &dlmessage);
+
+leave:
+	plist_free(msg);
+	free(dlmessage);
+	mobilebackup2_client_free(mb2);
+	free(buf);
+}
+
+static void bench_lockdown_get_value(unsigned int count)
+{
+	lockdownd_client_t lockdown = NULL;
+	const char *name = "lockdownd_get_value";
+	bench_t bench;
+	unsigned int i;
+
+	if (!bench_selected(name)) {
+		return;
+	}
+	if (emulator_get_port(emulator, EMULATOR_SERVICE_LOCKDOWN) == 0) {
+		printf("%-40s skipped, lockdownd port not available\n", name);
+		return;
+	}
+	if (lockdownd_client_new(device, &lockdown, "transport_bench") != LOCKDOWN_E_SUCCESS) {
+		fprintf(stderr, "%s: could not connect\n", name);
+		failures++;
+		return;
+	}
+
+	bench_begin(&bench, name, count);
+	for (i = 0; i < count; i++) {
+		plist_t value = NULL;
+		bench_op_begin(&bench);
+		lockdownd_error_t err = lockdownd_get_value(lockdown, NULL, "ProductVersion", &value);
+		plist_free(value);
+		bench_op_end(&bench, 0);
+		if (err != LOCKDOWN_E_SUCCESS) {
+			fprintf(stderr, "%s: failed (%d)\n", name, err);
+			failures++;
+			break;
+		}
+	}
+	bench_end(&bench);
+
+	lockdownd_client_free(lockdown);
+}
+
+int main(int argc, char **argv)
+{
+#ifdef SIGPIPE
+	signal(SIGPIPE, SIG_IGN);
+#endif
+	bench_init(argc, argv);
+
+	if (emulator_start(&emulator) < 0) {
+		fprintf(stderr, "ERROR: Could not start the device emulator\n");
+		return 1;
+	}
+	device = emulator_new_device(emulator);
+
+	bench_afc(0, 4096, bench_iterations(20000));
+	bench_afc(0, 65536, bench_iterations(5000));
+	bench_afc(0, 1048576, bench_iterations(500));
+	bench_afc(1, 4096, bench_iterations(20000));
+	bench_afc(1, 65536, bench_iterations(5000));
+	bench_afc(1, 1048576, bench_iterations(500));
+	bench_plist_echo(0, bench_iterations(20000));
+	bench_plist_echo(1000, bench_iterations(500));
+	bench_backup_stream(4096, bench_iterations(20000));
+	bench_backup_stream(1048576, bench_iterations(500));
+	bench_lockdown_get_value(bench_iterations(20000));
+
+	idevice_free(device);
+	emulator_stop(emulator);
+
+	return (failures > 0) ? 1 : 0;
+}
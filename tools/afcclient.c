@@ -776,6 +776,55 @@ static int __mkdir(const char* path)
 #endif
 }
 
+struct get_file_walk_ctx {
+	afc_client_t afc;
+	const char *srcpath;
+	const char *dstpath;
+	uint8_t force_overwrite;
+	uint8_t succeed;
+};
+
+static afc_walk_action_t get_file_walk_cb(const char *path, plist_t info, afc_error_t err, void *user_data)
+{
+	struct get_file_walk_ctx *ctx = (struct get_file_walk_ctx*)user_data;
+	if (err != AFC_E_SUCCESS) {
+		printf("Error: Failed to read '%s': %s (%d)\n", path, afc_strerror(err), err);
+		ctx->succeed = 0;
+		return AFC_WALK_STOP;
+	}
+	const char *relpath = path + strlen(ctx->srcpath);
+	while (*relpath == '/') {
+		relpath++;
+	}
+	size_t dst_len = strlen(ctx->dstpath);
+	size_t len = dst_len + 1 + strlen(relpath) + 1;
+	char *newdst = (char *) malloc(len);
+	if (*relpath == '\0') {
+		snprintf(newdst, len, "%s", ctx->dstpath);
+	} else if (dst_len > 0 && ctx->dstpath[dst_len - 1] == '/') {
+		snprintf(newdst, len, "%s%s", ctx->dstpath, relpath);
+	} else {
+		snprintf(newdst, len, "%s/%s", ctx->dstpath, relpath);
+	}
+	const char* ifmt = plist_get_string_ptr(plist_dict_get_item(info, "st_ifmt"), NULL);
+	if (ifmt && !strcmp(ifmt, "S_IFDIR")) {
+		// if directory exists, check force_overwrite flag
+		if (is_directory(newdst)) {
+			if (!ctx->force_overwrite) {
+				printf("Error: Failed to write into existing directory without '-f': %s\n", newdst);
+				ctx->succeed = 0;
+			}
+		} else if (__mkdir(newdst) != 0) {
+			printf("Error: Failed to create directory '%s': %s\n", newdst, strerror(errno));
+			ctx->succeed = 0;
+		}
+	} else {
+		ctx->succeed = get_single_file(ctx->afc, path, newdst, plist_dict_get_uint(info, "st_size"), ctx->force_overwrite);
+	}
+	free(newdst);
+	return (ctx->succeed) ? AFC_WALK_CONTINUE : AFC_WALK_STOP;
+}
+
 static uint8_t get_file(afc_client_t afc, const char *srcpath, const char *dstpath, uint8_t force_overwrite, uint8_t recursive_get)
 {
 	plist_t info = NULL;
@@ -798,55 +847,14 @@ static uint8_t get_file(afc_client_t afc, const char *srcpath, const char *dstpa
 			printf("Error: Failed to get a directory without '-r' option: %s\n", srcpath);
 			return 0;
 		}
-		char **entries = NULL;
-		err = afc_read_directory(afc, srcpath, &entries);
+		// walk the tree with batched file info requests instead of one round trip per entry
+		struct get_file_walk_ctx ctx = { afc, srcpath, dstpath, force_overwrite, 1 };
+		err = afc_walk(afc, srcpath, NULL, get_file_walk_cb, &ctx);
 		if (err != AFC_E_SUCCESS) {
 			printf("Error: Failed to list '%s': %s (%d)\n", srcpath, afc_strerror(err), err);
 			return 0;
 		}
-		char **p = entries;
-		size_t srcpath_len = strlen(srcpath);
-		uint8_t srcpath_is_root = strcmp(srcpath, "/") == 0;
-		// if directory exists, check force_overwrite flag
-		if (is_directory(dstpath)) {
-			if (!force_overwrite) {
-				printf("Error: Failed to write into existing directory without '-f': %s\n", dstpath);
-				return 0;
-			}
-		} else if (__mkdir(dstpath) != 0) {
-			printf("Error: Failed to create directory '%s': %s\n", dstpath, strerror(errno));
-			afc_dictionary_free(entries);
-			return 0;
-		}
-		while (p && *p) {
-			if (strcmp(".", *p) == 0 || strcmp("..", *p) == 0) {
-				p++;
-				continue;
-			}
-			size_t len = srcpath_is_root ? (strlen(*p) + 2) : (srcpath_len + 1 + strlen(*p) + 1);
-			char *testpath = (char *) malloc(len);
-			if (srcpath_is_root) {
-				snprintf(testpath, len, "/%s", *p);
-			} else {
-				snprintf(testpath, len, "%s/%s", srcpath, *p);
-			}
-			uint8_t dst_is_root = strcmp(srcpath, "/") == 0;
-			size_t dst_len = dst_is_root ? (strlen(*p) + 2) : (strlen(dstpath) + 1 + strlen(*p) + 1);
-			char *newdst = (char *) malloc(dst_len);
-			if (dst_is_root) {
-				snprintf(newdst, dst_len, "/%s", *p);
-			} else {
-				snprintf(newdst, dst_len, "%s/%s", dstpath, *p);
-			}
-			if (!get_file(afc, testpath, newdst, force_overwrite, recursive_get)) {
-				succeed = 0;
-				break;
-			}
-			free(testpath);
-			free(newdst);
-			p++;
-		}
-		afc_dictionary_free(entries);
+		succeed = ctx.succeed;
 	} else {
 		succeed = get_single_file(afc, srcpath, dstpath, file_size, force_overwrite);
 	}
@@ -23,6 +23,9 @@
 #ifdef HAVE_CONFIG_H
 #include <config.h>
 #endif
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1 /* syncfs */
+#endif
 
 #define TOOL_NAME "idevicebackup2"
 
@@ -40,23 +43,28 @@
 
 #include <libimobiledevice/libimobiledevice.h>
 #include <libimobiledevice/lockdown.h>
+#include <libimobiledevice/service.h>
 #include <libimobiledevice/mobilebackup2.h>
 #include <libimobiledevice/notification_proxy.h>
 #include <libimobiledevice/afc.h>
 #include <libimobiledevice/installation_proxy.h>
 #include <libimobiledevice/sbservices.h>
 #include <libimobiledevice/diagnostics_relay.h>
+#include <libimobiledevice-glue/sha.h>
 #include <libimobiledevice-glue/utils.h>
 #include <plist/plist.h>
 
 #include <endianness.h>
 
+#include "mb2_store.h"
+
 #define LOCK_ATTEMPTS 50
 #define LOCK_WAIT 200000
 
 #ifdef _WIN32
 #include <windows.h>
 #include <conio.h>
+#include <io.h>
 #define sleep(x) Sleep(x*1000)
 #ifndef ELOOP
 #define ELOOP 114
@@ -64,6 +72,10 @@
 #else
 #include <termios.h>
 #include <sys/statvfs.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <pthread.h>
 #endif
 #include <sys/stat.h>
 
@@ -102,7 +114,8 @@ enum cmd_flags {
 	CMD_FLAG_FORCE_FULL_BACKUP          = (1 << 9),
 	CMD_FLAG_CLOUD_ENABLE               = (1 << 10),
 	CMD_FLAG_CLOUD_DISABLE              = (1 << 11),
-	CMD_FLAG_RESTORE_SKIP_APPS          = (1 << 12)
+	CMD_FLAG_RESTORE_SKIP_APPS          = (1 << 12),
+	CMD_FLAG_DEDUP                      = (1 << 13)
 };
 
 static int backup_domain_changed = 0;
@@ -634,6 +647,15 @@ static int mb2_status_check_snapshot_state(const char *path, const char *udid, c
 	return ret;
 }
 
+static void print_service_start_error(service_start_request_t *request)
+{
+	if (request->lockdown_error != LOCKDOWN_E_SUCCESS) {
+		printf("ERROR: Could not start service %s: %s\n", request->service_name, lockdownd_strerror(request->lockdown_error));
+	} else {
+		printf("ERROR: Could not connect to service %s: error %d\n", request->service_name, request->error_code);
+	}
+}
+
 static void do_post_notification(idevice_t device, const char *notification)
 {
 	lockdownd_service_descriptor_t service = NULL;
@@ -767,6 +789,548 @@ static int errno_to_device_error(int errno_value)
 	}
 }
 
+/*
+ * Backup scheduler: with "backup --all" the process backs up every
+ * connected device.  It forks one child per device, and each child
+ * continues as a normal single device backup with its output going to
+ * DIRECTORY/UDID.log.  The children share a small anonymous mapping that
+ * holds a token bucket limiting the combined write rate to the backup
+ * filesystem (--limit) and per child byte counters.  The parent samples
+ * the counters, reports the aggregate throughput, and adjusts how many
+ * backups run at once: it adds one more while that still raises the
+ * throughput, and backs off when the throughput drops, which is what
+ * happens once the disk or the USB bus is saturated.
+ */
+#define SCHED_INTERVAL_MS 1000
+#define SCHED_ADAPT_SAMPLES 8
+#define SCHED_MAX_JOBS_DEFAULT 4
+
+#ifndef _WIN32
+struct mb2_sched_shared {
+	pthread_mutex_t lock;
+	double rate;		/* bytes per second, 0 for unlimited */
+	double tokens;
+	double last_refill;
+	uint64_t bytes[];	/* bytes received, per device */
+};
+
+static struct mb2_sched_shared *sched = NULL;
+static int sched_slot = -1;
+
+static double mb2_sched_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+#endif
+
+/* called from the receive path of a scheduled child for every block written */
+static void mb2_sched_account(uint32_t length)
+{
+#ifndef _WIN32
+	double wait = 0;
+
+	if (!sched || sched_slot < 0) {
+		return;
+	}
+	pthread_mutex_lock(&sched->lock);
+	sched->bytes[sched_slot] += length;
+	if (sched->rate > 0) {
+		double now = mb2_sched_now();
+		sched->tokens += (now - sched->last_refill) * sched->rate;
+		/* allow bursts of up to a quarter second */
+		if (sched->tokens > sched->rate / 4) {
+			sched->tokens = sched->rate / 4;
+		}
+		sched->last_refill = now;
+		sched->tokens -= length;
+		if (sched->tokens < 0) {
+			wait = -sched->tokens / sched->rate;
+		}
+	}
+	pthread_mutex_unlock(&sched->lock);
+	if (wait > 0) {
+		usleep((useconds_t)(wait * 1000000));
+	}
+#endif
+}
+
+/*
+ * Runs the scheduler.  Returns in each child with *child_udid set to the
+ * device it has to back up, and in the parent once all backups are done.
+ */
+static int mb2_sched_run(const char *backup_dir, int use_network, unsigned int max_jobs, double limit_mbps, char **child_udid)
+{
+#ifdef _WIN32
+	fprintf(stderr, "ERROR: --all is not supported on this platform.\n");
+	return -1;
+#else
+	idevice_info_t *dev_list = NULL;
+	int dev_count = 0;
+	char **udids = NULL;
+	unsigned int count = 0;
+	unsigned int i;
+	int res = 0;
+
+	*child_udid = NULL;
+
+	if (idevice_get_device_list_extended(&dev_list, &dev_count) != IDEVICE_E_SUCCESS) {
+		fprintf(stderr, "ERROR: Unable to retrieve device list!\n");
+		return -1;
+	}
+	udids = calloc(dev_count + 1, sizeof(char*));
+	if (!udids) {
+		fprintf(stderr, "ERROR: Out of memory for the device list!\n");
+		idevice_device_list_extended_free(dev_list);
+		return -1;
+	}
+	for (i = 0; i < (unsigned int)dev_count; i++) {
+		unsigned int j;
+		if (dev_list[i]->conn_type == CONNECTION_NETWORK && !use_network) {
+			continue;
+		}
+		for (j = 0; j < count; j++) {
+			if (!strcmp(udids[j], dev_list[i]->udid)) break;
+		}
+		if (j == count) {
+			udids[count++] = strdup(dev_list[i]->udid);
+		}
+	}
+	idevice_device_list_extended_free(dev_list);
+	if (count == 0) {
+		printf("No device found.\n");
+		free(udids);
+		return -1;
+	}
+
+	size_t shared_size = sizeof(struct mb2_sched_shared) + count * sizeof(uint64_t);
+	sched = mmap(NULL, shared_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (sched == MAP_FAILED) {
+		fprintf(stderr, "ERROR: Could not set up shared scheduler state: %s\n", strerror(errno));
+		sched = NULL;
+		for (i = 0; i < count; i++) {
+			free(udids[i]);
+		}
+		free(udids);
+		return -1;
+	}
+	memset(sched, 0, shared_size);
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutex_init(&sched->lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+	sched->rate = limit_mbps * 1000000.0;
+	sched->last_refill = mb2_sched_now();
+
+	pid_t *pids = calloc(count, sizeof(pid_t));
+	int *status = calloc(count, sizeof(int));
+	double *level_rate = calloc(max_jobs + 1, sizeof(double));
+	if (!pids || !status || !level_rate) {
+		fprintf(stderr, "ERROR: Out of memory for the scheduler state!\n");
+		res = -1;
+		goto leave;
+	}
+	unsigned int next = 0;
+	unsigned int running = 0;
+	unsigned int finished = 0;
+	unsigned int failed = 0;
+	unsigned int allowed = 1;
+	unsigned int ceiling = max_jobs;
+	unsigned int samples = 0;
+	double window_bytes = 0;
+	uint64_t last_total = 0;
+	double start = mb2_sched_now();
+	double last = start;
+
+	PRINT_VERBOSE(1, "Backing up %u devices, at most %u at a time.\n", count, max_jobs);
+
+	while (finished < count) {
+		/* start backups as long as slots are available */
+		while (!quit_flag && running < allowed && next < count) {
+			char *logpath = string_concat(backup_dir, "/", udids[next], ".log", NULL);
+			fflush(stdout);
+			fflush(stderr);
+			pid_t pid = fork();
+			if (pid == 0) {
+				int fd = open(logpath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+				if (fd >= 0) {
+					dup2(fd, STDOUT_FILENO);
+					dup2(fd, STDERR_FILENO);
+					close(fd);
+				}
+				free(logpath);
+				sched_slot = next;
+				*child_udid = strdup(udids[next]);
+				for (i = 0; i < count; i++) {
+					free(udids[i]);
+				}
+				free(udids);
+				free(pids);
+				free(status);
+				free(level_rate);
+				return 0;
+			}
+			free(logpath);
+			if (pid < 0) {
+				fprintf(stderr, "ERROR: Could not start backup of %s: %s\n", udids[next], strerror(errno));
+				status[next] = -1;
+				failed++;
+				finished++;
+			} else {
+				PRINT_VERBOSE(1, "Starting backup of %s (log: %s.log)\n", udids[next], udids[next]);
+				pids[next] = pid;
+				running++;
+			}
+			next++;
+		}
+		if (quit_flag && next < count) {
+			/* do not start anything else */
+			for (; next < count; next++) {
+				status[next] = -1;
+				failed++;
+				finished++;
+			}
+		}
+		if (finished >= count) {
+			break;
+		}
+
+		usleep(SCHED_INTERVAL_MS * 1000);
+
+		/* collect finished backups */
+		pid_t pid;
+		int wstatus = 0;
+		while ((pid = waitpid(-1, &wstatus, WNOHANG)) > 0) {
+			for (i = 0; i < count; i++) {
+				if (pids[i] == pid) break;
+			}
+			if (i == count) continue;
+			pids[i] = 0;
+			status[i] = (WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0) ? 0 : -1;
+			if (status[i] != 0) {
+				failed++;
+			}
+			running--;
+			finished++;
+			PRINT_VERBOSE(1, "Backup of %s %s.\n", udids[i], (status[i] == 0) ? "finished" : "FAILED");
+		}
+
+		/* measure the aggregate throughput */
+		double now = mb2_sched_now();
+		uint64_t total = 0;
+		pthread_mutex_lock(&sched->lock);
+		for (i = 0; i < count; i++) {
+			total += sched->bytes[i];
+		}
+		pthread_mutex_unlock(&sched->lock);
+		double rate = (total - last_total) / (now - last);
+		last_total = total;
+		last = now;
+		PRINT_VERBOSE(1, "%u running, %u of %u done: %.1f MB/s\n", running, finished, count, rate / 1000000.0);
+
+		/* adapt the number of concurrent backups */
+		if (running < allowed || next >= count) {
+			samples = 0;
+			window_bytes = 0;
+			continue;
+		}
+		window_bytes += rate;
+		if (++samples < SCHED_ADAPT_SAMPLES) {
+			continue;
+		}
+		level_rate[allowed] = window_bytes / samples;
+		samples = 0;
+		window_bytes = 0;
+		if (allowed > 1 && level_rate[allowed] < level_rate[allowed-1] * 0.9) {
+			/* more concurrency made it slower: back off and stay below */
+			ceiling = allowed - 1;
+			allowed--;
+			PRINT_VERBOSE(1, "Throughput dropped, running at most %u backups at a time.\n", allowed);
+		} else if (allowed < ceiling && (allowed == 1 || level_rate[allowed] > level_rate[allowed-1] * 1.1)) {
+			allowed++;
+			PRINT_VERBOSE(1, "Throughput still scaling, running up to %u backups at a time.\n", allowed);
+		}
+	}
+
+	/* wait for backups still running after an abort */
+	for (i = 0; i < count; i++) {
+		if (pids[i] > 0) {
+			int wstatus = 0;
+			waitpid(pids[i], &wstatus, 0);
+			if (!(WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0)) {
+				status[i] = -1;
+				failed++;
+			}
+		}
+	}
+
+	double elapsed = mb2_sched_now() - start;
+	PRINT_VERBOSE(1, "Backed up %u of %u devices, %.1f MB in %.0f s (%.1f MB/s).\n", count - failed, count, last_total / 1000000.0, elapsed, (elapsed > 0) ? last_total / 1000000.0 / elapsed : 0);
+	if (failed > 0) {
+		for (i = 0; i < count; i++) {
+			if (status[i] != 0) {
+				printf("Backup of %s failed, see %s.log\n", udids[i], udids[i]);
+			}
+		}
+		res = -1;
+	}
+
+leave:
+	for (i = 0; i < count; i++) {
+		free(udids[i]);
+	}
+	free(udids);
+	free(pids);
+	free(status);
+	free(level_rate);
+	munmap(sched, shared_size);
+	sched = NULL;
+	return res;
+#endif
+}
+
+/* deduplicating content store, see mb2_store.h */
+static char *dedup_store = NULL;
+static unsigned int dedup_files = 0;
+static uint64_t dedup_bytes = 0;
+
+static void mb2_dedup_ingest(const char *path, const unsigned char *hash, uint64_t size)
+{
+	int res = mb2_store_ingest(dedup_store, path, hash, size);
+	if (res == 1) {
+		dedup_files++;
+		dedup_bytes += size;
+	} else if (res < 0) {
+		PRINT_VERBOSE(2, "Could not add '%s' to store: %s\n", path, strerror(errno));
+	}
+}
+
+static void mb2_dedup_prune(void)
+{
+	unsigned int pruned;
+
+	if (!dedup_store) {
+		return;
+	}
+	pruned = mb2_store_prune(dedup_store);
+	if (pruned > 0) {
+		PRINT_VERBOSE(1, "Pruned %u unreferenced objects from store.\n", pruned);
+	}
+}
+
+/*
+ * Transfer journal: files are received into <name>.partial and renamed
+ * into place once the device signals the end of the file.  Every file is
+ * recorded as begun (B) and, after it has been renamed, as completed (C)
+ * together with its size.  Completed records are batched and written
+ * only after the data of those files has been flushed to disk with a
+ * single filesystem-wide sync, followed by a flush of the journal itself.
+ * Where no such sync exists (Windows), the data is only handed to the OS,
+ * which covers interrupted transfers and crashes but not power loss.  When a backup is started after an
+ * interrupted one, files that were begun but not durably completed are
+ * removed, so the device sees exactly the files that are intact and
+ * sends the rest again.  The journal is removed once a backup finishes.
+ */
+#define JOURNAL_SYNC_FILES 256
+#define JOURNAL_SYNC_BYTES (64 * 1024 * 1024)
+#define PARTIAL_SUFFIX ".partial"
+
+static FILE *journal = NULL;
+static char *journal_path = NULL;
+static const char *journal_root = NULL;
+static struct entry *journal_pending = NULL;
+static unsigned int journal_pending_count = 0;
+static uint64_t journal_pending_bytes = 0;
+
+static int mb2_is_temp_name(const char *name)
+{
+	size_t len = strlen(name);
+	if (len > strlen(PARTIAL_SUFFIX) && !strcmp(name + len - strlen(PARTIAL_SUFFIX), PARTIAL_SUFFIX)) {
+		return 1;
+	}
+	if (len > strlen(MB2_STORE_TEMP_SUFFIX) && !strcmp(name + len - strlen(MB2_STORE_TEMP_SUFFIX), MB2_STORE_TEMP_SUFFIX)) {
+		return 1;
+	}
+	return 0;
+}
+
+static void mb2_sync_file(FILE *f)
+{
+	fflush(f);
+#ifdef _WIN32
+	_commit(fileno(f));
+#else
+	fsync(fileno(f));
+#endif
+}
+
+/* flush everything written to the filesystem holding the backup */
+static void mb2_sync_filesystem(const char *dir)
+{
+#if defined(HAVE_SYNCFS)
+	int fd = open(dir, O_RDONLY);
+	if (fd >= 0) {
+		if (syncfs(fd) == 0) {
+			close(fd);
+			return;
+		}
+		close(fd);
+	}
+	sync();
+#elif !defined(_WIN32)
+	sync();
+#endif
+}
+
+static void mb2_journal_checkpoint(void)
+{
+	struct entry *ent;
+
+	if (!journal) {
+		return;
+	}
+	/* data first, then the records that claim it is there */
+	if (journal_pending) {
+		mb2_sync_filesystem(journal_root);
+	}
+	ent = journal_pending;
+	while (ent) {
+		struct entry *del = ent;
+		fprintf(journal, "C %s\n", ent->name);
+		free(ent->name);
+		ent = ent->next;
+		free(del);
+	}
+	journal_pending = NULL;
+	journal_pending_count = 0;
+	journal_pending_bytes = 0;
+	mb2_sync_file(journal);
+}
+
+static void mb2_journal_begin(const char *path)
+{
+	if (journal) {
+		fprintf(journal, "B %s\n", path);
+	}
+}
+
+static void mb2_journal_complete(const char *path, uint64_t size)
+{
+	if (!journal) {
+		return;
+	}
+	struct entry *ent = malloc(sizeof(struct entry));
+	if (!ent) {
+		return;
+	}
+	ent->name = strdup(path);
+	ent->next = journal_pending;
+	journal_pending = ent;
+	journal_pending_count++;
+	journal_pending_bytes += size;
+	if (journal_pending_count >= JOURNAL_SYNC_FILES || journal_pending_bytes >= JOURNAL_SYNC_BYTES) {
+		mb2_journal_checkpoint();
+	}
+}
+
+/* clean up after an interrupted run, compact the journal and reopen it */
+static void mb2_journal_open(const char *backup_dir, const char *udid)
+{
+	char line[4096 + 8];
+	unsigned int resumed = 0;
+	unsigned int discarded = 0;
+	plist_t files = plist_new_dict();
+
+	journal_root = backup_dir;
+	journal_path = string_concat(backup_dir, "/", udid, ".journal", NULL);
+
+	FILE *f = fopen(journal_path, "r");
+	if (f) {
+		char *tmp_path = string_concat(journal_path, ".tmp", NULL);
+		FILE *compact = fopen(tmp_path, "w");
+
+		while (fgets(line, sizeof(line), f)) {
+			size_t len = strlen(line);
+			if (len < 3 || line[len-1] != '\n' || line[1] != ' ') {
+				/* torn write at the end of the journal */
+				continue;
+			}
+			line[len-1] = '\0';
+			if (line[0] == 'B') {
+				plist_dict_set_item(files, line + 2, plist_new_bool(0));
+			} else if (line[0] == 'C') {
+				plist_dict_set_item(files, line + 2, plist_new_bool(1));
+			}
+		}
+		fclose(f);
+
+		plist_dict_iter iter = NULL;
+		plist_dict_new_iter(files, &iter);
+		if (iter) {
+			char *key = NULL;
+			plist_t node = NULL;
+			do {
+				key = NULL;
+				node = NULL;
+				plist_dict_next_item(files, iter, &key, &node);
+				if (key) {
+					uint8_t done = 0;
+					plist_get_bool_val(node, &done);
+					if (done) {
+						if (compact) {
+							fprintf(compact, "C %s\n", key);
+						}
+						resumed++;
+					} else {
+						char *path = string_build_path(backup_dir, key, NULL);
+						char *partial = string_concat(path, PARTIAL_SUFFIX, NULL);
+						remove_file(partial);
+						remove_file(path);
+						free(partial);
+						free(path);
+						discarded++;
+					}
+					free(key);
+				}
+			} while (node);
+			free(iter);
+		}
+		if (compact) {
+			mb2_sync_file(compact);
+			fclose(compact);
+			if (rename(tmp_path, journal_path) < 0) {
+				remove_file(tmp_path);
+			}
+		}
+		free(tmp_path);
+		PRINT_VERBOSE(1, "Resuming interrupted backup: keeping %u received files, discarding %u incomplete ones.\n", resumed, discarded);
+	}
+	plist_free(files);
+
+	journal = fopen(journal_path, "a");
+	if (!journal) {
+		printf("WARNING: Could not open transfer journal '%s': %s\n", journal_path, strerror(errno));
+	}
+}
+
+static void mb2_journal_close(int finished)
+{
+	if (journal) {
+		mb2_journal_checkpoint();
+		fclose(journal);
+		journal = NULL;
+	}
+	if (journal_path) {
+		if (finished) {
+			remove_file(journal_path);
+		}
+		free(journal_path);
+		journal_path = NULL;
+	}
+}
+
 static int mb2_handle_send_file(mobilebackup2_client_t mobilebackup2, const char *backup_dir, const char *path, plist_t *errplist)
 {
 	uint32_t nlen = 0;
@@ -1026,6 +1590,7 @@ static int mb2_handle_receive_files(mobilebackup2_client_t mobilebackup2, plist_
 	char *fname = NULL;
 	char *dname = NULL;
 	char *bname = NULL;
+	char *pname = NULL;
 	char code = 0;
 	char last_code = 0;
 	plist_t node = NULL;
@@ -1033,6 +1598,9 @@ static int mb2_handle_receive_files(mobilebackup2_client_t mobilebackup2, plist_
 	unsigned int file_count = 0;
 	int errcode = 0;
 	char *errdesc = NULL;
+	sha256_context sha;
+	unsigned char hash[MB2_STORE_HASH_LEN];
+	uint64_t fsize = 0;
 
 	if (!message || (plist_get_node_type(message) != PLIST_ARRAY) || plist_array_get_size(message) < 4 || !backup_dir) return 0;
 
@@ -1062,13 +1630,14 @@ static int mb2_handle_receive_files(mobilebackup2_client_t mobilebackup2, plist_
 			free(bname);
 			bname = NULL;
 		}
+		if (pname != NULL) {
+			free(pname);
+			pname = NULL;
+		}
 
 		bname = string_build_path(backup_dir, fname, NULL);
-
-		if (fname != NULL) {
-			free(fname);
-			fname = NULL;
-		}
+		pname = string_concat(bname, PARTIAL_SUFFIX, NULL);
+		mb2_journal_begin(fname);
 
 		r = 0;
 		nlen = 0;
@@ -1093,8 +1662,12 @@ static int mb2_handle_receive_files(mobilebackup2_client_t mobilebackup2, plist_
 			PRINT_VERBOSE(1, "Found new flag %02x\n", code);
 		}
 
-		remove_file(bname);
-		f = fopen(bname, "wb");
+		remove_file(pname);
+		f = fopen(pname, "wb");
+		fsize = 0;
+		if (dedup_store) {
+			sha256_init(&sha);
+		}
 		while (f && (code == CODE_FILE_DATA)) {
 			blocksize = nlen-1;
 			bdone = 0;
@@ -1110,6 +1683,11 @@ static int mb2_handle_receive_files(mobilebackup2_client_t mobilebackup2, plist_
 					break;
 				}
 				fwrite(buf, 1, r, f);
+				mb2_sched_account(r);
+				if (dedup_store) {
+					sha256_update(&sha, buf, r);
+				}
+				fsize += r;
 				bdone += r;
 			}
 			if (bdone == blocksize) {
@@ -1133,12 +1711,31 @@ static int mb2_handle_receive_files(mobilebackup2_client_t mobilebackup2, plist_
 		if (f) {
 			fclose(f);
 			file_count++;
+			/* the device ended the file with a status code: move it into place */
+			if (!quit_flag && nlen > 0) {
+				if (rename(pname, bname) < 0) {
+					errcode = errno_to_device_error(errno);
+					errdesc = strerror(errno);
+					printf("Error moving '%s' into place: %s\n", bname, errdesc);
+					break;
+				}
+				mb2_journal_complete(fname, fsize);
+				/* only complete, non-empty files go into the store */
+				if (dedup_store && code == CODE_SUCCESS && fsize > 0) {
+					sha256_final(&sha, hash);
+					mb2_dedup_ingest(bname, hash, fsize);
+				}
+			}
 		} else {
 			errcode = errno_to_device_error(errno);
 			errdesc = strerror(errno);
 			printf("Error opening '%s' for writing: %s\n", bname, errdesc);
 			break;
 		}
+		if (fname != NULL) {
+			free(fname);
+			fname = NULL;
+		}
 		if (nlen == 0) {
 			break;
 		}
@@ -1166,13 +1763,18 @@ static int mb2_handle_receive_files(mobilebackup2_client_t mobilebackup2, plist_
 		fname = (char*)malloc(nlen-1);
 		mobilebackup2_receive_raw(mobilebackup2, fname, nlen-1, &r);
 		free(fname);
-		remove_file(bname);
+		remove_file(pname);
 	}
 
 	/* clean up */
 	if (bname != NULL)
 		free(bname);
 
+	if (pname != NULL)
+		free(pname);
+
+	mb2_journal_checkpoint();
+
 	if (dname != NULL)
 		free(dname);
 
@@ -1210,6 +1812,10 @@ static void mb2_handle_list_directory(mobilebackup2_client_t mobilebackup2, plis
 			if ((strcmp(ep->d_name, ".") == 0) || (strcmp(ep->d_name, "..") == 0)) {
 				continue;
 			}
+			/* files still being received are not part of the backup */
+			if (mb2_is_temp_name(ep->d_name)) {
+				continue;
+			}
 			char *fpath = string_build_path(path, ep->d_name, NULL);
 			if (fpath) {
 				plist_t fdict = plist_new_dict();
@@ -1280,6 +1886,14 @@ static void mb2_copy_file_by_path(const char *src, const char *dst)
 	char buf[BUFSIZ];
 	size_t length;
 
+	/* with a store, link instead of copying; never truncate a shared file */
+	if (dedup_store) {
+		if (mb2_store_link_replace(src, dst) == 0) {
+			return;
+		}
+		remove_file(dst);
+	}
+
 	/* open source file */
 	if ((from = fopen(src, "rb")) == NULL) {
 		printf("Cannot open source path '%s'.\n", src);
@@ -1441,6 +2055,11 @@ static void print_usage(int argc, char **argv, int is_error)
 		"CMD:\n"
 		"  backup        create backup for the device\n"
 		"    --full              force full backup from device.\n"
+		"    --dedup             store file contents once in DIRECTORY/.store, shared\n"
+		"                        between all devices backed up to DIRECTORY.\n"
+		"    --all               back up all connected devices concurrently.\n"
+		"    --jobs N            run at most N backups at a time (default: 4).\n"
+		"    --limit MBPS        limit the combined write rate to MBPS megabytes/s.\n"
 		"  restore       restore last backup to the device\n"
 		"    --system            restore system files, too.\n"
 		"    --no-reboot         do NOT reboot the device when done (default: yes).\n"
@@ -1484,7 +2103,6 @@ int main(int argc, char *argv[])
 	char* udid = NULL;
 	char* source_udid = NULL;
 	int use_network = 0;
-	lockdownd_service_descriptor_t service = NULL;
 	int cmd = -1;
 	int cmd_flags = 0;
 	int is_full_backup = 0;
@@ -1497,6 +2115,9 @@ int main(int argc, char *argv[])
 	plist_t node_tmp = NULL;
 	plist_t info_plist = NULL;
 	plist_t opts = NULL;
+	int backup_all = 0;
+	unsigned int max_jobs = SCHED_MAX_JOBS_DEFAULT;
+	double limit_mbps = 0;
 
 	idevice_t device = NULL;
 	afc_client_t afc = NULL;
@@ -1515,6 +2136,10 @@ int main(int argc, char *argv[])
 #define OPT_SKIP_APPS 7
 #define OPT_PASSWORD 8
 #define OPT_FULL 9
+#define OPT_DEDUP 10
+#define OPT_ALL 11
+#define OPT_JOBS 12
+#define OPT_LIMIT 13
 
 	int c = 0;
 	const struct option longopts[] = {
@@ -1535,6 +2160,10 @@ int main(int argc, char *argv[])
 		{ "skip-apps", no_argument, NULL, OPT_SKIP_APPS },
 		{ "password", required_argument, NULL, OPT_PASSWORD },
 		{ "full", no_argument, NULL, OPT_FULL },
+		{ "dedup", no_argument, NULL, OPT_DEDUP },
+		{ "all", no_argument, NULL, OPT_ALL },
+		{ "jobs", required_argument, NULL, OPT_JOBS },
+		{ "limit", required_argument, NULL, OPT_LIMIT },
 		{ NULL, 0, NULL, 0}
 	};
 
@@ -1608,6 +2237,28 @@ int main(int argc, char *argv[])
 		case OPT_FULL:
 			cmd_flags |= CMD_FLAG_FORCE_FULL_BACKUP;
 			break;
+		case OPT_DEDUP:
+			cmd_flags |= CMD_FLAG_DEDUP;
+			break;
+		case OPT_ALL:
+			backup_all = 1;
+			break;
+		case OPT_JOBS:
+			max_jobs = (unsigned int)strtoul(optarg, NULL, 10);
+			if (max_jobs == 0) {
+				fprintf(stderr, "ERROR: Invalid number of jobs '%s'\n", optarg);
+				print_usage(argc, argv, 1);
+				return 2;
+			}
+			break;
+		case OPT_LIMIT:
+			limit_mbps = strtod(optarg, NULL);
+			if (limit_mbps <= 0) {
+				fprintf(stderr, "ERROR: Invalid rate limit '%s'\n", optarg);
+				print_usage(argc, argv, 1);
+				return 2;
+			}
+			break;
 		default:
 			print_usage(argc, argv, 1);
 			return 2;
@@ -1740,6 +2391,39 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if ((cmd_flags & CMD_FLAG_DEDUP) && (cmd == CMD_BACKUP || cmd == CMD_RESTORE)) {
+#ifdef _WIN32
+		fprintf(stderr, "WARNING: --dedup is not supported on this platform, ignoring.\n");
+#else
+		dedup_store = string_build_path(backup_directory, MB2_STORE_DIR, NULL);
+		if (mkdir_with_parents(dedup_store, 0755) < 0) {
+			fprintf(stderr, "ERROR: Could not create store directory \"%s\": %s\n", dedup_store, strerror(errno));
+			free(dedup_store);
+			return -1;
+		}
+#endif
+	}
+
+	if (backup_all) {
+		char *child_udid = NULL;
+		if (cmd != CMD_BACKUP) {
+			fprintf(stderr, "ERROR: --all is only supported for the backup command.\n");
+			return 2;
+		}
+		if (udid || source_udid) {
+			fprintf(stderr, "ERROR: --all cannot be combined with --udid or --source.\n");
+			return 2;
+		}
+		result_code = mb2_sched_run(backup_directory, use_network, max_jobs, limit_mbps, &child_udid);
+		if (!child_udid) {
+			/* parent: all backups are done */
+			free(dedup_store);
+			return result_code;
+		}
+		/* child: continue with a regular backup of the assigned device */
+		udid = child_udid;
+	}
+
 	ret = idevice_new_with_options(&device, udid, (use_network) ? IDEVICE_LOOKUP_NETWORK : IDEVICE_LOOKUP_USBMUX);
 	if (ret != IDEVICE_E_SUCCESS) {
 		if (udid) {
@@ -1860,59 +2544,63 @@ int main(int argc, char *argv[])
 	/* get ProductVersion */
 	int device_version = idevice_get_device_version(device);
 
-	/* start notification_proxy */
-	ldret = lockdownd_start_service(lockdown, NP_SERVICE_NAME, &service);
-	if ((ldret == LOCKDOWN_E_SUCCESS) && service && service->port) {
-		np_client_new(device, service, &np);
-		np_set_notify_callback(np, notify_cb, NULL);
-		const char *noties[7] = {
-			NP_SYNC_CANCEL_REQUEST,
-			NP_SYNC_SUSPEND_REQUEST,
-			NP_SYNC_RESUME_REQUEST,
-			NP_BACKUP_DOMAIN_CHANGED,
-			"com.apple.LocalAuthentication.ui.presented",
-			"com.apple.LocalAuthentication.ui.dismissed",
-			NULL
-		};
-		np_observe_notifications(np, noties);
-	} else {
-		printf("ERROR: Could not start service %s: %s\n", NP_SERVICE_NAME, lockdownd_strerror(ldret));
-		cmd = CMD_LEAVE;
-		goto checkpoint;
-	}
-	if (service) {
-		lockdownd_service_descriptor_free(service);
-		service = NULL;
+	/* start notification_proxy, AFC (we need this for the lock file) and
+	 * mobilebackup2 on the same lockdown session and connect to them at once */
+	service_start_request_t requests[3];
+	unsigned int num_requests = 0;
+	int afc_index = -1;
+	int mb2_index = -1;
+	memset(requests, '\0', sizeof(requests));
+	requests[num_requests].service_name = NP_SERVICE_NAME;
+	requests[num_requests].constructor_func = SERVICE_CONSTRUCTOR(np_client_new);
+	num_requests++;
+	if (cmd == CMD_BACKUP || cmd == CMD_RESTORE) {
+		afc_index = num_requests;
+		requests[num_requests].service_name = AFC_SERVICE_NAME;
+		requests[num_requests].constructor_func = SERVICE_CONSTRUCTOR(afc_client_new);
+		num_requests++;
+	}
+	mb2_index = num_requests;
+	requests[num_requests].service_name = MOBILEBACKUP2_SERVICE_NAME;
+	requests[num_requests].send_escrow_bag = 1;
+	requests[num_requests].constructor_func = SERVICE_CONSTRUCTOR(mobilebackup2_client_new);
+	num_requests++;
+
+	service_client_factory_start_services(device, lockdown, requests, num_requests, TOOL_NAME);
+	lockdownd_client_free(lockdown);
+	lockdown = NULL;
+
+	np = (np_client_t)requests[0].client;
+	if (afc_index >= 0) {
+		afc = (afc_client_t)requests[afc_index].client;
 	}
+	mobilebackup2 = (mobilebackup2_client_t)requests[mb2_index].client;
 
-	if (cmd == CMD_BACKUP || cmd == CMD_RESTORE) {
-		/* start AFC, we need this for the lock file */
-		ldret = lockdownd_start_service(lockdown, AFC_SERVICE_NAME, &service);
-		if ((ldret == LOCKDOWN_E_SUCCESS) && service->port) {
-			afc_client_new(device, service, &afc);
+	if (mobilebackup2) {
+		PRINT_VERBOSE(1, "Started \"%s\" service.\n", MOBILEBACKUP2_SERVICE_NAME);
+
+		if (np) {
+			np_set_notify_callback(np, notify_cb, NULL);
+			const char *noties[7] = {
+				NP_SYNC_CANCEL_REQUEST,
+				NP_SYNC_SUSPEND_REQUEST,
+				NP_SYNC_RESUME_REQUEST,
+				NP_BACKUP_DOMAIN_CHANGED,
+				"com.apple.LocalAuthentication.ui.presented",
+				"com.apple.LocalAuthentication.ui.dismissed",
+				NULL
+			};
+			np_observe_notifications(np, noties);
 		} else {
-			printf("ERROR: Could not start service %s: %s\n", AFC_SERVICE_NAME, lockdownd_strerror(ldret));
+			print_service_start_error(&requests[0]);
 			cmd = CMD_LEAVE;
 			goto checkpoint;
 		}
-	}
 
-	if (service) {
-		lockdownd_service_descriptor_free(service);
-		service = NULL;
-	}
-
-	/* start mobilebackup service and retrieve port */
-	ldret = lockdownd_start_service_with_escrow_bag(lockdown, MOBILEBACKUP2_SERVICE_NAME, &service);
-	lockdownd_client_free(lockdown);
-	lockdown = NULL;
-	if ((ldret == LOCKDOWN_E_SUCCESS) && service && service->port) {
-		PRINT_VERBOSE(1, "Started \"%s\" service on port %d.\n", MOBILEBACKUP2_SERVICE_NAME, service->port);
-		mobilebackup2_client_new(device, service, &mobilebackup2);
-
-		if (service) {
-			lockdownd_service_descriptor_free(service);
-			service = NULL;
+		if (afc_index >= 0 && !afc) {
+			print_service_start_error(&requests[afc_index]);
+			cmd = CMD_LEAVE;
+			goto checkpoint;
 		}
 
 		/* send Hello message */
@@ -2006,6 +2694,8 @@ checkpoint:
 			case CMD_BACKUP:
 			PRINT_VERBOSE(1, "Starting backup...\n");
 
+			mb2_journal_open(backup_directory, udid);
+
 			/* make sure backup device sub-directory exists */
 			char* devbackupdir = string_build_path(backup_directory, source_udid, NULL);
 			__mkdir(devbackupdir, 0755);
@@ -2579,6 +3269,11 @@ files_out:
 				case CMD_BACKUP:
 					PRINT_VERBOSE(1, "Received %d files from device.\n", file_count);
 					if (operation_ok && mb2_status_check_snapshot_state(backup_directory, udid, "finished")) {
+						mb2_journal_close(1);
+						if (dedup_store) {
+							PRINT_VERBOSE(1, "Deduplicated %u files (%llu bytes).\n", dedup_files, (unsigned long long)dedup_bytes);
+							mb2_dedup_prune();
+						}
 						PRINT_VERBOSE(1, "Backup Successful.\n");
 					} else {
 						if (quit_flag) {
@@ -2654,9 +3349,7 @@ files_out:
 				do_post_notification(device, NP_SYNC_DID_FINISH);
 		}
 	} else {
-		printf("ERROR: Could not start service %s: %s\n", MOBILEBACKUP2_SERVICE_NAME, lockdownd_strerror(ldret));
-		lockdownd_client_free(lockdown);
-		lockdown = NULL;
+		print_service_start_error(&requests[mb2_index]);
 	}
 
 	if (lockdown) {
@@ -2695,6 +3388,9 @@ files_out:
 		source_udid = NULL;
 	}
 
+	mb2_journal_close(0);
+	free(dedup_store);
+
 	return result_code;
 }
 
@@ -35,6 +35,7 @@
 #include <getopt.h>
 #include <assert.h>
 #include <fcntl.h>
+#include <sys/time.h>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -46,6 +47,7 @@
 
 #include <libimobiledevice/libimobiledevice.h>
 #include <libimobiledevice/bt_packet_logger.h>
+#include <libimobiledevice-glue/thread.h>
 
 typedef enum {
 	HCI_COMMAND = 0x00,
@@ -65,13 +67,42 @@ static bt_packet_logger_client_t bt_packet_logger = NULL;
 static int use_network = 0;
 static char* out_filename = NULL;
 static char* log_format_string = NULL;
-static FILE * packetlogger_file = NULL;
+static char* replay_filename = NULL;
 
 static enum {
 	LOG_FORMAT_PACKETLOGGER,
-	LOG_FORMAT_PCAP
+	LOG_FORMAT_PCAP,
+	LOG_FORMAT_PCAPNG
 } log_format = LOG_FORMAT_PACKETLOGGER;
 
+/* size of the in-memory buffer packets are collected in before writing */
+#define CAPTURE_BUFFER_SIZE (1024 * 1024)
+/* default maximum time buffered packets are held back, in milliseconds */
+#define DEFAULT_FLUSH_INTERVAL 100
+/* snaplen - max packet size - use 2kB (larger than any ACL) */
+#define CAPTURE_SNAPLEN 0x800
+
+/**
+ * Batched capture writer. Packets are assembled directly in a large buffer
+ * that is written out when it is full or when the flush interval elapsed,
+ * instead of issuing separate writes and a flush for every single packet.
+ */
+static struct {
+	mutex_t lock;
+	FILE *file;
+	unsigned int file_index;
+	uint64_t file_bytes;
+	uint64_t rotate_size;
+	uint8_t *buf;
+	size_t buf_size;
+	size_t buf_used;
+	unsigned int flush_interval;
+	uint64_t last_flush;
+	uint64_t num_packets;
+	uint64_t num_bytes;
+	uint64_t num_flushes;
+} writer = { .flush_interval = DEFAULT_FLUSH_INTERVAL };
+
 const uint8_t pcap_file_header[] = {
 	// Magic Number
 	0xA1, 0xB2, 0xC3, 0xD4,
@@ -82,7 +113,7 @@ const uint8_t pcap_file_header[] = {
 	// Reserved2
 	0x00, 0x00, 0x00, 0x00,
 	// Snaplen == max packet size - use 2kB (larger than any ACL)
-	0x00, 0x00, 0x08, 0x00,
+	0x00, 0x00, (CAPTURE_SNAPLEN >> 8) & 0xFF, CAPTURE_SNAPLEN & 0xFF,
 	// LinkType: DLT_BLUETOOTH_HCI_H4_WITH_PHDR
 	0x00, 0x00, 0x00, 201,
 };
@@ -101,16 +132,229 @@ static void big_endian_store_32(uint8_t * buffer, uint16_t position, uint32_t va
 	buffer[pos++] = (uint8_t)(value);
 }
 
+static void host_store_32(uint8_t * buffer, uint32_t position, uint32_t value)
+{
+	memcpy(buffer + position, &value, sizeof(value));
+}
+
+static void host_store_16(uint8_t * buffer, uint32_t position, uint16_t value)
+{
+	memcpy(buffer + position, &value, sizeof(value));
+}
+
+static uint64_t get_time_ms(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+/**
+ * Build the file name of the given output file index. The first file uses
+ * the name passed on the command line, subsequent files get the index
+ * appended like FILE1, FILE2, ...
+ */
+static char* capture_file_name(unsigned int index)
+{
+	char *name = NULL;
+	if (index == 0) {
+		return strdup(out_filename);
+	}
+	size_t len = strlen(out_filename) + 12;
+	name = malloc(len);
+	snprintf(name, len, "%s%u", out_filename, index);
+	return name;
+}
+
+/**
+ * Write out all buffered data. Must be called with writer.lock held.
+ */
+static void capture_flush_locked(void)
+{
+	if (writer.buf_used > 0 && writer.file) {
+		(void) fwrite(writer.buf, 1, writer.buf_used, writer.file);
+		(void) fflush(writer.file);
+		writer.num_flushes++;
+	}
+	writer.buf_used = 0;
+	writer.last_flush = get_time_ms();
+}
+
+static void capture_flush(void)
+{
+	mutex_lock(&writer.lock);
+	capture_flush_locked();
+	mutex_unlock(&writer.lock);
+}
+
+/**
+ * Flush buffered data if the flush interval elapsed.
+ */
+static void capture_flush_if_due(void)
+{
+	mutex_lock(&writer.lock);
+	if (writer.buf_used > 0 && get_time_ms() - writer.last_flush >= writer.flush_interval) {
+		capture_flush_locked();
+	}
+	mutex_unlock(&writer.lock);
+}
+
+static uint8_t* capture_reserve(size_t len);
+
+/**
+ * Write the file header for the selected log format into the writer buffer.
+ */
+static void capture_write_file_header(void)
+{
+	uint8_t *p;
+	switch (log_format) {
+		case LOG_FORMAT_PCAP:
+			p = capture_reserve(sizeof(pcap_file_header));
+			memcpy(p, pcap_file_header, sizeof(pcap_file_header));
+			break;
+		case LOG_FORMAT_PCAPNG:
+			// Section Header Block
+			p = capture_reserve(28);
+			host_store_32(p, 0, 0x0A0D0D0A);   // Block Type
+			host_store_32(p, 4, 28);           // Block Total Length
+			host_store_32(p, 8, 0x1A2B3C4D);   // Byte-Order Magic
+			host_store_16(p, 12, 1);           // Major Version
+			host_store_16(p, 14, 0);           // Minor Version
+			host_store_32(p, 16, 0xFFFFFFFF);  // Section Length: unspecified
+			host_store_32(p, 20, 0xFFFFFFFF);
+			host_store_32(p, 24, 28);          // Block Total Length
+			// Interface Description Block
+			p = capture_reserve(20);
+			host_store_32(p, 0, 0x00000001);   // Block Type
+			host_store_32(p, 4, 20);           // Block Total Length
+			host_store_16(p, 8, 201);          // LinkType: DLT_BLUETOOTH_HCI_H4_WITH_PHDR
+			host_store_16(p, 10, 0);           // Reserved
+			host_store_32(p, 12, CAPTURE_SNAPLEN); // SnapLen
+			host_store_32(p, 16, 20);          // Block Total Length
+			break;
+		case LOG_FORMAT_PACKETLOGGER:
+		default:
+			break;
+	}
+}
+
+/**
+ * Open the output file with the given index and write the file header.
+ * Must be called with writer.lock held.
+ */
+static int capture_open_file(unsigned int index)
+{
+	if (strcmp(out_filename, "-") == 0) {
+		writer.file = stdout;
+	} else {
+		char *name = capture_file_name(index);
+		writer.file = fopen(name, "wb");
+		if (!writer.file) {
+			fprintf(stderr, "Failed to open file %s, errno = %d\n", name, errno);
+			free(name);
+			return -1;
+		}
+		free(name);
+	}
+	writer.file_index = index;
+	writer.file_bytes = 0;
+	capture_write_file_header();
+	return 0;
+}
+
+/**
+ * Close the current output file and continue with the next one.
+ * Must be called with writer.lock held.
+ */
+static void capture_rotate_file(void)
+{
+	capture_flush_locked();
+	if (writer.file && writer.file != stdout) {
+		fclose(writer.file);
+	}
+	writer.file = NULL;
+	if (capture_open_file(writer.file_index + 1) < 0) {
+		quit_flag++;
+	}
+}
+
+/**
+ * Reserve len bytes in the writer buffer, flushing or rotating the output
+ * file first if required. Must be called with writer.lock held.
+ *
+ * @return Pointer into the writer buffer where len bytes can be stored.
+ */
+static uint8_t* capture_reserve(size_t len)
+{
+	if (writer.rotate_size > 0 && writer.file_bytes > 0 && writer.file_bytes + len > writer.rotate_size) {
+		capture_rotate_file();
+	}
+	if (writer.buf_used + len > writer.buf_size) {
+		capture_flush_locked();
+		if (len > writer.buf_size) {
+			writer.buf = realloc(writer.buf, len);
+			writer.buf_size = len;
+		}
+	}
+	uint8_t *p = writer.buf + writer.buf_used;
+	writer.buf_used += len;
+	writer.file_bytes += len;
+	return p;
+}
+
+static int capture_init(void)
+{
+	mutex_init(&writer.lock);
+	writer.buf_size = CAPTURE_BUFFER_SIZE;
+	writer.buf = malloc(writer.buf_size);
+	if (!writer.buf) {
+		return -1;
+	}
+	writer.buf_used = 0;
+	writer.last_flush = get_time_ms();
+	return capture_open_file(0);
+}
+
+static void capture_close(void)
+{
+	mutex_lock(&writer.lock);
+	capture_flush_locked();
+	if (writer.file && writer.file != stdout) {
+		fclose(writer.file);
+	}
+	writer.file = NULL;
+	free(writer.buf);
+	writer.buf = NULL;
+	mutex_unlock(&writer.lock);
+	mutex_destroy(&writer.lock);
+}
+
+/**
+ * Finish a packet that has been stored in the writer buffer.
+ * Must be called with writer.lock held.
+ */
+static void capture_packet_done(uint32_t len)
+{
+	writer.num_packets++;
+	writer.num_bytes += len;
+	if (writer.flush_interval == 0 || get_time_ms() - writer.last_flush >= writer.flush_interval) {
+		capture_flush_locked();
+	}
+}
+
 /**
  * Callback from the packet logger service to handle packets and log to PacketLogger format
  */
 static void bt_packet_logger_callback_packetlogger(uint8_t * data, uint16_t len, void *user_data)
 {
-	(void) fwrite(data, 1, len, packetlogger_file);
+	mutex_lock(&writer.lock);
+	memcpy(capture_reserve(len), data, len);
+	capture_packet_done(len);
+	mutex_unlock(&writer.lock);
 }
 
 /**
- * Callback from the packet logger service to handle packets and log to pcap
+ * Callback from the packet logger service to handle packets and log to pcap or pcapng
  */
 static void bt_packet_logger_callback_pcap(uint8_t * data, uint16_t len, void *user_data)
 {
@@ -159,23 +403,99 @@ static void bt_packet_logger_callback_pcap(uint8_t * data, uint16_t len, void *u
 			return;
 	}
 
-	// setup pcap record header, 4 byte direction flag, 1 byte HCI H4 packet type, data
-	uint8_t pcap_record_header[21];
-	big_endian_store_32(pcap_record_header,  0, ts_secs);       // Timestamp seconds
-	big_endian_store_32(pcap_record_header,  4, ts_us);         // Timestamp microseconds
-	big_endian_store_32(pcap_record_header,  8, 4 + 1 + len);   // Captured  Packet Length
-	big_endian_store_32(pcap_record_header, 12, 4 + 1 + len);   // Original Packet Length
-	big_endian_store_32(pcap_record_header, 16, direction_in);  // Direction: Incoming = 1
-	pcap_record_header[20] = hci_h4_type;
-
-	// write header
-	(void) fwrite(pcap_record_header, 1, sizeof(pcap_record_header), packetlogger_file);
+	// packet data: 4 byte direction flag, 1 byte HCI H4 packet type, data
+	uint32_t caplen = 4 + 1 + len;
+	uint8_t *p;
+
+	mutex_lock(&writer.lock);
+	if (log_format == LOG_FORMAT_PCAPNG) {
+		// Enhanced Packet Block, packet data padded to 32 bits
+		uint32_t padded = (caplen + 3) & ~3;
+		uint32_t block_len = 28 + padded + 4;
+		uint64_t ts = (uint64_t)ts_secs * 1000000 + ts_us;
+		p = capture_reserve(block_len);
+		host_store_32(p,  0, 0x00000006);          // Block Type
+		host_store_32(p,  4, block_len);           // Block Total Length
+		host_store_32(p,  8, 0);                   // Interface ID
+		host_store_32(p, 12, (uint32_t)(ts >> 32)); // Timestamp (High)
+		host_store_32(p, 16, (uint32_t)ts);        // Timestamp (Low)
+		host_store_32(p, 20, caplen);              // Captured Packet Length
+		host_store_32(p, 24, caplen);              // Original Packet Length
+		p += 28;
+		memset(p + caplen, 0, padded - caplen);
+		host_store_32(p, padded, block_len);       // Block Total Length
+	} else {
+		// setup pcap record header
+		p = capture_reserve(16 + caplen);
+		big_endian_store_32(p,  0, ts_secs);       // Timestamp seconds
+		big_endian_store_32(p,  4, ts_us);         // Timestamp microseconds
+		big_endian_store_32(p,  8, caplen);        // Captured  Packet Length
+		big_endian_store_32(p, 12, caplen);        // Original Packet Length
+		p += 16;
+	}
+	big_endian_store_32(p, 0, direction_in);  // Direction: Incoming = 1
+	p[4] = hci_h4_type;
+	memcpy(p + 5, data, len);
+	capture_packet_done(caplen);
+	mutex_unlock(&writer.lock);
+}
 
-	// write packet
-	(void) fwrite(data, 1, len, packetlogger_file);
+static bt_packet_logger_receive_cb_t get_packet_callback(void)
+{
+	switch (log_format){
+		case LOG_FORMAT_PCAP:
+		case LOG_FORMAT_PCAPNG:
+			return bt_packet_logger_callback_pcap;
+		case LOG_FORMAT_PACKETLOGGER:
+			return bt_packet_logger_callback_packetlogger;
+		default:
+			assert(0);
+			break;
+	}
+	return NULL;
+}
 
-	// flush
-	(void) fflush(packetlogger_file);
+/**
+ * Replay a recorded PacketLogger file through the capture writer and report
+ * the achieved throughput.
+ */
+static int replay_capture(const char* filename)
+{
+	FILE *f = fopen(filename, "rb");
+	if (!f) {
+		fprintf(stderr, "Failed to open file %s, errno = %d\n", filename, errno);
+		return -1;
+	}
+	bt_packet_logger_receive_cb_t callback = get_packet_callback();
+	uint8_t *packet = malloc(BT_MAX_PACKET_SIZE);
+	uint64_t start = get_time_ms();
+	while (!quit_flag) {
+		/* each record starts with the big endian length of the rest of the record */
+		if (fread(packet, 1, 4, f) != 4) {
+			break;
+		}
+		uint32_t len = big_endian_read_32(packet, 0);
+		if (len < 9 || len > BT_MAX_PACKET_SIZE - 4) {
+			fprintf(stderr, "Invalid record length %u, stopping replay\n", len);
+			break;
+		}
+		if (fread(packet + 4, 1, len, f) != len) {
+			fprintf(stderr, "Truncated record, stopping replay\n");
+			break;
+		}
+		callback(packet, (uint16_t)(len + 4), NULL);
+	}
+	capture_flush();
+	uint64_t elapsed = get_time_ms() - start;
+	free(packet);
+	fclose(f);
+
+	double secs = (elapsed > 0) ? (double)elapsed / 1000.0 : 0.001;
+	fprintf(stderr, "Replayed %llu packets (%llu bytes) in %.3f s: %.0f packets/s, %.2f MB/s, %llu flushes\n",
+		(unsigned long long)writer.num_packets, (unsigned long long)writer.num_bytes, secs,
+		(double)writer.num_packets / secs, (double)writer.num_bytes / secs / 1000000.0,
+		(unsigned long long)writer.num_flushes);
+	return 0;
 }
 
 /**
@@ -183,13 +503,13 @@ static void bt_packet_logger_callback_pcap(uint8_t * data, uint16_t len, void *u
  */
 static void stop_logging(void)
 {
-	fflush(NULL);
-
 	if (bt_packet_logger) {
 		bt_packet_logger_client_free(bt_packet_logger);
 		bt_packet_logger = NULL;
 	}
 
+	capture_flush();
+
 	if (device) {
 		idevice_free(device);
 		device = NULL;
@@ -220,19 +540,7 @@ static int start_logging(void)
 	bt_packet_logger_client_start_service(device, &bt_packet_logger, TOOL_NAME);
 
 	/* start capturing bt_packet_logger */
-	void (*callback)(uint8_t * data, uint16_t len, void *user_data);
-	switch (log_format){
-		case LOG_FORMAT_PCAP:
-			callback = bt_packet_logger_callback_pcap;
-			break;
-		case LOG_FORMAT_PACKETLOGGER:
-			callback = bt_packet_logger_callback_packetlogger;
-			break;
-		default:
-			assert(0);
-			return 0;
-	}
-	bt_packet_logger_error_t serr = bt_packet_logger_start_capture(bt_packet_logger, callback, NULL);
+	bt_packet_logger_error_t serr = bt_packet_logger_start_capture(bt_packet_logger, get_packet_callback(), NULL);
 	if (serr != BT_PACKET_LOGGER_E_SUCCESS) {
 		fprintf(stderr, "ERROR: Unable to start capturing bt_packet_logger.\n");
 		bt_packet_logger_client_free(bt_packet_logger);
@@ -304,8 +612,15 @@ static void print_usage(int argc, char **argv, int is_error)
 		"OPTIONS:\n" \
 		"  -u, --udid UDID     target specific device by UDID\n" \
 		"  -n, --network       connect to network device\n" \
-		"  -f, --format FORMAT logging format: packetlogger (default) or pcap\n" \
+		"  -f, --format FORMAT logging format: packetlogger (default), pcap or pcapng\n" \
 		"  -x, --exit          exit when device disconnects\n" \
+		"  -i, --flush-interval MS  maximum time in milliseconds packets are buffered\n" \
+		"                      before they are written out (default: 100, 0 writes\n" \
+		"                      every packet immediately)\n" \
+		"  -C, --rotate SIZE   start a new output file after SIZE megabytes; files are\n" \
+		"                      named FILE, FILE1, FILE2, ...\n" \
+		"  -r, --replay PKLG   convert a recorded PacketLogger file instead of capturing\n" \
+		"                      from a device and report the throughput\n" \
 		"  -h, --help          prints usage information\n" \
 		"  -d, --debug         enable communication debugging\n" \
 		"  -v, --version       prints version information\n" \
@@ -328,6 +643,9 @@ int main(int argc, char *argv[])
 		{ "format", required_argument, NULL, 'f' },
 		{ "network", no_argument, NULL, 'n' },
 		{ "exit", no_argument, NULL, 'x' },
+		{ "flush-interval", required_argument, NULL, 'i' },
+		{ "rotate", required_argument, NULL, 'C' },
+		{ "replay", required_argument, NULL, 'r' },
 		{ "version", no_argument, NULL, 'v' },
 		{ NULL, 0, NULL, 0}
 	};
@@ -339,7 +657,7 @@ int main(int argc, char *argv[])
 	signal(SIGPIPE, SIG_IGN);
 #endif
 
-	while ((c = getopt_long(argc, argv, "dhu:f:nxv", longopts, NULL)) != -1) {
+	while ((c = getopt_long(argc, argv, "dhu:f:nxi:C:r:v", longopts, NULL)) != -1) {
 		switch (c) {
 		case 'd':
 			idevice_set_debug_level(1);
@@ -368,6 +686,26 @@ int main(int argc, char *argv[])
 		case 'x':
 			exit_on_disconnect = 1;
 			break;
+		case 'i':
+			writer.flush_interval = (unsigned int)strtoul(optarg, NULL, 10);
+			break;
+		case 'C':
+			writer.rotate_size = strtoull(optarg, NULL, 10) * 1000000;
+			if (writer.rotate_size == 0) {
+				fprintf(stderr, "ERROR: Invalid rotation size '%s'\n", optarg);
+				print_usage(argc, argv, 1);
+				return 2;
+			}
+			break;
+		case 'r':
+			if (!*optarg) {
+				fprintf(stderr, "ERROR: PKLG must not be empty!\n");
+				print_usage(argc, argv, 1);
+				return 2;
+			}
+			free(replay_filename);
+			replay_filename = strdup(optarg);
+			break;
 		case 'h':
 			print_usage(argc, argv, 0);
 			return 0;
@@ -394,6 +732,8 @@ int main(int argc, char *argv[])
 			log_format = LOG_FORMAT_PACKETLOGGER;
 		} else if (strcmp("pcap", log_format_string) == 0){
 			log_format = LOG_FORMAT_PCAP;
+		} else if (strcmp("pcapng", log_format_string) == 0){
+			log_format = LOG_FORMAT_PCAPNG;
 		} else {
 			printf("Unknown logging format: '%s'\n", log_format_string);
 			print_usage(argc, argv, 1);
@@ -401,6 +741,21 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (writer.rotate_size > 0 && strcmp(out_filename, "-") == 0) {
+		fprintf(stderr, "ERROR: Output file rotation is not supported when writing to stdout.\n");
+		return 2;
+	}
+
+	if (replay_filename) {
+		if (capture_init() < 0) {
+			return -2;
+		}
+		int res = replay_capture(replay_filename);
+		capture_close();
+		free(replay_filename);
+		return (res == 0) ? 0 : -2;
+	}
+
 	int num = 0;
 	idevice_info_t *devices = NULL;
 	idevice_get_device_list_extended(&devices, &num);
@@ -415,42 +770,28 @@ int main(int argc, char *argv[])
 	}
 
 	// support streaming to stdout
-	if (strcmp(out_filename, "-") == 0){
-		packetlogger_file = stdout;
-	} else {
-		packetlogger_file = fopen(out_filename, "wb");
-	}
-
-
-	if (packetlogger_file == NULL){
-		fprintf(stderr, "Failed to open file %s, errno = %d\n", out_filename, errno);
+	if (capture_init() < 0) {
 		return -2;
 	}
 
-	switch (log_format){
-		case LOG_FORMAT_PCAP:
-			// printf("Output Format: PCAP\n");
-			// write PCAP file header
-			(void) fwrite(&pcap_file_header, 1, sizeof(pcap_file_header), packetlogger_file);
-			break;
-		case LOG_FORMAT_PACKETLOGGER:
-			printf("Output Format: PacketLogger\n");
-			break;
-		default:
-			assert(0);
-			return -2;
+	if (log_format == LOG_FORMAT_PACKETLOGGER) {
+		printf("Output Format: PacketLogger\n");
 	}
+	// write out the file header right away, e.g. for live feedback in Wireshark
+	capture_flush();
+
 	idevice_subscription_context_t context = NULL;
 	idevice_events_subscribe(&context, device_event_cb, NULL);
 
 	while (!quit_flag) {
-		sleep(1);
+		usleep(((writer.flush_interval > 0 && writer.flush_interval < 1000) ? writer.flush_interval : 1000) * 1000);
+		capture_flush_if_due();
 	}
 
 	idevice_events_unsubscribe(context);
 	stop_logging();
 
-	fclose(packetlogger_file);
+	capture_close();
 
 	free(udid);
 
@@ -52,7 +52,8 @@ static int debug_level = 0;
 enum cmd_mode {
 	CMD_NONE = 0,
 	CMD_RUN,
-	CMD_KILL
+	CMD_KILL,
+	CMD_BATCH
 };
 
 static int quit_flag = 0;
@@ -175,6 +176,159 @@ static debugserver_error_t debugserver_client_handle_response(debugserver_client
 	return dres;
 }
 
+static debugserver_error_t start_debugserver(idevice_t device, debugserver_client_t* debugserver_client)
+{
+	debugserver_error_t dres = debugserver_client_start_service(device, debugserver_client, TOOL_NAME);
+	if (dres != DEBUGSERVER_E_SUCCESS) {
+		fprintf(stderr,
+			"Could not start com.apple.debugserver!\n"
+			"Please make sure to mount the developer disk image first:\n"
+			"  1) Get the iOS version from `ideviceinfo -k ProductVersion`.\n"
+			"  2) Find the matching iPhoneOS DeveloperDiskImage.dmg files.\n"
+			"  3) Run `ideviceimagemounter` with the above path.\n");
+		return dres;
+	}
+
+	/* set receive params */
+	dres = debugserver_client_set_receive_params(*debugserver_client, cancel_receive, 250);
+	if (dres != DEBUGSERVER_E_SUCCESS) {
+		fprintf(stderr, "Error in debugserver_client_set_receive_params\n");
+	}
+	return dres;
+}
+
+static char* read_batch_file(const char* filename)
+{
+	FILE* f = (strcmp(filename, "-") == 0) ? stdin : fopen(filename, "rb");
+	char* buf = NULL;
+	size_t len = 0;
+	size_t cap = 0;
+
+	if (!f) {
+		fprintf(stderr, "ERROR: Could not open batch file %s\n", filename);
+		return NULL;
+	}
+	do {
+		if (len + 1 >= cap) {
+			char* newbuf = realloc(buf, (cap) ? cap * 2 : 4096);
+			if (!newbuf) {
+				free(buf);
+				buf = NULL;
+				break;
+			}
+			buf = newbuf;
+			cap = (cap) ? cap * 2 : 4096;
+		}
+		len += fread(buf + len, 1, cap - len - 1, f);
+	} while (!feof(f) && !ferror(f));
+	if (buf) {
+		buf[len] = '\0';
+	}
+	if (f != stdin) {
+		fclose(f);
+	}
+	return buf;
+}
+
+static int run_batch(debugserver_client_t client, const char* filename)
+{
+	char* script = read_batch_file(filename);
+	debugserver_command_t* commands = NULL;
+	char** responses = NULL;
+	size_t* response_sizes = NULL;
+	unsigned int count = 0;
+	unsigned int capacity = 0;
+	unsigned int i;
+	char* response = NULL;
+	char* line;
+	char* next;
+	int res = -1;
+
+	if (!script) {
+		return -1;
+	}
+
+	/* one raw packet payload per line, empty lines and # comments are skipped */
+	for (line = script; line && *line; line = next) {
+		next = strchr(line, '\n');
+		if (next) {
+			*next++ = '\0';
+		}
+		size_t n = strlen(line);
+		if (n > 0 && line[n-1] == '\r') {
+			line[--n] = '\0';
+		}
+		if (n == 0 || line[0] == '#') {
+			continue;
+		}
+		if (count == capacity) {
+			unsigned int newcapacity = (capacity) ? capacity * 2 : 64;
+			debugserver_command_t* newcommands = realloc(commands, newcapacity * sizeof(debugserver_command_t));
+			if (!newcommands) {
+				fprintf(stderr, "ERROR: Out of memory while reading batch file %s\n", filename);
+				free(script);
+				goto leave;
+			}
+			commands = newcommands;
+			capacity = newcapacity;
+		}
+		debugserver_command_new(line, 0, NULL, &commands[count++]);
+	}
+	free(script);
+
+	if (count == 0) {
+		fprintf(stderr, "ERROR: No commands found in batch file %s\n", filename);
+		goto leave;
+	}
+
+	/* responses can only be pipelined without acknowledgements */
+	log_debug("Disabling ACK mode...");
+	debugserver_command_t noack = NULL;
+	debugserver_command_new("QStartNoAckMode", 0, NULL, &noack);
+	debugserver_client_send_command(client, noack, &response, NULL);
+	debugserver_command_free(noack);
+	if (!response || strncmp(response, "OK", 2) != 0) {
+		fprintf(stderr, "ERROR: Could not disable ACK mode\n");
+		goto leave;
+	}
+	/* the device stopped acknowledging, so the client has to as well */
+	debugserver_client_set_ack_mode(client, 0);
+
+	log_debug("Sending %u commands...", count);
+	responses = calloc(count, sizeof(char*));
+	response_sizes = calloc(count, sizeof(size_t));
+	if (!responses || !response_sizes) {
+		fprintf(stderr, "ERROR: Out of memory for %u responses\n", count);
+		goto leave;
+	}
+	debugserver_error_t dres = debugserver_client_send_commands(client, commands, count, responses, response_sizes);
+	for (i = 0; i < count; i++) {
+		if (!responses[i]) {
+			break;
+		}
+		/* binary replies may contain NUL bytes */
+		fwrite(responses[i], 1, response_sizes[i], stdout);
+		fputc('\n', stdout);
+		free(responses[i]);
+	}
+	fflush(stdout);
+	if (dres != DEBUGSERVER_E_SUCCESS) {
+		fprintf(stderr, "ERROR: Failed to receive response %u of %u (%d)\n", i + 1, count, dres);
+		goto leave;
+	}
+	res = 0;
+
+leave:
+	for (i = 0; i < count; i++) {
+		debugserver_command_free(commands[i]);
+	}
+	free(commands);
+	free(responses);
+	free(response_sizes);
+	free(response);
+	return res;
+}
+
 static void print_usage(int argc, char **argv, int is_error)
 {
 	char *name = strrchr(argv[0], '/');
@@ -186,6 +340,8 @@ static void print_usage(int argc, char **argv, int is_error)
 		"Where COMMAND is one of:\n"
 		"  run BUNDLEID [ARGS...]  run app with BUNDLEID and optional ARGS on device.\n"
 		"  kill BUNDLEID           kill app with BUNDLEID\n"
+		"  batch FILE              send the GDB remote packets listed in FILE (one per\n"
+		"                          line, '-' for stdin) pipelined and print responses\n"
 		"\n"
 		"The following OPTIONS are accepted:\n"
 		"  -u, --udid UDID       target specific device by UDID\n"
@@ -331,6 +487,14 @@ int main(int argc, char *argv[])
 		/*  read bundle identifier */
 		bundle_identifier = argv[1];
 		i = 1;
+	} else if (!strcmp(argv[0], "batch")) {
+		cmd = CMD_BATCH;
+		if (argc < 2) {
+			fprintf(stderr, "ERROR: Please supply the file containing the commands to send.\n");
+			print_usage(argc+optind, argv-optind, 1);
+			res = 2;
+			goto cleanup;
+		}
 	}
 
 	/* verify options */
@@ -358,6 +522,13 @@ int main(int argc, char *argv[])
 		goto cleanup;
 	}
 
+	if (cmd == CMD_BATCH) {
+		if (start_debugserver(device, &debugserver_client) == DEBUGSERVER_E_SUCCESS) {
+			res = run_batch(debugserver_client, argv[1]);
+		}
+		goto cleanup;
+	}
+
 	/* get the path to the app and it's working directory */
 	if (instproxy_client_start_service(device, &instproxy_client, TOOL_NAME) != INSTPROXY_E_SUCCESS) {
 		fprintf(stderr, "Could not start installation proxy service.\n");
@@ -386,19 +557,7 @@ int main(int argc, char *argv[])
 	}
 
 	/* start and connect to debugserver */
-	if (debugserver_client_start_service(device, &debugserver_client, TOOL_NAME) != DEBUGSERVER_E_SUCCESS) {
-		fprintf(stderr,
-			"Could not start com.apple.debugserver!\n"
-			"Please make sure to mount the developer disk image first:\n"
-			"  1) Get the iOS version from `ideviceinfo -k ProductVersion`.\n"
-			"  2) Find the matching iPhoneOS DeveloperDiskImage.dmg files.\n"
-			"  3) Run `ideviceimagemounter` with the above path.\n");
-		goto cleanup;
-	}
-
-	/* set receive params */
-	if (debugserver_client_set_receive_params(debugserver_client, cancel_receive, 250) != DEBUGSERVER_E_SUCCESS) {
-		fprintf(stderr, "Error in debugserver_client_set_receive_params\n");
+	if (start_debugserver(device, &debugserver_client) != DEBUGSERVER_E_SUCCESS) {
 		goto cleanup;
 	}
 
@@ -29,25 +29,24 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <inttypes.h>
 #include <getopt.h>
 #include <errno.h>
 #include <signal.h>
+#include <sys/time.h>
 #ifdef _WIN32
 #include <winsock2.h>
 #include <windows.h>
+#define poll WSAPoll
 #else
-#include <sys/select.h>
+#include <poll.h>
 #endif
 
 #include <libimobiledevice/libimobiledevice.h>
+#include <libimobiledevice/lockdown.h>
 #include <libimobiledevice/debugserver.h>
 
 #include <libimobiledevice-glue/socket.h>
-#include <libimobiledevice-glue/thread.h>
-
-#ifndef ETIMEDOUT
-#define ETIMEDOUT 138
-#endif
 
 #define info(...) fprintf(stdout, __VA_ARGS__); fflush(stdout)
 #define debug(...) if(debug_mode) fprintf(stdout, __VA_ARGS__)
@@ -57,19 +56,26 @@ static int debug_mode = 0;
 static int quit_flag = 0;
 static uint16_t local_port = 0;
 
-typedef struct {
-	int client_fd;
-	idevice_t device;
-	debugserver_client_t debugserver_client;
-} socket_info_t;
+/* Must be larger than the maximum TLS record size so a single read drains
+ * everything that was decrypted; otherwise data could stay buffered in the
+ * SSL layer while the socket does not signal readability anymore. */
+#define PROXY_BUFFER_SIZE 65536
 
-struct thread_info {
-	THREAD_T th;
+struct proxy_session {
+	unsigned int id;
 	int client_fd;
-	struct thread_info *next;
+	int device_fd;
+	idevice_connection_t connection;
+	/* latency between forwarding a request and the first bytes of the reply */
+	struct timeval request_time;
+	int awaiting_reply;
+	uint64_t num_requests;
+	double total_latency;
+	double max_latency;
+	struct proxy_session *next;
 };
 
-typedef struct thread_info thread_info_t;
+typedef struct proxy_session proxy_session_t;
 
 
 static void clean_exit(int sig)
@@ -121,89 +127,155 @@ static int intercept_packet(char *packet, ssize_t *packet_len) {
 	return 1;
 }
 
-static void* connection_handler(void* data)
+static double time_diff_ms(struct timeval *start, struct timeval *end)
 {
-	debugserver_error_t derr = DEBUGSERVER_E_SUCCESS;
-	socket_info_t* socket_info = (socket_info_t*)data;
-	const int bufsize = 65536;
-	char* buf;
+	return (end->tv_sec - start->tv_sec) * 1000.0 + (end->tv_usec - start->tv_usec) / 1000.0;
+}
 
-	int client_fd = socket_info->client_fd;
+static idevice_connection_t start_debugserver(idevice_t device)
+{
+	lockdownd_client_t lockdown = NULL;
+	lockdownd_service_descriptor_t service = NULL;
+	idevice_connection_t connection = NULL;
 
-	debug("%s: client_fd = %d\n", __func__, client_fd);
+	if (lockdownd_client_new_with_handshake(device, &lockdown, TOOL_NAME) != LOCKDOWN_E_SUCCESS) {
+		fprintf(stderr, "Could not connect to lockdownd\n");
+		return NULL;
+	}
+	if (lockdownd_start_service(lockdown, DEBUGSERVER_SECURE_SERVICE_NAME, &service) != LOCKDOWN_E_SUCCESS) {
+		lockdownd_start_service(lockdown, DEBUGSERVER_SERVICE_NAME, &service);
+	}
+	lockdownd_client_free(lockdown);
 
-	derr = debugserver_client_start_service(socket_info->device, &socket_info->debugserver_client, TOOL_NAME);
-	if (derr != DEBUGSERVER_E_SUCCESS) {
+	if (!service || service->port == 0) {
 		fprintf(stderr, "Could not start debugserver on device!\nPlease make sure to mount a developer disk image first.\n");
+		lockdownd_service_descriptor_free(service);
 		return NULL;
 	}
-
-	buf = malloc(bufsize);
-	if (!buf) {
-		fprintf(stderr, "Failed to allocate buffer\n");
+	if (idevice_connect(device, service->port, &connection) != IDEVICE_E_SUCCESS) {
+		fprintf(stderr, "Could not connect to debugserver on device!\n");
+		lockdownd_service_descriptor_free(service);
 		return NULL;
 	}
+	if (service->ssl_enabled && idevice_connection_enable_ssl(connection) != IDEVICE_E_SUCCESS) {
+		fprintf(stderr, "Could not enable SSL for debugserver connection!\n");
+		idevice_disconnect(connection);
+		connection = NULL;
+	}
+	lockdownd_service_descriptor_free(service);
 
-	fd_set fds;
-	FD_ZERO(&fds);
-	FD_SET(client_fd, &fds);
-
-	int dtimeout = 1;
+	return connection;
+}
 
-	while (!quit_flag) {
-		ssize_t n = socket_receive_timeout(client_fd, buf, bufsize, 0, 1);
-		if (n != -ETIMEDOUT) {
-			if (n < 0) {
-				fprintf(stderr, "Failed to read from client fd: %s\n", strerror(-n));
-				break;
-			} else if (n == 0) {
-				fprintf(stderr, "connection closed\n");
-				break;
-			}
-			if (support_lldb && intercept_packet(buf, &n)) {
-				socket_send(client_fd, buf, n);
-				continue;
-			}
-			uint32_t sent = 0;
-			debugserver_client_send(socket_info->debugserver_client, buf, n, &sent);
-		}
-		do {
-			uint32_t r = 0;
-			derr = debugserver_client_receive_with_timeout(socket_info->debugserver_client, buf, bufsize, &r, dtimeout);
-			if (r > 0) {
-				socket_send(client_fd, buf, r);
-				dtimeout = 1;
-			} else if (derr == DEBUGSERVER_E_TIMEOUT) {
-				dtimeout = 5;
-				break;
-			} else {
-				fprintf(stderr, "debugserver connection closed\n");
-				break;
-			}
-		} while (derr == DEBUGSERVER_E_SUCCESS);
-		if (derr != DEBUGSERVER_E_TIMEOUT && derr != DEBUGSERVER_E_SUCCESS) {
-			break;
-		}
+static proxy_session_t* session_new(idevice_t device, int client_fd, unsigned int id)
+{
+	idevice_connection_t connection = start_debugserver(device);
+	if (!connection) {
+		return NULL;
 	}
-	free(buf);
+	proxy_session_t* session = (proxy_session_t*)calloc(1, sizeof(proxy_session_t));
+	if (!session) {
+		fprintf(stderr, "Out of memory\n");
+		idevice_disconnect(connection);
+		return NULL;
+	}
+	session->id = id;
+	session->client_fd = client_fd;
+	session->connection = connection;
+	idevice_connection_get_fd(connection, &session->device_fd);
 
-	debug("%s: shutting down...\n", __func__);
+	return session;
+}
 
-	debugserver_client_free(socket_info->debugserver_client);
-	socket_info->debugserver_client = NULL;
+static void session_free(proxy_session_t* session)
+{
+	if (session->num_requests > 0) {
+		info("Session %u closed: %" PRIu64 " requests, latency avg %.2f ms, max %.2f ms\n", session->id, session->num_requests, session->total_latency / session->num_requests, session->max_latency);
+	} else {
+		info("Session %u closed\n", session->id);
+	}
+	idevice_disconnect(session->connection);
+	socket_shutdown(session->client_fd, SHUT_RDWR);
+	socket_close(session->client_fd);
+	free(session);
+}
 
-	/* shutdown client socket */
-	socket_shutdown(socket_info->client_fd, SHUT_RDWR);
-	socket_close(socket_info->client_fd);
+/**
+ * Forwards data the client sent to debugserver.
+ *
+ * @return 0 on success, -1 if the session should be closed.
+ */
+static int session_forward_client(proxy_session_t* session, char* buf)
+{
+	ssize_t n = socket_receive(session->client_fd, buf, PROXY_BUFFER_SIZE);
+	if (n < 0) {
+		fprintf(stderr, "Failed to read from client fd: %s\n", strerror(-n));
+		return -1;
+	} else if (n == 0) {
+		debug("%s: client of session %u closed the connection\n", __func__, session->id);
+		return -1;
+	}
+	if (support_lldb && intercept_packet(buf, &n)) {
+		socket_send(session->client_fd, buf, n);
+		return 0;
+	}
+	/* only time packets that expect a reply, not bare acks */
+	if (!session->awaiting_reply && (memchr(buf, '$', n) || buf[0] == 0x03)) {
+		gettimeofday(&session->request_time, NULL);
+		session->awaiting_reply = 1;
+	}
+	ssize_t total = 0;
+	while (total < n) {
+		uint32_t sent = 0;
+		if (idevice_connection_send(session->connection, buf + total, (uint32_t)(n - total), &sent) != IDEVICE_E_SUCCESS) {
+			fprintf(stderr, "Failed to send to debugserver\n");
+			return -1;
+		}
+		total += sent;
+	}
+	return 0;
+}
 
-	return NULL;
+/**
+ * Forwards data debugserver sent to the client.
+ *
+ * @return 0 on success, -1 if the session should be closed.
+ */
+static int session_forward_device(proxy_session_t* session, char* buf)
+{
+	uint32_t r = 0;
+	if (idevice_connection_receive(session->connection, buf, PROXY_BUFFER_SIZE, &r) != IDEVICE_E_SUCCESS || r == 0) {
+		fprintf(stderr, "debugserver connection closed\n");
+		return -1;
+	}
+	if (session->awaiting_reply) {
+		struct timeval now;
+		gettimeofday(&now, NULL);
+		double latency = time_diff_ms(&session->request_time, &now);
+		session->total_latency += latency;
+		if (latency > session->max_latency) {
+			session->max_latency = latency;
+		}
+		session->num_requests++;
+		session->awaiting_reply = 0;
+	}
+	if (socket_send(session->client_fd, buf, r) < 0) {
+		fprintf(stderr, "Failed to send to client\n");
+		return -1;
+	}
+	return 0;
 }
 
 int main(int argc, char *argv[])
 {
 	idevice_error_t ret = IDEVICE_E_UNKNOWN_ERROR;
 	idevice_t device = NULL;
-	thread_info_t *thread_list = NULL;
+	proxy_session_t *sessions = NULL;
+	unsigned int num_sessions = 0;
+	unsigned int session_id = 0;
+	struct pollfd *pfds = NULL;
+	unsigned int pfds_size = 0;
+	char *buf = NULL;
 	const char* udid = NULL;
 	int use_network = 0;
 	int server_fd;
@@ -242,7 +314,7 @@ int main(int argc, char *argv[])
 #endif
 
 	/* parse cmdline arguments */
-	while ((c = getopt_long(argc, argv, "dhu:nv", longopts, NULL)) != -1) {
+	while ((c = getopt_long(argc, argv, "dhu:nlv", longopts, NULL)) != -1) {
 		switch (c) {
 		case 'd':
 			debug_mode = 1;
@@ -312,59 +384,107 @@ int main(int argc, char *argv[])
 		printf("Listening on port %d\n", port);
 	}
 
-	while (!quit_flag) {
-		debug("%s: Waiting for connection on local port %d\n", __func__, local_port);
+	buf = malloc(PROXY_BUFFER_SIZE);
+	if (!buf) {
+		fprintf(stderr, "Out of memory\n");
+		result = EXIT_FAILURE;
+		goto leave_cleanup;
+	}
 
-		/* wait for client */
-		int client_fd = socket_accept(server_fd, local_port);
-		if (client_fd < 0) {
-			continue;
+	/* single event loop: wait until the listening socket or any side of a
+	 * session becomes readable and forward the data right away */
+	debug("%s: Waiting for connections on local port %d\n", __func__, local_port);
+	while (!quit_flag) {
+		unsigned int nfds = 1 + num_sessions * 2;
+		if (nfds > pfds_size) {
+			struct pollfd *newpfds = (struct pollfd*)realloc(pfds, nfds * sizeof(struct pollfd));
+			if (!newpfds) {
+				fprintf(stderr, "Out of memory\n");
+				result = EXIT_FAILURE;
+				break;
+			}
+			pfds = newpfds;
+			pfds_size = nfds;
 		}
-
-		debug("%s: Handling new client connection...\n", __func__);
-
-		thread_info_t *el = (thread_info_t*)malloc(sizeof(thread_info_t));
-		if (!el) {
-			fprintf(stderr, "Out of memory\n");
-			exit(EXIT_FAILURE);
+		pfds[0].fd = server_fd;
+		pfds[0].events = POLLIN;
+		pfds[0].revents = 0;
+		unsigned int i = 1;
+		proxy_session_t *session;
+		for (session = sessions; session; session = session->next) {
+			pfds[i].fd = session->client_fd;
+			pfds[i].events = POLLIN;
+			pfds[i].revents = 0;
+			pfds[i+1].fd = session->device_fd;
+			pfds[i+1].events = POLLIN;
+			pfds[i+1].revents = 0;
+			i += 2;
 		}
-		el->client_fd = client_fd;
-		el->next = NULL;
 
-		if (thread_list) {
-			thread_list->next = el;
-		} else {
-			thread_list = el;
+		/* the timeout only serves to notice quit_flag */
+		int ready = poll(pfds, nfds, 500);
+		if (ready < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			fprintf(stderr, "poll failed: %s\n", strerror(errno));
+			result = EXIT_FAILURE;
+			break;
+		}
+		if (ready == 0) {
+			continue;
 		}
 
-		socket_info_t *sinfo = (socket_info_t*)malloc(sizeof(socket_info_t));
-		if (!sinfo) {
-			fprintf(stderr, "Out of memory\n");
-			exit(EXIT_FAILURE);
+		/* pfds mirrors the session list as it was before this iteration */
+		proxy_session_t **prev = &sessions;
+		i = 1;
+		while ((session = *prev) != NULL) {
+			int close_session = 0;
+			if (pfds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+				close_session = (session_forward_client(session, buf) < 0);
+			}
+			if (!close_session && (pfds[i+1].revents & (POLLIN | POLLHUP | POLLERR))) {
+				close_session = (session_forward_device(session, buf) < 0);
+			}
+			i += 2;
+			if (close_session) {
+				*prev = session->next;
+				session_free(session);
+				num_sessions--;
+			} else {
+				prev = &session->next;
+			}
 		}
-		sinfo->client_fd = client_fd;
-		sinfo->device = device;
 
-		if (thread_new(&(el->th), connection_handler, (void*)sinfo) != 0) {
-			fprintf(stderr, "Could not start connection handler.\n");
-			socket_shutdown(server_fd, SHUT_RDWR);
-			socket_close(server_fd);
-			break;
+		if (pfds[0].revents & POLLIN) {
+			int client_fd = socket_accept(server_fd, local_port);
+			if (client_fd < 0) {
+				continue;
+			}
+			debug("%s: Handling new client connection...\n", __func__);
+			session = session_new(device, client_fd, ++session_id);
+			if (!session) {
+				socket_shutdown(client_fd, SHUT_RDWR);
+				socket_close(client_fd);
+				continue;
+			}
+			info("Session %u started\n", session->id);
+			session->next = sessions;
+			sessions = session;
+			num_sessions++;
 		}
 	}
 
 	debug("%s: Shutting down debugserver proxy...\n", __func__);
 
-	/* join and clean up threads */
-	while (thread_list) {
-		thread_info_t *el = thread_list;
-		socket_shutdown(el->client_fd, SHUT_RDWR);
-		socket_close(el->client_fd);
-		thread_join(el->th);
-		thread_free(el->th);
-		thread_list = el->next;
-		free(el);
+	while (sessions) {
+		proxy_session_t *session = sessions;
+		sessions = session->next;
+		session_free(session);
 	}
+	free(pfds);
+	free(buf);
+	socket_close(server_fd);
 
 leave_cleanup:
 	if (device) {
@@ -37,8 +37,11 @@
 #include <sys/time.h>
 #include <inttypes.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 #ifndef _WIN32
 #include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #endif
 
 #include <libimobiledevice/libimobiledevice.h>
@@ -55,6 +58,7 @@
 static int list_mode = 0;
 static int use_network = 0;
 static int xml_mode = 0;
+static int timing_mode = 0;
 static const char *udid = NULL;
 static const char *imagetype = NULL;
 
@@ -100,6 +104,7 @@ static void print_usage(int argc, char **argv, int is_error)
 		"  -n, --network         connect to network device\n"
 		"  -t, --imagetype TYPE  Image type to use, default is 'Developer'\n"
 		"  -x, --xml             Use XML output\n"
+		"  -T, --timing          print the time spent in each stage of mounting\n"
 		"  -d, --debug           enable communication debugging\n"
 		"  -h, --help            prints usage information\n"
 		"  -v, --version         prints version information\n"
@@ -118,6 +123,7 @@ static void parse_opts(int argc, char **argv)
 		{ "network",   no_argument,       NULL, 'n' },
 		{ "imagetype", required_argument, NULL, 't' },
 		{ "xml",       no_argument,       NULL, 'x' },
+		{ "timing",    no_argument,       NULL, 'T' },
 		{ "debug",     no_argument,       NULL, 'd' },
 		{ "version",   no_argument,       NULL, 'v' },
 		{ NULL, 0, NULL, 0 }
@@ -125,7 +131,7 @@ static void parse_opts(int argc, char **argv)
 	int c;
 
 	while (1) {
-		c = getopt_long(argc, argv, "hu:t:xdnv", longopts, NULL);
+		c = getopt_long(argc, argv, "hu:t:xTdnv", longopts, NULL);
 		if (c == -1) {
 			break;
 		}
@@ -151,6 +157,9 @@ static void parse_opts(int argc, char **argv)
 		case 'x':
 			xml_mode = 1;
 			break;
+		case 'T':
+			timing_mode = 1;
+			break;
 		case 'd':
 			debug_level++;
 			break;
@@ -166,9 +175,83 @@ static void parse_opts(int argc, char **argv)
 	tss_set_debug_level(debug_level);
 }
 
-static ssize_t mim_upload_cb(void* buf, size_t size, void* userdata)
+struct image_data {
+	unsigned char *data;
+	size_t size;
+	int mapped;
+};
+
+/* Map the image into memory so it can be hashed and sent without copying it
+ * through intermediate buffers. The kernel is asked to read ahead, so disk
+ * reads overlap with hashing and transmission. */
+static int image_data_open(const char *path, struct image_data *image)
+{
+	memset(image, 0, sizeof(struct image_data));
+#ifndef _WIN32
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return -1;
+	}
+	struct stat fst;
+	if (fstat(fd, &fst) != 0 || fst.st_size <= 0) {
+		close(fd);
+		return -1;
+	}
+	void *data = mmap(NULL, fst.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data != MAP_FAILED) {
+		posix_madvise(data, fst.st_size, POSIX_MADV_SEQUENTIAL);
+		posix_madvise(data, fst.st_size, POSIX_MADV_WILLNEED);
+		image->data = (unsigned char*)data;
+		image->size = fst.st_size;
+		image->mapped = 1;
+		return 0;
+	}
+#endif
+	uint64_t size = 0;
+	if (!buffer_read_from_filename(path, (char**)&image->data, &size) || size == 0) {
+		free(image->data);
+		image->data = NULL;
+		return -1;
+	}
+	image->size = size;
+	return 0;
+}
+
+static void image_data_close(struct image_data *image)
+{
+	if (!image->data) {
+		return;
+	}
+#ifndef _WIN32
+	if (image->mapped) {
+		munmap(image->data, image->size);
+	} else
+#endif
+	free(image->data);
+	image->data = NULL;
+	image->size = 0;
+}
+
+static double time_elapsed_ms(struct timeval *start)
 {
-	return fread(buf, 1, size, (FILE*)userdata);
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) * 1000.0 + (now.tv_usec - start->tv_usec) / 1000.0;
+}
+
+static void print_stage_time(const char *stage, struct timeval *start, size_t bytes)
+{
+	if (!timing_mode) {
+		return;
+	}
+	double ms = time_elapsed_ms(start);
+	if (bytes > 0 && ms > 0) {
+		printf("Timing: %-16s %10.1f ms (%.1f MB/s)\n", stage, ms, (bytes / 1048576.0) / (ms / 1000.0));
+	} else {
+		printf("Timing: %-16s %10.1f ms\n", stage, ms);
+	}
+	gettimeofday(start, NULL);
 }
 
 int main(int argc, char **argv)
@@ -183,6 +266,8 @@ int main(int argc, char **argv)
 	char *image_path = NULL;
 	size_t image_size = 0;
 	char *image_sig_path = NULL;
+	struct image_data image = { NULL, 0, 0 };
+	struct timeval stage_start;
 
 #ifndef _WIN32
 	signal(SIGPIPE, SIG_IGN);
@@ -363,6 +448,7 @@ int main(int argc, char **argv)
 		struct stat fst;
 		plist_t mount_options = NULL;
 
+		gettimeofday(&stage_start, NULL);
 		if (device_version < IDEVICE_DEVICE_VERSION(17,0,0)) {
 			f = fopen(image_sig_path, "rb");
 			if (!f) {
@@ -381,11 +467,12 @@ int main(int argc, char **argv)
 				goto leave;
 			}
 
-			f = fopen(image_path, "rb");
-			if (!f) {
+			if (image_data_open(image_path, &image) != 0) {
 				fprintf(stderr, "Error opening image file '%s': %s\n", image_path, strerror(errno));
 				goto leave;
 			}
+			image_size = image.size;
+			print_stage_time("signature", &stage_start, 0);
 		} else {
 			if (stat(image_path, &fst) != 0) {
 				fprintf(stderr, "Error: stat: '%s': %s\n", image_path, strerror(errno));
@@ -466,27 +553,19 @@ int main(int argc, char **argv)
 			char *dmg_path = string_build_path(image_path, plist_get_string_ptr(p_dmg_path, NULL), NULL);
 			free(image_path);
 			image_path = dmg_path;
-			f = fopen(image_path, "rb");
-			if (!f) {
+			print_stage_time("manifest", &stage_start, 0);
+			if (image_data_open(image_path, &image) != 0) {
 				fprintf(stderr, "Error opening image file '%s': %s\n", image_path, strerror(errno));
 				goto leave;
 			}
+			image_size = image.size;
 
-			unsigned char buf[8192];
 			unsigned char sha384_digest[48];
 			sha384_context ctx;
 			sha384_init(&ctx);
-			fstat(fileno(f), &fst);
-			image_size = fst.st_size;
-			while (!feof(f)) {
-				ssize_t fr = fread(buf, 1, sizeof(buf), f);
-				if (fr <= 0) {
-					break;
-				}
-				sha384_update(&ctx, buf, fr);
-			}
-			rewind(f);
+			sha384_update(&ctx, image.data, image.size);
 			sha384_final(&ctx, sha384_digest);
+			print_stage_time("hash", &stage_start, image_size);
 			unsigned char* manifest = NULL;
 			unsigned int manifest_size = 0;
 			/* check if the device already has a personalization manifest for this image */
@@ -565,6 +644,7 @@ int main(int argc, char **argv)
 			}
 			sig = manifest;
 			sig_length = manifest_size;
+			print_stage_time("personalization", &stage_start, 0);
 
 			imagetype = "Personalized";
 		}
@@ -593,7 +673,7 @@ int main(int argc, char **argv)
 		switch(disk_image_upload_type) {
 			case DISK_IMAGE_UPLOAD_TYPE_UPLOAD_IMAGE:
 				printf("Uploading %s\n", image_path);
-				err = mobile_image_mounter_upload_image(mim, imagetype, image_size, sig, sig_length, mim_upload_cb, f);
+				err = mobile_image_mounter_upload_image_data(mim, imagetype, image.data, image.size, sig, sig_length);
 				break;
 			case DISK_IMAGE_UPLOAD_TYPE_AFC:
 			default:
@@ -609,42 +689,35 @@ int main(int argc, char **argv)
 				uint64_t af = 0;
 				if ((afc_file_open(afc, targetname, AFC_FOPEN_WRONLY, &af) !=
 					 AFC_E_SUCCESS) || !af) {
-					fclose(f);
 					fprintf(stderr, "afc_file_open on '%s' failed!\n", targetname);
 					goto leave;
 				}
 
-				char buf[8192];
-				size_t amount = 0;
-				do {
-					amount = fread(buf, 1, sizeof(buf), f);
-					if (amount > 0) {
-						uint32_t written, total = 0;
-						while (total < amount) {
-							written = 0;
-							if (afc_file_write(afc, af, buf + total, amount - total, &written) !=
-								AFC_E_SUCCESS) {
-								fprintf(stderr, "AFC Write error!\n");
-								break;
-							}
-							total += written;
-						}
-						if (total != amount) {
-							fprintf(stderr, "Error: wrote only %d of %d\n", total,
-									(unsigned int)amount);
-							afc_file_close(afc, af);
-							fclose(f);
-							goto leave;
-						}
+				/* write straight from the mapped image */
+				size_t total = 0;
+				while (total < image.size) {
+					size_t remaining = image.size - total;
+					uint32_t amount = (remaining < 0x100000) ? (uint32_t)remaining : 0x100000;
+					uint32_t written = 0;
+					if (afc_file_write(afc, af, (const char*)image.data + total, amount, &written) !=
+						AFC_E_SUCCESS || written == 0) {
+						fprintf(stderr, "AFC Write error!\n");
+						break;
 					}
+					total += written;
+				}
+				if (total != image.size) {
+					fprintf(stderr, "Error: wrote only %zu of %zu\n", total, image.size);
+					afc_file_close(afc, af);
+					goto leave;
 				}
-				while (amount > 0);
 
 				afc_file_close(afc, af);
+				err = MOBILE_IMAGE_MOUNTER_E_SUCCESS;
 				break;
 		}
-
-		fclose(f);
+		print_stage_time("upload", &stage_start, image.size);
+		image_data_close(&image);
 
 		if (err != MOBILE_IMAGE_MOUNTER_E_SUCCESS) {
 			if (err == MOBILE_IMAGE_MOUNTER_E_DEVICE_LOCKED) {
@@ -658,6 +731,7 @@ int main(int argc, char **argv)
 
 		printf("Mounting...\n");
 		err = mobile_image_mounter_mount_image_with_options(mim, mountname, sig, sig_length, imagetype, mount_options, &result);
+		print_stage_time("mount", &stage_start, 0);
 		if (err == MOBILE_IMAGE_MOUNTER_E_SUCCESS) {
 			if (result) {
 				plist_t node = plist_dict_get_item(result, "Status");
@@ -753,6 +827,7 @@ leave:
 	}
 	idevice_free(device);
 
+	image_data_close(&image);
 	if (image_path)
 		free(image_path);
 	if (image_sig_path)
@@ -0,0 +1,135 @@
+/*
+ * mb2_store.c
+ * Deduplicating content store for idevicebackup2
+ *
+ * Copyright (c) 2026 libimobiledevice project. All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <libimobiledevice-glue/utils.h>
+
+#include "mb2_store.h"
+
+int mb2_store_link_replace(const char *src, const char *dst)
+{
+#ifdef _WIN32
+	return -1;
+#else
+	int res = 0;
+	char *tmp = string_concat(dst, MB2_STORE_TEMP_SUFFIX, NULL);
+	if (!tmp) {
+		return -1;
+	}
+	remove(tmp);
+	if (link(src, tmp) < 0) {
+		res = -1;
+	} else if (rename(tmp, dst) < 0) {
+		remove(tmp);
+		res = -1;
+	}
+	free(tmp);
+	return res;
+#endif
+}
+
+int mb2_store_ingest(const char *store, const char *path, const unsigned char *hash, uint64_t size)
+{
+#ifdef _WIN32
+	return -1;
+#else
+	char hex[MB2_STORE_HASH_LEN*2+1];
+	char subdir[3];
+	struct stat st;
+	int res = -1;
+	int i;
+
+	for (i = 0; i < MB2_STORE_HASH_LEN; i++) {
+		snprintf(hex + i*2, 3, "%02x", hash[i]);
+	}
+	subdir[0] = hex[0];
+	subdir[1] = hex[1];
+	subdir[2] = '\0';
+
+	char *objdir = string_build_path(store, subdir, NULL);
+	char *obj = string_build_path(objdir, hex, NULL);
+	if (stat(obj, &st) == 0 && S_ISREG(st.st_mode) && (uint64_t)st.st_size == size) {
+		/* known content: drop the new copy in favor of the stored one */
+		if (mb2_store_link_replace(obj, path) == 0) {
+			res = 1;
+		}
+	} else if (mkdir(objdir, 0755) == 0 || errno == EEXIST) {
+		/* new content: the received file becomes the store object */
+		if (link(path, obj) == 0 || errno == EEXIST) {
+			res = 0;
+		}
+	}
+	free(obj);
+	free(objdir);
+	return res;
+#endif
+}
+
+unsigned int mb2_store_prune(const char *store)
+{
+	unsigned int pruned = 0;
+#ifndef _WIN32
+	DIR *dir = opendir(store);
+	struct dirent *ep;
+
+	if (!dir) {
+		return 0;
+	}
+	while ((ep = readdir(dir))) {
+		if (ep->d_name[0] == '.') {
+			continue;
+		}
+		char *objdir = string_build_path(store, ep->d_name, NULL);
+		DIR *sub = (objdir) ? opendir(objdir) : NULL;
+		if (sub) {
+			struct dirent *op;
+			while ((op = readdir(sub))) {
+				struct stat st;
+				if (op->d_name[0] == '.') {
+					continue;
+				}
+				char *obj = string_build_path(objdir, op->d_name, NULL);
+				if (obj && lstat(obj, &st) == 0 && S_ISREG(st.st_mode) && st.st_nlink == 1) {
+					if (remove(obj) == 0) {
+						pruned++;
+					}
+				}
+				free(obj);
+			}
+			closedir(sub);
+		}
+		free(objdir);
+	}
+	closedir(dir);
+#endif
+	return pruned;
+}
@@ -0,0 +1,64 @@
+/*
+ * mb2_store.h
+ * Deduplicating content store for idevicebackup2
+ *
+ * Copyright (c) 2026 libimobiledevice project. All Rights Reserved.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __MB2_STORE_H
+#define __MB2_STORE_H
+
+#include <stdint.h>
+
+/*
+ * Deduplicating store: the contents of every received file are kept once
+ * in DIRECTORY/.store/XX/<sha256> and the files in the backup are hard
+ * links to it, so the layout the device expects stays the same.  The link
+ * count is the reference count; objects only linked from the store are
+ * pruned after a successful backup.  Files in the backup are never
+ * written in place (they are removed and recreated), so sharing an inode
+ * between backups is safe.
+ */
+#define MB2_STORE_DIR ".store"
+#define MB2_STORE_HASH_LEN 32
+#define MB2_STORE_TEMP_SUFFIX ".dedup"
+
+/**
+ * Atomically replaces dst with a hard link to src.
+ *
+ * @return 0 on success, -1 on error or if hard links are not supported.
+ */
+int mb2_store_link_replace(const char *src, const char *dst);
+
+/**
+ * Adds the complete file at path with the given SHA-256 hash and size to
+ * the store. If the store already holds that content, the file is
+ * replaced by a link to it, otherwise the file becomes the store object.
+ *
+ * @return 1 if the file was replaced by a link to a stored object, 0 if
+ *   it was added to the store, -1 on error.
+ */
+int mb2_store_ingest(const char *store, const char *path, const unsigned char *hash, uint64_t size);
+
+/**
+ * Removes all objects from the store that no file links to anymore.
+ *
+ * @return The number of removed objects.
+ */
+unsigned int mb2_store_prune(const char *store);
+
+#endif